@@ -13,79 +13,209 @@
  *v.1.0.
  *Below is a simple function to allow the bootloader to control/update/restart the app section.
  *
+ *v.1.1.
+ *Added pre-erase of the app section. Page erase can be skipped in the page update.
+ *Pages that are identical to the FLASH content are skipped.
+ *
+ *v.1.2.
+ *Page update and app section erase hand their erase and half-page writes over to the NVM job queue.
+ *
+ *v.1.3.
+ *Added a fast boot path. We only wait for the full boot window if the host asked for it or is talking to us already.
+ *
+ *v.1.4.
+ *Added an app header with the length and the CRC32 of the app. The CRC is checked using the hardware CRC before we jump to the app.
+ *
+ *v.1.5.
+ *Added an app descriptor in the EEPROM. A verified app is not read back at every boot, only if the descriptor is missing or stale.
+ *
+ *v.1.6.
+ *TIM6 and its IRQ are stopped before we leave the bootloader.
+ *
+ *v.1.7.
+ *An all-zero page is only erased, the half-page writes are skipped.
+ *
+ *v.1.8.
+ *The app section is split into two slots (A/B), each with its own app header and app descriptor. An update goes into the slot that is not active.
+ *The active slot is selected by a word in the EEPROM. We fall back to the other slot if the active one is broken.
+ *
+ *v.1.9.
+ *The progress of an update is checkpointed into the EEPROM, so an interrupted update can be resumed.
+ *The app header is not rewritten if it is already in the FLASH.
+ *
+ *v.1.10.
+ *The Sleep mode clocking is set back to its reset values before the app is started.
+ *
+ *v.1.11.
+ *The page size, the memory map and the stack pointer the apps are checked against come from the profile in BootConfig.h.
+ *
+ *v.1.12.
+ *Added a handoff that resets the peripherals of the bootloader through the RCC, clears the NVIC and jumps without waiting for the log. GoToApp and ReBoot use it.
+ *The initial stack pointer of an app only has to point into the RAM.
+ *
+ *v.1.13.
+ *Added the node address of the bootloader on a shared bus. It is taken from the EEPROM if it has been configured, otherwise it is derived from the unique ID of the part.
+ *
+ *v.1.14.
+ *With image authentication enabled, an app without an app header is not accepted anymore. Only a commit with a valid tag writes a header.
+ *
+ *v.1.15.
+ *The sniff window of the fast boot path sleeps until a command frame or the end of the window (TIM2 compare) wakes it up, instead of polling TIM2.
+ *
  */
 
 #include "BootAppManager.h"
 
 
+static uint32_t Resume_checkpoint [Resume_checkpoint_size_in_words];						//the checkpoint being written into the EEPROM by the NVM job queue
+static uint16_t Resume_checkpoint_job_tag = 0;											//the NVM jobs of the last checkpoint (see NVMJobsDone)
+
+
 //1) Jump to app
 /*
- *	What we do here is that we define a function pointer into which we copy the function pointer we (should) find at App_Section_Start_Addr + 4.
- *  From the NVIC table, an app placed by the linker at "App_Section_Start_Addr" will have the reset vector at App_Section_Start_Addr + 4.
- *  Once the copy was successful, we call the function pointer and thus switch to the app.
- *  Mind, the app is a stand-alone element that is limited to the FLASH area App_Section_Start_Addr and after, thanks to the app's linker.
+ *	We check the app in the active slot and hand the core over to it (see BootHandoff).
+ *  From the NVIC table, an app placed by the linker at the start of its slot will have the stack pointer at the start of the slot and the reset vector at the start of the slot + 4.
+ *  The VTOR is moved to the vector table of the app, so the app starts with its own IRQs even if it does not set the VTOR itself.
+ *  Mind, the app is a stand-alone element that is limited to the FLASH area of its slot, thanks to the app's linker.
  *
- *  Note: the vector tables will be updated after the jumps given the system files and the linkers are properly set.
- *  Note: after the jump, we start with the startup assembly file (so a full reset occurs)
+ *  Note: the function only comes back if there is no valid app in the active slot.
+ *  Note: after the jump, we start with the startup assembly file of the app, with the peripherals the way a reset leaves them
+ *  Note: it must not be called from an IRQ, the app would start in handler mode (see TIM2_IRQHandler)
  *
  * */
 
 void GoToApp(void)
 {
-	uint32_t App_reset_vector_addr;																	//this is the address of the app's reset vector (which is also a function pointer!)
-	void (*Start_App_func_ptr)(void);																//the local function pointer we define
-
-	if((*(uint32_t*)App_Section_Start_Addr) == 0x20002000)											//we check, what is stored at the App_Section_Addr. It should be the very first word of the app's code.
-																									//This value should be the reset value of the stack pointer in RAM.
-																									//Note: the exact value stored at the App_Section_Addr needs to be checked (it seems to be 0x20002000)
-																									//Note: the memory monitor reads out the memory values upside-down! (there is an endian switch during the process)
+	if((AppIsValid(App_active_slot) == Yes) && (AppImageCheck(App_active_slot) == Yes))				//we check, what is stored at the start of the slot and the CRC of the app (see below)
 	{
-		printf("APP found. Starting...\r\n");
-		App_reset_vector_addr = *(uint32_t*)(App_Section_Start_Addr + 4);							//we define a pointer to APP_ADDR + 4 and then dereference it to extract the reset vector for the app
-																									//JumpAddress will hold the reset vector address (which won't be the same as APP_ADDR + 4, the address is just stored there)
-		Start_App_func_ptr = App_reset_vector_addr;													//we call the local function pointer with the address of the app's reset vector
-																									//Note: for the bootloader, this address is an integer. In reality, it will be a function pointer once the app is placed.
-		__set_MSP(*(uint32_t*) App_Section_Start_Addr);												//we move the stack pointer to the APP address
-		Start_App_func_ptr();																		//here we call the APP reset function through the local function pointer
+		BootHandoff(AppSlotStartAddr(App_active_slot));												//does not come back
 	} else {
-		printf("No APP found. \r\n");
+		BOOT_LOG("No APP found. \r\n");
 	}
 
 }
 
+
+
 //2)FLASH update
 /*
  * We update a page (32 words or 128 bytes) of FLASH memory.
  * The page must be erased first to avoid data corruption.
  * The function takes in an array pointer to then use that pointer to step through the array.
  * The array stores the machine code in hex format.
+ * If the page in the FLASH is already identical to the one in the Rx buffer, we don't touch the FLASH at all.
+ * The function gives back if the FLASH has been written to or not.
+ *
+ * The erase and the half-page writes are only put into the NVM job queue, the function does not wait for them to be done.
+ * The page data must thus stay untouched until the NVM jobs are done (see NVMJobsDone).
  *
  * */
-void UpdatePageInApp (uint32_t page_addr_in_FLASH, uint8_t full_page_select_in_buf) {
+enum_Yes_No_Selector UpdatePageInApp (uint32_t page_addr_in_FLASH, uint32_t* page_data_ptr, enum_Yes_No_Selector page_erase_selector) {
 	/*
 	 * We update one (!) page in the app by reading in values through a pointer.
 	 * We are using the function by relying on local variables. Stepping (page selection) is done externally. Half pages are selected within those pages using a "for" loop.
+	 * The page is read through the pointer we are given (a slot in the Rx ring, or a page assembled by the stream decoder).
 	 * The page is first erased, then replaced by an array of 32 words (32 x 32 = 1 kbit, which is 128 bytes).
 	 * It is not possible to erase smaller section than 128 bytes.
+	 * If the page has already been erased (see EraseAppSection below), the erase can be skipped. This halves the time we spend on one page.
+	 *
+	 * 1)Compare the page in the FLASH with the one in the buffer
+	 * 2)Erase the page, if necessary
+	 * 3)Write the two half pages, unless the page is all 0x00 - the erase has done the job already
 	 *
 	 * Note: the pointer must be properly manipulated to allow the right FLASH elements to be updated. Failing to do so will corrupt the app we intend to update.
+	 * Note: an erased page reads as all 0x00 on the L0xx. An all-zero page on an erased section is thus also skipped.
 	 *
 	 * */
 
-	 FLASHErase_Page(page_addr_in_FLASH);
+	 //1)
+	 enum_Yes_No_Selector page_is_identical = Yes;
+
+	 for(uint8_t i = 0; i < Boot_page_size_in_words; i++) {
+		 if ((*(uint32_t*)(page_addr_in_FLASH + (4 * i))) != page_data_ptr[i]) {
+			 page_is_identical = No;
+			 break;																					//we don't need to check the rest of the page
+		 } else {
+			 //do nothing
+		 }
+	 }
+
+	 if (page_is_identical == Yes) {
+		 return No;																					//the page is not written to - neither erase, nor half-page writes
+	 } else {
+		 //do nothing
+	 }
+
+	 //2)
+	 if (page_erase_selector == Yes) {
+		 NVMJobSubmit(NVM_Erase_Page, page_addr_in_FLASH, 0);
+	 } else {
+		 //do nothing
+	 }
 	 //Note: we select the page, then we select the half-page within that page
 
+	 //3)
+	 enum_Yes_No_Selector page_is_blank = Yes;
+
+	 for(uint8_t i = 0; i < Boot_page_size_in_words; i++) {
+		 if (page_data_ptr[i] != 0) {
+			 page_is_blank = No;
+			 break;
+		 } else {
+			 //do nothing
+		 }
+	 }
+
+	 if ((page_is_blank == Yes) && (page_erase_selector == Yes)) {
+		 return Yes;																				//the page is written to, but only by the erase
+	 } else {
+		 //do nothing
+	 }
+
 	 for(uint8_t half_page_select_in_buf = 0; half_page_select_in_buf < 2; half_page_select_in_buf++) {														//copying two half pages demand a loop of 2
-		FLASHUpd_HalfPage(page_addr_in_FLASH, full_page_select_in_buf, half_page_select_in_buf);	//unlike the word by word version where we passed the pointer value, we pass just the Rx_buffer position data - where we should read from it
-		page_addr_in_FLASH = page_addr_in_FLASH + 0x40;												//we increment the address value by half a page
+		NVMJobSubmit(NVM_Program_Half_Page, page_addr_in_FLASH, page_data_ptr + (Boot_half_page_size_in_words * half_page_select_in_buf));
+																									//we pass the pointer to the half page we want to write to the FLASH
+		page_addr_in_FLASH = page_addr_in_FLASH + (4 * Boot_half_page_size_in_words);												//we increment the address value by half a page
 																									//or I can just pass addresses in there instead? well, no, not really since the data is not kept at a predefined address
 																									//After 32 steps, we have updated a full page worth of FLASH area.
 	 }
 
+	 return Yes;
+}
+
+
+//3)App section erase
+/*
+ * We erase as many pages from the start of the update slot as are needed to hold an image of the given length.
+ * This is done before the machine code starts to come in, so that during reception only the half-page writes need to run.
+ * The function gives back the address of the first page that has not been erased.
+ *
+ * Note: erasing takes roughly 3.2 ms per page. The master must wait until the erase is done before sending the machine code.
+ * Note: the erases go through the NVM job queue. We only wait for all of them at the end.
+ *
+ * */
+uint32_t EraseAppSection (uint32_t image_length_in_bytes) {
+
+	uint32_t page_addr_in_FLASH = App_update_start_addr;
+
+	if (image_length_in_bytes > (App_update_end_addr - App_update_start_addr)) {			//we don't erase anything beyond the update slot
+		image_length_in_bytes = App_update_end_addr - App_update_start_addr;
+	} else {
+		//do nothing
+	}
+
+	while (page_addr_in_FLASH < (App_update_start_addr + image_length_in_bytes)) {		//we round up to full pages
+		NVMJobSubmit(NVM_Erase_Page, page_addr_in_FLASH, 0);							//we wait here only if the queue is full
+		page_addr_in_FLASH = page_addr_in_FLASH + Boot_page_size_in_bytes;
+	}
+
+	NVMWaitIdle();
+
+	return page_addr_in_FLASH;
 }
 
 
-//3) Reboot
+//4) Reboot
 /*
  *	This function reboots the microcontroller using software.
  *	It is slower than using hardware reset, but the outcome is the same.
@@ -95,27 +225,20 @@ void UpdatePageInApp (uint32_t page_addr_in_FLASH, uint8_t full_page_select_in_b
 
 void ReBoot(void)
 {
-	uint32_t Boot_reset_vector_addr;																//this is the address of the app's reset vector (which is also a function pointer!)
-	void (*Start_Boot_func_ptr)(void);																//the local function pointer we define
+	BootStayMarkerSet();																			//we want to stay in the bootloader after the reboot
 
-	if((*(uint32_t*)Boot_Section_Start_Addr) == 0x20002000)											//we check, what is stored at the Boot_Section_Addr. It should be the very first word of the app's code.
+	if(StackPointerCheck(*(uint32_t*)Boot_Section_Start_Addr) == Yes)								//we check, what is stored at the Boot_Section_Addr. It should be the very first word of the boot's code.
 																									//we do this check since we may run a device without a bootloader
 	{
-		printf("Rebooting...\r\n");
-		Boot_reset_vector_addr = *(uint32_t*)(Boot_Section_Start_Addr + 4);							//we define a pointer to APP_ADDR + 4 and then dereference it to extract the reset vector for the app
-																									//JumpAddress will hold the reset vector address (which won't be the same as APP_ADDR + 4, the address is just stored there)
-		Start_Boot_func_ptr = Boot_reset_vector_addr;													//we call the local function pointer with the address of the app's reset vector
-																									//Note: for the bootloader, this address is an integer. In reality, it will be a function pointer once the app is placed.
-		__set_MSP(*(uint32_t*) Boot_Section_Start_Addr);												//we move the stack pointer to the APP address
-		Start_Boot_func_ptr();																		//here we call the APP reset function through the local function pointer
+		BootHandoff(Boot_Section_Start_Addr);														//does not come back
 	} else {
-		printf("Boot not found. \r\n");
+		BOOT_LOG("Boot not found. \r\n");
 	}
 
 }
 
 
-//4) Reset app
+//5) Reset app
 /*
  *	This function resets the app using software. It does not use the bootloader.
  *	Mind, resetting the app only makes sense when run within the app's code. Thus, it does not have the address control like jumping in and out of the boot.
@@ -127,12 +250,663 @@ void ResetApp(void) {
 
 	void (*Start_App_func_ptr)(void);																//the local function pointer we define
 
-	printf("Resetting app...\r\n");
+	BOOT_LOG("Resetting app...\r\n");
 
-	App_reset_vector_addr = *(uint32_t*)(App_Section_Start_Addr + 4);								//we define a pointer to APP_ADDR + 4 and then dereference it to extract the reset vector for the app
+	uint32_t App_slot_start_addr = AppSlotStartAddr(App_active_slot);
+	App_reset_vector_addr = *(uint32_t*)(App_slot_start_addr + 4);								//we define a pointer to APP_ADDR + 4 and then dereference it to extract the reset vector for the app
 																									//JumpAddress will hold the reset vector address (which won't be the same as APP_ADDR + 4, the address is just stored there)
 	Start_App_func_ptr = App_reset_vector_addr;														//we call the local function pointer with the address of the app's reset vector
 																									//Note: for the bootloader, this address is an integer. In reality, it will be a function pointer once the app is placed.
-	__set_MSP(*(uint32_t*) App_Section_Start_Addr);													//we move the stack pointer to the APP address
+	__set_MSP(*(uint32_t*) App_slot_start_addr);													//we move the stack pointer to the APP address
 	Start_App_func_ptr();																			//here we call the APP reset function through the local function pointer
 }
+
+
+//6) App check
+/*
+ *	We check if there is an app in a slot that we can jump to.
+ *	The first word of the app should be the reset value of the stack pointer in RAM, the second word is the reset vector.
+ *
+ *  Note: the value stored at the App_Section_Addr is the initial stack pointer of the app. It must point into the RAM (see StackPointerCheck).
+ *  Note: the memory monitor reads out the memory values upside-down! (there is an endian switch during the process)
+ *  Note: the reset vector must point into the slot and must be a Thumb address (LSB is 1). An app linked to the other slot is thus not valid.
+ *
+ * */
+
+enum_Yes_No_Selector AppIsValid(uint8_t app_slot) {
+
+	uint32_t App_slot_start_addr = AppSlotStartAddr(app_slot);
+	uint32_t App_stack_pointer = *(uint32_t*)App_slot_start_addr;
+	uint32_t App_reset_vector_addr = *(uint32_t*)(App_slot_start_addr + 4);
+
+	if ((StackPointerCheck(App_stack_pointer) == Yes) &&
+		(App_reset_vector_addr >= App_slot_start_addr) &&
+		(App_reset_vector_addr < (App_slot_start_addr + App_slot_size_in_bytes)) &&
+		((App_reset_vector_addr & 1) == 1)) {
+		return Yes;
+	} else {
+		return No;
+	}
+}
+
+
+//7) Stay marker
+/*
+ *	We put the stay marker into the first RTC backup register.
+ *	The marker survives a reset (not a power cycle), so the app - or the bootloader itself - can use it to ask for the full boot window at the next start.
+ *
+ *	1)Enable the PWR clock and remove the write protection of the backup domain
+ *	2)Write the marker
+ *
+ * */
+
+void BootStayMarkerSet(void) {
+
+	//1)
+	RCC->APB1ENR |= (1<<28);																		//PWR clock enabled
+	PWR->CR |= (1<<8);																				//DBP - backup domain write protection removed
+
+	//2)
+	RTC->BKP0R = Boot_stay_marker;
+}
+
+
+//8) Boot start policy
+/*
+ *	We decide what to do after reset.
+ *
+ *	1)If the stay marker is present, we remove it and wait for the full boot window.
+ *	2)If there is no valid app in the active slot (or its CRC is wrong), we switch over to the other slot. If that one is not valid either, we stay in the bootloader.
+ *	3)If we are not on the fast path, we wait for the full boot window.
+ *	4)We check the Rx line: we pull it down and read it out. If nothing pulls it back up, there is no host connected and we start the app immediately.
+ *	5)We listen on the Rx line for a short sniff window. If a command frame comes in, or bytes are coming in, we stay for the full boot window.
+ *	  Otherwise, we start the app.
+ *
+ *	Note: the command capture must be running already (see UART1CommandCaptureEnable). A command frame that arrives during the sniff window stays in the frame queue and is processed by the main loop.
+ *	Note: TIM2 is started at init and counts milliseconds, so the sniff window is measured from the start of the bootloader.
+ *	Note: we sleep during the sniff window. The command capture (UART1 and DMA IRQs) or the TIM2 compare at the end of the window wakes us up.
+ *	Note: a UART host keeps its Tx line high when idle. A floating line is taken low by the pull-down.
+ *
+ * */
+
+enum_Boot_Start_Selector BootStartSelect(void) {
+
+	//1)
+	RCC->APB1ENR |= (1<<28);																		//PWR clock enabled
+	if (RTC->BKP0R == Boot_stay_marker) {
+		PWR->CR |= (1<<8);																			//DBP - backup domain write protection removed
+		RTC->BKP0R = 0;																				//the marker is only valid once
+		return Wait_For_Host;
+	} else {
+		//do nothing
+	}
+
+	//2)
+	if ((AppIsValid(App_active_slot) == No) || (AppImageCheck(App_active_slot) == No)) {
+		if ((AppIsValid(App_update_slot) == Yes) && (AppImageCheck(App_update_slot) == Yes)) {
+			BOOT_LOG("APP in slot %d broken, falling back to slot %d \r\n", App_active_slot, App_update_slot);
+			AppSlotActivate(App_update_slot);
+		} else {
+			return Stay_In_Boot;
+		}
+	} else {
+		//do nothing
+	}
+
+	//3)
+	if (Boot_policy == Boot_Full_Window) {
+		return Wait_For_Host;
+	} else {
+		//do nothing
+	}
+
+	//4)
+	GPIOA->PUPDR |= (2<<20);																		//pull-down on PA10 (Rx)
+	Delay_us(10);																					//we let the line settle
+	uint32_t Rx_line_state = GPIOA->IDR & (1<<10);
+	GPIOA->PUPDR &= ~(3<<20);																		//no pull resistor on PA10 again
+	if (Rx_line_state == 0) {																		//no host is driving the line
+		return Start_App_Now;
+	} else {
+		//do nothing
+	}
+
+	//5)
+	TIM2->CCR1 = Boot_sniff_window_in_ms;
+	TIM2->SR &= ~(1<<1);																			//no stale compare
+	TIM2->DIER |= (1<<1);																			//CC1 IRQ at the end of the sniff window, it only wakes us up (see TIM2_IRQHandler)
+	BOOT_SLEEP_WHILE((TIM2->CNT < Boot_sniff_window_in_ms) && (Cmd_frames_produced == 0));
+	TIM2->DIER &= ~(1<<1);
+	if (Cmd_frames_produced != 0) {																	//a command frame has arrived
+		return Wait_For_Host;
+	} else {
+		//do nothing
+	}
+
+	if (DMAChannelUART1RxPosition() != 0) {															//a command frame is still coming in
+		return Wait_For_Host;
+	} else {
+		return Start_App_Now;
+	}
+}
+
+
+//9) App image check
+/*
+ *	We check the app in a slot against its app header. The CRC32 of the slot (as long as the header says) must match the CRC in the header.
+ *
+ *	1)If there is no app header at all, the app was loaded before headers were introduced. We accept it.
+ *	  Slot B did not exist back then: an app there must have a header.
+ *	  With image authentication (see BootConfig.h), such an app has never been authenticated. We reject it.
+ *	2)If the length in the header is not valid, an update has been started but not committed. We reject the app.
+ *	3)If the app descriptor in the EEPROM says that this app has already been verified, we accept it without reading it back.
+ *	4)We calculate the CRC of the app using the hardware CRC and compare it to the header.
+ *	5)If they match, we write the app descriptor so the next boot can skip 4).
+ *
+ *	Note: an erased page reads as 0x00, so a missing header has no magic word.
+ *	Note: 1) to 3) take the same time independent of the size of the app.
+ *	Note: the CRC covers full pages. The last page of the app is padded with 0x00.
+ *
+ * */
+
+enum_Yes_No_Selector AppImageCheck(uint8_t app_slot) {
+
+	uint32_t* App_header_ptr = (uint32_t*)AppSlotHeaderAddr(app_slot);
+
+	//1)
+	if (App_header_ptr[0] != App_header_magic) {
+		if ((app_slot == 0) && (Boot_image_auth_enable == 0)) {
+			return Yes;
+		} else {
+			return No;
+		}
+	} else {
+		//do nothing
+	}
+
+	//2)
+	uint32_t image_length_in_bytes = App_header_ptr[1];
+	if ((image_length_in_bytes == 0) ||
+		(image_length_in_bytes > App_slot_size_in_bytes) ||
+		((image_length_in_bytes % Boot_page_size_in_bytes) != 0)) {
+		return No;
+	} else {
+		//do nothing
+	}
+
+	//3)
+	if (AppDescriptorCheck(app_slot) == Yes) {
+		return Yes;
+	} else {
+		//do nothing
+	}
+
+	//4)
+	uint32_t image_crc = CRCFinal(CRCCalculate(CRC_start_state, (uint32_t*)AppSlotStartAddr(app_slot), image_length_in_bytes / 4));
+	if (image_crc == App_header_ptr[2]) {
+
+		//5)
+		uint32_t* App_descriptor_ptr = (uint32_t*)AppSlotDescriptorAddr(app_slot);
+		uint32_t image_version = 0;
+		if (App_descriptor_ptr[0] == App_descriptor_magic) {									//we keep the version of a stale descriptor
+			image_version = App_descriptor_ptr[3];
+		} else {
+			//do nothing
+		}
+		AppDescriptorWrite(app_slot, image_length_in_bytes, image_crc, image_version);
+		return Yes;
+	} else {
+		BOOT_LOG("APP CRC mismatch. \r\n");
+		return No;
+	}
+}
+
+
+//10) App header write
+/*
+ *	We write the app header of a slot: the magic word, the length of the app in bytes and the CRC32 of the app.
+ *	At the start of an update, the header is written with an invalid length. This way an app that has not been fully updated and committed is never started.
+ *
+ *	Note: the header takes up one half page. The rest of the header page stays 0x00.
+ *	Note: the function blocks until the header is in the FLASH.
+ *	Note: every slot has its own header page. Writing the header of one slot never puts the header of the other one at risk.
+ *
+ * */
+
+void AppHeaderWrite(uint8_t app_slot, uint32_t image_length_in_bytes, uint32_t image_crc) {
+
+	uint32_t App_header[16] = {0};
+
+	App_header[0] = App_header_magic;
+	App_header[1] = image_length_in_bytes;
+	App_header[2] = image_crc;
+
+	if (memcmp((uint32_t*)AppSlotHeaderAddr(app_slot), App_header, sizeof(App_header)) == 0) {
+		return;																				//the header is already there (e.g. a resumed update)
+	} else {
+		//do nothing
+	}
+
+	FLASHErase_Page(AppSlotHeaderAddr(app_slot));
+	FLASHUpd_HalfPage(AppSlotHeaderAddr(app_slot), App_header);
+}
+
+
+//11) App descriptor write
+/*
+ *	We write the app descriptor of a slot into the EEPROM after the app has been verified.
+ *
+ *	The descriptor is 8 words:
+ *	0)magic word
+ *	1)length of the app in bytes
+ *	2)CRC32 of the app
+ *	3)version of the app (given by the master when committing)
+ *	4)verified flag
+ *	5)stack pointer of the app (first word of the slot)
+ *	6)reset vector of the app (second word of the slot)
+ *	7)CRC32 of words 0 to 6
+ *
+ *	Note: the verified flag is written last, after the CRC of the descriptor. A descriptor that has been interrupted while being written is never taken as valid.
+ *
+ * */
+
+void AppDescriptorWrite(uint8_t app_slot, uint32_t image_length_in_bytes, uint32_t image_crc, uint32_t image_version) {
+
+	uint32_t App_descriptor[App_descriptor_size_in_words];
+	uint32_t App_descriptor_addr = AppSlotDescriptorAddr(app_slot);
+
+	App_descriptor[0] = App_descriptor_magic;
+	App_descriptor[1] = image_length_in_bytes;
+	App_descriptor[2] = image_crc;
+	App_descriptor[3] = image_version;
+	App_descriptor[4] = App_descriptor_verified;
+	App_descriptor[5] = *(uint32_t*)AppSlotStartAddr(app_slot);
+	App_descriptor[6] = *(uint32_t*)(AppSlotStartAddr(app_slot) + 4);
+	App_descriptor[7] = CRCFinal(CRCCalculate(CRC_start_state, App_descriptor, 7));
+
+	AppDescriptorInvalidate(app_slot);														//we remove the verified flag first
+
+	for (uint8_t i = 0; i < App_descriptor_size_in_words; i++) {
+		if (i != 4) {
+			EEPROMUpd_Word(App_descriptor_addr + (4 * i), App_descriptor[i]);
+		} else {
+			//do nothing
+		}
+	}
+
+	EEPROMUpd_Word(App_descriptor_addr + (4 * 4), App_descriptor_verified);
+}
+
+
+//12) App descriptor invalidation
+/*
+ *	We remove the verified flag from the app descriptor of a slot. This is done at the start of an update.
+ *
+ * */
+
+void AppDescriptorInvalidate(uint8_t app_slot) {
+	EEPROMUpd_Word(AppSlotDescriptorAddr(app_slot) + (4 * 4), 0);
+}
+
+
+//13) App descriptor check
+/*
+ *	We check if the app descriptor of a slot describes the app that is in the slot right now.
+ *
+ *	1)The descriptor must have its magic word, the verified flag and a correct CRC.
+ *	2)The descriptor must match the app header (length and CRC).
+ *	3)The descriptor must match the first two words of the app (stack pointer and reset vector). This catches an app that has been loaded by other means (e.g. a debugger).
+ *
+ *	Note: this takes the same time independent of the size of the app.
+ *
+ * */
+
+enum_Yes_No_Selector AppDescriptorCheck(uint8_t app_slot) {
+
+	uint32_t* App_descriptor_ptr = (uint32_t*)AppSlotDescriptorAddr(app_slot);
+	uint32_t* App_header_ptr = (uint32_t*)AppSlotHeaderAddr(app_slot);
+	uint32_t App_slot_start_addr = AppSlotStartAddr(app_slot);
+
+	//1)
+	if ((App_descriptor_ptr[0] != App_descriptor_magic) ||
+		(App_descriptor_ptr[4] != App_descriptor_verified) ||
+		(CRCFinal(CRCCalculate(CRC_start_state, App_descriptor_ptr, 7)) != App_descriptor_ptr[7])) {
+		return No;
+	} else {
+		//do nothing
+	}
+
+	//2)
+	if ((App_descriptor_ptr[1] != App_header_ptr[1]) || (App_descriptor_ptr[2] != App_header_ptr[2])) {
+		return No;
+	} else {
+		//do nothing
+	}
+
+	//3)
+	if ((App_descriptor_ptr[5] != *(uint32_t*)App_slot_start_addr) ||
+		(App_descriptor_ptr[6] != *(uint32_t*)(App_slot_start_addr + 4))) {
+		return No;
+	} else {
+		return Yes;
+	}
+}
+
+
+//14) App slot addresses
+/*
+ *	We give back where a slot, its app header and its app descriptor are.
+ *	Slot A (0) is where the app section used to be, so an app loaded before the slots were introduced is found in slot A.
+ *
+ * */
+
+uint32_t AppSlotStartAddr(uint8_t app_slot) {
+	return App_Section_Start_Addr + (app_slot * App_slot_size_in_bytes);
+}
+
+uint32_t AppSlotHeaderAddr(uint8_t app_slot) {
+	return App_Header_Addr - (app_slot * Boot_page_size_in_bytes);
+}
+
+uint32_t AppSlotDescriptorAddr(uint8_t app_slot) {
+	return App_Descriptor_Addr + (app_slot * 4 * App_descriptor_size_in_words);
+}
+
+
+//15) App slot selection
+/*
+ *	We read the active slot from the EEPROM. The update goes into the other slot.
+ *	If the slot selector has never been written, slot A is active.
+ *
+ * */
+
+void AppSlotSelect(void) {
+
+	uint32_t App_active_slot_word = *(uint32_t*)App_Active_Slot_Addr;
+
+	if (((App_active_slot_word & ~0xFF) == App_active_slot_magic) && ((App_active_slot_word & 0xFF) < App_slot_count)) {
+		App_active_slot = App_active_slot_word & 0xFF;
+	} else {
+		App_active_slot = 0;
+	}
+
+	App_update_slot = (App_active_slot + 1) % App_slot_count;
+	App_update_start_addr = AppSlotStartAddr(App_update_slot);
+	App_update_end_addr = App_update_start_addr + App_slot_size_in_bytes;
+}
+
+
+//16) App slot activation
+/*
+ *	We make a slot the active one. This is a single word written into the EEPROM, so it takes the same time for any app.
+ *	The app in the slot is not checked here, see ActivateAppSlot in the controller.
+ *
+ *	Note: if the write is interrupted, the word does not carry the magic anymore and slot A is taken. If slot A is not valid, BootStartSelect falls back to slot B.
+ *
+ * */
+
+void AppSlotActivate(uint8_t app_slot) {
+	EEPROMUpd_Word(App_Active_Slot_Addr, App_active_slot_magic | app_slot);
+	AppSlotSelect();
+}
+
+
+//17) Resume checkpoint write
+/*
+ *	We write the progress of the update into the EEPROM: how much of the update slot has been written in order from its start, and the running CRC over it.
+ *	The checkpoint is 4 words: the magic word with the update slot, the length in bytes, the running CRC state (not the final CRC) and the CRC32 of the first 3 words.
+ *
+ *	Note: the words go through the NVM job queue behind the half-page writes of the last page, so they are only written once the pages they cover are in the FLASH.
+ *	Note: if the previous checkpoint is still being written, we skip this one. The words of a checkpoint must stay untouched until their jobs are done.
+ *	Note: a checkpoint that is only partially written has a wrong CRC and is ignored.
+ *
+ * */
+
+void ResumeCheckpointSave(uint32_t image_length_in_bytes, uint32_t image_crc_state) {
+
+	if (NVMJobsDone(Resume_checkpoint_job_tag) == No) {
+		return;
+	} else {
+		//do nothing
+	}
+
+	Resume_checkpoint[0] = Resume_checkpoint_magic | App_update_slot;
+	Resume_checkpoint[1] = image_length_in_bytes;
+	Resume_checkpoint[2] = image_crc_state;
+	Resume_checkpoint[3] = CRCFinal(CRCCalculate(CRC_start_state, Resume_checkpoint, 3));
+
+	for (uint8_t i = 0; i < Resume_checkpoint_size_in_words; i++) {
+		NVMJobSubmit(NVM_EEPROM_Word, Resume_Checkpoint_Addr + (4 * i), &Resume_checkpoint[i]);
+	}
+	Resume_checkpoint_job_tag = NVM_jobs_submitted;
+}
+
+
+//18) Resume checkpoint invalidation
+/*
+ *	We remove the resume checkpoint. This is done when a new update is started and when an update is committed.
+ *
+ * */
+
+void ResumeCheckpointInvalidate(void) {
+	EEPROMUpd_Word(Resume_Checkpoint_Addr, 0);
+}
+
+
+//19) Resume checkpoint check
+/*
+ *	We check if the update can be resumed from the checkpoint. The function gives back the length the checkpoint covers (0 if it can't be used) and the running CRC state at that point.
+ *
+ *	1)The checkpoint must have its magic word, be for the current update slot and have a correct CRC.
+ *	2)An update of the slot must have been started, but not committed: the app header of the slot has the invalid length.
+ *	3)The length must be full pages within the slot.
+ *	4)The slot must still hold what the checkpoint says. We read the covered part back using the hardware CRC.
+ *	  This also catches a page that failed to be written after the checkpoint was submitted.
+ *
+ * */
+
+uint32_t ResumeCheckpointLoad(uint32_t* image_crc_state_ptr) {
+
+	uint32_t* Resume_checkpoint_ptr = (uint32_t*)Resume_Checkpoint_Addr;
+	uint32_t* App_header_ptr = (uint32_t*)AppSlotHeaderAddr(App_update_slot);
+	uint32_t image_length_in_bytes = Resume_checkpoint_ptr[1];
+
+	//1)
+	if ((Resume_checkpoint_ptr[0] != (Resume_checkpoint_magic | App_update_slot)) ||
+		(CRCFinal(CRCCalculate(CRC_start_state, Resume_checkpoint_ptr, 3)) != Resume_checkpoint_ptr[3])) {
+		return 0;
+	} else {
+		//do nothing
+	}
+
+	//2)
+	if ((App_header_ptr[0] != App_header_magic) || (App_header_ptr[1] != App_header_length_invalid)) {
+		return 0;
+	} else {
+		//do nothing
+	}
+
+	//3)
+	if ((image_length_in_bytes == 0) || (image_length_in_bytes > App_slot_size_in_bytes) || ((image_length_in_bytes % Boot_page_size_in_bytes) != 0)) {
+		return 0;
+	} else {
+		//do nothing
+	}
+
+	//4)
+	if (CRCCalculate(CRC_start_state, (uint32_t*)App_update_start_addr, image_length_in_bytes / 4) != Resume_checkpoint_ptr[2]) {
+		return 0;
+	} else {
+		*image_crc_state_ptr = Resume_checkpoint_ptr[2];
+		return image_length_in_bytes;
+	}
+}
+
+
+
+//20) Handoff
+/*
+ * We hand the core over to the code whose vector table sits at "vector_table_addr" - an app slot or the boot section - as if it was coming out of a reset.
+ *
+ * 1)We let the NVM jobs finish and the queued responses on UART1 go out
+ * 2)We disable the IRQs and stop SysTick
+ * 3)We reset every peripheral the bootloader uses through the RCC and give the peripheral clocks their reset values
+ * 4)We disable and clear every IRQ in the NVIC, as well as a pending SysTick or PendSV
+ * 5)We move the VTOR to the new vector table, load the stack pointer and jump to the reset vector
+ *
+ * Note: nothing here blocks, except for an NVM job or a response that is still running. Otherwise the handoff takes a few microseconds.
+ * Note: the log on UART2 is not flushed. Whatever is still in the log ring is lost.
+ * Note: the clock tree (PLL at 32 MHz), the voltage range (PWR) and the FLASH wait states are kept, the core would not run at 32 MHz without them.
+ * Note: the IRQs are enabled again right before the jump, as they are after a reset. Nothing can fire since the NVIC is cleared.
+ *
+ * */
+
+void BootHandoff(uint32_t vector_table_addr) {
+
+	uint32_t stack_pointer = *(uint32_t*)vector_table_addr;
+	void (*Start_func_ptr)(void) = (void (*)(void))(*(uint32_t*)(vector_table_addr + 4));		//the reset vector
+
+	//1)
+	NVMDeinit();
+	UART1TxFlush();
+
+	//2)
+	__disable_irq();
+	SysTick->CTRL = 0;
+
+	//3)
+	RCC->AHBRSTR |= (1<<0) | (1<<12);															//DMA and CRC
+	RCC->AHBRSTR &= ~((1<<0) | (1<<12));
+	RCC->APB2RSTR |= (1<<0) | (1<<14);															//SYSCFG and USART1
+	RCC->APB2RSTR &= ~((1<<0) | (1<<14));
+	RCC->APB1RSTR |= (1<<0) | (1<<4) | (1<<17);													//TIM2, TIM6 and USART2
+	RCC->APB1RSTR &= ~((1<<0) | (1<<4) | (1<<17));
+	RCC->IOPRSTR |= (1<<0) | (1<<2) | (1<<7);													//GPIOA, GPIOC and GPIOH
+	RCC->IOPRSTR &= ~((1<<0) | (1<<2) | (1<<7));
+																								//Note: PWR is not reset, it holds the voltage range of the 32 MHz clocking
+	EXTI->IMR &= ~(1<<13);																		//the EXTI line of B1 is not reset through the RCC
+	EXTI->FTSR &= ~(1<<13);
+	EXTI->PR = (1<<13);
+
+	RCC->AHBENR = 0x00000100;																	//reset values - only the NVM interface is clocked
+	RCC->APB2ENR = 0x00000000;
+	RCC->APB1ENR = 0x00000000;
+	RCC->IOPENR = 0x00000000;
+	BootSleepDeinit();
+
+	//4)
+	NVIC->ICER[0] = 0xFFFFFFFF;
+	NVIC->ICPR[0] = 0xFFFFFFFF;
+	SCB->ICSR = (1<<25) | (1<<27);																//PENDSTCLR and PENDSVCLR
+
+	//5)
+	SCB->VTOR = vector_table_addr;																//the RAM vector table of the bootloader is left behind
+	__DSB();
+	__ISB();
+	__set_MSP(stack_pointer);
+	__enable_irq();
+	Start_func_ptr();
+}
+
+
+//21) Stack pointer check
+/*
+ * We check if an initial stack pointer points into the RAM and is word aligned.
+ * Apps are free to keep the top of the RAM for themselves, so the stack pointer does not have to be the top of the RAM.
+ *
+ * */
+
+enum_Yes_No_Selector StackPointerCheck(uint32_t stack_pointer) {
+	if ((stack_pointer > Boot_RAM_start_addr) && (stack_pointer <= Boot_stack_top_addr) && ((stack_pointer & 0x3) == 0)) {
+		return Yes;
+	} else {
+		return No;
+	}
+}
+
+
+//22) Unique ID read
+/*
+ * We copy the 96 bit unique ID of the part into a 12 byte array, lowest byte of the first word first.
+ * The three words of the ID are not next to each other on the L0 (see the reference manual, "Unique device ID registers").
+ *
+ * */
+
+void NodeUniqueIDRead(uint8_t* unique_id_ptr) {
+
+	uint32_t unique_id [3];
+
+	unique_id[0] = *(uint32_t*)(Boot_unique_ID_addr);
+	unique_id[1] = *(uint32_t*)(Boot_unique_ID_addr + 0x04);
+	unique_id[2] = *(uint32_t*)(Boot_unique_ID_addr + 0x14);
+
+	for (uint8_t i = 0; i < 12; i++) {
+		unique_id_ptr[i] = (unique_id[i / 4] >> (8 * (i % 4))) & 0xFF;
+	}
+}
+
+
+//23) Node address load
+/*
+ * We give back the node address of the bootloader on the bus.
+ * If an address has been configured (see NodeAddressSave), we take it from the EEPROM.
+ * Otherwise we fold the unique ID into a single byte. This is not guaranteed to be unique across the parts on a bus, which is why the address can be configured.
+ *
+ * Note: the address is always between 0x01 and 0xFE. 0xFF is the broadcast address (see UART1RxMessageWait), 0x00 is not used.
+ *
+ * */
+
+uint8_t NodeAddressLoad(void) {
+
+	uint32_t node_address_word = *(uint32_t*)Node_Address_Addr;
+	uint8_t unique_id [12];
+	uint8_t node_address_fold = 0;
+
+	if (NodeAddressConfigured() == Yes) {
+		return node_address_word & 0xFF;
+	} else {
+		//do nothing
+	}
+
+	NodeUniqueIDRead(unique_id);
+
+	for (uint8_t i = 0; i < 12; i++) {
+		node_address_fold ^= unique_id[i];
+	}
+
+	return (node_address_fold % 254) + 1;
+}
+
+
+//24) Node address check
+/*
+ * We check if the node address has been configured in the EEPROM.
+ *
+ * */
+
+enum_Yes_No_Selector NodeAddressConfigured(void) {
+
+	uint32_t node_address_word = *(uint32_t*)Node_Address_Addr;
+
+	if (((node_address_word & ~0xFF) == Node_address_magic) && ((node_address_word & 0xFF) != 0x00) && ((node_address_word & 0xFF) != 0xFF)) {
+		return Yes;
+	} else {
+		return No;
+	}
+}
+
+
+//25) Node address write
+/*
+ * We write the node address into the EEPROM. It is used from the next NodeAddressLoad onwards.
+ * Address 0x00 removes the configured address, we go back to the one derived from the unique ID.
+ *
+ * */
+
+void NodeAddressSave(uint8_t node_address) {
+	if (node_address == 0x00) {
+		EEPROMUpd_Word(Node_Address_Addr, 0);
+	} else {
+		EEPROMUpd_Word(Node_Address_Addr, Node_address_magic | node_address);
+	}
+}
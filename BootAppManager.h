@@ -13,26 +13,90 @@
 #define INC_APPMANAGER_CUSTOM_H_
 
 #include <BootNVMDriver_STM32L0x3.h>
+#include "BootDMADriver_STM32L0x3.h"
+#include "BootClockDriver_STM32L0x3.h"
+#include "BootCRCDriver_STM32L0x3.h"
+#include "BootUARTDriver_STM32L0x3.h"
 #include "main.h"
 #include "stdint.h"
 #include "stdio.h"
+#include "string.h"
 
 
 
 //LOCAL CONSTANT
-static const uint32_t App_Section_Start_Addr = 0x8008000;					//this is the app section's address. It is defined in the linker files.
-static const uint32_t Boot_Section_Start_Addr = 0x8000000;					//this is the boot section's address. It is defined in the boot's linker file.
+static const uint32_t App_Section_Start_Addr = App_section_start_addr;	//this is the app section's address. It is defined in the linker files (see BootConfig.h).
+static const uint32_t Boot_Section_Start_Addr = Boot_FLASH_start_addr;		//this is the boot section's address. It is defined in the boot's linker file.
+static const uint32_t App_Section_End_Addr = Boot_FLASH_end_addr;			//this is the end of the FLASH. The app can't go beyond it.
+
+static const uint32_t App_slot_size_in_bytes = (Boot_FLASH_end_addr - App_section_start_addr) / App_slot_count;	//the app section is split into slots (A and B) of 16 kbytes each
+																			//Note: an app must be linked to the slot it is loaded into
+
+static const uint32_t App_Header_Addr = App_section_start_addr - Boot_page_size_in_bytes;	//the app header of slot A sits in the last page of the boot section, the one of slot B in the page before
+																			//Note: the boot section's linker file must keep these two pages free
+static const uint32_t App_header_magic = 0x41505048;						//"APPH" - marks a written app header
+static const uint32_t App_header_length_invalid = 0xFFFFFFFF;				//length of an app header written at the start of an update
+
+#define App_descriptor_size_in_words 8
+static const uint32_t App_Descriptor_Addr = Boot_EEPROM_start_addr;			//the app descriptor sits at the start of the data EEPROM
+static const uint32_t App_descriptor_magic = 0x44455343;					//"DESC" - marks a written app descriptor
+static const uint32_t App_descriptor_verified = 0x00000001;					//the app in the FLASH has been checked against the header
+																			//Note: the descriptor of slot B follows the one of slot A
+static const uint32_t App_Active_Slot_Addr = Boot_EEPROM_start_addr + (App_slot_count * App_descriptor_size_in_words * 4);	//the active slot selector sits after the two app descriptors in the data EEPROM
+static const uint32_t App_active_slot_magic = 0x534C4F00;					//"SLO" followed by the index of the active slot
+
+#define Resume_checkpoint_size_in_words 4
+#define Resume_checkpoint_interval_in_pages 16								//how often the progress of an update is written into the EEPROM
+static const uint32_t Resume_Checkpoint_Addr = Boot_EEPROM_start_addr + (App_slot_count * App_descriptor_size_in_words * 4) + 4;	//the resume checkpoint sits after the active slot selector in the data EEPROM
+static const uint32_t Resume_checkpoint_magic = 0x52534D00;					//"RSM" followed by the index of the update slot
+
+static const uint32_t Node_Address_Addr = Boot_EEPROM_start_addr + (App_slot_count * App_descriptor_size_in_words * 4) + 4 + (Resume_checkpoint_size_in_words * 4);	//the node address sits after the resume checkpoint in the data EEPROM
+static const uint32_t Node_address_magic = 0x4E4F4400;						//"NOD" followed by the node address
+
+_Static_assert(((App_slot_count * App_descriptor_size_in_words) + 1 + Resume_checkpoint_size_in_words + 1) * 4 <= Boot_EEPROM_size_in_bytes, "the descriptors, the slot selector, the checkpoint and the node address must fit into the data EEPROM");
+
+static const enum_Boot_Policy_Selector Boot_policy = Boot_Fast_Path;		//Boot_Full_Window always waits for the TIM2 timeout before going to the app
+static const uint16_t Boot_sniff_window_in_ms = 50;							//how long we listen for a command after reset on the fast path
+static const uint32_t Boot_stay_marker = 0xB007B007;						//value in RTC->BKP0R that keeps us in the bootloader for the full window
 
 //LOCAL VARIABLE
 
 
 //EXTERNAL VARIABLE
-extern uint32_t Rx_Message_buf [64];
+extern uint32_t Rx_Message_buf [Rx_Message_buf_size_in_words];
+extern volatile uint8_t Cmd_frames_produced;
+extern uint8_t App_active_slot;
+extern uint8_t App_update_slot;
+extern uint32_t App_update_start_addr;
+extern uint32_t App_update_end_addr;
 
 //FUNCTION PROTOTYPES
 void GoToApp(void);
-void UpdatePageInApp (uint32_t loc_var_current_flash_page_addr, uint8_t current_data_page_select);
+enum_Yes_No_Selector UpdatePageInApp (uint32_t loc_var_current_flash_page_addr, uint32_t* page_data_ptr, enum_Yes_No_Selector page_erase_selector);
+uint32_t EraseAppSection (uint32_t image_length_in_bytes);
 void ReBoot(void);
 void ResetApp(void);
+enum_Yes_No_Selector AppIsValid(uint8_t app_slot);
+enum_Yes_No_Selector AppImageCheck(uint8_t app_slot);
+void AppHeaderWrite(uint8_t app_slot, uint32_t image_length_in_bytes, uint32_t image_crc);
+void AppDescriptorWrite(uint8_t app_slot, uint32_t image_length_in_bytes, uint32_t image_crc, uint32_t image_version);
+void AppDescriptorInvalidate(uint8_t app_slot);
+enum_Yes_No_Selector AppDescriptorCheck(uint8_t app_slot);
+uint32_t AppSlotStartAddr(uint8_t app_slot);
+uint32_t AppSlotHeaderAddr(uint8_t app_slot);
+uint32_t AppSlotDescriptorAddr(uint8_t app_slot);
+void AppSlotSelect(void);
+void AppSlotActivate(uint8_t app_slot);
+void ResumeCheckpointSave(uint32_t image_length_in_bytes, uint32_t image_crc_state);
+void ResumeCheckpointInvalidate(void);
+uint32_t ResumeCheckpointLoad(uint32_t* image_crc_state_ptr);
+void BootStayMarkerSet(void);
+enum_Boot_Start_Selector BootStartSelect(void);
+void BootHandoff(uint32_t vector_table_addr);
+enum_Yes_No_Selector StackPointerCheck(uint32_t stack_pointer);
+void NodeUniqueIDRead(uint8_t* unique_id_ptr);
+uint8_t NodeAddressLoad(void);
+enum_Yes_No_Selector NodeAddressConfigured(void);
+void NodeAddressSave(uint8_t node_address);
 
 #endif /* INC_APPMANAGER_CUSTOM_H_ */
@@ -0,0 +1,239 @@
+/*
+ *  Created on: 14 Oct 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_Bootloader
+ *  Processor: STM32L053R8
+ *  Program version: 1.0
+ *  File: BootBenchmark.c
+ *  Modified from: N/A
+ *  Change history:
+ *
+ * Code holds the on-target benchmarks of the bootloader (command 0xd4).
+ *
+ * v.1.0
+ * NVM benchmark: we erase and write two scratch pages at the top of the app section and measure how long a page erase, a page written word by word and a page written in half pages take.
+ * Rx benchmark: the master sends pages of a known pattern back-to-back. We check every page and measure the rate at which they have arrived.
+ * All times are taken from the free running TIM6 in microseconds (see TIM6Timestamp_us).
+ *
+ * v.1.1
+ * The scratch pages are checked against the app in the slot they are in (slot B).
+ *
+ */
+
+#include "BootBenchmark.h"
+
+
+static uint16_t Bench_Rx_pages = 0;														//pages checked in the Rx benchmark
+static uint16_t Bench_Rx_bad_pages = 0;													//pages that did not match the pattern
+static uint32_t Bench_Rx_first_page_time = 0;
+static uint32_t Bench_Rx_last_page_time = 0;
+
+static enum_Yes_No_Selector BenchScratchIsFree (void);
+static uint32_t BenchPattern (uint16_t page, uint8_t word);
+static void BenchPutLE32 (uint8_t* payload_ptr, uint32_t value);
+
+
+//1)NVM benchmark
+/*
+ * We measure the NVM on the scratch pages and fill the payload of the answer (Bench_NVM_report_size_in_bytes long).
+ * The payload is the number of rounds (1 byte), followed by the minimum and the maximum time in us of a page erase, a page written word by word and a page written in two half pages (4 bytes each, LSB first).
+ * We give back the error code of the benchmark (see enum_Boot_Error_Code).
+ *
+ * 1)We check that the scratch pages don't hold any part of the app.
+ * 2)In every round, we erase both scratch pages, write the first one word by word and the second one in half pages.
+ * 3)We check what we have written.
+ * 4)We leave the scratch pages erased.
+ *
+ * Note: the DMA and the UART1 IRQs run from RAM, command capture keeps on running during the benchmark.
+ * Note: one round takes roughly 100 ms, a word write takes almost as long as a half-page write.
+ *
+ * */
+
+uint8_t BenchNVMRun (uint8_t* payload_ptr) {
+
+	//1)
+	if (BenchScratchIsFree() == No) {
+		return Boot_Error_Scratch_In_Use;
+	} else {
+		//do nothing
+	}
+
+	uint32_t bench_min_us[3] = {0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF};						//erase, word by word, half pages
+	uint32_t bench_max_us[3] = {0, 0, 0};
+	uint32_t bench_page[Boot_page_size_in_words];
+	uint16_t NVM_errors_before = NVM_error_counter;
+	uint8_t bench_error = Boot_Error_None;
+
+	for (uint8_t round = 0; round < Bench_rounds; round++) {
+
+		//2)
+		for (uint8_t i = 0; i < Boot_page_size_in_words; i++) {
+			bench_page[i] = BenchPattern(round, i);
+		}
+
+		uint32_t bench_time_us[4];
+		uint32_t start_time = TIM6Timestamp_us();
+		FLASHErase_Page(Bench_Scratch_Start_Addr);
+		bench_time_us[0] = TIM6Timestamp_us() - start_time;
+
+		start_time = TIM6Timestamp_us();
+		FLASHErase_Page(Bench_Scratch_Start_Addr + Boot_page_size_in_bytes);
+		bench_time_us[1] = TIM6Timestamp_us() - start_time;
+
+		start_time = TIM6Timestamp_us();
+		for (uint8_t i = 0; i < Boot_page_size_in_words; i++) {
+			FLASHUpd_Word(Bench_Scratch_Start_Addr + (4 * i), bench_page[i]);
+		}
+		bench_time_us[2] = TIM6Timestamp_us() - start_time;
+
+		start_time = TIM6Timestamp_us();
+		FLASHUpd_HalfPage(Bench_Scratch_Start_Addr + Boot_page_size_in_bytes, bench_page);
+		FLASHUpd_HalfPage(Bench_Scratch_Start_Addr + Boot_page_size_in_bytes + (4 * Boot_half_page_size_in_words), bench_page + Boot_half_page_size_in_words);
+		bench_time_us[3] = TIM6Timestamp_us() - start_time;
+
+		for (uint8_t i = 0; i < 4; i++) {
+			uint8_t bench_select = (i < 2) ? 0 : (i - 1);										//both erases go into the same result
+			if (bench_time_us[i] < bench_min_us[bench_select]) bench_min_us[bench_select] = bench_time_us[i];
+			if (bench_time_us[i] > bench_max_us[bench_select]) bench_max_us[bench_select] = bench_time_us[i];
+		}
+
+		//3)
+		for (uint8_t i = 0; i < Boot_page_size_in_words; i++) {
+			if ((*(uint32_t*)(Bench_Scratch_Start_Addr + (4 * i)) != bench_page[i]) ||
+				(*(uint32_t*)(Bench_Scratch_Start_Addr + Boot_page_size_in_bytes + (4 * i)) != bench_page[i])) {
+				bench_error = Boot_Error_NVM;
+			} else {
+				//do nothing
+			}
+		}
+	}
+
+	//4)
+	FLASHErase_Page(Bench_Scratch_Start_Addr);
+	FLASHErase_Page(Bench_Scratch_Start_Addr + Boot_page_size_in_bytes);
+
+	if (NVM_error_counter != NVM_errors_before) {
+		bench_error = Boot_Error_NVM;
+	} else {
+		//do nothing
+	}
+
+	payload_ptr[0] = Bench_rounds;
+	for (uint8_t i = 0; i < 3; i++) {
+		BenchPutLE32(&payload_ptr[1 + (8 * i)], bench_min_us[i]);
+		BenchPutLE32(&payload_ptr[5 + (8 * i)], bench_max_us[i]);
+	}
+
+	return bench_error;
+}
+
+
+//2)Rx benchmark reset
+void BenchRxReset (void) {
+	Bench_Rx_pages = 0;
+	Bench_Rx_bad_pages = 0;
+	Bench_Rx_first_page_time = 0;
+	Bench_Rx_last_page_time = 0;
+}
+
+
+//3)Rx benchmark page check
+/*
+ * We check one page of the Rx benchmark against the pattern. Word "w" of page "n" is (n << 16) | (w << 8) | 0x5A, sent LSB first.
+ * The time a page is taken out of the Rx ring is its arrival time. Nothing is written to the NVM, so the main loop keeps up with the DMA.
+ *
+ * */
+
+void BenchRxSlotCheck (uint32_t* slot_ptr) {
+
+	Bench_Rx_last_page_time = TIM6Timestamp_us();
+	if (Bench_Rx_pages == 0) {
+		Bench_Rx_first_page_time = Bench_Rx_last_page_time;
+	} else {
+		//do nothing
+	}
+
+	for (uint8_t i = 0; i < Boot_page_size_in_words; i++) {
+		if (slot_ptr[i] != BenchPattern(Bench_Rx_pages, i)) {
+			Bench_Rx_bad_pages++;
+			break;
+		} else {
+			//do nothing
+		}
+	}
+
+	Bench_Rx_pages++;
+}
+
+
+//4)Rx benchmark result
+/*
+ * We send the result of the Rx benchmark to the master (ACK, Bench_Rx_report_size_in_bytes long).
+ * The payload is the number of pages checked, the number of pages that did not match the pattern, the number of pages overwritten in the Rx ring (2 bytes each, LSB first)
+ * and the time between the first and the last page in us (4 bytes, LSB first).
+ * The master calculates the rate from the time it took the DMA to bring in all the pages but the first.
+ *
+ * */
+
+void BenchRxReport (void) {
+
+	uint8_t response_payload[Bench_Rx_report_size_in_bytes];
+
+	response_payload[0] = Bench_Rx_pages & 0xFF;
+	response_payload[1] = Bench_Rx_pages >> 8;
+	response_payload[2] = Bench_Rx_bad_pages & 0xFF;
+	response_payload[3] = Bench_Rx_bad_pages >> 8;
+	response_payload[4] = Rx_ring_overflow_counter & 0xFF;
+	response_payload[5] = Rx_ring_overflow_counter >> 8;
+	BenchPutLE32(&response_payload[6], Bench_Rx_last_page_time - Bench_Rx_first_page_time);
+
+	if ((Bench_Rx_bad_pages == 0) && (Rx_ring_overflow_counter == 0)) {
+		UART1TxResponse(UART_response_ack, response_payload, Bench_Rx_report_size_in_bytes);
+	} else {
+		UART1TxResponse(UART_response_nack, response_payload, Bench_Rx_report_size_in_bytes);
+	}
+}
+
+
+//5)Scratch check
+/*
+ * The scratch pages are free if there is no app in their slot, if the committed app of the slot ends below them, or if an update of the slot has not been committed yet.
+ * An app without an app header has an unknown length. We assume it fills the slot.
+ *
+ * Note: the app in the slot may not be the active one. It is still kept, it is what a rollback goes back to.
+ * Note: an uncommitted update is overwritten. The external controller drops its running CRC and its checkpoint before the benchmark, so a commit reads the FLASH back and fails if the update reached into them.
+ *
+ * */
+
+static enum_Yes_No_Selector BenchScratchIsFree (void) {
+
+	uint8_t scratch_slot = (Bench_Scratch_Start_Addr - App_Section_Start_Addr) / App_slot_size_in_bytes;
+	uint32_t* App_header_ptr = (uint32_t*)AppSlotHeaderAddr(scratch_slot);
+
+	if (AppIsValid(scratch_slot) == No) {
+		return Yes;
+	} else if (App_header_ptr[0] != App_header_magic) {
+		return No;
+	} else if (App_header_ptr[1] == App_header_length_invalid) {
+		return Yes;
+	} else if ((AppSlotStartAddr(scratch_slot) + App_header_ptr[1]) <= Bench_Scratch_Start_Addr) {
+		return Yes;
+	} else {
+		return No;
+	}
+}
+
+
+//6)Benchmark pattern
+static uint32_t BenchPattern (uint16_t page, uint8_t word) {
+	return (((uint32_t)page) << 16) | (((uint32_t)word) << 8) | 0x5A;
+}
+
+
+//7)Little endian payload
+static void BenchPutLE32 (uint8_t* payload_ptr, uint32_t value) {
+	payload_ptr[0] = value & 0xFF;
+	payload_ptr[1] = (value >> 8) & 0xFF;
+	payload_ptr[2] = (value >> 16) & 0xFF;
+	payload_ptr[3] = value >> 24;
+}
@@ -0,0 +1,42 @@
+/*
+ *  Created on: 14 Oct 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_Bootloader
+ *  Processor: STM32L053R8
+ *  Header version: 1.0
+ *  File: BootBenchmark.h
+ *  Modified from: N/A
+ *  Change history: N/A
+ */
+
+#ifndef INC_BOOTBENCHMARK_CUSTOM_H_
+#define INC_BOOTBENCHMARK_CUSTOM_H_
+
+#include "stdint.h"
+#include "main.h"
+#include "BootAppManager.h"
+#include "BootClockDriver_STM32L0x3.h"
+#include "BootNVMDriver_STM32L0x3.h"
+#include "BootUARTDriver_STM32L0x3.h"
+
+//LOCAL CONSTANT
+#define Bench_scratch_size_in_pages 2
+static const uint32_t Bench_Scratch_Start_Addr = Boot_FLASH_end_addr - (Bench_scratch_size_in_pages * Boot_page_size_in_bytes);	//the NVM benchmark runs on the last two pages of the app section
+																			//Note: an app that reaches into these pages blocks the benchmark
+#define Bench_rounds 4														//how many times we erase and write the scratch pages
+#define Bench_NVM_report_size_in_bytes 25
+#define Bench_Rx_report_size_in_bytes 10
+
+//LOCAL VARIABLE
+
+//EXTERNAL VARIABLE
+extern volatile uint16_t Rx_ring_overflow_counter;
+extern volatile uint16_t NVM_error_counter;
+
+//FUNCTION PROTOTYPES
+uint8_t BenchNVMRun (uint8_t* payload_ptr);
+void BenchRxReset (void);
+void BenchRxSlotCheck (uint32_t* slot_ptr);
+void BenchRxReport (void);
+
+#endif /* INC_BOOTBENCHMARK_CUSTOM_H_ */
@@ -0,0 +1,91 @@
+/*
+ *  Created on: 14 Oct 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_Bootloader
+ *  Processor: STM32L053R8
+ *  Program version: 1.0
+ *  File: BootCRCDriver_STM32L0x3.c
+ *  Modified from: N/A
+ *  Change history:
+ *
+ * Code holds the hardware CRC driver for the bootloader.
+ *
+ * v.1.0
+ * CRC32 (same as zlib/Ethernet) calculated with the CRC peripheral.
+ * The calculation can be stopped and continued later, so we can run more than one CRC at the same time (e.g. a page CRC and an image CRC).
+ *
+ */
+
+#include "BootCRCDriver_STM32L0x3.h"
+
+
+//1)CRC init
+void CRCInit (void) {
+	/*
+	 * We set up the CRC peripheral for CRC32.
+	 *
+	 * 1)Enable the clocking
+	 * 2)Set the polynomial and the bit order
+	 *
+	 * Note: the CRC32 is calculated LSB first. The input words are thus reversed bit by bit (REV_IN). A word read from memory then gives the same CRC as its 4 bytes one after the other.
+	 * Note: the output is NOT reversed (REV_OUT). This way the DR holds the raw state of the calculation, which can be written back into INIT to continue the calculation later.
+	 * 			The reversal and the final XOR are done in software (see CRCFinal).
+	 *
+	 * */
+
+	//1)
+	RCC->AHBENR |= (1<<12);														//CRC clock enabled
+
+	//2)
+	CRC->POL = 0x04C11DB7;														//CRC32 polynomial - this is the reset value anyway
+	CRC->CR = (3<<5);															//32 bit polynomial, input reversed by word, output not reversed
+}
+
+
+//2)CRC calculation
+uint32_t CRCCalculate (uint32_t crc_state, uint32_t* data_ptr, uint16_t data_length_in_words) {
+	/*
+	 * We continue a CRC calculation from "crc_state" over a number of words and give back the new state.
+	 * A new calculation starts from CRC_start_state.
+	 *
+	 * 1)Load the state into the peripheral
+	 * 2)Feed the words
+	 * 3)Read out the new state
+	 *
+	 * Note: the data can be in FLASH or in RAM.
+	 * Note: the state is not the CRC itself. Use CRCFinal to get the CRC.
+	 *
+	 * */
+
+	//1)
+	CRC->INIT = crc_state;
+	CRC->CR |= (1<<0);															//RESET - the INIT value is loaded into the DR
+
+	//2)
+	for (uint16_t i = 0; i < data_length_in_words; i++) {
+		CRC->DR = data_ptr[i];
+	}
+
+	//3)
+	return CRC->DR;
+}
+
+
+//3)CRC final value
+uint32_t CRCFinal (uint32_t crc_state) {
+	/*
+	 * We turn the state of a calculation into the CRC32 value by reversing its bits and inverting it.
+	 *
+	 * Note: the M0+ core does not have a bit reversal instruction.
+	 *
+	 * */
+
+	uint32_t crc_value = 0;
+
+	for (uint8_t i = 0; i < 32; i++) {
+		crc_value = (crc_value << 1) | (crc_state & 1);
+		crc_state = crc_state >> 1;
+	}
+
+	return crc_value ^ 0xFFFFFFFF;
+}
@@ -0,0 +1,31 @@
+/*
+ *  Created on: 14 Oct 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_Bootloader
+ *  Processor: STM32L053R8
+ *  Header version: 1.0
+ *  File: BootCRCDriver_STM32L0x3.h
+ *  Modified from: N/A
+ *  Change history: N/A
+ */
+
+#ifndef INC_BOOTCRCDRIVER_CUSTOM_H_
+#define INC_BOOTCRCDRIVER_CUSTOM_H_
+
+#include "stdint.h"
+#include "main.h"
+#include "stm32l053xx.h"
+
+//LOCAL CONSTANT
+static const uint32_t CRC_start_state = 0xFFFFFFFF;							//the starting state of a CRC32 calculation
+
+//LOCAL VARIABLE
+
+//EXTERNAL VARIABLE
+
+//FUNCTION PROTOTYPES
+void CRCInit (void);
+uint32_t CRCCalculate (uint32_t crc_state, uint32_t* data_ptr, uint16_t data_length_in_words);
+uint32_t CRCFinal (uint32_t crc_state);
+
+#endif /* INC_BOOTCRCDRIVER_CUSTOM_H_ */
@@ -15,6 +15,20 @@
  * Added a TIM2 based timer with an IRQ at every second.
  *
  *
+ *v.1.1
+ * TIM6 is left free running and extended to a 32 bit microsecond timestamp by its update IRQ. The timestamps are used by the pipeline timing probes (see BootProfiler).
+ * The microsecond delay does not reset the TIM6 counter anymore. The millisecond delay calls the microsecond delay we actually have.
+ *
+ *v.1.2
+ * Only the peripherals the bootloader needs stay clocked while the core sleeps. SysTick is stopped once the HAL init is done.
+ *
+ *v.1.3
+ * TIM2 deinit stops the timer instead of enabling it and clears a pending TIM2 IRQ.
+ *
+ *v.1.4
+ * TIM2 init loads the prescaler with an update event (UG), the counter counts milliseconds from the start.
+ *
+ *
  * Note: for simple bootloader action, only TIM6 and TIM2 (as a timer) are used only.
  * Note: TIM2 PWM is currently not planed for the bootloader. If this is to change, boot_TIM2 should be merged with TIM22.
  *
@@ -23,6 +37,9 @@
 #include "BootClockDriver_STM32L0x3.h"
 #include "stm32l053xx.h"														//device specific header file for registers
 
+
+static volatile uint16_t TIM6_overflow_counter = 0;										//upper 16 bits of the microsecond timestamp, stepped by the TIM6 update IRQ
+
 //1)We set up the core clock and the peripheral prescalers/dividers
 void SysClockConfig(void) {
 	/**
@@ -99,6 +116,9 @@ void TIM6Config (void) {
 	 * 1)Enable TIM6 clocking
 	 * 2)Set prescaler and ARR
 	 * 3)Enable timer and wait for update flag
+	 * 4)Enable the update IRQ that counts the overflows of the timer
+	 *
+	 * Note: the timer is never stopped or reset afterwards. Delays and timestamps are both taken as differences of the free running counter.
 	 **/
 
 	//1)
@@ -106,7 +126,7 @@ void TIM6Config (void) {
 
 	//2)
 
-	TIM6->PSC = 16 - 1;															// 16 MHz/16 = 1 MHz -- 1 us delay
+	TIM6->PSC = (Boot_TIM_clock_in_Hz / 1000000) - 1;							// 16 MHz/16 = 1 MHz -- 1 us delay
 																				// Note: the timer has a prescaler, but so does APB1!
 																				// Here APB1 PCLK is 16 MHz
 
@@ -119,24 +139,31 @@ void TIM6Config (void) {
 																				//This part is necessary since we can update on the fly. We just need to wait until we are done with a counting cycle and thus an update event has been generated.
 																				//also, almost everything is preloaded before it takes effect
 																				//update events can be disabled by writing to the UDIS bits in CR1. UDIS as LOW is UDIS ENABLED!!!s
+
+	//4)
+	TIM6->SR &= ~(1<<0);														//we clear the update flag we have waited for
+	TIM6->DIER |= (1<<0);														//update interrupt enabled - the counter overflows every 65.536 ms
 }
 
 
 //3) Delay function for microseconds
 void Delay_us(int micro_sec) {
 	/**
-	 * 1)Reset counter for TIM6
-	 * 2)Wait until micro_sec
+	 * 1)Take the current value of the TIM6 counter
+	 * 2)Wait until micro_sec has passed since then
+	 *
+	 * Note: the counter is not reset, the timestamps (see below) rely on it running freely. The delay must be shorter than 65535 us.
 	 **/
-	TIM6->CNT = 0;
-	while(TIM6->CNT < micro_sec);												//Note: this is a blocking timer counter!
+	uint16_t delay_start = TIM6->CNT;
+	while((uint16_t)(TIM6->CNT - delay_start) < micro_sec);					//Note: this is a blocking timer counter!
+																				//Note: the 16 bit subtraction takes care of the counter wrapping around
 }
 
 
 //4) Delay function for milliseconds
 void Delay_ms(int milli_sec) {
 	for (uint32_t i = 0; i < milli_sec; i++){
-		Delay_us_custom(1000);													//we call the custom microsecond delay for 1000 to generate a delay of 1 millisecond
+		Delay_us(1000);														//we call the custom microsecond delay for 1000 to generate a delay of 1 millisecond
 	}
 }
 
@@ -155,13 +182,14 @@ void BootTIM2_INT (void) {
 
 	//2)
 
-	TIM2->PSC = 16000 - 1;														// 16 MHz/16000 = 1 kHz -- 1 ms delay
+	TIM2->PSC = (Boot_TIM_clock_in_Hz / 1000) - 1;								// 16 MHz/16000 = 1 kHz -- 1 ms delay
 																				//Note: we can't use the same PSC as with TIM21 since it is still too fast that way to reach 500 ms.
 
 	TIM2->ARR = TIM2_timer_interrupt;											//We want to count until 2999 only
 
 	//3)
 	TIM2->CR1 |= (1<<2);														//we want a trigger only when overflow happens
+	TIM2->EGR |= (1<<0);														//UG loads the prescaler now, so the first period counts milliseconds too (the sniff window relies on it)
 	TIM2->DIER |= (1<<0);														//update interrupt enabled. The SR registers's bit [0] will have the flag for this interrupt.
 
 	TIM2->CR1 |= (1<<0);														//timer counter enable bit
@@ -172,7 +200,97 @@ void BootTIM2_INT (void) {
 //6) TIM2 full deinit function
 void BootTIM2_DEINT (void) {
 	TIM2->CNT = 0;																//reset counter
-	TIM2->CR1 |= (1<<0);														//we shut off the TIM2 timer - used to transition to the app upon timeout
+	TIM2->CR1 &= ~(1<<0);														//we shut off the TIM2 timer - used to transition to the app upon timeout
 	NVIC_DisableIRQ(TIM2_IRQn);													//we disable the TIM2 IRQ
 	TIM2->SR &= ~(1<<0);														//we clear the TIM2 IRQ trigger flag
+	NVIC_ClearPendingIRQ(TIM2_IRQn);											//an update that came in before the IRQ was disabled must not fire later
+}
+
+
+//7) TIM6 timestamp
+BOOT_RAM_FUNC uint32_t TIM6Timestamp_us(void) {
+	/**
+	 * We give back the microseconds since TIM6 has been started on 32 bits. The value wraps around after about 71 minutes.
+	 * The lower 16 bits are the TIM6 counter, the upper 16 bits are the overflows counted by the TIM6 update IRQ.
+	 *
+	 * 1)We read the overflow counter and the timer counter with the IRQs off
+	 * 2)If the timer has overflown, but the IRQ hasn't counted it yet, we count it here and read the counter again
+	 *
+	 * Note: the function runs from RAM. It is called from the DMA and the FLASH IRQs while the NVM is busy.
+	 * Note: an overflow is lost if the TIM6 IRQ is blocked for longer than 65 ms.
+	 **/
+
+	//1)
+	uint32_t irq_mask_state = __get_PRIMASK();
+	__disable_irq();
+	uint16_t overflows = TIM6_overflow_counter;
+	uint16_t counter = TIM6->CNT;
+
+	//2)
+	if ((TIM6->SR & (1<<0)) == (1<<0)) {										//the timer has wrapped around, the IRQ is still pending
+		overflows++;
+		counter = TIM6->CNT;													//we read again, the counter may have been read just before the wrap
+	} else {
+		//do nothing
+	}
+	__set_PRIMASK(irq_mask_state);
+
+	return (((uint32_t)overflows) << 16) | counter;
+}
+
+
+//8) TIM6 IRQ
+BOOT_RAM_FUNC void TIM6_DAC_IRQHandler(void) {
+	/**
+	 * We count the overflows of TIM6 for the timestamp.
+	 * Note: the IRQ runs from RAM so it is served while the NVM is busy.
+	 **/
+	if ((TIM6->SR & (1<<0)) == (1<<0)) {
+		TIM6->SR &= ~(1<<0);													//we clear the update flag
+		TIM6_overflow_counter++;
+	} else {
+		//do nothing
+	}
+}
+
+
+//9) TIM6 IRQ priority
+void TIM6IRQPriorEnable(void) {
+	NVIC_SetPriority(TIM6_DAC_IRQn, 0);											//highest priority, the IRQ is short and must not miss an overflow
+	NVIC_EnableIRQ(TIM6_DAC_IRQn);
+}
+
+
+//10) Sleep mode clocking
+void BootSleepConfig(void) {
+	/**
+	 * The bootloader spends most of its time asleep, waiting for the next IRQ (see BOOT_SLEEP_WHILE). We cut the power it takes while it waits.
+	 *
+	 * 1)Only the peripherals that wake us up or run in the background keep their clock in Sleep mode: the DMA, the SRAM, the NVM interface, UART1, UART2, TIM2, TIM6 and GPIOA.
+	 * 2)We stop the SysTick IRQ. It would wake us up every ms, and nothing waits for it after the HAL init.
+	 *
+	 * Note: Stop mode would cut even more, but the DMA does not run in Stop mode and the PLL would have to be restarted on every wake-up. The command capture and the Rx ring rely on the DMA.
+	 * Note: a debugger loses the core while it sleeps, unless DBG_SLEEP is set in DBGMCU->CR.
+	 **/
+
+	//1)
+	RCC->AHBSMENR = (1<<0) | (1<<8) | (1<<9);									//DMA, NVM interface and SRAM
+	RCC->APB2SMENR = (1<<14);													//USART1
+	RCC->APB1SMENR = (1<<0) | (1<<4) | (1<<17);									//TIM2, TIM6 and USART2
+	RCC->IOPSMENR = (1<<0);														//GPIOA (UART1 and UART2 pins)
+
+	//2)
+	SysTick->CTRL &= ~((1<<1) | (1<<0));										//TICKINT and ENABLE
+}
+
+
+//11) Sleep mode clocking deinit
+void BootSleepDeinit(void) {
+	/**
+	 * We hand the clocks in Sleep mode over to the app as they are after reset.
+	 **/
+	RCC->AHBSMENR = 0x01111301;													//reset values (see the refman)
+	RCC->APB2SMENR = 0x00405225;
+	RCC->APB1SMENR = 0xB8E64A11;
+	RCC->IOPSMENR = 0x0000008F;
 }
@@ -13,6 +13,7 @@
 #define INC_BOOTRCCTIMPWMDELAY_CUSTOM_H_
 
 #include "stdint.h"
+#include "main.h"
 
 //LOCAL CONSTANT
 //constant for the seconds counter (sets the TIM2 IRQ)
@@ -25,5 +26,12 @@ void Delay_us(int micro_sec);
 void Delay_ms(int milli_sec);
 void BootTIM2_INT (void);
 void BootTIM2_DEINT (void);
+void TIM6IRQPriorEnable(void);
+void BootSleepConfig(void);
+void BootSleepDeinit(void);
+
+//Note: the functions below run from RAM, not FLASH! They are called from IRQs that are served while the NVM is busy.
+BOOT_RAM_FUNC uint32_t TIM6Timestamp_us(void);
+BOOT_RAM_FUNC void TIM6_DAC_IRQHandler(void);
 
 #endif /* BOOTRCCTIMPWMDELAY_CUSTOM_H_ */
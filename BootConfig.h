@@ -0,0 +1,147 @@
+/*
+ *  Created on: 14 Oct 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_Bootloader
+ *  Processor: STM32L053R8
+ *  Header version: 1.0
+ *  File: BootConfig.h
+ *  Modified from: N/A
+ *  Change history: N/A
+ */
+
+#ifndef INC_BOOTCONFIG_CUSTOM_H_
+#define INC_BOOTCONFIG_CUSTOM_H_
+
+/*
+ * This is the profile of the bootloader: the memory map of the part, the size of the buffers and the clocking of the link.
+ * Everything else (app slots, headers, descriptors, BRR values) is derived from these values.
+ *
+ * Every value can be overridden from the build (e.g. -DRx_ring_depth_in_pages=16) or from a product header (e.g. -DBOOT_CONFIG_PROFILE=\"BootConfig_L072.h\").
+ * The profile is checked at compile time, so a port that doesn't fit fails to build instead of failing on a board.
+ *
+ * Note: these are defines, not static consts, since they set array sizes and are checked by the preprocessor
+ * Note: the linker files of the boot and the app must follow the memory map defined here
+ *
+ * */
+
+#ifdef BOOT_CONFIG_PROFILE
+#include BOOT_CONFIG_PROFILE
+#endif
+
+//1)NVM geometry
+#ifndef Boot_page_size_in_bytes
+#define Boot_page_size_in_bytes 128											//smallest erasable unit of the FLASH (128 bytes on the STM32L0x3)
+#endif
+#define Boot_page_size_in_words (Boot_page_size_in_bytes / 4)
+#define Boot_half_page_size_in_words (Boot_page_size_in_words / 2)			//the FLASH is programmed in half-page bursts
+
+//2)Memory map
+#ifndef Boot_FLASH_start_addr
+#define Boot_FLASH_start_addr 0x08000000									//the boot section starts at the start of the FLASH
+#endif
+#ifndef Boot_FLASH_end_addr
+#define Boot_FLASH_end_addr 0x08010000										//end of the FLASH on the STM32L053R8 (64 kbytes)
+#endif
+#ifndef App_section_start_addr
+#define App_section_start_addr 0x08008000									//the boot section takes up the first 32 kbytes, the app section the rest
+#endif
+#ifndef App_slot_count
+#define App_slot_count 2													//the app section is split into this many slots (A and B)
+#endif
+#ifndef Boot_EEPROM_start_addr
+#define Boot_EEPROM_start_addr 0x08080000
+#endif
+#ifndef Boot_EEPROM_size_in_bytes
+#define Boot_EEPROM_size_in_bytes 0x800										//2 kbytes of data EEPROM on the STM32L053R8
+#endif
+#ifndef Boot_RAM_start_addr
+#define Boot_RAM_start_addr 0x20000000
+#endif
+#ifndef Boot_RAM_size_in_bytes
+#define Boot_RAM_size_in_bytes 0x2000										//8 kbytes of RAM on the STM32L053R8
+#endif
+#define Boot_stack_top_addr (Boot_RAM_start_addr + Boot_RAM_size_in_bytes)	//the initial stack pointer of the boot and of the apps - the top of the RAM
+#ifndef Boot_unique_ID_addr
+#define Boot_unique_ID_addr 0x1FF80050										//96 bit unique ID of the part - words at +0x00, +0x04 and +0x14 on the STM32L0
+#endif
+
+//3)Buffers
+#ifndef Rx_ring_depth_in_pages
+#define Rx_ring_depth_in_pages 8											//number of FLASH pages the Rx ring buffer can hold
+																			//Note: must be even - the DMA HT and TC IRQs hand over the ring in two halves
+																			//Note: 16 pages of 128 bytes take up 2 kbytes of the 8 kbytes of RAM
+#endif
+#define Rx_ring_slot_max_size_in_words (Boot_page_size_in_words + 2)		//one slot holds a page and - in addressed mode - a one word header and a one word CRC
+#define Rx_Message_buf_size_in_words (Rx_ring_slot_max_size_in_words * Rx_ring_depth_in_pages)
+
+#ifndef Rx_Command_buf_size_in_bytes
+#define Rx_Command_buf_size_in_bytes 64										//a command and its arguments, without the start sequence
+#endif
+#ifndef Cmd_frame_queue_depth
+#define Cmd_frame_queue_depth 4												//number of command frames the UART1 IRQ can log before they are picked up
+#endif
+#ifndef UART1_Tx_buf_size_in_bytes
+#define UART1_Tx_buf_size_in_bytes 128										//responses waiting to be sent by the DMA on UART1 Tx
+#endif
+#ifndef UART2_Log_buf_size_in_bytes
+#define UART2_Log_buf_size_in_bytes 512										//text log waiting to be sent by the DMA on UART2 Tx
+#endif
+
+//4)Clocking and link
+#ifndef Boot_SYSCLK_in_Hz
+#define Boot_SYSCLK_in_Hz 32000000											//HSI16 through the PLL (see SysClockConfig)
+#endif
+#ifndef Boot_APB2_clock_in_Hz
+#define Boot_APB2_clock_in_Hz 16000000										//SYSCLK divided by 2 - clocks the UART1 up to 460800 baud
+#endif
+#ifndef Boot_TIM_clock_in_Hz
+#define Boot_TIM_clock_in_Hz 16000000										//clock of TIM2 and TIM6
+#endif
+#ifndef Boot_UART1_boot_baud_rate
+#define Boot_UART1_boot_baud_rate Baud_57600								//the baud rate the bootloader starts at
+#endif
+#ifndef Boot_UART1_RS485_DE
+#define Boot_UART1_RS485_DE 0												//set to 1 to drive the driver enable of an RS-485 transceiver from PA12 (USART1_DE)
+#endif
+
+#define BOOT_UART_BRR(clock_in_Hz, baud) ((((clock_in_Hz) + ((baud) / 2)) / (baud)))	//BRR for an oversampling of 16, rounded to the nearest value
+
+//5)Image authentication
+#ifndef Boot_image_auth_enable
+#define Boot_image_auth_enable 0											//set to 1 to only commit apps that carry a valid HMAC-SHA256 tag (see BootImageAuth.c)
+#endif
+																			//Note: the key is a 32 byte initializer, e.g. -DBoot_image_auth_key="{0x3a, 0x91, ...}". There is no default key.
+																			//Note: the key sits in the boot section. The FLASH must be read protected (RDP level 1 or 2) for it to stay secret.
+
+//6)Checks
+_Static_assert((Boot_page_size_in_bytes >= 64) && ((Boot_page_size_in_bytes & (Boot_page_size_in_bytes - 1)) == 0), "the page size must be a power of 2, at least 64 bytes");
+_Static_assert((Boot_page_size_in_words % 2) == 0, "a page must be made of two half-pages");
+_Static_assert(Boot_page_size_in_bytes <= 255 * 4, "a page must fit into the 8 bit slot size of the Rx ring");
+
+_Static_assert((App_section_start_addr % Boot_page_size_in_bytes) == 0, "the app section must start on a page");
+_Static_assert((Boot_FLASH_end_addr % Boot_page_size_in_bytes) == 0, "the FLASH must end on a page");
+_Static_assert(App_section_start_addr - (App_slot_count * Boot_page_size_in_bytes) > Boot_FLASH_start_addr, "the app headers must fit into the boot section");
+_Static_assert(((Boot_FLASH_end_addr - App_section_start_addr) % (App_slot_count * Boot_page_size_in_bytes)) == 0, "the app section must split into slots of whole pages");
+_Static_assert((App_slot_count >= 1) && (App_slot_count <= 255), "the slot index must fit into one byte");
+_Static_assert((Boot_stack_top_addr % 8) == 0, "the stack pointer must be 8 byte aligned");
+
+_Static_assert(((Rx_ring_depth_in_pages % 2) == 0) && (Rx_ring_depth_in_pages >= 2), "Rx_ring_depth_in_pages must be an even number, at least 2");
+_Static_assert((Rx_Message_buf_size_in_words * 4) <= 0xFFFF, "the Rx ring must fit into one DMA transfer (16 bit counter)");
+_Static_assert((Rx_Message_buf_size_in_words * 4) <= (Boot_RAM_size_in_bytes / 2), "the Rx ring must leave at least half of the RAM free");
+_Static_assert((Cmd_frame_queue_depth & (Cmd_frame_queue_depth - 1)) == 0, "Cmd_frame_queue_depth must be a power of 2 - the 8 bit frame counters wrap around");
+//Note: the Tx and log rings wrap with a modulo in IRQs running from RAM - a size that is not a power of 2 calls the division routine in the FLASH
+_Static_assert((UART1_Tx_buf_size_in_bytes & (UART1_Tx_buf_size_in_bytes - 1)) == 0, "UART1_Tx_buf_size_in_bytes must be a power of 2");
+_Static_assert((UART2_Log_buf_size_in_bytes & (UART2_Log_buf_size_in_bytes - 1)) == 0, "UART2_Log_buf_size_in_bytes must be a power of 2");
+_Static_assert((Rx_Command_buf_size_in_bytes >= 16) && (Rx_Command_buf_size_in_bytes <= 255), "the command buffer must hold a commit and fit into an 8 bit length");
+#if Boot_image_auth_enable
+#ifndef Boot_image_auth_key
+#error "image authentication needs a key (Boot_image_auth_key)"
+#endif
+_Static_assert(Rx_Command_buf_size_in_bytes >= 35, "the command buffer must hold an image tag with a node address");
+#endif
+
+_Static_assert(BOOT_UART_BRR(Boot_APB2_clock_in_Hz, 460800) >= 16, "APB2 is too slow for 460800 baud");
+_Static_assert(BOOT_UART_BRR(Boot_SYSCLK_in_Hz, 1000000) >= 16, "SYSCLK is too slow for 1000000 baud");
+_Static_assert((Boot_TIM_clock_in_Hz % 1000000) == 0, "the timer clock must be a multiple of 1 MHz for the us timestamps");
+
+#endif /* INC_BOOTCONFIG_CUSTOM_H_ */
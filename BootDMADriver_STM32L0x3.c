@@ -15,6 +15,14 @@
  * It initialises the seven DMA channels according to page 263 of the refman.
  * Currently runs only the UART1 Rx on Channel3.
  *
+ * v.1.1
+ * UART1 Rx channel runs in circular mode. No restart is necessary after TC.
+ * Added a function to read out the position of the DMA within the Rx buffer.
+ *
+ * v.1.2
+ * Added the UART1 Tx on Channel2 for the responses to the master.
+ * Added the UART2 Tx on Channel4 for the text log.
+ *
  */
 
 #include "BootDMADriver_STM32L0x3.h"
@@ -35,6 +43,8 @@ void BootDMAInit(void){
 
 	//2)
 	DMA1_CSELR->CSELR |= (3<<8);												//DMA1_Channel3: will be requested at 4'b0011 for UARI1_RX
+	DMA1_CSELR->CSELR |= (3<<4);												//DMA1_Channel2: will be requested at 4'b0011 for UARI1_TX
+	DMA1_CSELR->CSELR |= (4<<12);												//DMA1_Channel4: will be requested at 4'b0100 for UART2_TX
 }
 
 
@@ -48,17 +58,22 @@ void DMAChannelUART1RxConfig(uint32_t mem_addr_UART1_Rx){
 	 * 4)Provide transfer width
 	 *
 	 * Note: transfer width is in bytes since we have 8-bit words!
+	 * Note: the memory side must stay 8 bits as well. The L0 DMA does not pack bytes into words - with a 32 bit memory side, every byte would be written as a word of its own.
+	 * 		The buffer is still a word array. The ring slots are whole words long, so the pages in them are word aligned and the half-page writes read them straight from the buffer.
+	 * Note: the channel runs in circular mode. Once CNDTR reaches zero, it is reloaded by hardware and the DMA continues from the start of the buffer.
+	 * Note: with circular mode, the HT and TC interrupts only tell us which half of the buffer is ready. Nothing needs to be reset in the IRQ.
 	 *
 	 */
 	//1)
 	DMA1_Channel3->CCR &= ~(1<<0);												//we disable this DMA channel, if it is activated
+	DMA1->IFCR |= (1<<8);														//we remove any interrupt flag left over from a previous transfer
 
 	//2)
 	DMA1_Channel3->CCR |= (1<<1);												//we enable the transfer complete interrupt within the DMA channel
 	DMA1_Channel3->CCR |= (1<<2);												//we enable the half-transfer interrupt within the DMA channel
 	DMA1_Channel3->CCR |= (1<<3);												//we enable the error interrupt within the DMA channel
 	DMA1_Channel3->CCR &= ~(1<<4);												//we read from the peripheral
-																				//circular mode is off - we will use the IRQ to restart the DMA after TC
+	DMA1_Channel3->CCR |= (1<<5);												//circular mode is on - the DMA wraps around to the start of the buffer after TC without any intervention
 	DMA1_Channel3->CCR &= ~(1<<6);												//peripheral increment is not used - we have just the RDR register to read from
 	DMA1_Channel3->CCR |= (1<<7);												//memory increment is used
 	DMA1_Channel3->CCR &= ~(3<<8);												//peri side data length is 8 bits - we have 8 bit words
@@ -72,6 +87,108 @@ void DMAChannelUART1RxConfig(uint32_t mem_addr_UART1_Rx){
 	DMA1_Channel3->CMAR = mem_addr_UART1_Rx;									//this is the address (!) of the memory buffer we want to funnel data into
 
 	//4)
-	DMA1_Channel3->CNDTR |= ((DMA_transfer_width_UART1)<<0);					//we want to have an element burst of "DMA_transfer_width_UART1"
+	DMA1_Channel3->CNDTR = ((DMA_transfer_width_UART1)<<0);					//we want to have an element burst of "DMA_transfer_width_UART1"
 																				//transfer_width_UART1 is set in bytes (!)
+																				//Note: we overwrite the register instead of OR-ing to it. A previous, interrupted transfer may have left a residual value in it.
+}
+
+
+//3)We check, where the UART1 Rx channel is within the Rx buffer
+uint16_t DMAChannelUART1RxPosition(void){
+	/* Gives back the number of bytes the DMA has loaded into the buffer since it has last wrapped around
+	 *
+	 * 1)Read out the remaining transfer width
+	 * 2)Calculate the position from the full transfer width
+	 *
+	 * Note: CNDTR counts down from the transfer width. It is reloaded at TC when the channel is in circular mode.
+	 * Note: the value is only stable if the channel is disabled or the bus is idle.
+	 *
+	 */
+	//1)
+	uint16_t remaining_transfer_width = DMA1_Channel3->CNDTR;
+
+	//2)
+	return (DMA_transfer_width_UART1 - remaining_transfer_width);
+}
+
+
+//4)We set up a channel for the UART1 Tx
+void DMAChannelUART1TxConfig(void){
+	/* Configure the DMA channel for UART1 Tx - channel2
+	 *
+	 * 1)Ensure that the channel is disabled
+	 * 2)Configure channel parameters: transfer direction (mem-to-peri), address increment, normal mode
+	 * 3)Provide the peri address
+	 *
+	 * Note: the memory address and the transfer width are given every time we send something (see DMAChannelUART1TxStart).
+	 *
+	 */
+	//1)
+	DMA1_Channel2->CCR &= ~(1<<0);												//we disable this DMA channel, if it is activated
+	DMA1->IFCR |= (1<<4);														//we remove any interrupt flag left over
+
+	//2)
+	DMA1_Channel2->CCR |= (1<<1);												//we enable the transfer complete interrupt within the DMA channel
+	DMA1_Channel2->CCR &= ~(1<<2);												//no half-transfer interrupt
+	DMA1_Channel2->CCR |= (1<<3);												//we enable the error interrupt within the DMA channel
+	DMA1_Channel2->CCR |= (1<<4);												//we read from the memory
+	DMA1_Channel2->CCR &= ~(1<<5);												//circular mode is off - every transfer is started on its own
+	DMA1_Channel2->CCR &= ~(1<<6);												//peripheral increment is not used - we have just the TDR register to write to
+	DMA1_Channel2->CCR |= (1<<7);												//memory increment is used
+	DMA1_Channel2->CCR &= ~(3<<8);												//peri side data length is 8 bits
+	DMA1_Channel2->CCR &= ~(3<<10);												//mem side data length is 8 bits
+	DMA1_Channel2->CCR |= (1<<12);												//priority level is set as MEDIUM - the Rx channel must win
+
+	//3)
+	DMA1_Channel2->CPAR = (uint32_t) (&(USART1->TDR));							//we want the data to be loaded into the UART's TDR register
+																				//TXE control is not necessary, the DMA waits for it
+}
+
+
+//5)We start a transfer on the UART1 Tx channel
+BOOT_RAM_FUNC void DMAChannelUART1TxStart(uint32_t mem_addr_UART1_Tx, uint16_t transfer_width){
+	/* Send a block of bytes on UART1 Tx
+	 *
+	 * Note: the channel must be done with the previous transfer. CMAR and CNDTR can only be written while the channel is disabled.
+	 * Note: runs from RAM, it is called from the DMA IRQ.
+	 *
+	 */
+	DMA1_Channel2->CCR &= ~(1<<0);
+	DMA1_Channel2->CMAR = mem_addr_UART1_Tx;
+	DMA1_Channel2->CNDTR = transfer_width;
+	DMA1_Channel2->CCR |= (1<<0);												//the DMA starts loading the TDR right away
+}
+
+
+//6)We set up a channel for the UART2 Tx
+void DMAChannelUART2TxConfig(void){
+	/* Configure the DMA channel for UART2 Tx (text log) - channel4
+	 *
+	 * Same setup as the UART1 Tx channel, but with the lowest priority. The log must never hold up the machine code.
+	 *
+	 */
+	DMA1_Channel4->CCR &= ~(1<<0);												//we disable this DMA channel, if it is activated
+	DMA1->IFCR |= (1<<12);														//we remove any interrupt flag left over
+
+	DMA1_Channel4->CCR |= (1<<1);												//we enable the transfer complete interrupt within the DMA channel
+	DMA1_Channel4->CCR &= ~(1<<2);												//no half-transfer interrupt
+	DMA1_Channel4->CCR |= (1<<3);												//we enable the error interrupt within the DMA channel
+	DMA1_Channel4->CCR |= (1<<4);												//we read from the memory
+	DMA1_Channel4->CCR &= ~(1<<5);												//circular mode is off
+	DMA1_Channel4->CCR &= ~(1<<6);												//peripheral increment is not used
+	DMA1_Channel4->CCR |= (1<<7);												//memory increment is used
+	DMA1_Channel4->CCR &= ~(3<<8);												//peri side data length is 8 bits
+	DMA1_Channel4->CCR &= ~(3<<10);												//mem side data length is 8 bits
+	DMA1_Channel4->CCR &= ~(3<<12);												//priority level is set as LOW
+
+	DMA1_Channel4->CPAR = (uint32_t) (&(USART2->TDR));
+}
+
+
+//7)We start a transfer on the UART2 Tx channel
+BOOT_RAM_FUNC void DMAChannelUART2TxStart(uint32_t mem_addr_UART2_Tx, uint16_t transfer_width){
+	DMA1_Channel4->CCR &= ~(1<<0);
+	DMA1_Channel4->CMAR = mem_addr_UART2_Tx;
+	DMA1_Channel4->CNDTR = transfer_width;
+	DMA1_Channel4->CCR |= (1<<0);
 }
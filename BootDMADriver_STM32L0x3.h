@@ -26,5 +26,10 @@ extern uint16_t DMA_transfer_width_UART1;
 //FUNCTION PROTOTYPES
 void BootDMAInit(void);
 void DMAChannelUART1RxConfig(uint32_t mem_addr_UART1_Rx);
+uint16_t DMAChannelUART1RxPosition(void);
+void DMAChannelUART1TxConfig(void);
+BOOT_RAM_FUNC void DMAChannelUART1TxStart(uint32_t mem_addr_UART1_Tx, uint16_t transfer_width);
+void DMAChannelUART2TxConfig(void);
+BOOT_RAM_FUNC void DMAChannelUART2TxStart(uint32_t mem_addr_UART2_Tx, uint16_t transfer_width);
 
 #endif /* INC_BOOTDMADRIVER_CUSTOM_H_ */
@@ -11,27 +11,116 @@
  * v.1.0
  * UART1-based external controller.
  *
+ * v.1.1
+ * Programmer mode drains a multi-page Rx ring instead of a 2 page ping-pong buffer.
+ * Added command 0xbd to erase the app section before the machine code is sent over.
+ * Added command 0xbe to send over only selected pages, each with its own page index.
+ * Added command 0xbf to send over compressed machine code.
+ *
+ * v.1.2
+ * Pages are handed over to the NVM job queue. Ring slots are released once their NVM jobs are done.
+ * The main loop does not stall on the FLASH anymore, it sleeps until the next IRQ if there is nothing to do.
+ *
+ * v.1.3
+ * Addressed pages carry a CRC32. Every addressed page is acknowledged (or not) on UART1 Tx once it is in the FLASH.
+ * The CRC32 of the image is calculated while the pages are written. Added command 0xd1 to commit the image into the app header.
+ *
+ * v.1.4
+ * Windowed transfer of addressed pages. Slots are picked up as soon as they are complete, not only on HT/TC.
+ * Addressed transfers are ended by an end-of-transfer page instead of the idle bus. Added command 0xd2 to publish the transfer parameters.
+ *
+ * v.1.5
+ * NACKs carry an error code. The counters of a transfer are sent to the master in a report on UART1 Tx.
+ * The text log is optional (see BOOT_LOG).
+ *
+ * v.1.6
+ * The pages are timestamped on their way through the Rx ring. Added command 0xd3 to send the timing results to the master.
+ * Added command 0xd4 to run the NVM and the Rx benchmarks.
+ *
+ * v.1.7
+ * The transfer report also carries the HT/TC events missed by the DMA IRQ and the command frames dropped from the frame queue.
+ *
+ * v.1.8
+ * Addressed pages are read from the Rx ring through a typed slot layout. The Rx buffer is not wiped on mode switches anymore, we rely on the ring indices.
+ *
+ * v.1.9
+ * Added command 0xba to send over the app as Intel HEX or S-record text. The records are placed by their address, pages without records are not sent over.
+ *
+ * v.1.10
+ * Updates go into the app slot that is not active (A/B slots). A commit activates the slot. Added command 0xd5 to switch back to the other slot.
+ *
+ * v.1.11
+ * The progress of an update is checkpointed into the EEPROM every few pages. Added command 0xd6 to report the checkpoint and resume the update from it.
+ *
+ * v.1.12
+ * Added command 0xb0 to send a batch of commands in one frame. The commands after a transfer are run once the transfer is over, without a new frame.
+ *
+ * v.1.13
+ * Added command 0xd7 to negotiate a faster baud rate, confirmed by a probe frame. A transfer with too many errors steps the baud rate down by one, announced in the transfer report.
+ *
+ * v.1.14
+ * Programmer mode only goes to sleep if nothing has changed since it last looked at the Rx ring and the NVM job queue. It does not rely on SysTick to catch a missed IRQ anymore.
+ *
+ * v.1.15
+ * Page and slot sizes come from the profile in BootConfig.h instead of being fixed to 128 byte pages.
+ *
+ * v.1.16
+ * Added command 0xd8 to read and configure the node address and to collect the results of a broadcast update per node. Command 0xd2 publishes the node address.
+ *
+ * v.1.17
+ * Added command 0xd9 to send the authentication tag of the image. If image authentication is enabled, a commit needs the tag (see BootImageAuth.c). Command 0xd2 publishes if it is enabled.
+ *
+ * v.1.18
+ * Pages overwritten in the Rx ring are counted by the main loop once the DMA has actually reached them or their FLASH content does not match, not by the DMA IRQ when they are only at risk.
  *
  */
 
 #include "BootExternalController.h"
 
 
+static uint16_t Rx_ring_slot_NVM_job_tag [Rx_ring_depth_in_pages];					//the NVM jobs that must be done before a slot can be released (see NVMJobsDone)
+static uint8_t Rx_ring_slot_error [Rx_ring_depth_in_pages];							//what went wrong with an addressed page (see enum_Boot_Error_Code), sent once its slot is released
+static uint16_t Rx_ring_slot_page_index [Rx_ring_depth_in_pages];					//the index of the addressed page in the slot
+static uint32_t Rx_ring_slot_page_addr [Rx_ring_depth_in_pages];					//where the page of the slot is written from the slot, 0 if it is not (see ProgramRxRingSlotPage)
+static uint32_t Rx_ring_slot_page_crc [Rx_ring_depth_in_pages];						//the CRC32 of the page as it was handed over, checked against the FLASH once the slot is released
+static enum_Yes_No_Selector Rx_ring_slot_overwritten [Rx_ring_depth_in_pages];		//the DMA had reached the page before it was handed over (see RxRingOverrunCheck)
+static uint16_t Rx_ring_checked_pages = 0;											//number of pages that have been checked for an overwrite before their hand-over
+static uint16_t NVM_errors_acknowledged = 0;										//NVM errors that have already been accounted for in a response
+static enum_Yes_No_Selector Addressed_transfer_ended = No;							//the end-of-transfer page has been handed over
+static const uint32_t Record_blank_page [Boot_page_size_in_words] = {0};			//what the pages between two records must hold
+static uint32_t Resume_length_in_bytes = 0;											//where a resumed update carries on (see command 0xd6), 0 for a new update
+static uint32_t Resume_crc_state = 0;												//the running CRC state at that point
+static uint8_t Batch_position = 0;													//the next command of a batch (see command 0xb0) in the command buffer
+static uint8_t Batch_end_position = 0;												//where the batch ends, same as Batch_position if there is no batch to run
+static uint8_t Transfer_report_last [Transfer_report_size_in_bytes];				//the last transfer report, kept for command 0xd8
+static enum_Yes_No_Selector Transfer_report_valid = No;								//a transfer has ended since the start of the bootloader
+static uint32_t Commit_crc_last = 0;												//the CRC the last commit has calculated, kept for command 0xd8
+static uint8_t Commit_error_last = Boot_Error_No_Commit;							//the result of the last commit
+
+_Static_assert(sizeof(struct_Addressed_Page_Slot) == (4 * Rx_ring_slot_max_size_in_words), "an addressed page slot must fill the largest Rx ring slot");
+
+
 //1)UART1 Rx-based external controller
 
 /*
  * Below is a serial-based bootloader controller that expects single commands or full pages of machine code on UART1.
- * Single commands are sent over using a start sequence. Capture is done using polling. We don't use DMA.
+ * Single commands are sent over using a start sequence. Capture is done using DMA, the frames are picked up from the Rx buffer once the bus goes idle.
  * Full pages are sent over without (!) a start sequence. Capture is done using DMA.
  * There is no end sequence for the UART messages. The end-of-message is triggered in both above cases if the bus is idle.
- * In both cases, incoming data is stored in a 64 word (256 bytes) long Rx buffer.
- * In Programmer Mode, the Rx buffer is used as a ping-pong buffer. It is also circularly loaded in case we have more than 2 pages of machine code to load.
+ * The exception is the transfer of addressed pages (command 0xbe). The master keeps a window of pages in flight and waits for their ACKs, so the bus goes idle all the time.
+ * 		The transfer is ended by a page with the index Addressed_page_end_of_transfer instead.
+ * In both cases, incoming data is stored in a multi-page long Rx buffer (see Rx_ring_depth_in_pages).
+ * In Programmer Mode, the Rx buffer is used as a ring buffer. The DMA loads it circularly, the FLASH update takes pages out of it one at a time.
  *
  * Writing to FLASH within this particular iteration is done using half-page write bursts, which is significantly faster than writing word-by-words
+ * The erases and the bursts are put into the NVM job queue and run in the background. A slot in the Rx ring is only released once its jobs are done.
+ *
+ * Commands can also come in a batch (command 0xb0). The commands of the batch are run one by one from the command buffer, as if each had come in its own frame.
+ * 		A command that switches to programmer mode is followed by the transfer. The rest of the batch is run once the transfer is over, so an update with its commit takes a single command frame.
  *
  * The reason why the code is so convoluted is that we don't have a master in UART. Thus the state of the bus must be used to govern, what happens.
  *
- * The code does not have a Tx element on the UART1. The stm32 can not communicate with the partner device. It does communicate with the PC using UART2.
+ * Responses (ACK/NACK and the transfer report) are sent back to the partner device on UART1 Tx by the DMA. The text log goes to the PC using UART2, if it is enabled.
  *
  * */
 
@@ -39,39 +128,241 @@ void UART1_External_Boot_Controller (void) {
 
 	  //Command and Control Mode
 	  if(UART1_DMA_active == No) {														//in C&C Mode, we expect a sequence of bytes (0xF0F0) followed by a command sequence
-		  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//we poll for the starting sequence but do not log it
-		  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//we are NOT using DMA!
+		  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//we look for the starting sequence but do not log it
+
+		  uint8_t* Rx_Message_byte_ptr = Rx_Command_buf;							//commands are single bytes, arguments follow them byte by byte
+		  if (Batch_position != Batch_end_position) {								//we carry on with the batch, no new command frame is needed
+			  Rx_Message_byte_ptr = &Rx_Command_buf[Batch_position];
+			  Batch_position = Batch_position + BatchCommandLength(Rx_Command_buf[Batch_position]);
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the command buffer is only overwritten by the next command frame, which we don't pick up until the batch is over
+		  } else {
+			  UART1RxMessage();													//we call the UART function to pick up the next command frame captured by the DMA
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//this order logs at maximum 64 bytes of incoming UART messages
+		  }
 
-		  UART1RxMessage();														//we call the UART function - no DMA - to scan for a command sequence
-		  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//this order logs at maximum 256 bytes of incoming UART messages
-		  switch (Rx_Message_buf[0]) {
+		  uint8_t command_error = Boot_Error_None;									//a failed command in a batch drops the rest of the batch
+
+		  switch (Rx_Message_byte_ptr[0]) {
 
 		  case 0xaa:																	//activate/jump to app
-			  printf("De-initializing bootloader drivers...\r\n");
-			  UART1Deinit();
-			  printf("Jumping to app...\r\n");
 			  GoToApp();																//we simply jump to the APP and leave the bootloader
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the handoff resets UART1 and the DMA, we stay in the bootloader with both running if there is no app
 			  break;
 
 		  case 0xbb:																	//switch to programmer mode
-			  printf("Update app...\r\n");
-			  memset(Rx_Message_buf, 0, 64);											//wipe the buffer
+			  BOOT_LOG("Update app...\r\n");
+			  ProgrammerModeEnable(Raw_Stream);
+			  break;
 
-			  UART1Deinit();														//we completely deinitialize the UART1
+		  case 0xbd:																	//erase the app section, then switch to programmer mode
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the command is followed by the length of the image in bytes (4 bytes, LSB first)
+		  {
+			  uint32_t image_length_in_bytes = ((uint32_t)Rx_Message_byte_ptr[1]) |
+					  	  	  	  	  	  	   ((uint32_t)Rx_Message_byte_ptr[2] << 8) |
+											   ((uint32_t)Rx_Message_byte_ptr[3] << 16) |
+											   ((uint32_t)Rx_Message_byte_ptr[4] << 24);
+			  BOOT_LOG("Erasing app section...\r\n");
+			  flash_erased_end_addr = EraseAppSection(image_length_in_bytes);			//we erase the pages now so only the half-page writes remain during reception
+			  BOOT_LOG("%d pages erased \r\n", (int)((flash_erased_end_addr - App_update_start_addr) / Boot_page_size_in_bytes));
+			  BOOT_LOG("Update app...\r\n");
+			  ProgrammerModeEnable(Raw_Stream);
+			  break;
+		  }
 
-			  DMAChannelUART1RxConfig(&Rx_Message_buf[0]);						//DMA channel reconfig - necessary after DMA shut off to ensure functionality
-			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: transfer width is 256 bytes, which is 2 pages of FLASH
-			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the above 3 functions are mere config functions and do not activate the DMA
+		  case 0xbe:																	//switch to programmer mode with addressed pages
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: every page comes with a header giving its position within the app section
+			  BOOT_LOG("Update pages in app...\r\n");
+			  ProgrammerModeEnable(Addressed_Pages);
+			  break;
 
-		      UART1DMAEnable();	 	  	  	  	  	  	  	  	  	  	  	  	//we activate the DMA and the idle detection UART IRQ
-		      	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//capture the incoming machine code (64 words) with DMA
-			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//here we want to have the DMA running and using the IRQs (for starters, only the TC IRQ to generate a flag)
+		  case 0xbf:																	//switch to programmer mode with compressed machine code
+			  BOOT_LOG("Update app from compressed code...\r\n");
+			  ProgrammerModeEnable(Compressed_Stream);
+			  break;
 
-		      UART1_DMA_active = Yes;
+		  case 0xba:																	//switch to programmer mode with HEX/SREC records
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the command is followed by the length of the image in bytes (4 bytes, LSB first). If it is not 0, the app section is erased first, as with 0xbd.
+		  {
+			  uint32_t image_length_in_bytes = ((uint32_t)Rx_Message_byte_ptr[1]) |
+					  	  	  	  	  	  	   ((uint32_t)Rx_Message_byte_ptr[2] << 8) |
+											   ((uint32_t)Rx_Message_byte_ptr[3] << 16) |
+											   ((uint32_t)Rx_Message_byte_ptr[4] << 24);
+			  if (image_length_in_bytes != 0) {
+				  BOOT_LOG("Erasing app section...\r\n");
+				  flash_erased_end_addr = EraseAppSection(image_length_in_bytes);		//the pages between the records won't need an erase during reception
+			  } else {
+				  //do nothing
+			  }
+			  BOOT_LOG("Update app from HEX/SREC records...\r\n");
+			  ProgrammerModeEnable(Record_Stream);
+			  break;
+		  }
 
-			  printf("Awaiting machine code...\r\n");
+		  case 0xb0:																	//run a batch of commands
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the command is followed by the commands of the batch back to back, each with its arguments. The batch ends at the end of the frame.
+		  {
+			  uint8_t batch_command_count = 0;
+			  uint8_t batch_length_in_bytes = BatchCheck(&Rx_Command_buf[1], Rx_Command_buf_size_in_bytes - 1, &batch_command_count);
+			  if (batch_length_in_bytes == 0) {
+				  command_error = Boot_Error_Batch_Invalid;
+				  UART1TxResponse(UART_response_nack, &command_error, 1);
+			  } else {
+				  BOOT_LOG("Batch of %d commands...\r\n", batch_command_count);
+				  UART1TxResponse(UART_response_ack, &batch_command_count, 1);
+				  Batch_position = 1;
+				  Batch_end_position = 1 + batch_length_in_bytes;
+			  }
+			  break;
+		  }
 
+		  case 0xd1:																	//commit the app
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the command is followed by the length of the image in bytes, its CRC32 and its version (4 bytes each, LSB first)
+		  {
+			  uint32_t image_length_in_bytes = ((uint32_t)Rx_Message_byte_ptr[1]) |
+					  	  	  	  	  	  	   ((uint32_t)Rx_Message_byte_ptr[2] << 8) |
+											   ((uint32_t)Rx_Message_byte_ptr[3] << 16) |
+											   ((uint32_t)Rx_Message_byte_ptr[4] << 24);
+			  uint32_t image_crc = ((uint32_t)Rx_Message_byte_ptr[5]) |
+					  	  	  	   ((uint32_t)Rx_Message_byte_ptr[6] << 8) |
+								   ((uint32_t)Rx_Message_byte_ptr[7] << 16) |
+								   ((uint32_t)Rx_Message_byte_ptr[8] << 24);
+			  uint32_t image_version = ((uint32_t)Rx_Message_byte_ptr[9]) |
+					  	  	  	  	   ((uint32_t)Rx_Message_byte_ptr[10] << 8) |
+									   ((uint32_t)Rx_Message_byte_ptr[11] << 16) |
+									   ((uint32_t)Rx_Message_byte_ptr[12] << 24);
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the version is 0 if the master does not send it
+			  command_error = CommitApp(image_length_in_bytes, image_crc, image_version);
 			  break;
+		  }
+
+		  case 0xd2:																	//publish the transfer parameters
+		  {
+			  uint8_t response_payload[16] = {Boot_protocol_version,
+					  	  	  	  	  	  	  Rx_ring_depth_in_pages,
+											  Rx_ring_depth_in_pages / 2,
+											  Rx_ring_slot_max_size_in_words,
+											  App_update_start_addr & 0xFF, (App_update_start_addr >> 8) & 0xFF, (App_update_start_addr >> 16) & 0xFF, App_update_start_addr >> 24,
+											  App_update_end_addr & 0xFF, (App_update_end_addr >> 8) & 0xFF, (App_update_end_addr >> 16) & 0xFF, App_update_end_addr >> 24,
+											  App_active_slot,
+											  App_update_slot,
+											  UART1_node_address,
+											  Boot_image_auth_enable};
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the window is half the ring, the other half is left as a margin. Only a window larger than the ring could overwrite a slot (see RxRingOverrunCheck).
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the app section we publish is the update slot. The app must be linked to it.
+			  UART1TxResponse(UART_response_ack, response_payload, 16);
+			  break;
+		  }
+
+		  case 0xd3:																	//send the timing results of the pipeline
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the command is followed by 1 byte. If it is 0x01, the results are wiped once they are sent.
+		  {
+			  uint8_t response_payload[Profiler_report_size_in_bytes];
+			  ProfilerReport(response_payload);
+			  UART1TxResponse(UART_response_ack, response_payload, Profiler_report_size_in_bytes);
+			  if (Rx_Message_byte_ptr[1] == 0x01) {
+				  ProfilerReset();
+			  } else {
+				  //do nothing
+			  }
+			  break;
+		  }
+
+		  case 0xd4:																	//run a benchmark
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the command is followed by 1 byte. 0x00 is the NVM benchmark on the scratch pages, 0x01 is the Rx benchmark with pattern pages sent by the master.
+			  if (Rx_Message_byte_ptr[1] == 0x01) {
+				  BOOT_LOG("Rx benchmark...\r\n");
+				  ProgrammerModeEnable(Benchmark_Stream);
+			  } else {
+				  BOOT_LOG("NVM benchmark...\r\n");
+				  if ((Bench_Scratch_Start_Addr >= App_update_start_addr) && (Bench_Scratch_Start_Addr < App_update_end_addr)) {
+					  Image_crc_valid = No;												//the scratch pages may hold the end of an uncommitted update, a commit has to read the FLASH back
+#if Boot_image_auth_enable
+					  ImageAuthStart();													//same for the running hash
+#endif
+					  ResumeCheckpointInvalidate();										//the update can't be resumed either
+				  } else {
+					  //do nothing
+				  }
+				  uint8_t response_payload[Bench_NVM_report_size_in_bytes];
+				  command_error = BenchNVMRun(response_payload);
+				  if (command_error == Boot_Error_None) {
+					  UART1TxResponse(UART_response_ack, response_payload, Bench_NVM_report_size_in_bytes);
+				  } else {
+					  UART1TxResponse(UART_response_nack, &command_error, 1);
+				  }
+			  }
+			  break;
+
+		  case 0xd5:																	//switch the active app slot
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the command is followed by the index of the slot (1 byte). Switching back to the previous app is a rollback.
+		  {
+			  command_error = ActivateAppSlot(Rx_Message_byte_ptr[1]);
+			  uint8_t response_payload[2] = {App_active_slot, command_error};
+			  if (command_error == Boot_Error_None) {
+				  UART1TxResponse(UART_response_ack, response_payload, 2);
+			  } else {
+				  UART1TxResponse(UART_response_nack, response_payload, 2);
+			  }
+			  break;
+		  }
+
+		  case 0xd6:																	//report the resume checkpoint or resume the update from it
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the command is followed by 1 byte. 0x00 only reports the checkpoint, 0x01 resumes with addressed pages, 0x02 resumes with raw machine code.
+		  {
+			  uint32_t resume_crc_state = 0;
+			  uint32_t resume_length_in_bytes = ResumeCheckpointLoad(&resume_crc_state);
+			  uint32_t resume_crc = CRCFinal(resume_crc_state);							//the master checks it against the CRC of the same part of its image
+			  if (resume_length_in_bytes == 0) {
+				  command_error = Boot_Error_No_Checkpoint;
+				  UART1TxResponse(UART_response_nack, &command_error, 1);
+			  } else {
+				  uint8_t response_payload[9] = {App_update_slot,
+						  	  	  	  	  	  	  resume_length_in_bytes & 0xFF, (resume_length_in_bytes >> 8) & 0xFF, (resume_length_in_bytes >> 16) & 0xFF, resume_length_in_bytes >> 24,
+												  resume_crc & 0xFF, (resume_crc >> 8) & 0xFF, (resume_crc >> 16) & 0xFF, resume_crc >> 24};
+				  UART1TxResponse(UART_response_ack, response_payload, 9);
+				  if ((Rx_Message_byte_ptr[1] == 0x01) || (Rx_Message_byte_ptr[1] == 0x02)) {
+					  BOOT_LOG("Resuming update at page %d...\r\n", (int)(resume_length_in_bytes / Boot_page_size_in_bytes));
+					  Resume_length_in_bytes = resume_length_in_bytes;
+					  Resume_crc_state = resume_crc_state;
+					  if (Rx_Message_byte_ptr[1] == 0x01) {
+						  ProgrammerModeEnable(Addressed_Pages);
+					  } else {
+						  ProgrammerModeEnable(Raw_Stream);
+					  }
+				  } else {
+					  //do nothing
+				  }
+			  }
+			  break;
+		  }
+
+		  case 0xd7:																	//switch the baud rate
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the command is followed by the index of the baud rate (1 byte, see enum_UART_Baud_Selector). 0xFF is the probe, followed by the probe pattern.
+			  if (Rx_Message_byte_ptr[1] == 0xFF) {										//a probe outside a negotiation only tests the link
+				  if (memcmp(&Rx_Message_byte_ptr[2], Baud_probe_pattern, sizeof(Baud_probe_pattern)) == 0) {
+					  UART1TxResponse(UART_response_ack, (uint8_t*)Baud_probe_pattern, sizeof(Baud_probe_pattern));
+				  } else {
+					  command_error = Boot_Error_Baud_Probe;
+					  UART1TxResponse(UART_response_nack, &command_error, 1);
+				  }
+			  } else {
+				  command_error = BaudNegotiate(Rx_Message_byte_ptr[1]);
+			  }
+			  break;
+
+		  case 0xd8:																	//node address and the results of a broadcast update
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the command is followed by 1 byte. 0x00 reports the node, 0x01 sets the node address, 0x02 sends the last transfer report again.
+			  command_error = NodeCommand(Rx_Message_byte_ptr);
+			  break;
+
+		  case 0xd9:																	//authentication tag of the image
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the command is followed by the 32 byte tag. It is used by the next commit.
+		  {
+			  uint8_t response_payload[1] = {Boot_image_auth_enable};					//the master can tell if the tag is going to be checked
+			  ImageAuthTagSet(&Rx_Message_byte_ptr[1]);
+			  UART1TxResponse(UART_response_ack, response_payload, 1);
+			  break;
+		  }
 
 		  case 0xcc:																	//reboot
 			  ReBoot();
@@ -82,62 +373,942 @@ void UART1_External_Boot_Controller (void) {
 			  break;
 		  }
 
+		  if ((command_error != Boot_Error_None) && (Batch_position != Batch_end_position)) {
+			  BOOT_LOG("Batch aborted \r\n");
+			  Batch_position = Batch_end_position;										//we don't run the rest of the batch, the master has the NACK of the failed command
+		  } else {
+			  //do nothing
+		  }
+
 	  //Programmer Mode
-	  } else if (UART1_DMA_active == Yes) {								  	  	  	  	//defined by the DMA being active (response to the command 0xbb)
+	  } else if (UART1_DMA_active == Yes) {								  	  	  	  	//defined by the DMA being active (response to the command 0xba, 0xbb, 0xbd, 0xbe or 0xbf)
 
-		  if (UART1_Message_Received == Yes) {											//in Programmer Mode if we detect that the bus is idle
+		  if (((UART1_Message_Received == Yes) && (Programmer_Mode != Addressed_Pages)) || (Addressed_transfer_ended == Yes)) {
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//in Programmer Mode if we detect that the bus is idle or we have the end-of-transfer page
 
-			  UART1Deinit();														//we de-initialize the UART completely
-			  UART1_DMA_active = No;													//remove the DMA flag
-			  UART1_Message_Received = No;												//remove the message received flag
-			  printf("%d pages of machine app code have been updated \r\n", page_counter);	//we publish the page counter results
-			  page_counter = 0;															//we reset the page counter
-			  flash_page_addr = App_Section_Start_Addr;									//we move the flash pointer to the start of the app for additional updates
-			  memset(Rx_Message_buf, 0, 64);											//we wipe the UART buffer
-			  USART1->CR1 |= (1<<0);													//we re-enable the UART1 without DMA
+			  UART1RxDMAStop();														//we stop the reception, but keep the Tx for the remaining responses
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the DMA is stopped here, CNDTR won't change anymore
+			  RxRingOverrunCheck();														//the last look at the ring before the producer index is moved - the pages not reached by now are safe
+
+			  uint16_t Rx_ring_slot_size_in_bytes = 4 * Rx_ring_slot_size_in_words;
+			  uint16_t last_half_position = (Rx_ring_produced_pages % Rx_ring_depth_in_pages) * Rx_ring_slot_size_in_bytes;
+			  uint16_t DMA_position = DMAChannelUART1RxPosition();						//bytes loaded into the ring since the DMA last wrapped around
+			  uint16_t last_slot_length_in_bytes = Rx_ring_slot_size_in_bytes;
+			  if (DMA_position > last_half_position) {									//the ring holds pages that have arrived after the last HT/TC IRQ
+				  uint16_t tail_bytes = DMA_position - last_half_position;
+				  if ((tail_bytes % Rx_ring_slot_size_in_bytes) == 0) {					//we only have complete pages
+					  //do nothing
+				  } else if ((Programmer_Mode == Compressed_Stream) || (Programmer_Mode == Record_Stream)) {
+					  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//compressed data and records do not need to end on a slot boundary
+					  last_slot_length_in_bytes = tail_bytes % Rx_ring_slot_size_in_bytes;
+					  tail_bytes = tail_bytes + Rx_ring_slot_size_in_bytes - last_slot_length_in_bytes;
+					  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//we only decompress the bytes that have arrived
+				  } else if (Programmer_Mode == Raw_Stream) {							//the last page of the machine code is not complete
+					  memset(((uint8_t*)Rx_Message_buf) + DMA_position, 0, Rx_ring_slot_size_in_bytes - (tail_bytes % Rx_ring_slot_size_in_bytes));
+					  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//we pad it with 0x00, the erased value of the FLASH
+					  tail_bytes = tail_bytes + Rx_ring_slot_size_in_bytes - (tail_bytes % Rx_ring_slot_size_in_bytes);
+				  } else {																//an incomplete addressed or benchmark page is broken, we drop it
+					  page_rejected_counter++;
+				  }
+				  Rx_ring_produced_pages = Rx_ring_produced_pages + (tail_bytes / Rx_ring_slot_size_in_bytes);
+				  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the DMA IRQ is off, we can write the producer index
+			  } else {
+				  //do nothing
+			  }
 
-		  } else if (UART1_Message_Received == No){										//if the bus is not idle
+			  while (Rx_ring_submitted_pages != Rx_ring_produced_pages) {				//we drain the ring
+				  if ((Rx_ring_produced_pages - Rx_ring_submitted_pages) == 1) {		//last slot
+					  ProgramRxRingPage(last_slot_length_in_bytes);
+				  } else {
+					  ProgramRxRingPage(Rx_ring_slot_size_in_bytes);
+				  }
+			  }
 
-			  switch (Machine_Code_Page_Received) {										//we check if we are at the first or the second part of the 64 word long Rx buffer
+			  if (Programmer_Mode == Compressed_Stream) {
+				  if (StreamPagePad() == Yes) {											//the decompressed app does not end on a page boundary
+					  ProgramPage(flash_page_addr, Stream_page_buf);
+					  flash_page_addr = flash_page_addr + Boot_page_size_in_bytes;
+					  NVMWaitIdle();													//the page buffer must stay untouched until it is in the FLASH
+					  StreamPageRelease();
+				  } else {
+					  //do nothing
+				  }
+			  } else if (Programmer_Mode == Record_Stream) {
+				  if (RecordPageFlush() == Yes) {										//the last page assembled from the records
+					  ProgramRecordPage();
+				  } else {
+					  //do nothing
+				  }
+			  } else {
+				  //do nothing
+			  }
 
-			  case First:																//if we are in the front - triggered by the DMA halfway point
-				  UpdatePageInApp(flash_page_addr, 0);									//we pass the address as well as from where in the buffer we intend to read the data
-				  flash_page_addr = flash_page_addr + 0x80;								//we step the page address by one page
-				  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: we select the page to process on this level
-				  Machine_Code_Page_Received = None;									//we remove the page detection flag
-				  break;
+			  NVMWaitIdle();															//we wait for the last NVM jobs to be done
+			  ReleaseRxRingPages();
+			  enum_UART_Baud_Selector next_baud_rate = UART1_baud_rate;
+			  if ((UART1_baud_rate != UART1_boot_baud_rate) && ((UART1_Rx_error_counter + page_rejected_counter + Rx_ring_overflow_counter) >= UART1_Rx_error_threshold)) {
+				  next_baud_rate = UART1_baud_rate - 1;								//the link is too noisy for the baud rate, we step down by one
+			  } else {
+				  //do nothing
+			  }
+			  SendTransferReport(next_baud_rate);										//the master learns the baud rate from the report
+			  if (Programmer_Mode == Benchmark_Stream) {
+				  BenchRxReport();
+			  } else {
+				  //do nothing
+			  }
+			  if (next_baud_rate != UART1_baud_rate) {
+				  BOOT_LOG("%d Rx errors, stepping the baud rate down \r\n", UART1_Rx_error_counter);
+				  UART1BaudSwitch(next_baud_rate);										//the report goes out at the old baud rate first
+				  Delay_ms(Baud_switch_settle_in_ms);									//the rest of a batch must not answer before the master has followed
+			  } else {
+				  //do nothing
+			  }
 
-				  //Note: the FLASH copying MUST ALWAYS BE faster than the data reception!
+			  UART1_DMA_active = No;													//remove the DMA flag
+			  UART1_Message_Received = No;												//remove the message received flag
+			  Addressed_transfer_ended = No;
+			  BOOT_LOG("%d pages of machine app code have been updated \r\n", page_counter);	//we publish the page counter results
+			  BOOT_LOG("%d pages written, %d pages unchanged and skipped \r\n", page_written_counter, page_skipped_counter);
+			  if ((page_rejected_counter != 0) || (Rx_ring_overflow_counter != 0) || (NVM_error_counter != 0)) {
+				  Image_crc_valid = No;													//the running CRC does not match the FLASH, a commit has to read the FLASH back
+			  } else {
+				  //do nothing
+			  }
+			  if (page_rejected_counter != 0) {
+				  BOOT_LOG("%d pages rejected \r\n", page_rejected_counter);
+			  } else {
+				  //do nothing
+			  }
+			  if (Rx_ring_missed_events_counter != 0) {
+				  BOOT_LOG("%d HT/TC events were served late by the DMA IRQ \r\n", Rx_ring_missed_events_counter);
+			  } else {
+				  //do nothing
+			  }
+			  if (Rx_ring_overflow_counter != 0) {
+				  BOOT_LOG("%d pages were overwritten in the Rx ring before being copied. The app is corrupted! \r\n", Rx_ring_overflow_counter);
+			  } else {
+				  //do nothing
+			  }
+			  if (NVM_error_counter != 0) {
+				  BOOT_LOG("%d NVM operations failed (last error flags: 0x%x). The app is corrupted! \r\n", NVM_error_counter, (unsigned int)NVM_last_error_flags);
+			  } else {
+				  //do nothing
+			  }
+			  page_counter = 0;															//we reset the page counter
+			  page_written_counter = 0;
+			  page_skipped_counter = 0;
+			  page_rejected_counter = 0;
+			  Rx_ring_produced_pages = 0;												//we reset the ring
+			  Rx_ring_consumed_pages = 0;
+			  Rx_ring_submitted_pages = 0;
+			  Rx_ring_checked_pages = 0;
+			  Rx_ring_overflow_counter = 0;
+			  Rx_ring_missed_events_counter = 0;
+			  NVM_error_counter = 0;
+			  NVM_last_error_flags = 0;
+			  flash_page_addr = App_update_start_addr;									//we move the flash pointer to the start of the update slot for additional updates
+			  flash_erased_end_addr = App_update_start_addr;							//any pre-erase was only valid for this update
+			  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the Rx buffer is not wiped. Only what the DMA has loaded since the indices were reset is ever read.
+			  UART1CommandCaptureEnable();												//we go back to capturing command frames
 
-			  case Second:																//if we are in the back - triggered by the DMA TC point
-				  UpdatePageInApp(flash_page_addr, 1);
-				  flash_page_addr = flash_page_addr + 0x80;								//we step the page address by one page
-				  Machine_Code_Page_Received = None;									//we remove the page detection flag
+		  } else {																		//if the bus is not idle or the transfer is not over yet
 
-				  //Note: there is a small delay between the page_received flag (being "first" or "second") and the "message received" flag being "yes".
-				  //Note: the "standby" state of the main loop must be able to sample the page_received state change before the message received "yes"
-				  //Note: in other words, the main loop has to be fast enough to detect a change in the Rx buffer state before it detects that the bus is idle
-				  //Note: current standby cycle time (sampling time) of DMA standby is 2 us...
+			  uint8_t NVM_queue_free = NVMJobQueueFree();								//what we have seen before we go to sleep (see below)
+			  ReleaseRxRingPages();														//we free up the slots that are already in the FLASH
+			  RxRingOverrunCheck();
+			  uint16_t available_pages = RxRingAvailablePages();
 
-				  break;
+			  if ((Rx_ring_submitted_pages != available_pages) && (NVMJobQueueFree() >= 3)) {
+				  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//if we have at least one page in the ring that is not yet handed over to the NVM
+				  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//and the NVM job queue can take an erase and two half-page writes
+				  ProgramRxRingPage(4 * Rx_ring_slot_size_in_words);
 
-			  case None:
-				  //do nothing
-				  break;
+				  //Note: the FLASH copying must be faster than the data reception on average. Bursts of slow FLASH copying are absorbed by the ring.
+				  //Note: the ring can fall behind by almost its whole depth before the DMA starts overwriting pages not yet in the FLASH. That is detected and counted by RxRingOverrunCheck and ReleaseRxRingPages.
 
-			  default:
-				  //do nothing
-				  break;
+			  } else {
+				  __disable_irq();
+				  if ((RxRingAvailablePages() == available_pages) && (NVMJobQueueFree() == NVM_queue_free) &&
+					  ((UART1_Message_Received == No) || (Programmer_Mode == Addressed_Pages))) {
+					  __WFI();															//nothing to do, we sleep until the DMA, the UART1 or the FLASH IRQ
+					  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: with the IRQs disabled, an IRQ that has come in since we looked still wakes us up. It is served once we enable the IRQs again.
+				  } else {
+					  //do nothing													//an IRQ has changed something, we go around again
+				  }
+				  __enable_irq();
 			  }
 
-		  } else {
-			  //do nothing
 		  }
 
-		  //Note: the DMA needs to be restarted when the logging reaches the end of the Rx buffer. This takes time.
-		  //UART needs to be slower than the DMA restart time, otherwise only every second set of data will be captured.
+		  //Note: the DMA runs in circular mode. It does not need to be restarted when the logging reaches the end of the Rx ring.
+		  //Note: pages that arrive after the last HT/TC IRQ are picked up using the DMA position (see RxRingAvailablePages). The UART1 IRQ wakes us up for them.
 
 	  } else {
 		  //do nothing
 	  }
 }
+
+
+//2)Rx ring page processing
+/*
+ * We take the oldest slot that has not yet been handed over to the NVM out of the Rx ring and write it to the FLASH.
+ * In raw mode, pages are written one after the other from the start of the update slot.
+ * In addressed mode, every page has a one word header in front of it (page index in the update slot on 16 bits, LSB first, followed by 2 bytes that must be zero).
+ * 		The page is followed by the CRC32 of the header and the page (4 bytes, LSB first). Pages with a wrong CRC are dropped.
+ * 		A page with the index Addressed_page_end_of_transfer is not written. It ends the transfer and is acknowledged once all pages before it are in the FLASH.
+ * In compressed mode, the slot is fed to the decompressor. A slot can give any number of pages, which are written one after the other from the start of the update slot.
+ * In record mode, the slot is fed to the HEX/SREC decoder. A slot can give any number of pages, which are written where their records point to (see ProgramRecordPage).
+ *
+ * Note: the function must only be called if the ring holds at least one slot.
+ * Note: the slot length is only used in compressed and record mode. The last slot of such a stream is usually not full.
+ * Note: pages pointing outside of the update slot are dropped.
+ * Note: the slot is not released here. The NVM jobs still read the page data from the slot. See ReleaseRxRingPages.
+ *
+ * */
+
+void ProgramRxRingPage (uint16_t slot_length_in_bytes) {
+
+	uint32_t* slot_ptr = &Rx_Message_buf[(Rx_ring_submitted_pages % Rx_ring_depth_in_pages) * Rx_ring_slot_size_in_words];
+																						//the start of the slot in the Rx ring
+	uint32_t slot_taken_time = TIM6Timestamp_us();										//the arrival time of a slot picked up before its HT/TC
+	Rx_ring_slot_page_addr[Rx_ring_submitted_pages % Rx_ring_depth_in_pages] = 0;		//set again if the page is written straight from the slot
+
+	switch (Programmer_Mode) {
+
+	case Addressed_Pages:
+	{
+		struct_Addressed_Page_Slot* addressed_slot_ptr = (struct_Addressed_Page_Slot*)slot_ptr;
+		uint32_t page_header = addressed_slot_ptr->header;
+		uint8_t page_error = Boot_Error_None;
+		Rx_ring_slot_page_index[Rx_ring_submitted_pages % Rx_ring_depth_in_pages] = page_header & 0xFFFF;
+		if (CRCFinal(CRCCalculate(CRC_start_state, &addressed_slot_ptr->header, Boot_page_size_in_words + 1)) != addressed_slot_ptr->crc) {
+																						//the page has been corrupted on the way (the CRC covers the header and the page)
+			page_rejected_counter++;
+			page_error = Boot_Error_Page_CRC;
+		} else if ((page_header >> 16) != 0) {											//broken header
+			page_rejected_counter++;
+			page_error = Boot_Error_Page_Header;
+		} else if ((page_header & 0xFFFF) == Addressed_page_end_of_transfer) {			//the master has sent everything
+			Addressed_transfer_ended = Yes;
+		} else {
+			uint16_t page_rejected_before = page_rejected_counter;
+			ProgramRxRingSlotPage(App_update_start_addr + (Boot_page_size_in_bytes * (page_header & 0xFFFF)), addressed_slot_ptr->page);
+																						//we use the index in the header instead of the running address
+																						//Note: the page is word aligned, the half-page writes read it straight from the slot
+			if (page_rejected_counter != page_rejected_before) {						//the page is outside the update slot
+				page_error = Boot_Error_Page_Range;
+			} else {
+				//do nothing
+			}
+		}
+		Rx_ring_slot_error[Rx_ring_submitted_pages % Rx_ring_depth_in_pages] = page_error;
+																						//Note: the master will have to send a NACK-ed page again
+		break;
+	}
+
+	case Compressed_Stream:
+	{
+		uint16_t processed_bytes = 0;
+		while (1) {
+			processed_bytes = processed_bytes + LZDecodeBytes(((uint8_t*)slot_ptr) + processed_bytes, slot_length_in_bytes - processed_bytes);
+			if (StreamPageFull() == Yes) {												//the decompressor has a page for us
+				ProgramPage(flash_page_addr, Stream_page_buf);
+				flash_page_addr = flash_page_addr + Boot_page_size_in_bytes;
+				NVMWaitIdle();															//the page buffer must stay untouched until it is in the FLASH
+				StreamPageRelease();
+																						//Note: we go around again even if the slot is done, a match may still be waiting to be copied
+			} else {
+				break;																	//the slot is done
+			}
+		}
+		break;
+	}
+
+	case Record_Stream:
+	{
+		uint16_t processed_bytes = 0;
+		while (1) {
+			processed_bytes = processed_bytes + RecordDecodeBytes(((uint8_t*)slot_ptr) + processed_bytes, slot_length_in_bytes - processed_bytes);
+			if (StreamPageFull() == Yes) {												//the decoder has a page for us
+				ProgramRecordPage();
+																						//Note: we go around again even if the slot is done, the rest of a record may still be waiting to be placed
+			} else {
+				break;																	//the slot is done
+			}
+		}
+		break;
+	}
+
+	case Benchmark_Stream:
+		BenchRxSlotCheck(slot_ptr);														//the page is only checked, nothing goes to the NVM
+		break;
+
+	case Raw_Stream:
+	default:
+		ProgramRxRingSlotPage(flash_page_addr, slot_ptr);
+		flash_page_addr = flash_page_addr + Boot_page_size_in_bytes;					//we step the page address by one page
+																						//Note: we select the page to process on this level
+		break;
+	}
+
+	Rx_ring_slot_NVM_job_tag[Rx_ring_submitted_pages % Rx_ring_depth_in_pages] = NVM_jobs_submitted;
+																						//the slot can be released once all jobs so far are done
+	Rx_ring_slot_overwritten[Rx_ring_submitted_pages % Rx_ring_depth_in_pages] = No;
+	ProfilerRxRingPageHandedOver(Rx_ring_submitted_pages, slot_taken_time);
+	Rx_ring_submitted_pages++;
+}
+
+
+//3)Rx ring slot release
+/*
+ * We release the slots in the Rx ring whose NVM jobs are done, oldest first.
+ * A page written straight from its slot is read back from the FLASH first. If it does not match what we have handed over, the DMA has overwritten it before its half-page writes got to it.
+ *
+ * Note: a mismatch is not counted once an NVM job has failed. The page is corrupted anyway and the failure is already reported.
+ *
+ * */
+
+void ReleaseRxRingPages (void) {
+
+	uint16_t available_pages = RxRingAvailablePages();									//for the slack of the released slots
+
+	while ((Rx_ring_consumed_pages != Rx_ring_submitted_pages) &&
+		   (NVMJobsDone(Rx_ring_slot_NVM_job_tag[Rx_ring_consumed_pages % Rx_ring_depth_in_pages]) == Yes)) {
+
+		uint32_t page_addr = Rx_ring_slot_page_addr[Rx_ring_consumed_pages % Rx_ring_depth_in_pages];
+		if ((page_addr != 0) && (NVM_error_counter == 0) &&
+			(CRCFinal(CRCCalculate(CRC_start_state, (uint32_t*)page_addr, Boot_page_size_in_words)) != Rx_ring_slot_page_crc[Rx_ring_consumed_pages % Rx_ring_depth_in_pages])) {
+			Rx_ring_overflow_counter++;													//the page was overwritten in the slot after the hand-over
+		} else {
+			//do nothing
+		}
+
+		if (Programmer_Mode == Addressed_Pages) {										//we tell the master what happened to the page
+			uint8_t slot = Rx_ring_consumed_pages % Rx_ring_depth_in_pages;
+			uint8_t page_error = Rx_ring_slot_error[slot];
+			if ((page_error == Boot_Error_None) && (NVM_error_counter != NVM_errors_acknowledged)) {
+																						//an NVM job has failed since the last response
+				NVM_errors_acknowledged = NVM_error_counter;
+				page_error = Boot_Error_NVM;
+																						//Note: we can't tell which page the failed job belonged to. The master may send a good page again, which does no harm.
+			} else {
+				//do nothing
+			}
+			uint8_t response_payload[3] = {Rx_ring_slot_page_index[slot] & 0xFF, Rx_ring_slot_page_index[slot] >> 8, page_error};
+			if (page_error == Boot_Error_None) {
+				UART1TxResponse(UART_response_ack, response_payload, 3);
+			} else {
+				UART1TxResponse(UART_response_nack, response_payload, 3);
+			}
+		} else {
+			//do nothing
+		}
+
+		ProfilerRxRingPageReleased(Rx_ring_consumed_pages, available_pages);
+		Rx_ring_consumed_pages++;														//we release the slot in the ring
+	}
+}
+
+
+//4)Rx ring fill level
+/*
+ * We tell how many slots have been loaded into the Rx ring so far, including the ones that have arrived after the last HT/TC IRQ.
+ * The DMA IRQ only steps the producer index by half the ring. A master with only a few pages in flight would never fill half the ring, so we also look at where the DMA is.
+ *
+ * 1)We take the producer index and the DMA position. If the DMA IRQ has stepped the index in the meantime, we just take the new index.
+ * 2)We count the complete slots between the last HT/TC and the DMA position.
+ *
+ * Note: the producer index itself is not changed, it remains written only by the DMA IRQ.
+ * Note: if the DMA has wrapped around, but the TC IRQ hasn't been served yet, the position is below the last HT/TC. We wait for the IRQ then.
+ *
+ * */
+
+uint16_t RxRingAvailablePages (void) {
+
+	//1)
+	uint16_t produced_pages = Rx_ring_produced_pages;
+	uint16_t DMA_position = DMAChannelUART1RxPosition();
+	if (produced_pages != Rx_ring_produced_pages) {
+		return Rx_ring_produced_pages;
+	} else {
+		//do nothing
+	}
+
+	//2)
+	uint16_t Rx_ring_slot_size_in_bytes = 4 * Rx_ring_slot_size_in_words;
+	uint16_t last_half_position = (produced_pages % Rx_ring_depth_in_pages) * Rx_ring_slot_size_in_bytes;
+	if (DMA_position > last_half_position) {
+		produced_pages = produced_pages + ((DMA_position - last_half_position) / Rx_ring_slot_size_in_bytes);
+	} else {
+		//do nothing
+	}
+
+	return produced_pages;
+}
+
+
+//5)Page programming
+/*
+ * We write one page to the FLASH and count what happened to it.
+ * Pages that have been erased before the transfer (command 0xbd) are not erased again.
+ * Pages that are identical to what is already in the FLASH are not written at all, we only count them.
+ * Every few pages written in order, we checkpoint the progress into the EEPROM (see ResumeCheckpointSave).
+ *
+ * */
+
+void ProgramPage (uint32_t page_addr_in_FLASH, uint32_t* page_data_ptr) {
+
+	if ((page_addr_in_FLASH < App_update_start_addr) || (page_addr_in_FLASH >= App_update_end_addr)) {
+																						//we never write outside the update slot - the active app stays untouched
+		page_rejected_counter++;
+		return;
+	} else {
+		//do nothing
+	}
+
+	enum_Yes_No_Selector page_erase = Yes;
+	if (page_addr_in_FLASH < flash_erased_end_addr) {									//page is already erased
+		page_erase = No;
+	} else {
+		//do nothing
+	}
+
+	if (page_addr_in_FLASH == (App_update_start_addr + Image_crc_length_in_bytes)) {	//the page follows the ones we already have in the running CRC
+		Image_crc_state = CRCCalculate(Image_crc_state, page_data_ptr, Boot_page_size_in_words);
+		Image_crc_length_in_bytes = Image_crc_length_in_bytes + Boot_page_size_in_bytes;
+	} else {
+		Image_crc_valid = No;															//pages are not coming in order, the running CRC is useless
+	}
+#if Boot_image_auth_enable
+	if (page_addr_in_FLASH == (App_update_start_addr + ImageAuthLength())) {
+		ImageAuthPage(page_data_ptr);													//the hash runs while the NVM writes the previous page
+	} else {
+		//do nothing
+	}
+#endif
+
+	if (UpdatePageInApp(page_addr_in_FLASH, page_data_ptr, page_erase) == Yes) {
+		page_written_counter++;
+	} else {
+		page_skipped_counter++;															//the page was identical to the FLASH content
+	}
+	page_counter++;																		//we count the pages we have updated
+
+	if ((Image_crc_valid == Yes) && ((Image_crc_length_in_bytes % (Resume_checkpoint_interval_in_pages * Boot_page_size_in_bytes)) == 0)) {
+		ResumeCheckpointSave(Image_crc_length_in_bytes, Image_crc_state);				//an interrupted update can carry on from here
+																						//Note: the checkpoint is queued behind the writes of this page
+	} else {
+		//do nothing
+	}
+}
+
+
+//6)Transfer report
+/*
+ * We send the counters of the transfer that has just ended to the master (report response, 27 bytes).
+ * The payload is the number of pages updated, written, skipped, rejected and overwritten in the Rx ring, the number of failed NVM jobs (2 bytes each, LSB first),
+ * the error flags of the last failed NVM job (4 bytes, LSB first), the number of responses and the number of log bytes that had to be dropped (2 bytes each, LSB first),
+ * the number of HT/TC events the DMA IRQ has missed and the number of command frames dropped since the start of the bootloader (2 bytes each, LSB first),
+ * the number of Rx errors since the last baud rate switch (2 bytes, LSB first) and the baud rate we run at once the report is out (1 byte, see enum_UART_Baud_Selector).
+ *
+ * Note: a copy of the report is kept. After a broadcast transfer, the report was not sent, the master asks each node for it with command 0xd8.
+ *
+ * */
+
+void SendTransferReport (enum_UART_Baud_Selector next_baud_rate) {
+
+	uint16_t report_counters[6] = {page_counter, page_written_counter, page_skipped_counter, page_rejected_counter, Rx_ring_overflow_counter, NVM_error_counter};
+	uint8_t* response_payload = Transfer_report_last;
+
+	for (uint8_t i = 0; i < 6; i++) {
+		response_payload[2 * i] = report_counters[i] & 0xFF;
+		response_payload[(2 * i) + 1] = report_counters[i] >> 8;
+	}
+	response_payload[12] = NVM_last_error_flags & 0xFF;
+	response_payload[13] = (NVM_last_error_flags >> 8) & 0xFF;
+	response_payload[14] = (NVM_last_error_flags >> 16) & 0xFF;
+	response_payload[15] = NVM_last_error_flags >> 24;
+	response_payload[16] = UART1_Tx_dropped_counter & 0xFF;
+	response_payload[17] = UART1_Tx_dropped_counter >> 8;
+	response_payload[18] = UART2_Log_dropped_bytes & 0xFF;
+	response_payload[19] = UART2_Log_dropped_bytes >> 8;
+	response_payload[20] = Rx_ring_missed_events_counter & 0xFF;
+	response_payload[21] = Rx_ring_missed_events_counter >> 8;
+	response_payload[22] = Cmd_frames_dropped_counter & 0xFF;
+	response_payload[23] = Cmd_frames_dropped_counter >> 8;
+	response_payload[24] = UART1_Rx_error_counter & 0xFF;
+	response_payload[25] = UART1_Rx_error_counter >> 8;
+	response_payload[26] = next_baud_rate;
+
+	Transfer_report_valid = Yes;
+	UART1TxResponse(UART_response_report, response_payload, Transfer_report_size_in_bytes);
+}
+
+
+//7)Programmer mode activation
+/*
+ * We switch from command and control to programmer mode.
+ * The UART1 is reconfigured to load the Rx ring using DMA. The size of the ring slots depends on the mode.
+ * The Rx benchmark does not touch the FLASH, the update slot stays valid.
+ * A resumed update (command 0xd6) carries on with the running CRC and the FLASH pointer of the checkpoint. A new update removes the checkpoint.
+ *
+ * */
+
+void ProgrammerModeEnable (enum_Programmer_Mode_Selector programmer_mode_selector) {
+
+	Programmer_Mode = programmer_mode_selector;
+
+	if (Programmer_Mode == Addressed_Pages) {
+		Rx_ring_slot_size_in_words = Rx_ring_slot_max_size_in_words;					//header word, page and CRC word
+	} else {
+		Rx_ring_slot_size_in_words = Boot_page_size_in_words;							//page only, or a page worth of compressed data
+	}
+	StreamDecoderReset();																//the decompressor starts from scratch
+	NVM_errors_acknowledged = NVM_error_counter;
+	Addressed_transfer_ended = No;
+	ProfilerRxRingStart();																//none of the slots hold a page yet
+#if Boot_image_auth_enable
+	ImageAuthStart();																	//a resumed update is hashed from the FLASH at the commit
+#endif
+	if (Programmer_Mode == Benchmark_Stream) {
+		BenchRxReset();
+	} else if (Resume_length_in_bytes != 0) {
+		Image_crc_state = Resume_crc_state;
+		Image_crc_length_in_bytes = Resume_length_in_bytes;
+		Image_crc_valid = Yes;
+		flash_page_addr = App_update_start_addr + Resume_length_in_bytes;				//raw machine code carries on after the checkpoint
+		Resume_length_in_bytes = 0;														//Note: the app header of the update slot is already invalid
+	} else {
+		ResumeCheckpointInvalidate();
+		Image_crc_state = CRC_start_state;												//the running CRC starts from scratch
+		Image_crc_length_in_bytes = 0;
+		Image_crc_valid = Yes;
+		AppHeaderWrite(App_update_slot, App_header_length_invalid, 0);					//the update slot is not valid anymore until the update is committed
+		AppDescriptorInvalidate(App_update_slot);										//Note: the active slot is not touched, its app can still be started
+	}
+	DMA_transfer_width_UART1 = 4 * Rx_ring_slot_size_in_words * Rx_ring_depth_in_pages;	//the DMA loads the entire ring before it wraps around
+																						//Note: HT and TC then fall exactly on a slot boundary
+
+	UART1Deinit();																		//we completely deinitialize the UART1
+
+	Rx_ring_DMA_next_half = 0;															//the DMA starts on the first half of the ring
+	DMAChannelUART1RxConfig((uint32_t)Rx_Message_buf);									//DMA channel reconfig - necessary after DMA shut off to ensure functionality
+																						//Note: the above 3 functions are mere config functions and do not activate the DMA
+
+	UART1DMAEnable();																	//we activate the DMA and the idle detection UART IRQ
+																						//capture the incoming machine code with DMA
+
+	UART1_DMA_active = Yes;
+
+	BOOT_LOG("Awaiting machine code...\r\n");
+}
+
+
+//8)App commit
+/*
+ * We check the app in the update slot against the length and the CRC32 the master has sent over. If they match, we write them into the app header of the slot and activate it.
+ * Until the app is committed, the bootloader won't start it. It keeps starting the app in the active slot instead.
+ *
+ * 1)We round the length up to full pages. The master must calculate the CRC over the image padded with 0x00 to a full page.
+ * 2)If the running CRC of the update covers exactly the image, we use it. Otherwise, we read the update slot back using the hardware CRC.
+ * 3)We write the app header and the app descriptor if the CRCs match, the app is linked to the update slot and - with image authentication - its tag is valid. Then we make the update slot the active one.
+ * 4)We respond with an ACK or a NACK. The payload is the CRC we have calculated (4 bytes, LSB first), the error code and the active slot.
+ *   The CRC and the error code are kept for command 0xd8, in case the commit came in a broadcast frame.
+ *
+ * The function gives back the error code (see enum_Boot_Error_Code).
+ *
+ * Note: the running CRC is not valid if the pages did not come in order, or if any page has been lost, rejected or failed to be written.
+ * Note: an app that fails the authentication is left in the update slot with an invalid header, the bootloader never starts it.
+ *
+ * */
+
+uint8_t CommitApp (uint32_t image_length_in_bytes, uint32_t image_crc, uint32_t image_version) {
+
+	//1)
+	image_length_in_bytes = (image_length_in_bytes + (Boot_page_size_in_bytes - 1)) & ~(Boot_page_size_in_bytes - 1);
+
+	uint8_t commit_error = Boot_Error_App_Length;
+	uint32_t device_crc = 0;
+
+	if ((image_length_in_bytes != 0) && (image_length_in_bytes <= (App_update_end_addr - App_update_start_addr))) {
+
+		//2)
+		if ((Image_crc_valid == Yes) && (Image_crc_length_in_bytes == image_length_in_bytes)) {
+			device_crc = CRCFinal(Image_crc_state);
+		} else {
+			device_crc = CRCFinal(CRCCalculate(CRC_start_state, (uint32_t*)App_update_start_addr, image_length_in_bytes / 4));
+		}
+
+		//3)
+		if ((device_crc == image_crc) && (AppIsValid(App_update_slot) == No)) {			//the app has no vector table, or it is linked to the other slot
+			commit_error = Boot_Error_Slot_Invalid;
+			BOOT_LOG("App not linked to slot %d, app not committed \r\n", App_update_slot);
+#if Boot_image_auth_enable
+		} else if ((device_crc == image_crc) && (ImageAuthCheck(App_update_start_addr, image_length_in_bytes, image_version, Image_crc_valid) == No)) {
+			commit_error = Boot_Error_App_Auth;
+			BOOT_LOG("App not authentic, app not committed \r\n");
+#endif
+		} else if (device_crc == image_crc) {
+			uint8_t committed_slot = App_update_slot;
+			AppHeaderWrite(committed_slot, image_length_in_bytes, image_crc);
+			AppDescriptorWrite(committed_slot, image_length_in_bytes, image_crc, image_version);	//the next boot won't need to read the app back
+			ResumeCheckpointInvalidate();												//there is nothing left to resume
+			commit_error = ActivateAppSlot(committed_slot);
+			BOOT_LOG("App version %d committed to slot %d \r\n", (int)image_version, committed_slot);
+		} else {
+			commit_error = Boot_Error_App_CRC;
+			BOOT_LOG("App CRC mismatch, app not committed \r\n");
+		}
+
+	} else {
+		BOOT_LOG("Invalid app length, app not committed \r\n");
+	}
+
+	//4)
+	Commit_crc_last = device_crc;
+	Commit_error_last = commit_error;
+	uint8_t response_payload[6] = {device_crc & 0xFF, (device_crc >> 8) & 0xFF, (device_crc >> 16) & 0xFF, device_crc >> 24, commit_error, App_active_slot};
+	if (commit_error == Boot_Error_None) {
+		UART1TxResponse(UART_response_ack, response_payload, 6);
+	} else {
+		UART1TxResponse(UART_response_nack, response_payload, 6);
+	}
+
+	return commit_error;
+}
+
+
+//9)Record page programming
+/*
+ * We write the page assembled by the HEX/SREC decoder to where its records point to.
+ * The pages between the FLASH pointer and the page are not covered by any record. They are brought to 0x00, so the app section holds the same as the padded image on the master.
+ * 		Such a page is only erased if it is not empty already. If the app section has been erased before the transfer (command 0xba with a length), they are all skipped.
+ * The FLASH pointer is moved past the page, unless the page is behind it already.
+ *
+ * Note: the running CRC stays valid as long as the records come in order, the pages between them are part of the CRC just like in the image on the master.
+ * Note: the page buffer must stay untouched until the page is in the FLASH, so we wait for the NVM here.
+ *
+ * */
+
+void ProgramRecordPage (void) {
+
+	while (flash_page_addr < Stream_page_addr) {
+		ProgramPage(flash_page_addr, (uint32_t*)Record_blank_page);
+		flash_page_addr = flash_page_addr + Boot_page_size_in_bytes;
+	}
+
+	ProgramPage(Stream_page_addr, Stream_page_buf);
+	if (Stream_page_addr == flash_page_addr) {
+		flash_page_addr = flash_page_addr + Boot_page_size_in_bytes;
+	} else {
+		//do nothing
+	}
+	NVMWaitIdle();
+	StreamPageRelease();
+}
+
+
+//10)App slot activation
+/*
+ * We make a slot the active one, if it holds a valid app. The next start of the app - or the next boot - goes to this slot.
+ * The other slot becomes the update slot, so we move the FLASH pointer over to it.
+ * The function gives back the error code (see enum_Boot_Error_Code).
+ *
+ * Note: activating is a single word in the EEPROM. Going back to the previous app does not need the app to be sent over again, as long as no update has been started since.
+ *
+ * */
+
+uint8_t ActivateAppSlot (uint8_t app_slot) {
+
+	if ((app_slot >= App_slot_count) || (AppIsValid(app_slot) == No) || (AppImageCheck(app_slot) == No)) {
+		BOOT_LOG("No valid app in slot %d \r\n", app_slot);
+		return Boot_Error_Slot_Invalid;
+	} else {
+		//do nothing
+	}
+
+	AppSlotActivate(app_slot);
+	flash_page_addr = App_update_start_addr;
+	flash_erased_end_addr = App_update_start_addr;
+	BOOT_LOG("Slot %d active \r\n", App_active_slot);
+
+	return Boot_Error_None;
+}
+
+
+//11)Command batches
+/*
+ * Below are the lengths of the commands that can go into a batch, together with their arguments. 0 means the command can't be part of a batch.
+ *
+ * Note: a batch can't hold another batch. Commands that switch to programmer mode can go anywhere in the batch, the transfer ends as it would without a batch.
+ * Note: 0xd1 must come with its version in a batch, all the arguments are needed to find where the next command starts.
+ * Note: 0xd7 can't be part of a batch, its probe comes in a frame of its own.
+ * Note: 0xd8 can't be part of a batch, its length depends on what it does.
+ * Note: 0xd9 must come before the 0xd1 it authenticates.
+ *
+ * */
+
+uint8_t BatchCommandLength (uint8_t command) {
+
+	switch (command) {
+
+	case 0xaa:
+	case 0xbb:
+	case 0xbe:
+	case 0xbf:
+	case 0xcc:
+	case 0xd2:
+		return 1;
+
+	case 0xd3:
+	case 0xd4:
+	case 0xd5:
+	case 0xd6:
+		return 2;
+
+	case 0xbd:
+	case 0xba:
+		return 5;
+
+	case 0xd1:
+		return 13;
+
+	case 0xd9:
+		return 33;
+
+	default:
+		return 0;
+	}
+}
+
+/*
+ * We walk through the commands of a batch before running any of them. The batch ends at the first 0x00 command byte - the command buffer is padded with 0x00 after the frame - or at the end of the buffer.
+ * The function gives back the length of the batch in bytes, 0 if the batch is empty, holds an unknown command or a command is cut short by the end of the frame.
+ *
+ * */
+
+uint8_t BatchCheck (uint8_t* batch_ptr, uint8_t batch_max_length_in_bytes, uint8_t* command_count_ptr) {
+
+	uint8_t batch_length_in_bytes = 0;
+	*command_count_ptr = 0;
+
+	while ((batch_length_in_bytes < batch_max_length_in_bytes) && (batch_ptr[batch_length_in_bytes] != 0x00)) {
+		uint8_t command_length = BatchCommandLength(batch_ptr[batch_length_in_bytes]);
+		if ((command_length == 0) || (command_length > (batch_max_length_in_bytes - batch_length_in_bytes))) {
+			return 0;
+		} else {
+			//do nothing
+		}
+		batch_length_in_bytes = batch_length_in_bytes + command_length;
+		(*command_count_ptr)++;
+	}
+
+	return batch_length_in_bytes;
+}
+
+
+//12)Baud rate negotiation
+/*
+ * The master proposes a baud rate (command 0xd7), then both sides confirm it with a probe frame. We go back to the old baud rate if the probe does not make it.
+ *
+ * 1)We check the baud rate and ACK it at the old baud rate.
+ * 2)We switch the baud rate and wait for the probe of the master: command 0xd7, followed by 0xFF and the probe pattern.
+ * 3)If the probe is intact and came without Rx errors, we send the pattern back in an ACK at the new baud rate. The master keeps the new baud rate once it has the ACK.
+ * 4)If the probe is broken or late, we go back to the old baud rate and send a NACK there.
+ *
+ * Note: the UART1 may be clocked from SYSCLK for the fastest baud rates (see UART1BRRSet).
+ * Note: if the link gets noisy later on, we step down on our own (see UART1RxMessageWait and the transfer report).
+ *
+ * The function gives back the error code (see enum_Boot_Error_Code).
+ *
+ * */
+
+uint8_t BaudNegotiate (uint8_t baud_selector) {
+
+	uint8_t baud_error = Boot_Error_None;
+
+	//1)
+	if (baud_selector > Baud_1000000) {
+		baud_error = Boot_Error_Baud_Invalid;
+		UART1TxResponse(UART_response_nack, &baud_error, 1);
+		return baud_error;
+	} else {
+		//do nothing
+	}
+
+	enum_UART_Baud_Selector previous_baud_rate = UART1_baud_rate;
+	UART1TxResponse(UART_response_ack, &baud_selector, 1);
+
+	//2)
+	UART1BaudSwitch((enum_UART_Baud_Selector)baud_selector);						//the ACK goes out first
+	enum_Yes_No_Selector probe_received = UART1RxMessageWait(Baud_probe_timeout_in_ms);
+
+	//3)
+	if ((probe_received == Yes) && (UART1_Rx_error_counter == 0) && (Rx_Command_buf[0] == 0xd7) && (Rx_Command_buf[1] == 0xFF) &&
+		(memcmp(&Rx_Command_buf[2], Baud_probe_pattern, sizeof(Baud_probe_pattern)) == 0)) {
+		UART1TxResponse(UART_response_ack, (uint8_t*)Baud_probe_pattern, sizeof(Baud_probe_pattern));
+		BOOT_LOG("Baud rate %d selected \r\n", baud_selector);
+
+	//4)
+	} else {
+		UART1BaudSwitch(previous_baud_rate);
+		baud_error = Boot_Error_Baud_Probe;
+		UART1TxResponse(UART_response_nack, &baud_error, 1);
+		BOOT_LOG("Baud rate probe failed \r\n");
+	}
+
+	return baud_error;
+}
+
+
+//13)Node commands
+/*
+ * We run command 0xd8. Several bootloaders can share one bus, each picks up the command frames sent to its node address or to the broadcast address (see UART1RxMessageWait).
+ * The byte after the command selects what we do:
+ *
+ * 0x00 - We report the node: the node address, if it has been configured (1 byte each), the unique ID of the part (12 bytes), the CRC of the last commit (4 bytes, LSB first),
+ * 		  the error code of the last commit (Boot_Error_No_Commit if there was none since the start of the bootloader) and the active slot.
+ * 0x01 - We set the node address. The command is followed by the unique ID of the part (12 bytes) and the new address (1 byte). 0x00 goes back to the address derived from the unique ID.
+ * 		  The address is only set if the unique ID is ours, so the command can be sent in a broadcast frame to give each node on the bus an address of its own.
+ * 		  The ACK holds the address we now listen to. Once an address is configured, frames without a node address are dropped (see UART1RxMessageWait).
+ * 0x02 - We send the last transfer report again (see SendTransferReport). If no transfer has ended yet, the counters are sent as they are now.
+ *
+ * The function gives back the error code (see enum_Boot_Error_Code).
+ *
+ * Note: a broadcast update is a regular update sent in broadcast frames. None of the bootloaders respond to it, the master collects the result of each node afterwards with 0x02 and 0x00.
+ * Note: unknown selectors and an unknown unique ID are NACKed with Boot_Error_Node_Address. A master that sends 0x01 in a broadcast frame checks the result with 0x00 at the new address.
+ *
+ * */
+
+uint8_t NodeCommand (uint8_t* command_ptr) {
+
+	uint8_t node_error = Boot_Error_None;
+	uint8_t unique_id [12];
+
+	NodeUniqueIDRead(unique_id);
+
+	if (command_ptr[1] == 0x00) {
+		uint8_t response_payload[Node_info_size_in_bytes];
+		response_payload[0] = UART1_node_address;
+		response_payload[1] = NodeAddressConfigured();
+		memcpy(&response_payload[2], unique_id, 12);
+		response_payload[14] = Commit_crc_last & 0xFF;
+		response_payload[15] = (Commit_crc_last >> 8) & 0xFF;
+		response_payload[16] = (Commit_crc_last >> 16) & 0xFF;
+		response_payload[17] = Commit_crc_last >> 24;
+		response_payload[18] = Commit_error_last;
+		response_payload[19] = App_active_slot;
+		UART1TxResponse(UART_response_ack, response_payload, Node_info_size_in_bytes);
+
+	} else if ((command_ptr[1] == 0x01) && (memcmp(&command_ptr[2], unique_id, 12) == 0) && (command_ptr[14] != UART_node_broadcast)) {
+		NodeAddressSave(command_ptr[14]);
+		UART1_node_address = NodeAddressLoad();
+		if (NodeAddressConfigured() == Yes) {
+			UART1_Bus_shared = Yes;
+		} else {
+			//do nothing
+		}
+		BOOT_LOG("Node address set to %d \r\n", UART1_node_address);
+		UART1TxResponse(UART_response_ack, &UART1_node_address, 1);
+
+	} else if (command_ptr[1] == 0x02) {
+		if (Transfer_report_valid == Yes) {
+			UART1TxResponse(UART_response_report, Transfer_report_last, Transfer_report_size_in_bytes);
+		} else {
+			SendTransferReport(UART1_baud_rate);
+		}
+
+	} else {
+		node_error = Boot_Error_Node_Address;
+		UART1TxResponse(UART_response_nack, &node_error, 1);
+	}
+
+	return node_error;
+}
+
+
+//14)Rx ring overrun check
+/*
+ * We count the pages the DMA has started loading again before they were handed over (see ProgramRxRingPage).
+ * Once a page is handed over, the main loop has read it and the rest is up to its half-page writes. Those are checked against the FLASH when the slot is released (see ReleaseRxRingPages).
+ *
+ * 1)We take the producer index and the DMA position together, the same way as the fill level does (see RxRingAvailablePages).
+ * 2)We go through the pages not yet checked, oldest first. A page the DMA has loaded at least one byte over, one ring later, is counted as overwritten.
+ * 		Pages that have been handed over are done. We stop at the first page that is neither.
+ *
+ * Note: a page is only counted if the DMA has reached it while it was still waiting in the ring. It is certainly overwritten then.
+ * Note: must only be called while the DMA runs or right after it has been stopped. The producer index is moved past the DMA position for the last slots afterwards.
+ * Note: the DMA IRQ can't do this. On a HT/TC, the DMA has only just entered the half of the unprocessed slots, most of them are handed over before it gets to them.
+ *
+ * */
+
+void RxRingOverrunCheck (void) {
+
+	//1)
+	uint16_t produced_pages;
+	uint16_t DMA_position;
+	do {
+		produced_pages = Rx_ring_produced_pages;
+		DMA_position = DMAChannelUART1RxPosition();
+	} while (produced_pages != Rx_ring_produced_pages);									//the DMA IRQ has stepped the index in the meantime
+
+	uint16_t Rx_ring_slot_size_in_bytes = 4 * Rx_ring_slot_size_in_words;
+	uint16_t last_half_position = (produced_pages % Rx_ring_depth_in_pages) * Rx_ring_slot_size_in_bytes;
+	uint16_t loaded_bytes;																//bytes loaded since the last HT/TC
+	if (DMA_position >= last_half_position) {
+		loaded_bytes = DMA_position - last_half_position;
+	} else {																			//the DMA has wrapped around, but the TC IRQ hasn't been served yet
+		loaded_bytes = DMA_position + DMA_transfer_width_UART1 - last_half_position;
+	}
+	uint16_t loaded_pages = produced_pages + (loaded_bytes / Rx_ring_slot_size_in_bytes);
+
+	//2)
+	while (Rx_ring_checked_pages != loaded_pages) {
+		if ((int16_t)(Rx_ring_checked_pages - Rx_ring_submitted_pages) < 0) {			//the page has been handed over
+			Rx_ring_checked_pages++;
+			continue;
+		} else {
+			//do nothing
+		}
+
+		int32_t next_lap_position = (int16_t)(Rx_ring_checked_pages + Rx_ring_depth_in_pages - produced_pages) * (int32_t)Rx_ring_slot_size_in_bytes;
+																						//where the DMA starts loading the slot again, from the last HT/TC
+		if (next_lap_position < loaded_bytes) {											//the DMA has reached the page
+			Rx_ring_overflow_counter++;
+			Rx_ring_slot_overwritten[Rx_ring_checked_pages % Rx_ring_depth_in_pages] = Yes;
+																						//Note: we don't skip it. The page addresses in the FLASH stay aligned, though the app will be corrupted.
+			Rx_ring_checked_pages++;
+		} else {
+			break;																		//we look again on the next turn
+		}
+	}
+}
+
+
+//15)Rx ring page hand-over
+/*
+ * We hand a page over to the NVM straight from its slot in the Rx ring.
+ * The half-page writes read the page from the slot once the NVM controller gets to them, so the DMA may still overwrite it in the meantime.
+ * We keep the CRC32 of the page as we have handed it over. Once the slot is released, it is checked against the FLASH (see ReleaseRxRingPages).
+ *
+ * Note: pages that are skipped or rejected are not written from the slot, there is nothing to check.
+ * Note: a page the DMA had already reached before the hand-over has been counted (see RxRingOverrunCheck). It is not checked again.
+ *
+ * */
+
+void ProgramRxRingSlotPage (uint32_t page_addr_in_FLASH, uint32_t* page_data_ptr) {
+
+	uint8_t slot = Rx_ring_submitted_pages % Rx_ring_depth_in_pages;
+	uint32_t page_crc = CRCFinal(CRCCalculate(CRC_start_state, page_data_ptr, Boot_page_size_in_words));
+	uint16_t page_written_before = page_written_counter;
+
+	ProgramPage(page_addr_in_FLASH, page_data_ptr);
+
+	if ((page_written_counter != page_written_before) && (Rx_ring_slot_overwritten[slot] == No)) {
+		Rx_ring_slot_page_addr[slot] = page_addr_in_FLASH;
+		Rx_ring_slot_page_crc[slot] = page_crc;
+	} else {
+		//do nothing
+	}
+}
@@ -15,20 +15,74 @@
 
 #include "main.h"
 #include "BootAppManager.h"
+#include "BootDMADriver_STM32L0x3.h"
+#include "BootUARTDriver_STM32L0x3.h"
+#include "BootStreamDecoder.h"
+#include "BootProfiler.h"
+#include "BootBenchmark.h"
+#include "BootImageAuth.h"
 
 //LOCAL CONSTANT
+static const uint8_t Boot_protocol_version = 4;						//version of the command set, published by command 0xd2
+static const uint16_t Addressed_page_end_of_transfer = 0xFFFF;		//page index that ends a transfer of addressed pages
+static const uint8_t Baud_probe_pattern [8] = {0x55, 0xAA, 0x00, 0xFF, 0x0F, 0xF0, 0xCC, 0x33};	//what the master sends to confirm a new baud rate (see command 0xd7)
+static const uint32_t Baud_probe_timeout_in_ms = 500;				//how long we wait for the probe at the new baud rate
+static const int Baud_switch_settle_in_ms = 20;						//how long we wait after a step down for the master to follow
+#define Transfer_report_size_in_bytes 27
+#define Node_info_size_in_bytes 20
 
 //LOCAL VARIABLE
 
 //EXTERNAL VARIABLE
-extern uint32_t Rx_Message_buf [64];
+extern uint32_t Rx_Message_buf [Rx_Message_buf_size_in_words];
+extern uint8_t Rx_Command_buf [Rx_Command_buf_size_in_bytes];
 extern enum_Yes_No_Selector UART1_DMA_active;
 extern enum_Yes_No_Selector UART1_Message_Received;
-extern uint8_t page_counter;
-extern enum_First_Second_Selector Machine_Code_Page_Received;
+extern uint16_t page_counter;
+extern uint16_t page_written_counter;
+extern uint16_t page_skipped_counter;
+extern uint16_t page_rejected_counter;
+extern uint8_t Rx_ring_slot_size_in_words;
+extern enum_Programmer_Mode_Selector Programmer_Mode;
+extern uint16_t DMA_transfer_width_UART1;
+extern volatile uint16_t Rx_ring_produced_pages;
+extern volatile uint16_t Rx_ring_consumed_pages;
+extern volatile uint16_t Rx_ring_submitted_pages;
+extern volatile uint16_t Rx_ring_overflow_counter;
+extern volatile uint16_t Rx_ring_missed_events_counter;
+extern volatile uint8_t Rx_ring_DMA_next_half;
+extern volatile uint16_t Cmd_frames_dropped_counter;
+extern volatile uint16_t UART1_Rx_error_counter;
+extern enum_UART_Baud_Selector UART1_baud_rate;
+extern uint8_t UART1_node_address;
 extern uint32_t flash_page_addr;
+extern uint32_t flash_erased_end_addr;
+extern uint8_t App_active_slot;
+extern uint8_t App_update_slot;
+extern uint32_t App_update_start_addr;
+extern uint32_t App_update_end_addr;
+extern volatile uint16_t NVM_error_counter;
+extern volatile uint32_t NVM_last_error_flags;
+extern uint32_t Image_crc_state;
+extern uint32_t Image_crc_length_in_bytes;
+extern enum_Yes_No_Selector Image_crc_valid;
 
 //FUNCTION PROTOTYPES
 void UART1_External_Boot_Controller (void);
+void ProgramRxRingPage (uint16_t slot_length_in_bytes);
+void ReleaseRxRingPages (void);
+uint16_t RxRingAvailablePages (void);
+void RxRingOverrunCheck (void);
+void ProgramRxRingSlotPage (uint32_t page_addr_in_FLASH, uint32_t* page_data_ptr);
+void ProgramPage (uint32_t page_addr_in_FLASH, uint32_t* page_data_ptr);
+void SendTransferReport (enum_UART_Baud_Selector next_baud_rate);
+void ProgrammerModeEnable (enum_Programmer_Mode_Selector programmer_mode_selector);
+uint8_t CommitApp (uint32_t image_length_in_bytes, uint32_t image_crc, uint32_t image_version);
+void ProgramRecordPage (void);
+uint8_t ActivateAppSlot (uint8_t app_slot);
+uint8_t BatchCommandLength (uint8_t command);
+uint8_t BatchCheck (uint8_t* batch_ptr, uint8_t batch_max_length_in_bytes, uint8_t* command_count_ptr);
+uint8_t BaudNegotiate (uint8_t baud_selector);
+uint8_t NodeCommand (uint8_t* command_ptr);
 
 #endif /* INC_EXTERNALCONTROLLER_CUSTOM_H_ */
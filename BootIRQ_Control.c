@@ -17,66 +17,185 @@
  * DMA IRQ for the UART1 Rx on channel 3.
  * Added TIM2 timer interrupt to count seconds.
  *
+ * v.1.1
+ * DMA IRQ does not restart the DMA anymore (circular mode).
+ * DMA IRQ steps the producer index of the multi-page Rx ring and counts overflows.
+ *
+ * v.1.2
+ * DMA and UART1 IRQs run from RAM, together with a copy of the vector table.
+ * This allows the Rx ring to be serviced while the NVM is busy erasing or programming.
+ *
+ * v.1.3
+ * UART1 IRQ logs the end of command frames captured by the DMA.
+ * DMA IRQ tolerates the main loop being ahead of the producer index.
+ *
+ * v.1.4
+ * DMA IRQ also serves the UART1 Tx channel (channel 2) of the responses.
+ * DMA IRQ only clears the flags it has seen.
+ *
+ * v.1.5
+ * Added the DMA IRQ of the UART2 log channel (channel 4).
+ *
+ * v.1.6
+ * DMA IRQ timestamps the arrival of the Rx ring slots on HT/TC (see BootProfiler).
+ *
+ * v.1.7
+ * DMA IRQ checks the HT/TC events against the half of the Rx ring the DMA is loading. Events that were merged into a flag still pending are not lost anymore.
+ * Events served late (together with the next one) are counted as missed deadlines.
+ *
+ * v.1.8
+ * UART1 IRQ counts the framing and noise errors on UART1 Rx (see UART1BaudSwitch).
+ *
+ * v.1.9
+ * TIM2 IRQ only flags the end of the boot window. The app is started from the main loop.
+ *
+ * v.1.10
+ * TIM2 IRQ also takes the compare at the end of the sniff window (see BootStartSelect). It only wakes up the core.
+ *
+ * v.1.11
+ * DMA IRQ does not count the overwritten pages of the Rx ring anymore. It could only tell the pages at risk. The main loop counts the pages the DMA has actually overwritten (see RxRingOverrunCheck).
+ *
  */
 
 #include "BootClockDriver_STM32L0x3.h"
 #include "BootIRQ_Control.h"
+#include "BootUARTDriver_STM32L0x3.h"
+#include "BootProfiler.h"
 #include "main.h"
 #include "stdio.h"
 
+__attribute__((aligned(256))) static uint32_t Boot_RAM_vector_table[Boot_vector_table_size_in_words];
+																				//Note: VTOR needs the table to be aligned to the next power of 2 of its size (192 bytes -> 256 bytes)
+
 //1) DMA IRQ on UART1
-void DMA1_Channel2_3_IRQHandler (void){
+BOOT_RAM_FUNC void DMA1_Channel2_3_IRQHandler (void){
 	/*
-	 * IRQ activated on half transmission, full transmission and error.
+	 * IRQ activated on half transmission, full transmission and error of the Rx channel (channel 3) and on the end of a transfer on the Tx channel (channel 2).
 	 *
-	 * 1)We check, what activated the IRQ.
-	 * 2)We pull the appropriate flag according to the activation.
-	 * 3)We reset the IRQ.
+	 * 1)We check, what activated the IRQ. A finished (or failed) Tx transfer is handed over to the UART driver.
+	 * 2)We check the HT/TC events against the half of the ring the DMA is loading now. Every IRQ should serve exactly one half, anything more is a missed deadline.
+	 * 3)We timestamp the arrival of the slots and step the producer index of the Rx ring by half the ring for every half that is done.
+	 * 4)We reset the IRQ.
 	 *
 	 * Note: we want an indifferent FLASH loader, not one that is not controlled differently depending on if we are at the halfway or end point.
+	 * Note: the IRQ only writes the producer index and the missed events counter. The consumer index is only written by the main loop.
+	 * Note: the pages the DMA overwrites before they are in the FLASH are counted by the main loop (see RxRingOverrunCheck). On a HT/TC, the DMA has only just entered the half they are in.
+	 * Note: the IRQ runs from RAM so it can be served while the NVM is busy. It must not call anything in FLASH on the normal path.
+	 * Note: the Rx channel flags are also set in command and control mode, where its IRQs are off. We ignore them then.
+	 * Note: we only clear the flags we have seen. A HT coming in while we are in the IRQ would otherwise be lost.
+	 * Note: a flag that is set again before we clear it is a single event. If the IRQ is late by a full half of the ring, only the DMA position tells us that one more half is done.
+	 * 		We thus take the flags and the position together, and read them again if the DMA has passed a half in between.
 	 *
 	 * */
-	if ((DMA1->ISR & (1<<10)) == (1<<10)) {										//if we had the half transmission triggered
-		Machine_Code_Page_Received = First;
-	} else if ((DMA1->ISR & (1<<9)) == (1<<9)) {								//if we had full transmission triggered
-		Machine_Code_Page_Received = Second;
-
-		//Note: in order to reset the transfer width, we need to fully reinitialize the DMA (or use circular mode). The transfer width register is a DO NOT TOUCH register when the DMA is active.
-
-		USART1->CR1 &= ~(1<<0);													//disable the UART1
-		DMA1_Channel3->CCR &= ~(1<<0);											//we disable the DMA channel
-																				//we do not need to reset the DMA memory address to the beginning of the Rx buffer, it should have not changed during the DMA running
-		DMA1_Channel3->CNDTR |= ((DMA_transfer_width_UART1)<<0);				//we reload the original transfer width
-																				//Note: according to the refman 270, only the CNDTR register needs to be reset
-		DMA1_Channel3->CCR |= (1<<0);											//we re-enable the DMA channel
-		USART1->CR1 |= (1<<0);													//we re-enable the UART1
-
-	} else if ((DMA1->ISR & (1<<11)) == (1<<11)){								//if we had an error
-		printf("DMA transmission error!");
+
+	//1)
+	uint32_t DMA_flags;
+	uint16_t DMA_position;
+	do {
+		DMA_flags = DMA1->ISR;
+		DMA_position = DMA_transfer_width_UART1 - DMA1_Channel3->CNDTR;				//bytes loaded since the DMA last wrapped around
+	} while (((DMA1->ISR ^ DMA_flags) & (3<<9)) != 0);								//HT or TC has come in while we were reading the position
+
+	if ((DMA_flags & ((1<<5) | (1<<7))) != 0) {										//Tx channel is done (or has failed, in which case we drop what was sent)
+		DMA1->IFCR = (1<<4);														//we remove all the interrupt flags from Channel 2
+		UART1TxDMAComplete();
+	} else {
+		//do nothing
+	}
+
+	if ((DMA1_Channel3->CCR & (1<<1)) == 0) {										//the Rx channel IRQs are off
+		DMA_flags &= ~(0xF<<8);
+	} else {
+		//do nothing
+	}
+
+	uint8_t ring_halves_ready = 0;
+	if ((DMA_flags & (1<<10)) == (1<<10)) ring_halves_ready++;						//if we had the half transmission triggered
+	if ((DMA_flags & (1<<9)) == (1<<9)) ring_halves_ready++;							//if we had full transmission triggered
+																						//Note: both can be set if the IRQ was blocked for longer than half the ring
+
+	if (ring_halves_ready != 0) {
+
+		//2)
+		uint8_t DMA_half = 0;															//the half the DMA is loading now
+		if (DMA_position >= (DMA_transfer_width_UART1 / 2)) DMA_half = 1;
+		if ((Rx_ring_DMA_next_half ^ (ring_halves_ready & 1)) != DMA_half) {			//the flags are one half short, a HT/TC has been merged into a flag that was still pending
+			ring_halves_ready++;
+		} else {
+			//do nothing
+		}
+		Rx_ring_missed_events_counter = Rx_ring_missed_events_counter + ring_halves_ready - 1;
+																						//Note: a full ring of missed events can't be seen.
+
+		//3)
+		for (uint8_t i = 0; i < ring_halves_ready; i++) {
+			if (Rx_ring_DMA_next_half == 0) {
+				ProfilerRxRingSlotsArrived(0);											//first half of the ring
+			} else {
+				ProfilerRxRingSlotsArrived(Rx_ring_depth_in_pages / 2);					//second half of the ring
+			}
+			Rx_ring_DMA_next_half ^= 1;
+		}
+		Rx_ring_produced_pages = Rx_ring_produced_pages + ring_halves_ready * (Rx_ring_depth_in_pages / 2);
+
+		//Note: the DMA is in circular mode. CNDTR is reloaded by hardware and the channel keeps on running, so there is nothing to reset here.
+
+	} else if ((DMA_flags & (1<<11)) == (1<<11)){								//if we had an error
+		BOOT_LOG("DMA transmission error!");
 		while(1);
 	} else {
 		//do nothing
 	}
-	page_counter++;																//we count, how many times the IRQ is engaged (and thus count the number of pages we are updating)
-	DMA1->IFCR |= (1<<8);														//we remove all the interrupt flags from Channel 3
+
+	//4)
+	DMA1->IFCR = DMA_flags & (0xE<<8);											//we remove the interrupt flags of Channel 3 we have seen
 
 }
 
 
 //2) UART1 IRQ
-void USART1_IRQHandler(void) {
+BOOT_RAM_FUNC void USART1_IRQHandler(void) {
 	/*
 	 * This IRQ currently only activates on the detection of an idle frame.
 	 * Idle frames are the indicators that we don't have incoming data anymore.
 	 *
+	 * In command and control mode, every idle line ends a command frame. We log where the DMA was in the Rx buffer at that moment.
+	 * In programmer mode, we count idle frames to end the machine code transfer.
+	 *
 	 * Note: since we are parallel receiving data AND doing other stuff, we MUST leave some time for any concurrent process to activate or conclude.
 	 * Note: with an idle frame counter set to 2, we have a delay of roughly 1 ms.
+	 * Note: the IRQ runs from RAM so it can be served while the NVM is busy.
+	 * Note: framing and noise errors also activate the IRQ. We only count them here, a link that has too many of them is given up by the main loop (see UART1RxMessageWait).
 	 */
 
-	Idle_frame_counter++;
-	if(Idle_frame_counter >=2){
-		UART1_Message_Received = Yes;
-		Idle_frame_counter = 0;
+	if ((USART1->ISR & ((1<<1) | (1<<2))) != 0) {									//FE or NF
+		UART1_Rx_error_counter++;
+		USART1->ICR |= (1<<1) | (1<<2);												//we clear the error flags
+		if ((USART1->ISR & (1<<4)) == 0) {											//no idle line to serve
+			return;
+		} else {
+			//do nothing
+		}
+	} else {
+		//do nothing
+	}
+
+	if (UART1_Command_Capture_active == Yes) {
+		uint16_t frame_end_position = DMA_transfer_width_UART1 - DMA1_Channel3->CNDTR;
+		if (frame_end_position == DMA_transfer_width_UART1) {							//CNDTR has not yet been reloaded
+			frame_end_position = 0;
+		} else {
+			//do nothing
+		}
+		Cmd_frame_end_position[Cmd_frames_produced % Cmd_frame_queue_depth] = frame_end_position;
+		Cmd_frames_produced++;
+																						//Note: if frames are not picked up fast enough, the oldest ones are overwritten (see UART1RxMessage)
+	} else {
+		Idle_frame_counter++;
+		if(Idle_frame_counter >=2){
+			UART1_Message_Received = Yes;
+			Idle_frame_counter = 0;
+		}
 	}
 	USART1->ICR |= (1<<4);														//Idle detect flag clearing
 }
@@ -84,16 +203,26 @@ void USART1_IRQHandler(void) {
 //3) TIM2 IRQ
 void TIM2_IRQHandler(void) {
 
+	  if ((TIM2->SR & (1<<1)) != 0) {											//CC1 - the end of the sniff window
+		  TIM2->SR &= ~(1<<1);													//nothing else to do, the core is awake
+	  } else {
+		  //do nothing
+	  }
+
+	  if ((TIM2->SR & (1<<0)) == 0) {											//no update, the boot window goes on
+		  return;
+	  } else {
+		  //do nothing
+	  }
+
 	  if (seconds_counter >= Boot_transit_in_sec) {
 
-		printf("De-initializing bootloader drivers...\r\n");
-		UART1Deinit();													//we deinit the UART1 driver
-		BootTIM2_DEINT();												//we deinit the TIM2 driver
-																				//Note: it is highyl recommended to deinit all drivers before jumping to the app
+		Boot_window_expired = Yes;												//the main loop starts the app (see main.c)
+																				//Note: we don't jump from here, the app would start in handler mode with TIM2 still active in the NVIC
 		seconds_counter = 0;
-		printf("Jumping to app...\r\n");
-	  	GoToApp();																//jumping to the app should unblock the micro from waiting for a reply
 
+	  } else {
+		  //do nothing
 	  }
 
 	  seconds_counter++;														//we use the seconds counter to count until 3
@@ -119,3 +248,55 @@ void BootTIM2IRQPriorEnable(void) {
 	NVIC_SetPriority(TIM2_IRQn, 1);												//IRQ priority for channel 2 & 3
 	NVIC_EnableIRQ(TIM2_IRQn);													//IRQ enable for channel 2 & 3
 }
+
+//7)Vector table to RAM
+void BootVectorTableToRAM(void) {
+	/*
+	 * The vector fetch of an IRQ happens from the vector table. If the table is in FLASH, the fetch stalls while the NVM is busy.
+	 * We copy the table to RAM and point the VTOR to it. The RAM-resident IRQs (DMA and UART1) are then served immediately during an erase or a write.
+	 * IRQs that run from FLASH (TIM2, SysTick) still stall until the NVM is done. Since they have a higher priority, they also block the RAM IRQs for that time.
+	 *
+	 * 1)Copy the currently active vector table
+	 * 2)Switch the VTOR over
+	 *
+	 * Note: this should be called before the bootloader IRQs are enabled. IRQs are masked while the VTOR is switched.
+	 * Note: the app must set its own VTOR upon startup.
+	 */
+
+	//1)
+	uint32_t* active_vector_table_ptr = (uint32_t*)SCB->VTOR;
+	for(uint8_t i = 0; i < Boot_vector_table_size_in_words; i++){
+		Boot_RAM_vector_table[i] = active_vector_table_ptr[i];
+	}
+
+	//2)
+	__disable_irq();
+	SCB->VTOR = (uint32_t)Boot_RAM_vector_table;
+	__DSB();																	//we ensure the VTOR is updated before any IRQ is taken
+	__enable_irq();
+}
+
+
+//8)DMA IRQ on UART2 log
+BOOT_RAM_FUNC void DMA1_Channel4_5_6_7_IRQHandler (void){
+	/*
+	 * IRQ activated at the end (or on an error) of a transfer on the log channel.
+	 * We hand the next part of the log ring over to the DMA.
+	 *
+	 * Note: runs from RAM, the log keeps on going out while the NVM is busy.
+	 *
+	 * */
+
+	if ((DMA1->ISR & ((1<<13) | (1<<15))) != 0) {									//TC or error on channel 4 - we drop what failed
+		DMA1->IFCR = (1<<12);														//we remove all the interrupt flags from Channel 4
+		UART2LogDMAComplete();
+	} else {
+		//do nothing
+	}
+}
+
+
+//9)DMA log IRQ priority
+void BootDMALogIRQPriorEnable(void) {
+	NVIC_SetPriority(DMA1_Channel4_5_6_7_IRQn, 3);								//the log goes last
+}
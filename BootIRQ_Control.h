@@ -18,6 +18,7 @@
 #include "stm32l053xx.h"
 
 //LOCAL CONSTANT
+#define Boot_vector_table_size_in_words 48									//16 core exceptions and 32 IRQs on the L0
 static const uint8_t Boot_transit_in_sec = 5;								//defines how many TIM2 IRQs we wait before leaving the bootloader
 
 //LOCAL VARIABLE
@@ -25,15 +26,21 @@ static uint8_t Idle_frame_counter = 0;
 
 //EXTERNAL VARIABLE
 extern enum_Yes_No_Selector UART1_Message_Received;
-extern enum_Yes_No_Selector UART1_Message_Started;
-extern enum_First_Second_Selector Machine_Code_Page_Received;
+extern enum_Yes_No_Selector UART1_Command_Capture_active;
+extern volatile uint16_t Cmd_frame_end_position [Cmd_frame_queue_depth];
+extern volatile uint8_t Cmd_frames_produced;
 extern uint16_t DMA_transfer_width_UART1;
-extern uint8_t page_counter;
+extern volatile uint16_t Rx_ring_produced_pages;
+extern volatile uint16_t Rx_ring_missed_events_counter;
+extern volatile uint8_t Rx_ring_DMA_next_half;
 extern uint8_t seconds_counter;
+extern volatile enum_Yes_No_Selector Boot_window_expired;
 
 //FUNCTION PROTOTYPES
 void UART1IRQPriorEnable(void);
 void BootDMAIRQPriorEnable(void);
+void BootDMALogIRQPriorEnable(void);
 void BootTIM2IRQPriorEnable(void);
+void BootVectorTableToRAM(void);
 
 #endif /* INC_BOOTIRQ_CONTROL_CUSTOM_H_ */
@@ -0,0 +1,246 @@
+/*
+ *  Created on: 14 Oct 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_Bootloader
+ *  Processor: STM32L053R8
+ *  Program version: 1.0
+ *  File: BootImageAuth.c
+ *  Modified from: N/A
+ *  Change history:
+ *
+ * Code holds the authentication of the app images.
+ *
+ * v.1.0
+ * An image is authenticated with an HMAC-SHA256 tag, calculated by the master with a key it shares with the bootloader (see Boot_image_auth_key in BootConfig.h).
+ * The tag covers the image padded with 0x00 to a full page, followed by its length and its version (4 bytes each, LSB first) - the same values the commit carries.
+ * The pages are hashed one by one as they are programmed (see ProgramPage), so the check at the commit only has to hash its last block.
+ * If the pages did not come in order, the image is hashed from the FLASH at the commit instead.
+ * The tag is sent to the bootloader by command 0xd9 (see the external controller).
+ *
+ * Note: there is no hardware hash on the L053, SHA-256 is done in software. A page of 128 bytes takes roughly 0.25 ms at 32 MHz, a lot less than the page takes to come in.
+ *
+ */
+
+#include "BootImageAuth.h"
+
+
+#define IMAGE_AUTH_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))			//rotate right, not a function so the block hash does not call into the FLASH
+
+#if Boot_image_auth_enable
+static const uint8_t Image_auth_key [32] = Boot_image_auth_key;
+#else
+static const uint8_t Image_auth_key [32] = {0};							//not used, the commit does not check the tag
+#endif
+
+static const uint32_t Image_auth_start_state [8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+static uint32_t Image_auth_round_constants [64] = {						//not const - the table is placed in RAM together with ImageAuthBlock
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static uint32_t Image_auth_state [8];											//the running hash of the image (inner hash of the HMAC)
+static uint32_t Image_auth_length_in_bytes = 0;								//how much of the image the running hash covers
+static uint8_t Image_auth_tag [Image_auth_tag_size_in_bytes];					//the tag sent by the master
+static enum_Yes_No_Selector Image_auth_tag_set = No;
+
+
+//1)Block hash
+/*
+ * We hash one block of 64 bytes into the state (the SHA-256 compression function).
+ * The 64 words of the message schedule are calculated on the fly in a window of 16 words, to keep the stack small.
+ *
+ * */
+
+BOOT_RAM_FUNC void ImageAuthBlock (uint32_t* hash_state_ptr, uint8_t* block_ptr) {
+
+	uint32_t schedule [16];
+	uint32_t a = hash_state_ptr[0];
+	uint32_t b = hash_state_ptr[1];
+	uint32_t c = hash_state_ptr[2];
+	uint32_t d = hash_state_ptr[3];
+	uint32_t e = hash_state_ptr[4];
+	uint32_t f = hash_state_ptr[5];
+	uint32_t g = hash_state_ptr[6];
+	uint32_t h = hash_state_ptr[7];
+
+	for (uint8_t i = 0; i < 16; i++) {
+		schedule[i] = ((uint32_t)block_ptr[4 * i] << 24) | ((uint32_t)block_ptr[(4 * i) + 1] << 16) | ((uint32_t)block_ptr[(4 * i) + 2] << 8) | block_ptr[(4 * i) + 3];
+																						//SHA-256 reads the words MSB first
+	}
+
+	for (uint8_t i = 0; i < 64; i++) {
+		if (i >= 16) {
+			uint32_t word_15 = schedule[(i + 1) & 15];
+			uint32_t word_2 = schedule[(i + 14) & 15];
+			schedule[i & 15] = schedule[i & 15] + schedule[(i + 9) & 15] +
+							   (IMAGE_AUTH_ROTR(word_15, 7) ^ IMAGE_AUTH_ROTR(word_15, 18) ^ (word_15 >> 3)) +
+							   (IMAGE_AUTH_ROTR(word_2, 17) ^ IMAGE_AUTH_ROTR(word_2, 19) ^ (word_2 >> 10));
+		} else {
+			//do nothing
+		}
+		uint32_t t1 = h + (IMAGE_AUTH_ROTR(e, 6) ^ IMAGE_AUTH_ROTR(e, 11) ^ IMAGE_AUTH_ROTR(e, 25)) + ((e & f) ^ (~e & g)) + Image_auth_round_constants[i] + schedule[i & 15];
+		uint32_t t2 = (IMAGE_AUTH_ROTR(a, 2) ^ IMAGE_AUTH_ROTR(a, 13) ^ IMAGE_AUTH_ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	hash_state_ptr[0] += a;
+	hash_state_ptr[1] += b;
+	hash_state_ptr[2] += c;
+	hash_state_ptr[3] += d;
+	hash_state_ptr[4] += e;
+	hash_state_ptr[5] += f;
+	hash_state_ptr[6] += g;
+	hash_state_ptr[7] += h;
+}
+
+
+//2)Hash start
+/*
+ * We start the hash of a new image: the key XOR-ed with the inner pad (0x36) is the first block.
+ * This is done whenever an update is started (see ProgrammerModeEnable).
+ *
+ * */
+
+static void ImageAuthKeyBlock (uint32_t* hash_state_ptr, uint8_t pad) {
+
+	uint8_t key_block [Image_auth_block_size_in_bytes];
+
+	memcpy(hash_state_ptr, Image_auth_start_state, sizeof(Image_auth_start_state));
+	for (uint8_t i = 0; i < Image_auth_block_size_in_bytes; i++) {
+		key_block[i] = (i < sizeof(Image_auth_key)) ? (Image_auth_key[i] ^ pad) : pad;	//the key is zero padded to a full block
+	}
+	ImageAuthBlock(hash_state_ptr, key_block);
+	memset(key_block, 0, sizeof(key_block));											//we don't leave the key on the stack
+}
+
+void ImageAuthStart (void) {
+	ImageAuthKeyBlock(Image_auth_state, 0x36);
+	Image_auth_length_in_bytes = 0;
+}
+
+
+//3)Page hash
+/*
+ * We hash the next page of the image. The page must follow the ones already hashed (see ImageAuthLength).
+ *
+ * */
+
+void ImageAuthPage (uint32_t* page_data_ptr) {
+	for (uint16_t i = 0; i < Boot_page_size_in_bytes; i = i + Image_auth_block_size_in_bytes) {
+		ImageAuthBlock(Image_auth_state, (uint8_t*)page_data_ptr + i);
+	}
+	Image_auth_length_in_bytes = Image_auth_length_in_bytes + Boot_page_size_in_bytes;
+}
+
+uint32_t ImageAuthLength (void) {
+	return Image_auth_length_in_bytes;
+}
+
+
+//4)Tag
+/*
+ * We keep the tag the master has sent for the next commit. A tag is only good for one commit.
+ *
+ * */
+
+void ImageAuthTagSet (uint8_t* tag_ptr) {
+	memcpy(Image_auth_tag, tag_ptr, Image_auth_tag_size_in_bytes);
+	Image_auth_tag_set = Yes;
+}
+
+
+//5)Image check
+/*
+ * We check the image at the commit against the tag of the master.
+ *
+ * 1)If the running hash does not cover exactly the image, or it can't be trusted ("stream_valid" - the pages that went into the FLASH may not be the ones we hashed), we hash the image from the FLASH.
+ * 2)We add the length and the version of the image, with the SHA-256 padding, as the last block of the inner hash.
+ * 3)The outer hash is the key XOR-ed with the outer pad (0x5C), followed by the inner hash.
+ * 4)We compare the result with the tag in constant time, then throw the tag away.
+ *
+ * The function gives back Yes if the image is authentic.
+ *
+ * Note: the image length is always full pages, thus full blocks. The length and the version always fit into a single last block.
+ *
+ * */
+
+enum_Yes_No_Selector ImageAuthCheck (uint32_t image_start_addr, uint32_t image_length_in_bytes, uint32_t image_version, enum_Yes_No_Selector stream_valid) {
+
+	uint8_t last_block [Image_auth_block_size_in_bytes];
+	uint32_t outer_state [8];
+	uint32_t message_length_in_bits;
+	uint8_t tag_difference = 0;
+
+	if (Image_auth_tag_set == No) {
+		return No;
+	} else {
+		//do nothing
+	}
+
+	//1)
+	if ((stream_valid == No) || (Image_auth_length_in_bytes != image_length_in_bytes)) {
+		ImageAuthStart();
+		for (uint32_t page_addr = image_start_addr; page_addr < (image_start_addr + image_length_in_bytes); page_addr = page_addr + Boot_page_size_in_bytes) {
+			ImageAuthPage((uint32_t*)page_addr);
+		}
+	} else {
+		//do nothing
+	}
+
+	//2)
+	memset(last_block, 0, sizeof(last_block));
+	last_block[0] = image_length_in_bytes & 0xFF;
+	last_block[1] = (image_length_in_bytes >> 8) & 0xFF;
+	last_block[2] = (image_length_in_bytes >> 16) & 0xFF;
+	last_block[3] = image_length_in_bytes >> 24;
+	last_block[4] = image_version & 0xFF;
+	last_block[5] = (image_version >> 8) & 0xFF;
+	last_block[6] = (image_version >> 16) & 0xFF;
+	last_block[7] = image_version >> 24;
+	last_block[8] = 0x80;
+	message_length_in_bits = (Image_auth_block_size_in_bytes + image_length_in_bytes + 8) * 8;	//the key block, the image, the length and the version
+	last_block[60] = message_length_in_bits >> 24;
+	last_block[61] = (message_length_in_bits >> 16) & 0xFF;
+	last_block[62] = (message_length_in_bits >> 8) & 0xFF;
+	last_block[63] = message_length_in_bits & 0xFF;
+	ImageAuthBlock(Image_auth_state, last_block);
+	Image_auth_length_in_bytes = 0;														//the running hash is used up
+
+	//3)
+	ImageAuthKeyBlock(outer_state, 0x5C);
+	memset(last_block, 0, sizeof(last_block));
+	for (uint8_t i = 0; i < 32; i++) {
+		last_block[i] = (Image_auth_state[i / 4] >> (24 - (8 * (i % 4)))) & 0xFF;
+	}
+	last_block[32] = 0x80;
+	message_length_in_bits = (Image_auth_block_size_in_bytes + 32) * 8;					//the key block and the inner hash
+	last_block[62] = (message_length_in_bits >> 8) & 0xFF;
+	last_block[63] = message_length_in_bits & 0xFF;
+	ImageAuthBlock(outer_state, last_block);
+
+	//4)
+	for (uint8_t i = 0; i < Image_auth_tag_size_in_bytes; i++) {
+		tag_difference |= ((outer_state[i / 4] >> (24 - (8 * (i % 4)))) & 0xFF) ^ Image_auth_tag[i];
+	}
+	memset(Image_auth_tag, 0, sizeof(Image_auth_tag));
+	Image_auth_tag_set = No;
+
+	if (tag_difference == 0) {
+		return Yes;
+	} else {
+		return No;
+	}
+}
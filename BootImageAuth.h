@@ -0,0 +1,37 @@
+/*
+ *  Created on: 14 Oct 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_Bootloader
+ *  Processor: STM32L053R8
+ *  Header version: 1.0
+ *  File: BootImageAuth.h
+ *  Modified from: N/A
+ *  Change history: N/A
+ */
+
+#ifndef INC_BOOTIMAGEAUTH_CUSTOM_H_
+#define INC_BOOTIMAGEAUTH_CUSTOM_H_
+
+#include "stdint.h"
+#include "string.h"
+#include "main.h"
+
+//LOCAL CONSTANT
+#define Image_auth_tag_size_in_bytes 32										//HMAC-SHA256
+#define Image_auth_block_size_in_bytes 64									//SHA-256 works on blocks of 64 bytes - a page is always made of whole blocks (see BootConfig.h)
+
+//LOCAL VARIABLE
+
+//EXTERNAL VARIABLE
+
+//FUNCTION PROTOTYPES
+void ImageAuthStart (void);
+void ImageAuthPage (uint32_t* page_data_ptr);
+uint32_t ImageAuthLength (void);
+void ImageAuthTagSet (uint8_t* tag_ptr);
+enum_Yes_No_Selector ImageAuthCheck (uint32_t image_start_addr, uint32_t image_length_in_bytes, uint32_t image_version, enum_Yes_No_Selector stream_valid);
+
+//Note: the function below runs from RAM, not FLASH! It keeps hashing a page while the NVM is busy with the previous one.
+BOOT_RAM_FUNC void ImageAuthBlock (uint32_t* hash_state_ptr, uint8_t* block_ptr);
+
+#endif /* INC_BOOTIMAGEAUTH_CUSTOM_H_ */
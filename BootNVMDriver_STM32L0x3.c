@@ -13,17 +13,49 @@
  * v.1.0
  * Slightly rework version of the previously written NVM driver code.
  *
+ * v.1.1
+ * Erase, word and half-page write functions are placed in RAM.
+ * IRQs are only disabled while the half-page burst is being loaded.
+ *
+ * v.1.2
+ * Erase and half-page write are done through an NVM job queue. Jobs are started one after the other from the FLASH IRQ on EOP.
+ * NVM errors are counted and logged instead of blocking the code.
+ * The erase and half-page write functions are kept as blocking wrappers around the job queue.
+ *
+ * v.1.3
+ * Added a word write to the data EEPROM.
+ *
+ * v.1.4
+ * The duration of every erase and half-page write is measured from the start of the job to its EOP (see BootProfiler).
+ *
+ * v.1.5
+ * EEPROM word writes can also go through the NVM job queue, so they don't block the main loop.
+ *
+ * v.1.6
+ * The waits for the job queue do not rely on SysTick anymore to catch an IRQ that came in right before the WFI.
+ *
  */
 
 #include <BootNVMDriver_STM32L0x3.h>
 #include "main.h"
 
 
+typedef struct {
+	enum_NVM_Job_Type job_type;
+	uint32_t flash_addr;
+	uint32_t* data_ptr;																		//only used for half-page and EEPROM word writes
+} struct_NVM_Job;
+
+static struct_NVM_Job NVM_job_queue [NVM_job_queue_depth];									//job "n" sits at position "n % NVM_job_queue_depth"
+
+BOOT_RAM_FUNC static void NVMJobStart (struct_NVM_Job* job_ptr);
+
+
 //1)FLASH speed and interrupt initialisation
 void NVM_Init (void){
 	/*
 	 * Function to set NVM functions (FLASH, EEPROM and Option bytes).
-	 * We generally don't need to use this since FLASH is already properly initialised upon startup and we don't use EEPROM.
+	 * We generally don't need to use this since FLASH is already properly initialised upon startup. The EEPROM only holds the app descriptor (see BootAppManager).
 	 * Separate NVMs should be interacted with separately in code.
 	 * Note: even though all registers are called FLASH, it is actually NVM and not just FLASH.
 	 * Note: in EEPROM, a page and the word are the same size.
@@ -47,7 +79,7 @@ void NVM_Init (void){
 
 	//3)
 	FLASH->PECR &= ~(1<<16);					//EOP interrupt disabled (EOPIE)
-												//Note: since we do FLASH writing word by word, this interrupt will be mostly useless.
+												//Note: EOPIE is only enabled while there are jobs in the NVM job queue. The word write does not use it.
 	FLASH->PECR |= (1<<17);						//Error interrupt enabled (ERRIE)
 //	FLASH->PECR |= (1<<23);						//we would enable the NZDISABLE erase check (will only allow writing to FLASH if FLASH has been erased)
 												//on L0xx devices, it doesn't seem to exist
@@ -65,46 +97,16 @@ void FLASHErase_Page(uint32_t flash_page_addr) {
 	/* This function erases a full page of NVM. A page consists of 8 rows of 4 words (128 bytes or 1 kbit).
 	 * It is not possible to erase a smaller section of FLASH than a page.
 	 *
-	 * 1)Unlock the NVM control register PECR.
-	 * 2)Unlock FLASH memory.
-	 * 3)Remove readout protection (if necessary)
-	 * 4)Choose the erase action. Pick the FLASH as the target of the operation.
-	 * 5)Replace the word with the new one and wait until success flag is raised
-	 * 6)Close NVM and add readout protection
+	 * The erase is done through the NVM job queue (see NVMJobStart). The function blocks until the erase is done.
 	 *
-	 * Note: writing 0xCC to the RDPORT bricks the micro indefinitely!!!
-	 */
-
-	//1)
-	FLASH->PEKEYR = 0x89ABCDEF;					//PEKEY1
-	FLASH->PEKEYR = 0x02030405;					//PEKEY2
-
-	//2)
-	FLASH->PRGKEYR = 0x8C9DAEBF;				//RRGKEY1
-	FLASH->PRGKEYR = 0x13141516;				//RRGKEY2
-
-	//3)
-//	FLASH->OPTR = (0xAA<<0);					//we switch to Level 0 protection using RDPROT bits
-
-	//4)
-	FLASH->PECR |= (1<<9);						//we ERASE
-	FLASH->PECR |= (1<<3);						//we pick the FLASH for erasing
-
-	//5)
-	*(__IO uint32_t*)(flash_page_addr) = (uint32_t)0;		//value doesn't actually matter here, we are erasing
-
-	while((FLASH->SR & (1<<0)) == (1<<0));		//we stay in the loop while the BSY flag is 1
-
-	while(!(((FLASH->SR & (1<<1)) == (1<<1))));	//we stay in the loop while the EOP flag is not 1
-	FLASH->SR |= (1<<1);						//we reset the EOP flag to 0 by writing 1 to it
+	 * */
 
-	//6)
-//	FLASH->OPTR = (0xBB<<0);					//we switch back to Level 1 protection using RDPROT bits
-	FLASH->PECR |= (1<<0);						//we set PELOCK on the NVM to 1, locking it again for writing operations
+	NVMJobSubmit(NVM_Erase_Page, flash_page_addr, 0);
+	NVMWaitIdle();
 }
 
 //3)Write a word to a FLASH address
-void FLASHUpd_Word(uint32_t flash_word_addr, uint32_t updated_flash_value) {
+BOOT_RAM_FUNC void FLASHUpd_Word(uint32_t flash_word_addr, uint32_t updated_flash_value) {
 	/* This function writes a 32-bit word in the NVM.
 	 * The code assumes that the target position is empty. If it is not, the resulting word will be corrupted (a bitwise OR of the original value and the new one).
 	 * On L0xx, there is no NOTZEROERR control to avoid this corruption.
@@ -122,8 +124,12 @@ void FLASHUpd_Word(uint32_t flash_word_addr, uint32_t updated_flash_value) {
 	 * Note: writing is a bitwise "OR" operation. Target must be erased first (see FLASHErase_Page function).
 	 * Note: the arriving byte sequence is LSB byte first, not MSB byte first. The machine code within the micro is flipped compared to what is loaded into it.
 	 * Note: writing 0xCC to the RDPORT bricks the micro indefinitely!!!
+	 * Note: the word write does not go through the NVM job queue. It waits for the queue to be empty and then blocks until the word is written.
 	 */
 
+	NVMWaitIdle();								//we don't interfere with the NVM job queue
+												//Note: EOPIE is off once the queue is empty
+
 	//1)
 #ifdef endian_swap
 	uint32_t swapped_updated_flash_value = ((updated_flash_value >> 24) & 0xff) | 		// move byte 3 to byte 0
@@ -169,35 +175,97 @@ void FLASHUpd_Word(uint32_t flash_word_addr, uint32_t updated_flash_value) {
 
 
 //4)Write a half-page to a FLASH address
-void FLASHUpd_HalfPage(uint32_t loc_var_current_flash_half_page_addr, uint8_t full_page_cnt_in_buf, uint8_t half_page_cnt_in_page) {
+void FLASHUpd_HalfPage(uint32_t loc_var_current_flash_half_page_addr, uint32_t* half_page_data_ptr) {
 	/*
+	 * This function writes a sixteen 32-bit words in the NVM.
+	 * The address of the action must align to a half page - first 6 bits of the first address must be 0.
+	 *
+	 * The write is done through the NVM job queue (see NVMJobStart). The function blocks until the write is done.
+	 *
+	 * */
+
+	NVMJobSubmit(NVM_Program_Half_Page, loc_var_current_flash_half_page_addr, half_page_data_ptr);
+	NVMWaitIdle();
+}
+
+
+
 
+//5)FLASH IRQ
+BOOT_RAM_FUNC void FLASH_IRQHandler(void){
+	/*
+	 * The IRQ drives the NVM job queue. It is activated on the end of an NVM operation (EOP) or on an NVM error.
+	 *
+	 * 1)We check, how the running job has ended. Errors are counted and their flags are logged for the external controller.
+	 * 2)We reset the flags and close the NVM.
+	 * 3)We start the next job in the queue or, if there is none, we turn off the EOP IRQ.
+	 *
+	 * Note: a job that ended with an error is not repeated. The page it belongs to is likely corrupted and must be sent over again.
+	 * Note: the IRQ runs from RAM since it starts the next NVM operation.
+	 * Note: the IRQ only writes the completed job counter. The submitted job counter is only written by the main loop.
+	 *
+	 * */
+
+	//1)
+	uint32_t NVM_status = FLASH->SR;
+
+	if ((NVM_status & NVM_error_flags_mask) != 0) {												//the job has failed
+		NVM_error_counter++;
+		NVM_last_error_flags = NVM_status & NVM_error_flags_mask;
+	} else if ((NVM_status & (1<<1)) == (1<<1)) {												//the job is done
+		ProfilerNVMJobEnded(NVM_job_queue[NVM_jobs_completed % NVM_job_queue_depth].job_type);
+	} else {
+		return;																					//nothing has ended, we don't touch the queue
+	}
+
+	//2)
+	FLASH->SR = NVM_status & (NVM_error_flags_mask | (1<<1));									//we reset the error flags and the EOP flag by writing 1 to them
+	FLASH->PECR &= ~((1<<10) | (1<<9) | (1<<3));												//we remove the half-page, the erase and the FLASH selections
+	NVM_jobs_completed++;
+
+	//3)
+	if (NVM_jobs_completed != NVM_jobs_submitted) {												//we have more jobs in the queue
+		FLASH->PECR |= (1<<0);																	//we lock the NVM, the next job unlocks it again
+		NVMJobStart(&NVM_job_queue[NVM_jobs_completed % NVM_job_queue_depth]);
+	} else {
+		FLASH->PECR &= ~(1<<16);																//queue is empty, EOPIE disabled
+		FLASH->PECR |= (1<<0);																	//we set PELOCK on the NVM to 1, locking it again for writing operations
+	}
+}
+
+
+//6)FLASH IRQ priority
+void FLASHIRQPriorEnable(void) {
+	NVIC_SetPriority(FLASH_IRQn, 1);
+	NVIC_EnableIRQ(FLASH_IRQn);
+}
+
+
+//7)NVM job start
+BOOT_RAM_FUNC static void NVMJobStart (struct_NVM_Job* job_ptr) {
+	/*
+	 * We start one erase, half-page write or EEPROM word write. The function returns as soon as the NVM controller has taken over. The end of the job is signalled by the FLASH IRQ.
+	 *
 	 * The function MUST run in RAM, not in FLASH!!!!!!
-	 * Call with the __RAM_FUNC attribute!!!!!
+	 * It is placed there using the BOOT_RAM_FUNC attribute (see main.h).
 	 *
-	 * Also, ALL IRQs must be disabled during the write process or we have a crash.
+	 * For a half-page write, ALL IRQs must be disabled while the 16 words are being loaded or we have a crash.
+	 * Once the last word is loaded, the NVM controller does the programming on its own. IRQs are enabled again for that time.
+	 * IRQs that run from RAM (the DMA, the UART1 and the FLASH IRQ) are then served while the NVM is busy. Anything that reads the FLASH stalls until the programming is done.
 	 *
-	 * This function writes a sixteen 32-bit words in the NVM.
-	 * The address of the action must align to a half page - first 6 bits of the first address must be 0.
+	 * The half-page address must align to a half page - first 6 bits of the first address must be 0.
 	 * The code assumes that the target position is empty. If it is not, the resulting word will be corrupted (a bitwise OR of the original value and the new one).
 	 * On L0xx, there is no NOTZEROERR control to avoid this corruption.
 	 *
-	 * We are using the function by relying on local variables. Stepping (half-page selection and page selection) is done externally.
-	 *
-	 * //Note: we remain within the same half-page on this level
-	 *
 	 * 1)Unlock the NVM control register PECR.
 	 * 2)Unlock FLASH memory.
 	 * 3)Remove readout protection (if necessary)
-	 * 4)We pick FLASH programming at half-page.
-	 * 5)Disable IRQs
-	 * 6)Replace the word with the new one and wait until success flag is raised
-	 * 			Note: NOTZEROERR flag/interrupt may not be available on certain devices, meaning that data will be written to a target independent of what is already there.
-	 * 			Note: if NOTZEROERR flag/interrupt is active, only if the target is empty are we allowed to write there.
-	 * 7)Close NVM and add readout protection
-	 * 8)Enable IRQs
+	 * 4)Enable the EOP IRQ
+	 * 5)Erase: choose the erase action, pick the FLASH as the target and write to the page
+	 * 6)Half-page: pick FLASH programming at half-page, disable IRQs, load the 16 words and enable IRQs again (if they were enabled before)
+	 * 7)EEPROM word: write the word, the NVM controller erases the old one if needed (see EEPROMUpd_Word)
 	 *
-	 * Note: writing is a bitwise "OR" operation. Target must be erased first (see FLASHErase_Page function).
+	 * Note: writing is a bitwise "OR" operation. Target must be erased first.
 	 * Note: the arriving byte sequence is LSB byte first, not MSB byte first. The machine code within the micro is flipped compared to what is loaded into it.
 	 * Note: writing 0xCC to the RDPORT bricks the micro indefinitely!!!
 	 */
@@ -218,50 +286,186 @@ void FLASHUpd_HalfPage(uint32_t loc_var_current_flash_half_page_addr, uint8_t fu
 												//in-application FLASH should be modified at Level1 readout protection, so likley no need to change that
 
 	//4)
-	FLASH->PECR |= (1<<3);						//we pick the FLASH for programming (PRG)
-	FLASH->PECR |= (1<<10);						//we pick the half-page programming mode (FPPRG)
+	FLASH->PECR |= (1<<16);						//EOP interrupt enabled (EOPIE)
 
+	if (job_ptr->job_type == NVM_Erase_Page) {
 
-	//5)
-	__disable_irq();							//we disable all the IRQs
+		//5)
+		FLASH->PECR |= (1<<9);					//we ERASE
+		FLASH->PECR |= (1<<3);					//we pick the FLASH for erasing
+		*(__IO uint32_t*)(job_ptr->flash_addr) = (uint32_t)0;		//value doesn't actually matter here, we are erasing
+
+	} else if (job_ptr->job_type == NVM_EEPROM_Word) {
+
+		//7)
+		*(__IO uint32_t*)(job_ptr->flash_addr) = *(job_ptr->data_ptr);
+												//Note: the word must stay where it is until the job is done, just like the data of a half-page write
+
+	} else {
+
+		//6)
+		FLASH->PECR |= (1<<3);					//we pick the FLASH for programming (PRG)
+		FLASH->PECR |= (1<<10);					//we pick the half-page programming mode (FPPRG)
+
+		uint32_t irq_mask_state = __get_PRIMASK();	//we remember if the IRQs were enabled
+		__disable_irq();						//we disable all the IRQs
 												//Note: apparently this was "forgotten" in the refman, but one must deactivate all IRQs before working with FLASH, otherwise the writing will be interrupted
 												//Note: it actually makes complete sense...a pickle it is not mentioned whatsoever
 
-	//6)
-	for(uint8_t i = 0; i < 16; i++) {
-		*(__IO uint32_t*)(loc_var_current_flash_half_page_addr) = Rx_Message_buf[(32 * full_page_cnt_in_buf) + (16 * half_page_cnt_in_page) + i];
+		for(uint8_t i = 0; i < Boot_half_page_size_in_words; i++) {
+			*(__IO uint32_t*)(job_ptr->flash_addr) = job_ptr->data_ptr[i];
 												//Note: the half page address does not need to be changed (similar to the erasing command)
 												//Note: we only need to step the pointer for the data we want to write into the FLASH
+		}
+
+		__set_PRIMASK(irq_mask_state);			//we re-enable the IRQs - the burst is loaded, the NVM controller takes over from here
+												//Note: an IRQ between two words of the burst aborts the half-page programming. After the last word, it does not.
 	}
 
+	ProfilerNVMJobStarted();					//the NVM controller is running the job from here until the EOP
+}
+
+
+//8)NVM job submission
+void NVMJobSubmit (enum_NVM_Job_Type job_type, uint32_t flash_addr, uint32_t* data_ptr) {
+	/*
+	 * We put a job into the NVM job queue. If the NVM is idle, the job is started immediately.
+	 *
+	 * 1)We wait until there is space in the queue.
+	 * 2)We add the job to the queue.
+	 * 3)We start the job if the queue was empty. Otherwise, the FLASH IRQ will start it once the jobs before it are done.
+	 *
+	 * Note: for a half-page or an EEPROM word write, the data must stay where it is until the job is done (see NVMJobsDone).
+	 * Note: 2) and 3) are done with IRQs disabled, so the FLASH IRQ can't empty the queue between us checking it and adding the job.
+	 *
+	 * */
+
+	//1)
+	BOOT_SLEEP_WHILE(NVMJobQueueFree() == 0);	//we sleep until the FLASH IRQ frees up a place in the queue
+
+	//2)
+	__disable_irq();
+	struct_NVM_Job* job_ptr = &NVM_job_queue[NVM_jobs_submitted % NVM_job_queue_depth];
+	job_ptr->job_type = job_type;
+	job_ptr->flash_addr = flash_addr;
+	job_ptr->data_ptr = data_ptr;
+	enum_Yes_No_Selector NVM_was_idle = No;
+	if (NVM_jobs_submitted == NVM_jobs_completed) {
+		NVM_was_idle = Yes;
+	} else {
+		//do nothing
+	}
+	NVM_jobs_submitted++;
+
+	//3)
+	if (NVM_was_idle == Yes) {
+		NVMJobStart(job_ptr);
+	} else {
+		//do nothing
+	}
+	__enable_irq();
+}
+
+
+//9)NVM job queue space
+uint8_t NVMJobQueueFree (void) {
+	return NVM_job_queue_depth - (uint16_t)(NVM_jobs_submitted - NVM_jobs_completed);
+}
+
+
+//10)NVM job check
+enum_Yes_No_Selector NVMJobsDone (uint16_t NVM_job_tag) {
+	/*
+	 * We check if all jobs up to a certain point are done.
+	 * The tag is the value of NVM_jobs_submitted right after the last job we are interested in was submitted.
+	 *
+	 * Note: the counters wrap around. The difference between the two is never more than the queue depth, so the comparison works across the wrap-around.
+	 *
+	 * */
+
+	if ((int16_t)(NVM_jobs_completed - NVM_job_tag) >= 0) {
+		return Yes;
+	} else {
+		return No;
+	}
+}
+
+
+//11)NVM wait
+void NVMWaitIdle (void) {
+	/*
+	 * We block until the NVM job queue is empty.
+	 *
+	 * */
+
+	BOOT_SLEEP_WHILE(NVM_jobs_completed != NVM_jobs_submitted);
+												//we sleep until the FLASH IRQ has run the last job
+}
+
+
+//12)Write a word to the data EEPROM
+void EEPROMUpd_Word(uint32_t eeprom_word_addr, uint32_t updated_eeprom_value) {
+	/* This function writes a 32-bit word in the data EEPROM.
+	 * Unlike the FLASH, the EEPROM does not need to be erased first. The NVM controller erases the word automatically if it is not empty.
+	 *
+	 * 1)Wait for the NVM job queue to be empty
+	 * 2)Unlock the NVM control register PECR.
+	 * 3)Write the word and wait until success flag is raised
+	 * 4)Close NVM
+	 *
+	 * Note: only the PECR must be unlocked for the EEPROM. The PRGKEY is only needed for the FLASH.
+	 * Note: a word write takes roughly 3.2 ms if the word needs to be erased. The FLASH can't be read in the meantime, so the code stalls.
+	 * Note: the EEPROM word is not written if it already holds the value. This saves time and EEPROM endurance.
+	 */
+
+	//1)
+	NVMWaitIdle();
+
+	if ((*(__IO uint32_t*)(eeprom_word_addr)) == updated_eeprom_value) {
+		return;
+	} else {
+		//do nothing
+	}
+
+	//2)
+	FLASH->PEKEYR = 0x89ABCDEF;					//PEKEY1
+	FLASH->PEKEYR = 0x02030405;					//PEKEY2
+
+	//3)
+	*(__IO uint32_t*)(eeprom_word_addr) = updated_eeprom_value;
+
 	while((FLASH->SR & (1<<0)) == (1<<0));		//we stay in the loop while the BSY flag is 1
 	while(!(((FLASH->SR & (1<<1)) == (1<<1))));	//we stay in the loop while the EOP flag is not 1
-												//EOP will go HIGH only after the 16 words have been copied properly
 	FLASH->SR |= (1<<1);						//we reset the EOP flag to 0 by writing 1 to it
 
-	//7)
-	FLASH->PECR &= ~(1<<3);						//we disable the FLASH for programming
-	FLASH->PECR &= ~(1<<10);					//we disable the half-page programming mode
+	//4)
 	FLASH->PECR |= (1<<0);						//we set PELOCK on the NVM to 1, locking it again for writing operations
-
-	//8)
-	__enable_irq();								//we re-enable the IRQs
 }
 
 
+//13)NVM deinit
+void NVMDeinit(void) {
+	/* This function gives the NVM interface back the way it is after a reset, before we leave the bootloader.
+	 *
+	 * 1)Wait for the NVM job queue to be empty
+	 * 2)Unlock the NVM control register PECR.
+	 * 3)Disable the NVM IRQs and clear the flags
+	 * 4)Close NVM
+	 *
+	 * Note: the wait only takes time if a job - e.g. the EEPROM words of a commit - is still running. A jump in the middle of it would leave the job half done.
+	 */
 
+	//1)
+	NVMWaitIdle();
 
-//5)
-//if we encounter an error during writing to the FLASH, the code stops working
-void FLASH_IRQHandler(void){
-	printf("Memory error... \r\n");
-	FLASH->SR |= (0x32F<<8);						//we reset all the error interrupt flags
-	while(1);
-}
+	//2)
+	FLASH->PEKEYR = 0x89ABCDEF;					//PEKEY1
+	FLASH->PEKEYR = 0x02030405;					//PEKEY2
 
+	//3)
+	FLASH->PECR &= ~((1<<16) | (1<<17));		//EOPIE and ERRIE disabled
+	FLASH->SR |= (1<<1);						//we clear EOP
 
-//6)FLASH IRQ priority
-void FLASHIRQPriorEnable(void) {
-	NVIC_SetPriority(FLASH_IRQn, 1);
-	NVIC_EnableIRQ(FLASH_IRQn);
+	//4)
+	FLASH->PECR |= (1<<0);						//we set PELOCK on the NVM to 1, locking it again for writing operations
 }
@@ -14,14 +14,37 @@
 
 #include "stdint.h"
 #include "stm32l053xx.h"
+#include "main.h"
+#include "BootProfiler.h"
 
-extern uint32_t Rx_Message_buf [64];
+//LOCAL CONSTANT
+#define NVM_job_queue_depth 8														//number of erase/half-page/EEPROM word jobs the NVM job queue can hold
+																			//Note: must be a power of 2 - the queue position is calculated in the FLASH IRQ, which can't call the division from the C library
+#if (NVM_job_queue_depth & (NVM_job_queue_depth - 1)) != 0
+#error "NVM_job_queue_depth must be a power of 2"
+#endif
+static const uint32_t NVM_error_flags_mask = (0x32F<<8);					//WRPERR, PGAERR, SIZERR, OPTVERR, RDERR, NOTZEROERR and FWWERR
 
+//EXTERNAL VARIABLE
+extern uint32_t Rx_Message_buf [Rx_Message_buf_size_in_words];
+extern volatile uint16_t NVM_jobs_submitted;
+extern volatile uint16_t NVM_jobs_completed;
+extern volatile uint16_t NVM_error_counter;
+extern volatile uint32_t NVM_last_error_flags;
+
+//FUNCTION PROTOTYPES
 void NVM_Init (void);
-void FLASHErase_Page(uint32_t flash_page_addr);
-void FLASHUpd_Word(uint32_t flash_word_addr, uint32_t updated_flash_value);
 void FLASHIRQPriorEnable(void);
+void FLASHErase_Page(uint32_t flash_page_addr);
+void FLASHUpd_HalfPage(uint32_t loc_var_current_flash_half_page_addr, uint32_t* half_page_data_ptr);
+void NVMJobSubmit (enum_NVM_Job_Type job_type, uint32_t flash_addr, uint32_t* data_ptr);
+uint8_t NVMJobQueueFree (void);
+enum_Yes_No_Selector NVMJobsDone (uint16_t NVM_job_tag);
+void NVMWaitIdle (void);
+void EEPROMUpd_Word(uint32_t eeprom_word_addr, uint32_t updated_eeprom_value);
+void NVMDeinit(void);
 
-__attribute__((section(".RamFunc"))) void FLASHUpd_HalfPage(uint32_t loc_var_current_flash_half_page_addr, uint8_t full_page_cnt_in_buf, uint8_t half_page_cnt_in_page);		//Note: this function MUST run from RAM, not FLASH!
+//Note: the function below runs from RAM, not FLASH! The CPU can't fetch code from the FLASH while it is being erased or written.
+BOOT_RAM_FUNC void FLASHUpd_Word(uint32_t flash_word_addr, uint32_t updated_flash_value);
 
 #endif /* INC_NVMDRIVER_CUSTOM_H_ */
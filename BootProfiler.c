@@ -0,0 +1,258 @@
+/*
+ *  Created on: 14 Oct 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_Bootloader
+ *  Processor: STM32L053R8
+ *  Program version: 1.0
+ *  File: BootProfiler.c
+ *  Modified from: N/A
+ *  Change history:
+ *
+ * Code holds the timing probes of the receive->program pipeline.
+ *
+ * v.1.0
+ * All times are taken from the free running TIM6 in microseconds (see TIM6Timestamp_us).
+ * We measure, for every page in the Rx ring, the time from its arrival to its handover to the NVM job queue (the end of UpdatePageInApp) and to the release of its slot.
+ * We measure the time every erase and every half-page write takes, from the start of the job to its EOP.
+ * We measure the slack of every slot at its release: the number of slots the DMA can still load before it starts overwriting the one we have just released.
+ * The results are sent to the master by command 0xd3 (see the external controller).
+ *
+ */
+
+#include "BootProfiler.h"
+
+
+typedef struct {
+	uint16_t count;
+	uint32_t min_us;
+	uint32_t max_us;
+	uint32_t sum_us;
+} struct_Profiler_Stat;
+
+static struct_Profiler_Stat Page_handover_stat;												//arrival to the end of UpdatePageInApp
+static struct_Profiler_Stat Page_done_stat;													//arrival to the release of the slot
+static struct_Profiler_Stat NVM_job_stat [2];												//erase and half-page write, indexed by enum_NVM_Job_Type
+static uint32_t Rx_ring_slot_arrival_time [Rx_ring_depth_in_pages];
+static enum_Yes_No_Selector Rx_ring_slot_arrived [Rx_ring_depth_in_pages];					//the arrival of the page in the slot has been timestamped
+static uint16_t Slack_histogram [Rx_ring_depth_in_pages];									//number of releases with "n" slots of slack
+static uint8_t Slack_min_in_pages = 0xFF;
+static uint8_t Slack_max_in_pages = 0;
+static uint32_t NVM_job_start_time = 0;
+
+BOOT_RAM_FUNC static void ProfilerStatAdd (struct_Profiler_Stat* stat_ptr, uint32_t duration_us);
+
+
+//1)Profiler reset
+void ProfilerReset (void) {
+	/*
+	 * We wipe all the results. The results are kept over multiple transfers until the master asks for a reset.
+	 *
+	 * */
+
+	struct_Profiler_Stat* stats[4] = {&Page_handover_stat, &Page_done_stat, &NVM_job_stat[NVM_Erase_Page], &NVM_job_stat[NVM_Program_Half_Page]};
+
+	for (uint8_t i = 0; i < 4; i++) {
+		stats[i]->count = 0;
+		stats[i]->min_us = 0xFFFFFFFF;
+		stats[i]->max_us = 0;
+		stats[i]->sum_us = 0;
+	}
+
+	for (uint8_t i = 0; i < Rx_ring_depth_in_pages; i++) {
+		Slack_histogram[i] = 0;
+	}
+	Slack_min_in_pages = 0xFF;
+	Slack_max_in_pages = 0;
+}
+
+
+//2)Rx ring start
+void ProfilerRxRingStart (void) {
+	/*
+	 * The Rx ring is (re)started, none of the slots hold a page yet.
+	 *
+	 * */
+
+	for (uint8_t i = 0; i < Rx_ring_depth_in_pages; i++) {
+		Rx_ring_slot_arrived[i] = No;
+	}
+}
+
+
+//3)Slot arrival
+BOOT_RAM_FUNC void ProfilerRxRingSlotsArrived (uint8_t first_slot) {
+	/*
+	 * Called from the DMA IRQ on HT (first half of the ring) or TC (second half of the ring).
+	 * We timestamp the slots of the half that haven't been picked up yet by the main loop using the DMA position (see RxRingAvailablePages).
+	 *
+	 * Note: the function runs from RAM. It must not use the division from the C library, the slots are stepped one by one instead.
+	 *
+	 * */
+
+	uint32_t now = TIM6Timestamp_us();
+
+	for (uint8_t slot = first_slot; slot < (first_slot + (Rx_ring_depth_in_pages / 2)); slot++) {
+		if (Rx_ring_slot_arrived[slot] == No) {
+			Rx_ring_slot_arrival_time[slot] = now;
+			Rx_ring_slot_arrived[slot] = Yes;
+		} else {
+			//do nothing
+		}
+	}
+}
+
+
+//4)Page handover
+void ProfilerRxRingPageHandedOver (uint16_t page, uint32_t page_taken_time) {
+	/*
+	 * Called once the page has been handed over to the NVM job queue.
+	 * If the page has been picked up before its HT/TC, it has no arrival timestamp. We take the time the main loop has taken it out of the ring instead.
+	 *
+	 * Note: the IRQs are off while we touch the slot, the DMA IRQ may want to timestamp it too.
+	 *
+	 * */
+
+	uint8_t slot = page % Rx_ring_depth_in_pages;
+
+	__disable_irq();
+	if ((Rx_ring_slot_arrived[slot] == No) || ((int32_t)(Rx_ring_slot_arrival_time[slot] - page_taken_time) > 0)) {
+																							//the HT/TC came only after we have taken the page
+		Rx_ring_slot_arrival_time[slot] = page_taken_time;
+		Rx_ring_slot_arrived[slot] = Yes;
+	} else {
+		//do nothing
+	}
+	__enable_irq();
+
+	ProfilerStatAdd(&Page_handover_stat, TIM6Timestamp_us() - Rx_ring_slot_arrival_time[slot]);
+}
+
+
+//5)Slot release
+void ProfilerRxRingPageReleased (uint16_t page, uint16_t available_pages) {
+	/*
+	 * Called when the slot of the page is released.
+	 * The DMA overwrites the slot when it loads the page one ring later. The slack is how many slots the DMA still loads until then, counting the one it is loading now.
+	 * A slack of 1 means the DMA is loading the slot right in front of the one we release. A slack of 0 means the DMA has already started overwriting the slot.
+	 *
+	 * Note: the half-page writes have read the slot before its release. A slack of 0 is only counted as an overwritten page if the DMA got there before them (see ReleaseRxRingPages).
+	 *
+	 * */
+
+	uint8_t slot = page % Rx_ring_depth_in_pages;
+
+	ProfilerStatAdd(&Page_done_stat, TIM6Timestamp_us() - Rx_ring_slot_arrival_time[slot]);
+	Rx_ring_slot_arrived[slot] = No;														//the next page in the slot gets a new timestamp
+
+	int16_t slack_in_pages = (int16_t)(page + Rx_ring_depth_in_pages - available_pages);
+	if (slack_in_pages < 0) {																//the slot has been overwritten by more than one page
+		slack_in_pages = 0;
+	} else if (slack_in_pages >= Rx_ring_depth_in_pages) {									//we keep the histogram in bounds, whatever the indices say
+		slack_in_pages = Rx_ring_depth_in_pages - 1;
+	} else {
+		//do nothing
+	}
+
+	if (Slack_histogram[slack_in_pages] != 0xFFFF) Slack_histogram[slack_in_pages]++;
+	if (slack_in_pages < Slack_min_in_pages) Slack_min_in_pages = slack_in_pages;
+	if (slack_in_pages > Slack_max_in_pages) Slack_max_in_pages = slack_in_pages;
+}
+
+
+//6)NVM job start
+BOOT_RAM_FUNC void ProfilerNVMJobStarted (void) {
+	/*
+	 * Called once the NVM controller has taken over an erase or a half-page write.
+	 *
+	 * */
+
+	NVM_job_start_time = TIM6Timestamp_us();
+}
+
+
+//7)NVM job end
+BOOT_RAM_FUNC void ProfilerNVMJobEnded (enum_NVM_Job_Type job_type) {
+	/*
+	 * Called from the FLASH IRQ on the EOP of a job.
+	 * Note: failed jobs are not measured.
+	 * Note: EEPROM word writes (the resume checkpoint) are not measured either, they are not part of the page pipeline.
+	 *
+	 * */
+
+	if (job_type == NVM_EEPROM_Word) {
+		return;
+	} else {
+		//do nothing
+	}
+
+	ProfilerStatAdd(&NVM_job_stat[job_type], TIM6Timestamp_us() - NVM_job_start_time);
+}
+
+
+//8)Timing result
+BOOT_RAM_FUNC static void ProfilerStatAdd (struct_Profiler_Stat* stat_ptr, uint32_t duration_us) {
+	/*
+	 * We add one measurement to a timing stat.
+	 * Note: the stat stops once it has counted 65535 measurements so the sum does not overflow.
+	 *
+	 * */
+
+	if (stat_ptr->count == 0xFFFF) {
+		return;
+	} else {
+		//do nothing
+	}
+
+	stat_ptr->count++;
+	stat_ptr->sum_us = stat_ptr->sum_us + duration_us;
+	if (duration_us < stat_ptr->min_us) stat_ptr->min_us = duration_us;
+	if (duration_us > stat_ptr->max_us) stat_ptr->max_us = duration_us;
+}
+
+
+//9)Profiler report
+void ProfilerReport (uint8_t* payload_ptr) {
+	/*
+	 * We fill the payload of the response to command 0xd3 (Profiler_report_size_in_bytes long).
+	 * The payload is the handover latency, the release latency, the erase time and the half-page write time.
+	 * 		Each of them is the number of measurements (2 bytes, LSB first), followed by the minimum, the maximum and the mean in us (4 bytes each, LSB first).
+	 * 		A stat without any measurements reads as all 0.
+	 * It is followed by the minimum and the maximum slack in slots (1 byte each) and the slack histogram (Rx_ring_depth_in_pages times 2 bytes, LSB first, 0 slack first).
+	 *
+	 * */
+
+	struct_Profiler_Stat* stats[4] = {&Page_handover_stat, &Page_done_stat, &NVM_job_stat[NVM_Erase_Page], &NVM_job_stat[NVM_Program_Half_Page]};
+	uint8_t payload_pos = 0;
+
+	for (uint8_t i = 0; i < 4; i++) {
+		uint32_t stat_values[3] = {0, 0, 0};
+		if (stats[i]->count != 0) {
+			stat_values[0] = stats[i]->min_us;
+			stat_values[1] = stats[i]->max_us;
+			stat_values[2] = stats[i]->sum_us / stats[i]->count;
+		} else {
+			//do nothing
+		}
+
+		payload_ptr[payload_pos++] = stats[i]->count & 0xFF;
+		payload_ptr[payload_pos++] = stats[i]->count >> 8;
+		for (uint8_t j = 0; j < 3; j++) {
+			payload_ptr[payload_pos++] = stat_values[j] & 0xFF;
+			payload_ptr[payload_pos++] = (stat_values[j] >> 8) & 0xFF;
+			payload_ptr[payload_pos++] = (stat_values[j] >> 16) & 0xFF;
+			payload_ptr[payload_pos++] = stat_values[j] >> 24;
+		}
+	}
+
+	if (Slack_min_in_pages == 0xFF) {														//nothing has been released yet
+		payload_ptr[payload_pos++] = 0;
+	} else {
+		payload_ptr[payload_pos++] = Slack_min_in_pages;
+	}
+	payload_ptr[payload_pos++] = Slack_max_in_pages;
+
+	for (uint8_t i = 0; i < Rx_ring_depth_in_pages; i++) {
+		payload_ptr[payload_pos++] = Slack_histogram[i] & 0xFF;
+		payload_ptr[payload_pos++] = Slack_histogram[i] >> 8;
+	}
+}
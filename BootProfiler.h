@@ -0,0 +1,41 @@
+/*
+ *  Created on: 14 Oct 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_Bootloader
+ *  Processor: STM32L053R8
+ *  Header version: 1.0
+ *  File: BootProfiler.h
+ *  Modified from: N/A
+ *  Change history: N/A
+ */
+
+#ifndef INC_BOOTPROFILER_CUSTOM_H_
+#define INC_BOOTPROFILER_CUSTOM_H_
+
+#include "stdint.h"
+#include "main.h"
+#include "BootClockDriver_STM32L0x3.h"
+
+//LOCAL CONSTANT
+#define Profiler_report_size_in_bytes (58 + (2 * Rx_ring_depth_in_pages))		//four timing stats (14 bytes each), the slack extremes and the slack histogram
+#if (Profiler_report_size_in_bytes + 4) >= UART1_Tx_buf_size_in_bytes
+#error "the profiler report does not fit into the UART1 Tx buffer"
+#endif
+
+//LOCAL VARIABLE
+
+//EXTERNAL VARIABLE
+
+//FUNCTION PROTOTYPES
+void ProfilerReset (void);
+void ProfilerRxRingStart (void);
+void ProfilerRxRingPageHandedOver (uint16_t page, uint32_t page_taken_time);
+void ProfilerRxRingPageReleased (uint16_t page, uint16_t available_pages);
+void ProfilerReport (uint8_t* payload_ptr);
+
+//Note: the functions below run from RAM, not FLASH! They are called from the DMA and the FLASH IRQs.
+BOOT_RAM_FUNC void ProfilerRxRingSlotsArrived (uint8_t first_slot);
+BOOT_RAM_FUNC void ProfilerNVMJobStarted (void);
+BOOT_RAM_FUNC void ProfilerNVMJobEnded (enum_NVM_Job_Type job_type);
+
+#endif /* INC_BOOTPROFILER_CUSTOM_H_ */
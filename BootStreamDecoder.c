@@ -0,0 +1,510 @@
+/*
+ *  Created on: 14 Oct 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_Bootloader
+ *  Processor: STM32L053R8
+ *  Program version: 1.0
+ *  File: BootStreamDecoder.c
+ *  Modified from: N/A
+ *  Change history:
+ *
+ * Code holds the decoders that turn an incoming byte stream into FLASH pages.
+ *
+ * v.1.0
+ * LZ decompressor for compressed machine code.
+ * The decompressed data is assembled into a page buffer. Once the page is full, the decoder stops and waits for the page to be written to the FLASH.
+ *
+ * The compressed stream is made of groups. Each group starts with a flag byte, followed by 8 items.
+ * A flag bit of 0 (LSB first) means the item is a literal byte that is copied to the output as it is.
+ * A flag bit of 1 means the item is a match on 2 bytes (LSB first): 10 bits of offset (1 to 1024 bytes back in the output) and 6 bits of length (3 to 66 bytes).
+ *
+ * v.1.1
+ * Intel HEX and Motorola S-record decoder. The records are placed into the page buffer by their address, not one after the other.
+ * A page is handed over once a record points outside of it. Pages no record points to are never assembled, nor sent over.
+ * Records with a broken checksum or pointing outside the app section are dropped and counted as rejected.
+ *
+ * v.1.2
+ * The page buffer follows the page size of the profile in BootConfig.h.
+ *
+ */
+
+#include "BootStreamDecoder.h"
+
+
+static uint8_t LZ_window [LZ_window_size_in_bytes];										//the last 1024 decompressed bytes
+static uint16_t LZ_window_pos = 0;														//where the next decompressed byte goes in the window
+static enum_LZ_Decoder_State LZ_state = LZ_Flags;
+static uint8_t LZ_flags = 0;															//flag byte of the current group
+static uint8_t LZ_items_left = 0;														//items left in the current group
+static uint8_t LZ_match_low_byte = 0;
+static uint16_t LZ_match_offset = 0;
+static uint8_t LZ_match_bytes_left = 0;													//bytes of the current match that are not yet in the page buffer
+static uint16_t Stream_page_fill = 0;												//bytes in the page buffer
+																						//Note: for records, it is only 0 (no page handed over) or a full page (page ready to be written)
+static enum_Record_Decoder_State Record_state = Record_Idle;
+static enum_Yes_No_Selector Record_is_SREC = No;										//the record started with 'S' instead of ':'
+static uint8_t Record_SREC_type = 0;													//the digit after the 'S'
+static uint8_t Record_buf [Record_max_size_in_bytes];									//the bytes of the current record, checksum included
+static uint16_t Record_length = 0;														//bytes in the record buffer
+static enum_Yes_No_Selector Record_nibble_pending = No;									//the high nibble of a byte has arrived, the low one has not
+static uint32_t Record_base_addr = 0;													//extended address of the Intel HEX records (types 02 and 04)
+static uint32_t Record_data_addr = 0;													//where the next data byte of the last record goes
+static uint16_t Record_data_pos = 0;													//the next data byte of the last record in the record buffer
+static uint16_t Record_data_left = 0;													//data bytes of the last record not yet in the page buffer
+static enum_Yes_No_Selector Record_page_open = No;										//the page buffer holds the page at Stream_page_addr
+static enum_Yes_No_Selector Record_stream_ended = No;									//the end-of-file record has arrived
+
+
+//1)Decoder reset
+void StreamDecoderReset (void) {
+	/*
+	 * We put the decoder back to the start of a stream.
+	 * The window does not need to be wiped - a valid stream never refers to bytes before its own start.
+	 *
+	 * */
+
+	LZ_window_pos = 0;
+	LZ_state = LZ_Flags;
+	LZ_flags = 0;
+	LZ_items_left = 0;
+	LZ_match_bytes_left = 0;
+	Stream_page_fill = 0;
+	Record_state = Record_Idle;
+	Record_length = 0;
+	Record_nibble_pending = No;
+	Record_base_addr = 0;
+	Record_data_left = 0;
+	Record_page_open = No;
+	Record_stream_ended = No;
+}
+
+
+//2)LZ decompression
+uint16_t LZDecodeBytes (uint8_t* compressed_data_ptr, uint16_t compressed_data_length) {
+	/*
+	 * We decompress the incoming bytes into the page buffer.
+	 *
+	 * 1)We finish any match that did not fit into the page buffer the last time.
+	 * 2)We step through the incoming bytes and run the decoder state machine on them.
+	 * 3)We stop if the page buffer is full, or all bytes have been processed.
+	 *
+	 * The function gives back how many of the incoming bytes have been processed.
+	 * It must be called again with the rest of the bytes once the page has been written to the FLASH.
+	 *
+	 * Note: an item can be split between two calls, the state machine remembers where it was.
+	 * Note: a corrupted stream will give corrupted output, but will never write outside the page buffer or the window.
+	 *
+	 * */
+
+	uint16_t processed_bytes = 0;
+	uint8_t* page_byte_ptr = (uint8_t*)Stream_page_buf;
+
+	while (Stream_page_fill < Boot_page_size_in_bytes) {
+
+		//1)
+		if (LZ_match_bytes_left != 0) {
+			uint8_t match_byte = LZ_window[(LZ_window_pos - LZ_match_offset) & (LZ_window_size_in_bytes - 1)];
+			LZ_window[LZ_window_pos] = match_byte;
+			LZ_window_pos = (LZ_window_pos + 1) & (LZ_window_size_in_bytes - 1);
+			page_byte_ptr[Stream_page_fill++] = match_byte;
+			LZ_match_bytes_left--;
+			continue;
+		} else {
+			//do nothing
+		}
+
+		//3)
+		if (processed_bytes == compressed_data_length) {
+			break;																		//we ran out of incoming bytes
+		} else {
+			//do nothing
+		}
+
+		//2)
+		uint8_t incoming_byte = compressed_data_ptr[processed_bytes++];
+
+		switch (LZ_state) {
+
+		case LZ_Flags:
+			LZ_flags = incoming_byte;
+			LZ_items_left = 8;
+			LZ_state = LZ_Item;
+			break;
+
+		case LZ_Item:
+			if ((LZ_flags & 1) == 0) {													//literal
+				LZ_window[LZ_window_pos] = incoming_byte;
+				LZ_window_pos = (LZ_window_pos + 1) & (LZ_window_size_in_bytes - 1);
+				page_byte_ptr[Stream_page_fill++] = incoming_byte;
+				LZ_flags = LZ_flags >> 1;
+				LZ_items_left--;
+				if (LZ_items_left == 0) {
+					LZ_state = LZ_Flags;
+				} else {
+					//do nothing
+				}
+			} else {																	//match - we need one more byte
+				LZ_match_low_byte = incoming_byte;
+				LZ_state = LZ_Match_High;
+			}
+			break;
+
+		case LZ_Match_High:
+		{
+			uint16_t match_item = ((uint16_t)incoming_byte << 8) | LZ_match_low_byte;
+			LZ_match_offset = (match_item & 0x3FF) + 1;
+			LZ_match_bytes_left = (match_item >> 10) + 3;								//the copy is done at the start of the loop
+			LZ_flags = LZ_flags >> 1;
+			LZ_items_left--;
+			if (LZ_items_left == 0) {
+				LZ_state = LZ_Flags;
+			} else {
+				LZ_state = LZ_Item;
+			}
+			break;
+		}
+
+		default:
+			LZ_state = LZ_Flags;
+			break;
+		}
+	}
+
+	return processed_bytes;
+}
+
+
+//3)Page buffer full check
+enum_Yes_No_Selector StreamPageFull (void) {
+	if (Stream_page_fill == Boot_page_size_in_bytes) {
+		return Yes;
+	} else {
+		return No;
+	}
+}
+
+
+//4)Page buffer padding
+enum_Yes_No_Selector StreamPagePad (void) {
+	/*
+	 * We fill up an incomplete page with 0x00 - the erased value of the FLASH - at the end of the stream.
+	 * The function gives back if there was anything in the page buffer to be written.
+	 *
+	 * */
+
+	if (Stream_page_fill == 0) {
+		return No;
+	} else {
+		memset(((uint8_t*)Stream_page_buf) + Stream_page_fill, 0, Boot_page_size_in_bytes - Stream_page_fill);
+		Stream_page_fill = Boot_page_size_in_bytes;
+		return Yes;
+	}
+}
+
+
+//5)Page buffer release
+void StreamPageRelease (void) {
+	Stream_page_fill = 0;																//the page has been written, we start a new one
+	Record_page_open = No;
+}
+
+
+//6)HEX/SREC decoding
+uint16_t RecordDecodeBytes (uint8_t* record_data_ptr, uint16_t record_data_length) {
+	/*
+	 * We decode Intel HEX or Motorola S-record text into the page buffer. Both formats can be mixed, every record is recognised by its first character.
+	 *
+	 * 1)We place the data bytes of the last record that have not been placed yet.
+	 * 	If a byte falls outside the page in the buffer, we stop and hand the page over first. The byte goes into the next page once the buffer is released.
+	 * 2)We step through the incoming characters. Records are collected into the record buffer as bytes.
+	 * 	A record is done at the end of the line or at the start of the next record. It is only then checked and applied (see RecordApply).
+	 * 3)We stop if a page is ready, or all characters have been processed.
+	 *
+	 * The function gives back how many of the incoming characters have been processed, just like LZDecodeBytes.
+	 *
+	 * Note: a record can be split between two slots, the state machine remembers where it was.
+	 * Note: everything after the end-of-file record is ignored. The last record must be ended by a line end to be applied.
+	 *
+	 * */
+
+	uint16_t processed_bytes = 0;
+	uint8_t* page_byte_ptr = (uint8_t*)Stream_page_buf;
+
+	while (Stream_page_fill < Boot_page_size_in_bytes) {
+
+		//1)
+		if (Record_data_left != 0) {
+			if (Record_page_open == No) {
+				RecordPageOpen(Record_data_addr & ~(Boot_page_size_in_bytes - 1));
+			} else if ((Record_data_addr & ~(Boot_page_size_in_bytes - 1)) != Stream_page_addr) {	//the record goes on in another page
+				Stream_page_fill = Boot_page_size_in_bytes;								//we hand the page over
+				break;
+			} else {
+				//do nothing
+			}
+			page_byte_ptr[Record_data_addr % Boot_page_size_in_bytes] = Record_buf[Record_data_pos++];
+			Record_data_addr++;
+			Record_data_left--;
+			continue;
+		} else {
+			//do nothing
+		}
+
+		//3)
+		if (processed_bytes == record_data_length) {
+			break;																		//we ran out of incoming characters
+		} else {
+			//do nothing
+		}
+
+		//2)
+		uint8_t incoming_char = record_data_ptr[processed_bytes++];
+
+		if (Record_stream_ended == Yes) {
+			continue;
+		} else {
+			//do nothing
+		}
+
+		if ((incoming_char == ':') || (incoming_char == 'S') || (incoming_char == '\r') || (incoming_char == '\n')) {
+			if (Record_state == Record_Hex_Digits) {
+				RecordApply();															//the record before is done
+			} else {
+				//do nothing
+			}
+			Record_length = 0;
+			Record_nibble_pending = No;
+			if (incoming_char == ':') {
+				Record_is_SREC = No;
+				Record_state = Record_Hex_Digits;
+			} else if (incoming_char == 'S') {
+				Record_is_SREC = Yes;
+				Record_state = Record_SREC_Type;
+			} else {
+				Record_state = Record_Idle;
+			}
+			continue;
+		} else {
+			//do nothing
+		}
+
+		switch (Record_state) {
+
+		case Record_SREC_Type:
+			if ((incoming_char >= '0') && (incoming_char <= '9')) {
+				Record_SREC_type = incoming_char - '0';
+				Record_state = Record_Hex_Digits;
+			} else {																	//not an S-record
+				page_rejected_counter++;
+				Record_state = Record_Idle;
+			}
+			break;
+
+		case Record_Hex_Digits:
+		{
+			uint8_t nibble = RecordHexNibble(incoming_char);
+			if ((nibble > 0xF) || (Record_length == Record_max_size_in_bytes)) {		//broken or too long record, we drop it
+				page_rejected_counter++;
+				Record_state = Record_Idle;
+			} else if (Record_nibble_pending == No) {
+				Record_buf[Record_length] = nibble << 4;
+				Record_nibble_pending = Yes;
+			} else {
+				Record_buf[Record_length++] |= nibble;
+				Record_nibble_pending = No;
+			}
+			break;
+		}
+
+		case Record_Idle:
+		default:
+			break;																		//we ignore anything between records
+		}
+	}
+
+	return processed_bytes;
+}
+
+
+//7)Record check
+void RecordApply (void) {
+	/*
+	 * We check the record in the record buffer and act on it.
+	 *
+	 * 1)We check the length and the checksum of the record.
+	 * 	A HEX record has a byte count, 2 bytes of address, a type, the data and a checksum that brings the sum of all bytes to 0x00.
+	 * 	An S-record has a byte count (address, data and checksum), 2 to 4 bytes of address depending on the type, the data and a checksum that brings the sum of all bytes to 0xFF.
+	 * 2)Data records are queued to be placed into the page buffer (see RecordDataQueue).
+	 * 	HEX types 02 and 04 set the upper part of the address for the data records that follow them.
+	 * 	HEX type 01 and S-record types 7 to 9 end the stream. The start address and the S-record header and count records are ignored.
+	 *
+	 * Note: the addresses, like the ones the linker puts into the file, are FLASH addresses, not offsets within the app section.
+	 *
+	 * */
+
+	//1)
+	uint8_t checksum = 0;
+	for (uint16_t i = 0; i < Record_length; i++) {
+		checksum = checksum + Record_buf[i];
+	}
+
+	if ((Record_nibble_pending == Yes) || (Record_length < 3)) {
+		page_rejected_counter++;
+		return;
+	} else {
+		//do nothing
+	}
+
+	//2)
+	if (Record_is_SREC == No) {
+
+		if ((Record_length < 5) || ((Record_buf[0] + 5) != Record_length) || (checksum != 0x00)) {
+			page_rejected_counter++;
+			return;
+		} else {
+			//do nothing
+		}
+
+		uint16_t record_addr = ((uint16_t)Record_buf[1] << 8) | Record_buf[2];
+		switch (Record_buf[3]) {
+		case 0x00:																		//data
+			RecordDataQueue(Record_base_addr + record_addr, 4, Record_buf[0]);
+			break;
+		case 0x01:																		//end of file
+			Record_stream_ended = Yes;
+			break;
+		case 0x02:																		//extended segment address
+			Record_base_addr = (((uint32_t)Record_buf[4] << 8) | Record_buf[5]) << 4;
+			break;
+		case 0x04:																		//extended linear address
+			Record_base_addr = (((uint32_t)Record_buf[4] << 8) | Record_buf[5]) << 16;
+			break;
+		case 0x03:																		//start address
+		case 0x05:
+			break;
+		default:
+			page_rejected_counter++;
+			break;
+		}
+
+	} else {
+
+		if (((Record_buf[0] + 1) != Record_length) || (checksum != 0xFF)) {
+			page_rejected_counter++;
+			return;
+		} else {
+			//do nothing
+		}
+
+		uint8_t addr_length_in_bytes = 0;
+		switch (Record_SREC_type) {
+		case 1:																			//data with 16, 24 or 32 bits of address
+		case 2:
+		case 3:
+			addr_length_in_bytes = Record_SREC_type + 1;
+			if (Record_buf[0] < (addr_length_in_bytes + 1)) {
+				page_rejected_counter++;
+			} else {
+				uint32_t record_addr = 0;
+				for (uint8_t i = 0; i < addr_length_in_bytes; i++) {
+					record_addr = (record_addr << 8) | Record_buf[1 + i];
+				}
+				RecordDataQueue(record_addr, 1 + addr_length_in_bytes, Record_buf[0] - addr_length_in_bytes - 1);
+			}
+			break;
+		case 7:																			//end of the records with the start address
+		case 8:
+		case 9:
+			Record_stream_ended = Yes;
+			break;
+		case 0:																			//header
+		case 5:																			//record count
+		case 6:
+			break;
+		default:
+			page_rejected_counter++;
+			break;
+		}
+
+	}
+}
+
+
+//8)Record data placement
+void RecordDataQueue (uint32_t data_addr_in_FLASH, uint16_t data_pos_in_record, uint16_t data_length_in_bytes) {
+	/*
+	 * We queue the data bytes of a record for RecordDecodeBytes to place them into the page buffer.
+	 * Data that would not go entirely into the update slot is dropped.
+	 *
+	 * */
+
+	if (data_length_in_bytes == 0) {
+		return;
+	} else if ((data_addr_in_FLASH < App_update_start_addr) || (data_addr_in_FLASH >= App_update_end_addr) ||
+			   (data_length_in_bytes > (App_update_end_addr - data_addr_in_FLASH))) {
+		page_rejected_counter++;
+		return;
+	} else {
+		//do nothing
+	}
+
+	Record_data_addr = data_addr_in_FLASH;
+	Record_data_pos = data_pos_in_record;
+	Record_data_left = data_length_in_bytes;
+}
+
+
+//9)Record page start
+void RecordPageOpen (uint32_t page_addr_in_FLASH) {
+	/*
+	 * We start assembling a new page in the page buffer.
+	 * Bytes no record points to must not change what is already in the FLASH for this stream, so the buffer is filled up accordingly.
+	 * Pages below the FLASH pointer have already been written (or left empty) by this stream: we take them from the FLASH.
+	 * Pages above the FLASH pointer start as 0x00, the erased value of the FLASH.
+	 *
+	 * */
+
+	Stream_page_addr = page_addr_in_FLASH;
+	if (page_addr_in_FLASH < flash_page_addr) {
+		memcpy(Stream_page_buf, (uint32_t*)page_addr_in_FLASH, Boot_page_size_in_bytes);
+	} else {
+		memset(Stream_page_buf, 0, Boot_page_size_in_bytes);
+	}
+	Record_page_open = Yes;
+}
+
+
+//10)Record page end
+enum_Yes_No_Selector RecordPageFlush (void) {
+	/*
+	 * We hand over the last page at the end of the stream.
+	 * The function gives back if there was a page in the buffer to be written.
+	 *
+	 * */
+
+	if (Record_page_open == No) {
+		return No;
+	} else {
+		Stream_page_fill = Boot_page_size_in_bytes;
+		return Yes;
+	}
+}
+
+
+//11)Hex character conversion
+uint8_t RecordHexNibble (uint8_t hex_char) {
+	/*
+	 * We turn a hex character into its value. Anything that is not a hex character gives back 0xFF.
+	 *
+	 * */
+
+	if ((hex_char >= '0') && (hex_char <= '9')) {
+		return hex_char - '0';
+	} else if ((hex_char >= 'A') && (hex_char <= 'F')) {
+		return hex_char - 'A' + 10;
+	} else if ((hex_char >= 'a') && (hex_char <= 'f')) {
+		return hex_char - 'a' + 10;
+	} else {
+		return 0xFF;
+	}
+}
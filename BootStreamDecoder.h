@@ -0,0 +1,46 @@
+/*
+ *  Created on: 14 Oct 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_Bootloader
+ *  Processor: STM32L053R8
+ *  Header version: 1.0
+ *  File: BootStreamDecoder.h
+ *  Modified from: N/A
+ *  Change history: N/A
+ */
+
+#ifndef INC_BOOTSTREAMDECODER_CUSTOM_H_
+#define INC_BOOTSTREAMDECODER_CUSTOM_H_
+
+#include "stdint.h"
+#include "string.h"
+#include "main.h"
+#include "BootAppManager.h"
+
+//LOCAL CONSTANT
+#define LZ_window_size_in_bytes 1024										//the decoder can look back this many bytes for a match
+																			//Note: must be a power of 2 and match the 10 bit offset of the match items
+#define Record_max_size_in_bytes 260										//the longest HEX record: count, address, type, 255 data bytes and checksum
+
+//LOCAL VARIABLE
+
+//EXTERNAL VARIABLE
+extern uint32_t Stream_page_buf [Boot_page_size_in_words];
+extern uint32_t Stream_page_addr;
+extern uint32_t flash_page_addr;
+extern uint16_t page_rejected_counter;
+
+//FUNCTION PROTOTYPES
+void StreamDecoderReset (void);
+uint16_t LZDecodeBytes (uint8_t* compressed_data_ptr, uint16_t compressed_data_length);
+enum_Yes_No_Selector StreamPageFull (void);
+enum_Yes_No_Selector StreamPagePad (void);
+void StreamPageRelease (void);
+uint16_t RecordDecodeBytes (uint8_t* record_data_ptr, uint16_t record_data_length);
+void RecordApply (void);
+void RecordDataQueue (uint32_t data_addr_in_FLASH, uint16_t data_pos_in_record, uint16_t data_length_in_bytes);
+void RecordPageOpen (uint32_t page_addr_in_FLASH);
+enum_Yes_No_Selector RecordPageFlush (void);
+uint8_t RecordHexNibble (uint8_t hex_char);
+
+#endif /* INC_BOOTSTREAMDECODER_CUSTOM_H_ */
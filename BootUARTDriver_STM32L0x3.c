@@ -12,14 +12,70 @@
  * Slight rework of the previously written UART1 driver code.
  * Deinit function added.
  *
+ * v.1.1.
+ * Baud rate is selected when calling the config function.
+ *
+ * v.1.2.
+ * Command messages are captured by the DMA and framed by the idle line instead of polling byte by byte.
+ * Added responses to the master on UART1 Tx.
+ *
+ * v.1.3.
+ * Reception can be stopped without disabling the UART1, so the last responses of a transfer can still be sent.
+ *
+ * v.1.4.
+ * Responses are queued and sent by the DMA (channel 2) on UART1 Tx. Sending a response does not block anymore.
+ *
+ * v.1.5.
+ * The text log is queued in a RAM ring and sent by the DMA (channel 4) on UART2 Tx.
+ *
+ * v.1.6.
+ * Command frames overwritten in the frame queue are dropped and counted instead of being read back from stale positions.
+ *
+ * v.1.7.
+ * The baud rate can be switched while UART1 is running. 921600 and 1000000 baud run the UART1 from the 32 MHz SYSCLK.
+ * Framing and noise errors on UART1 Rx are counted. Too many of them while we wait for a command send UART1 back to the boot baud rate.
+ * Command frames can be waited for with a timeout.
+ *
+ * v.1.8.
+ * The wait for a command frame can't miss the UART1 IRQ anymore, we don't need SysTick to wake us up.
+ *
+ * v.1.9.
+ * The BRR values are calculated from the clocking in BootConfig.h.
+ *
+ * v.1.10.
+ * The wait for a command frame is also over at the end of the boot window (see TIM2_IRQHandler).
+ *
+ * v.1.11.
+ * Command frames can carry a node address, so several bootloaders can share one bus. Frames to the broadcast address are run without a response.
+ * The driver enable of an RS-485 transceiver can be driven from PA12.
+ *
+ * v.1.12.
+ * Frames without a node address are dropped once we know that we share the bus.
+ *
  */
 
 #include <BootClockDriver_STM32L0x3.h>
 #include "BootUARTDriver_STM32L0x3.h"
+#include "BootDMADriver_STM32L0x3.h"
 #include "stm32l053xx.h"
+#include "string.h"
+
+static uint8_t UART1_Tx_buf [UART1_Tx_buf_size_in_bytes];								//responses waiting to be sent, used as a ring
+static volatile uint16_t UART1_Tx_head = 0;												//where the next response goes - written only by the main loop
+static volatile uint16_t UART1_Tx_tail = 0;												//the first byte not yet sent - written only by the DMA IRQ
+static volatile uint16_t UART1_Tx_DMA_length = 0;										//bytes the DMA is currently sending, 0 if the DMA is idle
+
+static uint8_t UART2_Log_buf [UART2_Log_buf_size_in_bytes];							//log bytes waiting to be sent, used as a ring
+static volatile uint16_t UART2_Log_head = 0;											//where the next log byte goes
+static volatile uint16_t UART2_Log_tail = 0;											//the first log byte not yet sent - written only by the DMA IRQ
+static volatile uint16_t UART2_Log_DMA_length = 0;										//bytes the DMA is currently sending, 0 if the DMA is idle
+
+static void UART1BRRSet (enum_UART_Baud_Selector baud_rate);
+BOOT_RAM_FUNC static void UART1TxDMAStart (void);
+BOOT_RAM_FUNC static void UART2LogDMAStart (void);
 
 //1)UART init (no DMA)
-void UART1Config (void)
+void UART1Config (enum_UART_Baud_Selector baud_rate)
 {
 	/**We wish to recreate the CubeMX generate uart1 control. That uart1 has 115200 baud, 8 bit word length, no parity, 1 stop bit and 16 sample oversampling
 
@@ -34,6 +90,7 @@ void UART1Config (void)
 	 *
 	 * Note: DMA must be deinitalized before we change to the app from the boot.
 	 * Note: idle is a full frame of 1s. Break character is a full frame of 0s, followed by two stop bits.
+	 * Note: the BRR values are calculated from the APB2 and SYSCLK clocking in BootConfig.h for an oversampling of 16 (see UART1BRRSet).
 	 *
 	**/
 
@@ -41,7 +98,7 @@ void UART1Config (void)
 	//1)Set the clock source, enable hardware
 	RCC->APB2ENR |= (1<<14);															//APB2 is the peripheral clock enable. Bit 14 is to enable the uart1 clock
 	RCC->IOPENR |= (1<<0);																//IOPENR enables the clock on the PORTA (PA10/D2 is Rx, PA9/D8 is Tx for USART1)
-//	RCC->CCIPR |= (2<<0);																//we could clock the UART using HSI16 as source (16 MHz). We currently clock on APB2 isnetad, which is also 16 MHz.
+																						//Note: the clock source of the UART1 (CCIPR) is picked with the baud rate, see UART1BRRSet
 
 	//2)Set the GPIOs
 	GPIOA->MODER &= ~(1<<18);															//AF for PA9
@@ -49,6 +106,10 @@ void UART1Config (void)
 	GPIOA->OSPEEDR |= (3<<18) | (3<<20);												//very high speed PA9 and PA10
 	GPIOA->AFR[1] |= (1<<6) | (1<<10);													//from page 46 of the device datasheet, USART1 is on AF4 for PA9 and PA10 on the HIGH register of the AFR
 																						//OTYPER and PUPDR are not written to since we want push/pull and no pull resistors
+#if Boot_UART1_RS485_DE
+	GPIOA->MODER &= ~(1<<24);															//AF for PA12
+	GPIOA->AFR[1] |= (4<<16);															//USART1_DE is on AF4 for PA12
+#endif
 
 	//3)Configure UART
 	USART1->CR1 = 0x00;																	//we clear the UART1 control registers
@@ -68,12 +129,21 @@ void UART1Config (void)
 
 	USART1->CR3 |= (1<<11);																//one bit sampling on data
 	USART1->CR3 |= (1<<12);																//overrun error disabled
+	USART1->CR3 |= (1<<7);																//DMA enabled on Tx (DMAT bit) - the channel is only enabled when we have something to send
+	USART1->CR3 |= (1<<0);																//EIE enabled. Framing and noise errors activate the main USART1 IRQ, where they are counted.
 																						//LSB first, CPOL clock polarity is standard, CPHA clock phase is standard
+#if Boot_UART1_RS485_DE
+	USART1->CR3 |= (1<<14);																//DEM enabled. The driver enable is HIGH while we send (DEP is 0).
+	USART1->CR1 |= (16<<21) | (16<<16);													//DEAT and DEDT - the driver is enabled a bit time before the first start bit and disabled a bit time after the last stop bit
+																						//Note: the times are in sample times, so 1/16 of a bit at an oversampling of 16
+#endif
 
 //	USART1->BRR |= 0x683;																//we want to have a baud rate of 9600 with HSI16 as source (refman 779 proposes values for 32 MHz) and oversampling of 16
 
-	USART1->BRR |= 0x116;																//57600 baud rate using 16 MHz clocking and oversampling of 16
-																						//Note: 115200 baud rate is just barely too fast for the DMA to restart between incoming UART bytes
+	UART1BRRSet(baud_rate);
+	UART1_baud_rate = baud_rate;
+	UART1_Rx_error_counter = 0;
+																						//Note: with the DMA in circular mode, there is no DMA restart between incoming UART bytes anymore which limited us to 57600 before
 
 	//4)Enable the interrupts, set up errors
 	USART1->CR1 |= (1<<4);																//IDIE enabled. It activates the main USART1 IRQ.
@@ -89,6 +159,7 @@ void UART1DMAEnable (void) {
 
 	USART1->CR1 &= ~(1<<0);																//disable the UART1
 
+	NVIC_ClearPendingIRQ(DMA1_Channel2_3_IRQn);											//we remove any HT/TC left over from the command capture
 	NVIC_EnableIRQ(DMA1_Channel2_3_IRQn);												//we enable the IRQ for the DMA
 
 	NVIC_EnableIRQ(USART1_IRQn);														//we enable the UART1 IRQ
@@ -127,75 +198,135 @@ uint8_t UART1RxByte (void)
 
 //4)UART1 get the message - with message start sequence
 void UART1RxMessage(void) {
+	UART1RxMessageWait(0);																//no timeout
+}
+
+enum_Yes_No_Selector UART1RxMessageWait (uint32_t timeout_in_ms) {
 	/*
-	 * 1)We enable the UART.
-	 * 2)While the timeout is not reached
-	 * 3)We check if we have the incoming message sequence detected
-	 * 4)If yes, we transfer incoming bytes to a memory buffer
-	 * 5)After the IRQ is triggered and we leave the state machine-in-the-loop, we reset everything and shut down the UART
+	 * Command frames are captured by the DMA into the Rx buffer (see UART1CommandCaptureEnable). The end of a frame is marked by the UART1 IRQ on an idle line.
+	 * Here we only pick the frames up.
+	 *
+	 * 1)We sleep until the UART1 IRQ tells us that a frame has arrived, or until the timeout is over. 0 means no timeout.
+	 * 	 If the UART1 IRQ counts too many Rx errors in the meantime, the link is too noisy for the baud rate. We go back to the boot baud rate.
+	 * 2)We take the frame out of the frame queue. If the UART1 IRQ has overwritten frames in the queue, we drop them, count them and carry on with the ones that are left.
+	 * 3)We look for the message start sequence in the frame and copy everything after it into the command buffer.
+	 * 4)If the frame did not have the start sequence, we discard it and wait for the next one.
+	 *   If the frame carries a node address (the node prefix after the start sequence, then the address), we remove the two bytes.
+	 *   Frames to another node are discarded. Frames to the broadcast address are taken, but the responses to them are muted (see UART1TxResponse).
+	 *   Frames without a node address are discarded once we know that we share the bus (see UART1_Bus_shared).
 	 *
 	 * Note: the start of the message is detected when 0xFOFO comes through the bus.
-	 * Note: the end of the message is detected when the bus has been idle for 2 bytes. This MUST be matched on the transmitter side by implementing an adequately sized delay between messages. Failing to do so freezes the bus.
-	 * Note: the bus is VERY noisy. If we don't sample the bus exactly where we should, we can capture fake data.
+	 * Note: the end of the message is detected when the bus goes idle. Since the DMA keeps on capturing while we are processing a frame, no inter-message gap is needed other than the idle frame itself.
+	 * Note: the bus is VERY noisy. Anything in the frame before the start sequence is discarded.
+	 * Note: the function blocks until a command arrives (or the timeout is over). It also gives up once the TIM2 IRQ has flagged the end of the boot window.
+	 * Note: the master finds the bootloader again at the boot baud rate if it does not get an answer at the faster one.
+	 * Note: frames without a node address are only taken as long as we may be alone on the bus. Once our address is configured in the EEPROM or a frame with a node address has come in, we drop them.
+	 * 		On a shared bus, such a frame can be anything - e.g. the pages of an app sent to another node, where any 0xF0 0xF0 looks like a start sequence.
+	 *
+	 * The function gives back Yes if a command has been picked up, No if the timeout or the boot window is over.
 	 *
 	 * */
 
-	//1)
-	USART1->CR1 |= (1<<0);																//enable the UART1
+	uint8_t* Rx_ring_byte_ptr = (uint8_t*)Rx_Message_buf;
+	uint32_t wait_start_time = TIM6Timestamp_us();
 
-	//2)
-	while (UART1_Message_Received == No){												//we execute the following section until the IRQ is triggered by an idle line
-		switch (UART1_Message_Started){
-		case No:
-			while(!((USART1->ISR & (1<<5)) == (1<<5)));									//RXNE bit. Goes HIGH when the data register is ready to be read out.
-			uint8_t Rx_byte_buf = USART1->RDR;											//reading the RDR clears the RXE flag
-
-			//3)
-			if(Rx_byte_buf == UART_message_start_byte) {								//we detected the start byte
-				switch (UART1_Start_Byte_Detected_Once){
-				case No:																//if this was the first time
-					UART1_Start_Byte_Detected_Once = Yes;
-					break;
-				case Yes:																//if this was the second time
-					UART1_Start_Byte_Detected_Once = No;
-					UART1_Message_Started = Yes;
-					break;
-				default:
-					break;
+	while (1) {
+
+		//1)
+		while (Cmd_frames_consumed == Cmd_frames_produced) {
+			if (Boot_window_expired == Yes) {
+				return No;																//the main loop starts the app
+			} else {
+				//do nothing
+			}
+			if ((UART1_Rx_error_counter >= UART1_Rx_error_threshold) && (UART1_baud_rate != UART1_boot_baud_rate)) {
+				UART1BaudSwitch(UART1_boot_baud_rate);
+			} else {
+				//do nothing
+			}
+			if ((timeout_in_ms != 0) && ((TIM6Timestamp_us() - wait_start_time) >= (timeout_in_ms * 1000))) {
+				return No;
+			} else {
+				//do nothing
+			}
+			__disable_irq();
+			if ((Cmd_frames_consumed == Cmd_frames_produced) && (Boot_window_expired == No)) {
+				__WFI();																//we sleep until the next IRQ
+				  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the TIM6 IRQ wakes us up at least every 65 ms for the timeout
+			} else {
+				//do nothing
+			}
+			__enable_irq();
+		}
+
+		//2)
+		__disable_irq();
+		uint8_t frames_produced = Cmd_frames_produced;
+		if ((uint8_t)(frames_produced - Cmd_frames_consumed) > Cmd_frame_queue_depth) {	//the oldest frames have been overwritten
+			Cmd_frames_dropped_counter = Cmd_frames_dropped_counter + (uint8_t)(frames_produced - Cmd_frames_consumed) - (Cmd_frame_queue_depth - 1);
+			Cmd_frame_start_position = Cmd_frame_end_position[(uint8_t)(frames_produced - Cmd_frame_queue_depth) % Cmd_frame_queue_depth];
+			Cmd_frames_consumed = frames_produced - Cmd_frame_queue_depth + 1;			//the oldest frame left only gives the start of the next one
+		} else {
+			//do nothing
+		}
+		__enable_irq();
+		uint16_t frame_end_position = Cmd_frame_end_position[Cmd_frames_consumed % Cmd_frame_queue_depth];
+		Cmd_frames_consumed++;
+
+		//3)
+		uint8_t start_bytes_detected = 0;
+		uint8_t command_length = 0;
+		uint16_t frame_position = Cmd_frame_start_position;
+
+		while (frame_position != frame_end_position) {
+			uint8_t Rx_byte_buf = Rx_ring_byte_ptr[frame_position];
+			if (start_bytes_detected < 2) {
+				if (Rx_byte_buf == UART_message_start_byte) {							//we detected the start byte
+					start_bytes_detected++;
+				} else {
+					start_bytes_detected = 0;											//if the start byte is not detected twice in a sequence, we discard
 				}
+			} else if (command_length < Rx_Command_buf_size_in_bytes) {
+				Rx_Command_buf[command_length] = Rx_byte_buf;
+				command_length++;
+			} else {
+				//do nothing															//the command is too long, we drop the rest
+			}
 
+			frame_position++;
+			if (frame_position == DMA_transfer_width_UART1) {							//we step around the end of the buffer
+				frame_position = 0;
 			} else {
-				UART1_Start_Byte_Detected_Once = No;									//if the start byte is not detected twice in a sequence, we discard
+				//do nothing
 			}
-			break;
+		}
+
+		Cmd_frame_start_position = frame_end_position;									//the next frame starts where this one ended
 
 		//4)
-		case Yes:
-
-			if((USART1->ISR & (1<<5)) == (1<<5)){										//if we have data in the RX buffer
-																						//Note: we don't use a while loop here to avoid being stuck (RXNE test comes after the idle test, which could freeze the bus)
-				USART1->ICR |= (1<<4);													//we clear the idle flag
-				NVIC_EnableIRQ(USART1_IRQn);											//we activate the IRQ
-																						//Note: the IRQ should only be active when we are receiving a message. Activating it earlier can lead to false triggers.
-																						//Note: we use an IRQ to end the message since we can't use a specific sequence to stop it. That sequence can very much be in the machine code.
-																						//Note: 0xFFFF is different to two idle frames due to the position of the start bit
-				*(Rx_Message_buf_ptr++) = USART1->RDR;									//we read out and reset the RXNE flag
+		if ((start_bytes_detected == 2) && (command_length != 0) && (Rx_Command_buf[0] == UART_node_prefix)) {
+			UART1_Bus_shared = Yes;														//there is a master talking to nodes on the bus
+			if ((command_length > 2) && ((Rx_Command_buf[1] == UART1_node_address) || (Rx_Command_buf[1] == UART_node_broadcast))) {
+				UART1_Responses_muted = (Rx_Command_buf[1] == UART_node_broadcast) ? Yes : No;
+				command_length = command_length - 2;
+				memmove(&Rx_Command_buf[0], &Rx_Command_buf[2], command_length);
 			} else {
-				//do nothing
+				start_bytes_detected = 0;												//the frame is not for us
 			}
-			break;
+		} else if (UART1_Bus_shared == Yes) {
+			start_bytes_detected = 0;													//the frame has no node address, it is not for us
+		} else {
+			UART1_Responses_muted = No;
+		}
 
-		default:
-			break;
+		if ((start_bytes_detected == 2) && (command_length != 0)) {
+			memset(&Rx_Command_buf[command_length], 0, Rx_Command_buf_size_in_bytes - command_length);
+																						//we don't leave any argument of an earlier command in the buffer
+			return Yes;
+		} else {
+			//do nothing
 		}
 	}
-
-	//5)
-	NVIC_DisableIRQ(USART1_IRQn);
-	USART1->CR1 &= ~(1<<0);																//disable the UART1
-	UART1_Message_Received = No;														//we reset the message received flag
-	UART1_Message_Started = No;															//we reset the message started flag
-	Rx_Message_buf_ptr = Rx_Message_buf;												//we reset the buf pointer to its original spot
 }
 
 
@@ -206,9 +337,355 @@ void UART1RxMessage(void) {
 	 *
 	 */
 void UART1Deinit(void) {
+	UART1TxFlush();																		//we let the queued responses go out first
+	UART1_Command_Capture_active = No;													//the UART1 IRQ goes back to counting idle frames
 	USART1->CR1 &= ~(1<<0);																//disable the UART1
 	USART1->CR3 &= ~(1<<6);																//DMA disabled on Rx (DMAR bit)
 	DMA1_Channel3->CCR &= ~(1<<0);														//we disable the DMA channel
 	NVIC_DisableIRQ(DMA1_Channel2_3_IRQn);												//we disable the IRQ for the DMA
 	NVIC_DisableIRQ(USART1_IRQn);														//disable UART1 IRQ
 }
+
+
+//6)UART1 command capture enable
+void UART1CommandCaptureEnable (void) {
+	/*
+	 * We set up the UART1 to capture command messages using the DMA.
+	 * The DMA loads the entire Rx buffer in circular mode. The UART1 IRQ logs where the DMA was when the bus went idle, marking the end of a frame.
+	 * The HT and TC IRQs of the Rx channel are not used - they don't mean anything for a command frame.
+	 * The DMA IRQ itself is enabled, it serves the Tx channel of the responses.
+	 *
+	 * 1)We reset the UART1, the DMA and the frame queue.
+	 * 2)We enable the UART1 IRQ for idle detection.
+	 * 3)We enable the DMA and the UART1.
+	 *
+	 * Note: the UART1 IRQ can be active all the time now. An idle frame without any data before it only gives an empty frame, which is discarded.
+	 *
+	 * */
+
+	//1)
+	UART1Deinit();
+	DMA_transfer_width_UART1 = 4 * Rx_Message_buf_size_in_words;						//we use the entire Rx buffer
+	DMAChannelUART1RxConfig((uint32_t)Rx_Message_buf);
+	DMA1_Channel3->CCR &= ~((1<<1) | (1<<2) | (1<<3));									//no TC, HT or error IRQ on the Rx channel
+	Cmd_frames_produced = 0;
+	Cmd_frames_consumed = 0;
+	Cmd_frame_start_position = 0;
+	UART1_Command_Capture_active = Yes;
+
+	//2)
+	USART1->ICR |= (1<<4);																//we clear the idle flag
+	NVIC_ClearPendingIRQ(USART1_IRQn);
+	NVIC_EnableIRQ(USART1_IRQn);														//we enable the UART1 IRQ
+	NVIC_EnableIRQ(DMA1_Channel2_3_IRQn);												//we enable the DMA IRQ for the responses
+
+	//3)
+	DMA1_Channel3->CCR |= (1<<0);														//we enable the DMA channel
+	USART1->CR3 |= (1<<6);																//DMA enabled on Rx (DMAR bit)
+	USART1->CR3 |= (1<<13);																//DMA is disabled on reception error
+	USART1->CR1 |= (1<<0);																//enable the UART1
+}
+
+
+//7)UART1 response
+void UART1TxResponse (uint8_t response_type, uint8_t* payload_ptr, uint8_t payload_length) {
+	/*
+	 * We queue a response frame for the master on UART1 Tx.
+	 * The frame is the message start sequence (0xF0F0), the response type, the length of the payload and the payload itself.
+	 *
+	 * 1)We check if the frame fits into the Tx ring. If it doesn't, we drop it and count it.
+	 * 2)We copy the frame into the ring.
+	 * 3)We start the DMA if it is idle. Otherwise the DMA IRQ picks the frame up once the current transfer is done.
+	 *
+	 * Note: the function does not wait for the frame to go out. A response of a few bytes takes roughly 1 ms at 57600 baud.
+	 * Note: the ring holds more than the ACKs of a full window of addressed pages. A frame is only dropped if the master does not follow the protocol.
+	 * Note: nothing is sent while the command being run came in a broadcast frame. Every bootloader on the bus would answer at the same time.
+	 *
+	 * */
+
+	uint8_t response_header[4] = {UART_message_start_byte, UART_message_start_byte, response_type, payload_length};
+	uint16_t frame_length = 4 + payload_length;
+
+	//1)
+	if (UART1_Responses_muted == Yes) {
+		return;																			//not counted as dropped
+	} else {
+		//do nothing
+	}
+
+	uint16_t used_bytes = (UART1_Tx_head + UART1_Tx_buf_size_in_bytes - UART1_Tx_tail) % UART1_Tx_buf_size_in_bytes;
+	if ((used_bytes + frame_length) >= UART1_Tx_buf_size_in_bytes) {					//one byte is always left free to tell a full ring from an empty one
+		UART1_Tx_dropped_counter++;
+		return;
+	} else {
+		//do nothing
+	}
+
+	//2)
+	uint16_t head = UART1_Tx_head;
+	for (uint16_t i = 0; i < frame_length; i++) {
+		if (i < 4) {
+			UART1_Tx_buf[head] = response_header[i];
+		} else {
+			UART1_Tx_buf[head] = payload_ptr[i - 4];
+		}
+		head = (head + 1) % UART1_Tx_buf_size_in_bytes;
+	}
+	UART1_Tx_head = head;																//the frame is only visible to the DMA IRQ once it is complete
+
+	//3)
+	__disable_irq();																	//the DMA IRQ may also start the DMA
+	if (UART1_Tx_DMA_length == 0) {
+		UART1TxDMAStart();
+	} else {
+		//do nothing
+	}
+	__enable_irq();
+}
+
+
+//8)UART1 Rx DMA stop
+void UART1RxDMAStop(void) {
+	/*
+	 * We stop the DMA reception, but leave the UART1 enabled.
+	 * The DMA position is frozen, while the last responses of a transfer can still go out on UART1 Tx.
+	 *
+	 * Note: UART1Deinit disables the entire UART1, so it has to wait for all queued responses to go out first.
+	 *
+	 */
+	USART1->CR3 &= ~(1<<6);																//DMA disabled on Rx (DMAR bit)
+	DMA1_Channel3->CCR &= ~(1<<0);														//we disable the DMA channel
+	NVIC_DisableIRQ(USART1_IRQn);														//disable UART1 IRQ
+																						//Note: the DMA IRQ stays on. It still sends the responses and serves a HT/TC that came in right before the stop.
+}
+
+
+//9)UART1 Tx DMA start
+BOOT_RAM_FUNC static void UART1TxDMAStart (void) {
+	/*
+	 * We hand the oldest queued bytes over to the DMA.
+	 * The DMA can only send a continuous block. If the queued bytes wrap around the end of the ring, we send until the end of the ring now and the rest on the next TC.
+	 *
+	 * Note: must be called with the DMA idle and the IRQs masked (or from the DMA IRQ).
+	 *
+	 * */
+
+	uint16_t head = UART1_Tx_head;
+	uint16_t tail = UART1_Tx_tail;
+	if (head == tail) {																	//nothing to send
+		return;
+	} else if (head > tail) {
+		UART1_Tx_DMA_length = head - tail;
+	} else {
+		UART1_Tx_DMA_length = UART1_Tx_buf_size_in_bytes - tail;
+	}
+	DMAChannelUART1TxStart((uint32_t)&UART1_Tx_buf[tail], UART1_Tx_DMA_length);
+}
+
+
+//10)UART1 Tx DMA complete
+BOOT_RAM_FUNC void UART1TxDMAComplete (void) {
+	/*
+	 * Called by the DMA IRQ on the TC of the Tx channel (channel 2).
+	 * We release the bytes that have been sent and start the DMA on whatever has been queued in the meantime.
+	 *
+	 * */
+
+	UART1_Tx_tail = (UART1_Tx_tail + UART1_Tx_DMA_length) % UART1_Tx_buf_size_in_bytes;
+	UART1_Tx_DMA_length = 0;
+	UART1TxDMAStart();
+}
+
+
+//11)UART1 Tx flush
+void UART1TxFlush (void) {
+	/*
+	 * We wait until every queued response is out on the bus.
+	 * The TC of the Tx channel is polled here instead of waiting for the DMA IRQ, so it can also be called from an IRQ of higher priority (TIM2).
+	 *
+	 * 1)We serve the Tx channel until the ring is empty.
+	 * 2)We wait for the UART1 to send the last byte (TC bit).
+	 *
+	 * */
+
+	//1)
+	while (UART1_Tx_DMA_length != 0) {
+		__disable_irq();
+		if ((DMA1->ISR & (1<<5)) == (1<<5)) {											//TC on channel 2
+			DMA1->IFCR = (1<<4);														//we remove all the interrupt flags from Channel 2
+			UART1TxDMAComplete();
+		} else {
+			//do nothing
+		}
+		__enable_irq();
+	}
+
+	//2)
+	if ((USART1->CR1 & (1<<0)) == (1<<0)) {												//the UART1 is enabled
+		while(!((USART1->ISR & (1<<6)) == (1<<6)));										//TC bit. Goes HIGH when the last byte has left the shift register.
+	} else {
+		//do nothing
+	}
+}
+
+
+//12)UART2 log init
+void UART2LogConfig (void) {
+	/*
+	 * We let the DMA send the text log on UART2 Tx.
+	 * UART2 itself is set up by the CubeMX generated code (115200 baud). We only enable the DMA request on Tx and the DMA IRQ.
+	 *
+	 * Note: must be called after MX_USART2_UART_Init, HAL_UART_Init clears CR3.
+	 *
+	 * */
+	DMAChannelUART2TxConfig();
+	USART2->CR3 |= (1<<7);																//DMA enabled on Tx (DMAT bit)
+	NVIC_ClearPendingIRQ(DMA1_Channel4_5_6_7_IRQn);
+	NVIC_EnableIRQ(DMA1_Channel4_5_6_7_IRQn);
+}
+
+
+//13)UART2 log write
+void UART2LogWrite (char* log_ptr, uint16_t log_length) {
+	/*
+	 * We copy the log bytes into the log ring and start the DMA if it is idle. This is all the time a log message costs on the caller's side.
+	 *
+	 * 1)We copy as many bytes as fit into the ring. What doesn't fit is dropped and counted.
+	 * 2)We start the DMA if it is idle.
+	 *
+	 * Note: the log is written from the main loop and from the TIM2 IRQ, so the IRQs are masked while we copy. A log message is short, this only takes a few us.
+	 * Note: the ring is sent out at 115200 baud, roughly 11 bytes per ms. Bursts of log messages longer than the ring are cut.
+	 *
+	 * */
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	//1)
+	uint16_t used_bytes = (UART2_Log_head + UART2_Log_buf_size_in_bytes - UART2_Log_tail) % UART2_Log_buf_size_in_bytes;
+	uint16_t free_bytes = UART2_Log_buf_size_in_bytes - 1 - used_bytes;					//one byte is always left free to tell a full ring from an empty one
+	if (log_length > free_bytes) {
+		UART2_Log_dropped_bytes = UART2_Log_dropped_bytes + (log_length - free_bytes);
+		log_length = free_bytes;
+	} else {
+		//do nothing
+	}
+
+	uint16_t head = UART2_Log_head;
+	uint16_t bytes_to_end = UART2_Log_buf_size_in_bytes - head;
+	if (log_length <= bytes_to_end) {
+		memcpy(&UART2_Log_buf[head], log_ptr, log_length);
+	} else {
+		memcpy(&UART2_Log_buf[head], log_ptr, bytes_to_end);							//we wrap around the end of the ring
+		memcpy(&UART2_Log_buf[0], log_ptr + bytes_to_end, log_length - bytes_to_end);
+	}
+	UART2_Log_head = (head + log_length) % UART2_Log_buf_size_in_bytes;
+
+	//2)
+	if (UART2_Log_DMA_length == 0) {
+		UART2LogDMAStart();
+	} else {
+		//do nothing
+	}
+
+	__set_PRIMASK(primask);
+}
+
+
+//14)UART2 log DMA start
+BOOT_RAM_FUNC static void UART2LogDMAStart (void) {
+	/*
+	 * Same as UART1TxDMAStart, but for the log ring.
+	 *
+	 * Note: must be called with the DMA idle and the IRQs masked (or from the DMA IRQ).
+	 *
+	 * */
+
+	uint16_t head = UART2_Log_head;
+	uint16_t tail = UART2_Log_tail;
+	if (head == tail) {																	//nothing to send
+		return;
+	} else if (head > tail) {
+		UART2_Log_DMA_length = head - tail;
+	} else {
+		UART2_Log_DMA_length = UART2_Log_buf_size_in_bytes - tail;
+	}
+	DMAChannelUART2TxStart((uint32_t)&UART2_Log_buf[tail], UART2_Log_DMA_length);
+}
+
+
+//15)UART2 log DMA complete
+BOOT_RAM_FUNC void UART2LogDMAComplete (void) {
+	/*
+	 * Called by the DMA IRQ on the TC of the log channel (channel 4).
+	 *
+	 * */
+
+	UART2_Log_tail = (UART2_Log_tail + UART2_Log_DMA_length) % UART2_Log_buf_size_in_bytes;
+	UART2_Log_DMA_length = 0;
+	UART2LogDMAStart();
+}
+
+
+//16)UART1 baud rate switch
+void UART1BaudSwitch (enum_UART_Baud_Selector baud_rate) {
+	/*
+	 * We switch the baud rate of the UART1 without touching anything else. The DMA keeps on capturing into the Rx buffer once the UART1 is enabled again.
+	 *
+	 * 1)We let the queued responses go out at the old baud rate.
+	 * 2)We disable the UART1, set the new baud rate and enable the UART1 again.
+	 * 3)We start counting the Rx errors from zero for the new baud rate.
+	 *
+	 * Note: anything that comes in while the UART1 is disabled is lost. The master must wait a few ms before it sends anything at the new baud rate.
+	 *
+	 * */
+
+	//1)
+	UART1TxFlush();
+
+	//2)
+	USART1->CR1 &= ~(1<<0);																//disable the UART1
+	UART1BRRSet(baud_rate);
+	UART1_baud_rate = baud_rate;
+	USART1->ICR |= (1<<1) | (1<<2) | (1<<4);											//we remove the errors and the idle line of the switch
+	USART1->CR1 |= (1<<0);																//enable the UART1
+
+	//3)
+	UART1_Rx_error_counter = 0;
+}
+
+static void UART1BRRSet (enum_UART_Baud_Selector baud_rate) {
+	/*
+	 * We set the clock source and the BRR of the UART1 for the baud rate. The UART1 must be disabled.
+	 * Up to 460800 baud, the UART1 runs from APB2 (16 MHz). Above that, BRR would be too small to stay within 1% error, so we clock the UART1 from SYSCLK (32 MHz).
+	 *
+	 * */
+
+	RCC->CCIPR &= ~(3<<0);																//APB2 is the clock source
+
+	switch (baud_rate) {
+	case Baud_57600:
+		USART1->BRR = BOOT_UART_BRR(Boot_APB2_clock_in_Hz, 57600);						//57600 baud rate using 16 MHz clocking and oversampling of 16
+		break;
+	case Baud_115200:
+		USART1->BRR = BOOT_UART_BRR(Boot_APB2_clock_in_Hz, 115200);						//115200 baud rate - 0.08% error
+		break;
+	case Baud_230400:
+		USART1->BRR = BOOT_UART_BRR(Boot_APB2_clock_in_Hz, 230400);						//230400 baud rate - 0.6% error
+		break;
+	case Baud_460800:
+		USART1->BRR = BOOT_UART_BRR(Boot_APB2_clock_in_Hz, 460800);						//460800 baud rate - 0.8% error
+		break;
+	case Baud_921600:
+		RCC->CCIPR |= (1<<0);															//SYSCLK is the clock source
+		USART1->BRR = BOOT_UART_BRR(Boot_SYSCLK_in_Hz, 921600);							//921600 baud rate using 32 MHz clocking - 0.8% error
+		break;
+	case Baud_1000000:
+		RCC->CCIPR |= (1<<0);
+		USART1->BRR = BOOT_UART_BRR(Boot_SYSCLK_in_Hz, 1000000);						//1000000 baud rate using 32 MHz clocking - no error
+		break;
+	default:
+		USART1->BRR = BOOT_UART_BRR(Boot_APB2_clock_in_Hz, 57600);						//we fall back to 57600 if we don't recognise the selection
+		break;
+	}
+}
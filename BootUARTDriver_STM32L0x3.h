@@ -17,22 +17,52 @@
 
 //LOCAL CONSTANT
 static const uint8_t UART_message_start_byte = 0xF0;		//the message start sequence is (twice this byte)
+static const uint8_t UART_response_ack = 0x06;				//response type for a page or command that has been accepted
+static const uint8_t UART_response_nack = 0x15;				//response type for a page or command that has been rejected
+static const uint8_t UART_response_report = 0x52;			//response type for the counters of a transfer
+static const uint8_t UART_node_prefix = 0xA5;				//a command frame to a node starts with this byte and the node address after the start sequence
+static const uint8_t UART_node_broadcast = 0xFF;			//node address taken by every bootloader on the bus - no response is sent
+static const enum_UART_Baud_Selector UART1_boot_baud_rate = Boot_UART1_boot_baud_rate;	//the baud rate the bootloader starts at, and goes back to on a noisy link
+static const uint16_t UART1_Rx_error_threshold = 16;		//framing and noise errors after which a baud rate is given up
 
 //LOCAL VARIABLE
-static enum_Yes_No_Selector UART1_Start_Byte_Detected_Once = No;
+static uint8_t Cmd_frames_consumed = 0;						//number of command frames we have picked up
+static uint16_t Cmd_frame_start_position = 0;				//where the next command frame starts in the Rx buffer
 
 //EXTERNAL VARIABLE
 extern enum_Yes_No_Selector UART1_Message_Received;
-extern enum_Yes_No_Selector UART1_Message_Started;
-extern uint32_t Rx_Message_buf [64];						//we have a 32 bit MCU
-extern uint8_t* Rx_Message_buf_ptr;							//UART data is only 8 bits
+extern uint32_t Rx_Message_buf [Rx_Message_buf_size_in_words];						//we have a 32 bit MCU
+extern uint8_t Rx_Command_buf [Rx_Command_buf_size_in_bytes];						//UART data is only 8 bits
+extern uint16_t DMA_transfer_width_UART1;
+extern enum_Yes_No_Selector UART1_Command_Capture_active;
+extern volatile uint16_t Cmd_frame_end_position [Cmd_frame_queue_depth];
+extern volatile uint8_t Cmd_frames_produced;
+extern volatile uint16_t Cmd_frames_dropped_counter;
+extern volatile uint16_t UART1_Tx_dropped_counter;
+extern volatile uint16_t UART1_Rx_error_counter;
+extern enum_UART_Baud_Selector UART1_baud_rate;
+extern volatile enum_Yes_No_Selector Boot_window_expired;
+extern volatile uint16_t UART2_Log_dropped_bytes;
+extern uint8_t UART1_node_address;
+extern enum_Yes_No_Selector UART1_Responses_muted;
+extern enum_Yes_No_Selector UART1_Bus_shared;
 
 //FUNCTION PROTOTYPES
-void UART1Config (void);
+void UART1Config (enum_UART_Baud_Selector baud_rate);
 uint8_t UART1RxByte (void);
 void UART1RxMessage(void);
+enum_Yes_No_Selector UART1RxMessageWait (uint32_t timeout_in_ms);
 void UART1DMAEnable (void);
 void UART1Deinit(void);
+void UART1CommandCaptureEnable (void);
+void UART1TxResponse (uint8_t response_type, uint8_t* payload_ptr, uint8_t payload_length);
+void UART1RxDMAStop(void);
+BOOT_RAM_FUNC void UART1TxDMAComplete (void);
+void UART1TxFlush (void);
+void UART2LogConfig (void);
+void UART2LogWrite (char* log_ptr, uint16_t log_length);
+BOOT_RAM_FUNC void UART2LogDMAComplete (void);
+void UART1BaudSwitch (enum_UART_Baud_Selector baud_rate);
 
 
 #endif /* INC_UARTDRIVER_CUSTOM_H_ */
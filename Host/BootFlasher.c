@@ -0,0 +1,1809 @@
+/*
+ *  Created on: 14 Oct 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_Bootloader
+ *  Processor: host PC (POSIX)
+ *  Program version: 1.0
+ *  File: BootFlasher.c
+ *  Modified from: N/A
+ *  Change history:
+ *
+ * v.1.0
+ * Host-side flasher for the UART1 external controller.
+ * Sends the app as addressed pages (command 0xbe) with a window of pages in flight and waits for the ACK of every page.
+ * Can drive multiple serial ports in parallel, one thread each.
+ *
+ * v.1.1
+ * Error codes of the NACKs and the transfer report of the bootloader are decoded.
+ * The dropped log bytes of the bootloader are shown, if the bootloader reports them.
+ *
+ * v.1.2
+ * The timing results of the bootloader pipeline (command 0xd3) can be shown after the transfer.
+ * Benchmark mode (command 0xd4): the NVM benchmark of the bootloader, followed by pattern pages sent back-to-back to measure the Rx rate.
+ *
+ * v.1.3
+ * The missed HT/TC events and the dropped command frames of the bootloader are shown, if the bootloader reports them.
+ *
+ * v.1.4
+ * The app is checked against the update slot published by the bootloader (A/B slots). An app linked to the other slot is not sent over.
+ *
+ * v.1.5
+ * An interrupted update can be resumed from the checkpoint of the bootloader (command 0xd6) instead of being sent over from the start.
+ *
+ * v.1.6
+ * The switch to addressed pages, the commit and - with -j - the start of the app go to the bootloader in a single batch (command 0xb0), if the bootloader takes batches.
+ *
+ * v.1.7
+ * A faster baud rate can be negotiated with the bootloader (command 0xd7) for the transfer. We step down along with the bootloader if it announces it in the transfer report.
+ *
+ * v.1.8
+ * The page size of the bootloader is checked against ours (from the slot size published by command 0xd2): a bootloader built for another page size is not flashed.
+ *
+ * v.1.9
+ * Gang programming of several bootloaders on one bus (-N): the app is sent once in broadcast frames, then the result of each node is collected (command 0xd8).
+ * Nodes that did not get the app are flashed one by one afterwards.
+ *
+ * v.1.10
+ * The authentication tag of the app (HMAC-SHA256 with the key of -K) is sent to the bootloader before the transfer (command 0xd9). A bootloader that authenticates its apps is not flashed without a key.
+ *
+ * v.1.11
+ * The Rx benchmark (-B) runs at every baud rate from the one of -b up to the one of -s (or the fastest one), negotiated with the bootloader (command 0xd7). The fastest sustainable one is given at the end.
+ *
+ * Build: gcc -O2 -pthread -o BootFlasher BootFlasher.c
+ * Use:   BootFlasher [-b baud] [-s baud] [-w window] [-V version] [-t timeout_ms] [-r retries] [-K keyfile] [-n] [-j] [-p] [-R] app.bin /dev/ttyUSB0 [/dev/ttyUSB1 ...]
+ *        BootFlasher [-b baud] [-w window] [-V version] [-t timeout_ms] [-r retries] [-g gap_ms] [-K keyfile] [-n] [-j] -N node[,node ...] app.bin /dev/ttyUSB0
+ *        BootFlasher [-b baud] [-s baud] -B pages /dev/ttyUSB0 [/dev/ttyUSB1 ...]
+ *
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+//LOCAL CONSTANT
+static const uint8_t UART_message_start_byte = 0xF0;			//the message start sequence is (twice this byte)
+static const uint8_t UART_response_ack = 0x06;
+static const uint8_t UART_response_nack = 0x15;
+static const uint8_t UART_response_report = 0x52;				//counters of the transfer, sent by the bootloader when the transfer is over
+static const uint16_t Addressed_page_end_of_transfer = 0xFFFF;	//page index that ends the transfer
+static const uint32_t Page_size_in_bytes = 128;
+static const uint32_t Frame_size_in_bytes = 136;				//header word, page and CRC word (see ProgramRxRingPage)
+static const int Handshake_attempts = 5;
+static const int Command_gap_in_ms = 20;						//the bootloader must see the bus idle between two commands
+static const int Programmer_mode_setup_in_ms = 100;				//the bootloader invalidates the app header and the app descriptor before it takes pages
+
+#define Max_ports 16
+#define Max_nodes 32
+static const uint8_t UART_node_prefix = 0xA5;					//a command frame to a node starts with this byte and the node address after the start sequence
+static const uint8_t UART_node_broadcast = 0xFF;				//every node takes the frame, none of them responds
+static const int Broadcast_page_period_in_us = 12000;			//a page erase and two half-page writes take roughly 10 ms on the L0, there is no window to slow us down
+#define Report_size_in_bytes 18								//newer bootloaders send 20, 24 or 27 bytes, we take the first 18
+#define Baud_count 6
+static const long Baud_rates[Baud_count] = {57600, 115200, 230400, 460800, 921600, 1000000};
+																//see enum_UART_Baud_Selector in the bootloader
+static const uint8_t Baud_probe_pattern[8] = {0x55, 0xAA, 0x00, 0xFF, 0x0F, 0xF0, 0xCC, 0x33};
+static const int Baud_probe_timeout_in_ms = 700;				//the bootloader gives up on the probe after 500 ms and goes back to the old baud rate
+
+static const char* Boot_error_names[] = {"none", "page CRC", "page header", "page outside the app section", "NVM", "app length", "app CRC", "scratch pages in use by the app", "slot empty or broken", "no resume checkpoint", "invalid batch", "invalid baud rate", "baud rate probe failed", "no commit yet", "invalid node command", "app not authenticated"};
+																//see enum_Boot_Error_Code in the bootloader
+#define Max_window 64
+#define Timing_stat_count 4
+#define Timing_report_min_size_in_bytes 58							//the slack histogram follows, its length depends on the Rx ring of the bootloader
+
+static const char* Timing_stat_names[Timing_stat_count] = {"handover", "release", "erase", "half-page"};
+																//see ProfilerReport in the bootloader
+#define Bench_NVM_stat_count 3
+static const char* Bench_NVM_names[Bench_NVM_stat_count] = {"page erase", "page by words", "page by half pages"};
+																//see BenchNVMRun in the bootloader
+
+//LOCAL VARIABLE
+typedef struct {
+	const char* port_name;
+	char node_name[64];											//the port and the node address, for the nodes of a bus
+	int fd;
+	uint8_t node;												//0 if the bootloader takes frames without a node address (one bootloader on the port)
+	uint8_t device_unique_id[12];								//unique ID of the part behind the node (command 0xd8)
+	uint8_t rx_buf[256];										//bytes received, but not yet parsed into a response
+	int rx_length;
+	uint8_t device_protocol_version;							//version of the command set of the bootloader, batches need 2 or later
+	uint8_t device_window;										//window and slot size published by the bootloader (command 0xd2)
+	uint8_t device_slot_size_in_words;
+	uint32_t device_app_start_addr;								//the update slot of the bootloader
+	uint32_t device_app_size_in_bytes;
+	int device_update_slot;										//-1 if the bootloader does not have A/B slots
+	int device_auth_enabled;									//the bootloader only commits apps with a valid tag (command 0xd9)
+	uint32_t pages_sent;
+	uint32_t pages_resumed;										//pages the bootloader already had from an interrupted update
+	uint32_t pages_resent;
+	uint32_t nacks;
+	uint32_t device_crc;
+	uint8_t last_error_code;									//error code of the last NACK
+	uint8_t report[Report_size_in_bytes];
+	int report_received;
+	int log_dropped_bytes;										//-1 if the bootloader does not report it
+	int missed_events;											//-1 if the bootloader does not report it
+	int cmd_frames_dropped;
+	int rx_errors;												//-1 if the bootloader does not report it
+	int baud_index;												//the baud rate the port runs at, see Baud_rates
+	int baud_stepped_down;										//the bootloader has stepped the baud rate down after a noisy transfer
+	uint8_t timing[256];										//timing results of the bootloader pipeline (command 0xd3)
+	uint8_t timing_length;
+	double transfer_time_in_s;
+	double total_time_in_s;
+	const char* error;											//NULL if the port has been flashed
+} flasher_port_t;
+
+static uint8_t* image;											//the app, padded with 0x00 to a full page
+static uint32_t image_length_in_bytes;
+static uint32_t image_page_count;
+static uint32_t image_crc;
+static uint32_t image_version = 0;
+static speed_t baud_rate = B57600;
+static long baud_in_bits = 57600;
+static long switch_baud_in_bits = 0;							//0 means we stay at the baud rate of -b
+static int requested_window = 0;								//0 means we take the window from the bootloader
+static int response_timeout_in_ms = 1000;
+static int max_retries = 5;
+static int commit_enabled = 1;
+static int jump_enabled = 0;
+static int timing_enabled = 0;
+static int resume_enabled = 0;
+static int bench_pages = 0;										//0 means we flash, anything else is the number of pages of the Rx benchmark
+static uint8_t gang_nodes[Max_nodes];							//node addresses of -N
+static int gang_node_count = 0;									//0 means we flash every port on its own
+static int gang_page_gap_in_us = -1;							//pause between two broadcast pages, so the slowest node keeps up. -1 means we keep to Broadcast_page_period_in_us
+static uint32_t crc_table[256];
+static int auth_enabled = 0;									//we have a key (-K) and send the tag of the app
+static uint8_t auth_key[32];
+static uint8_t image_tag[32];
+static pthread_mutex_t print_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+//1)CRC32
+/*
+ * Same CRC32 as the bootloader (CRCCalculate followed by CRCFinal). It is the zlib/Ethernet CRC32.
+ *
+ * */
+
+static void CRCTableInit (void) {
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++) {
+			c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+		}
+		crc_table[i] = c;
+	}
+}
+
+static uint32_t CRC32 (const uint8_t* data_ptr, uint32_t length_in_bytes) {
+	uint32_t crc = 0xFFFFFFFF;
+	for (uint32_t i = 0; i < length_in_bytes; i++) {
+		crc = crc_table[(crc ^ data_ptr[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return crc ^ 0xFFFFFFFF;
+}
+
+static void PutLE32 (uint8_t* dst_ptr, uint32_t value) {
+	dst_ptr[0] = value & 0xFF;
+	dst_ptr[1] = (value >> 8) & 0xFF;
+	dst_ptr[2] = (value >> 16) & 0xFF;
+	dst_ptr[3] = value >> 24;
+}
+
+static uint32_t GetLE32 (const uint8_t* src_ptr) {
+	return ((uint32_t)src_ptr[0]) | ((uint32_t)src_ptr[1] << 8) | ((uint32_t)src_ptr[2] << 16) | ((uint32_t)src_ptr[3] << 24);
+}
+
+static const char* ErrorName (uint8_t error_code) {
+	if (error_code < (sizeof(Boot_error_names) / sizeof(Boot_error_names[0]))) {
+		return Boot_error_names[error_code];
+	} else {
+		return "unknown";
+	}
+}
+
+static speed_t BaudSelect (long baud);
+static int SerialBaudSet (flasher_port_t* port, long baud);
+static void ResultPrint (flasher_port_t* port, int window);
+
+static void ReportStore (flasher_port_t* port, const uint8_t* payload_ptr, uint8_t length) {
+	if (length >= Report_size_in_bytes) {
+		memcpy(port->report, payload_ptr, Report_size_in_bytes);
+		port->report_received = 1;
+		port->log_dropped_bytes = (length >= (Report_size_in_bytes + 2)) ? (payload_ptr[18] | (payload_ptr[19] << 8)) : -1;
+		port->missed_events = (length >= (Report_size_in_bytes + 6)) ? (payload_ptr[20] | (payload_ptr[21] << 8)) : -1;
+		port->cmd_frames_dropped = (length >= (Report_size_in_bytes + 6)) ? (payload_ptr[22] | (payload_ptr[23] << 8)) : -1;
+		port->rx_errors = (length >= (Report_size_in_bytes + 9)) ? (payload_ptr[24] | (payload_ptr[25] << 8)) : -1;
+		if ((length >= (Report_size_in_bytes + 9)) && (payload_ptr[26] < Baud_count) && (payload_ptr[26] != port->baud_index)) {
+			SerialBaudSet(port, Baud_rates[payload_ptr[26]]);						//the bootloader has stepped down, the rest comes at the new baud rate
+			port->baud_index = payload_ptr[26];
+			port->baud_stepped_down = 1;
+		} else {
+			//do nothing
+		}
+	} else {
+		//do nothing
+	}
+}
+
+static double Now (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+//2)Serial port
+/*
+ * The bootloader uses 8 bits, no parity and 1 stop bit on UART1. The port is put into raw mode, reads never block (we poll instead).
+ *
+ * */
+
+static int SerialOpen (flasher_port_t* port) {
+	port->fd = open(port->port_name, O_RDWR | O_NOCTTY);
+	if (port->fd < 0) {
+		return -1;
+	} else {
+		//do nothing
+	}
+
+	struct termios tty;
+	if (tcgetattr(port->fd, &tty) != 0) {
+		close(port->fd);
+		return -1;
+	} else {
+		//do nothing
+	}
+	cfmakeraw(&tty);
+	tty.c_cflag |= CLOCAL | CREAD;
+	tty.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+	tty.c_cc[VMIN] = 0;
+	tty.c_cc[VTIME] = 0;
+	cfsetispeed(&tty, baud_rate);
+	cfsetospeed(&tty, baud_rate);
+	if (tcsetattr(port->fd, TCSANOW, &tty) != 0) {
+		close(port->fd);
+		return -1;
+	} else {
+		//do nothing
+	}
+
+	tcflush(port->fd, TCIOFLUSH);
+	port->rx_length = 0;
+	return 0;
+}
+
+static int SerialBaudSet (flasher_port_t* port, long baud) {
+	/*
+	 * We change the baud rate of an open port. Whatever is still going out is sent at the old baud rate first.
+	 *
+	 * */
+	struct termios tty;
+	tcdrain(port->fd);
+	if (tcgetattr(port->fd, &tty) != 0) {
+		return -1;
+	} else {
+		//do nothing
+	}
+	cfsetispeed(&tty, BaudSelect(baud));
+	cfsetospeed(&tty, BaudSelect(baud));
+	return tcsetattr(port->fd, TCSANOW, &tty);
+}
+
+static int SerialWrite (flasher_port_t* port, const uint8_t* data_ptr, uint32_t length_in_bytes) {
+	while (length_in_bytes != 0) {
+		ssize_t written = write(port->fd, data_ptr, length_in_bytes);
+		if (written < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			} else {
+				return -1;
+			}
+		} else {
+			data_ptr += written;
+			length_in_bytes -= written;
+		}
+	}
+	return 0;
+}
+
+static int SendCommand (flasher_port_t* port, const uint8_t* command_ptr, uint8_t command_length) {
+	/*
+	 * Commands are the message start sequence followed by the command byte and its arguments.
+	 * On a bus, the node prefix and the node address come between the start sequence and the command.
+	 * The bootloader frames them on the idle line, so we wait for the bytes to go out and then leave the bus idle for a while.
+	 *
+	 * */
+	uint8_t frame[64];
+	uint8_t frame_length = 2;
+	frame[0] = UART_message_start_byte;
+	frame[1] = UART_message_start_byte;
+	if (port->node != 0) {
+		frame[frame_length++] = UART_node_prefix;
+		frame[frame_length++] = port->node;
+	} else {
+		//do nothing
+	}
+	memcpy(&frame[frame_length], command_ptr, command_length);
+	if (SerialWrite(port, frame, frame_length + command_length) != 0) {
+		return -1;
+	} else {
+		//do nothing
+	}
+	tcdrain(port->fd);
+	usleep(Command_gap_in_ms * 1000);
+	return 0;
+}
+
+
+//3)Response parsing
+/*
+ * Responses are the message start sequence, the response type, the payload length and the payload (see UART1TxResponse).
+ * We return 1 if we have a response, 0 on a timeout and -1 on a port error.
+ *
+ * */
+
+static int ReadResponse (flasher_port_t* port, int timeout_in_ms, uint8_t* type_ptr, uint8_t* payload_ptr, uint8_t* length_ptr) {
+	double deadline = Now() + timeout_in_ms * 1e-3;
+
+	while (1) {
+
+		//we look for a complete frame in what we already have
+		int start = 0;
+		while ((start + 1) < port->rx_length) {
+			if ((port->rx_buf[start] == UART_message_start_byte) && (port->rx_buf[start + 1] == UART_message_start_byte)) {
+				break;
+			} else {
+				start++;
+			}
+		}
+		if (start != 0) {															//we drop anything before the start sequence
+			memmove(port->rx_buf, &port->rx_buf[start], port->rx_length - start);
+			port->rx_length -= start;
+		} else {
+			//do nothing
+		}
+		if ((port->rx_length >= 4) && (port->rx_length >= (4 + port->rx_buf[3]))) {
+			*type_ptr = port->rx_buf[2];
+			*length_ptr = port->rx_buf[3];
+			memcpy(payload_ptr, &port->rx_buf[4], port->rx_buf[3]);
+			int frame_length = 4 + port->rx_buf[3];
+			memmove(port->rx_buf, &port->rx_buf[frame_length], port->rx_length - frame_length);
+			port->rx_length -= frame_length;
+			return 1;
+		} else {
+			//do nothing
+		}
+
+		//we wait for more bytes
+		int remaining_in_ms = (int)((deadline - Now()) * 1e3);
+		if (remaining_in_ms <= 0) {
+			return 0;
+		} else {
+			//do nothing
+		}
+		struct pollfd pfd = {port->fd, POLLIN, 0};
+		int ready = poll(&pfd, 1, remaining_in_ms);
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			} else {
+				return -1;
+			}
+		} else if (ready == 0) {
+			return 0;
+		} else {
+			ssize_t received = read(port->fd, &port->rx_buf[port->rx_length], sizeof(port->rx_buf) - port->rx_length);
+			if (received < 0) {
+				if (errno == EINTR || errno == EAGAIN) {
+					continue;
+				} else {
+					return -1;
+				}
+			} else {
+				port->rx_length += received;
+			}
+		}
+	}
+}
+
+
+//4)Handshake
+/*
+ * 1)We send 0xc3 to keep the bootloader in the external controller mode. It is ignored if the bootloader is already there.
+ * 2)We ask for the transfer parameters (command 0xd2).
+ *
+ * Note: the bootloader only waits for 0xc3 for a few seconds after reset (or even less on the fast boot path). Reset the targets right before starting the tool.
+ *
+ * */
+
+static int Handshake (flasher_port_t* port) {
+	for (int attempt = 0; attempt < Handshake_attempts; attempt++) {
+
+		//1)
+		uint8_t stay_command = 0xc3;
+		if (SendCommand(port, &stay_command, 1) != 0) {
+			return -1;
+		} else {
+			//do nothing
+		}
+
+		//2)
+		uint8_t parameter_command = 0xd2;
+		if (SendCommand(port, &parameter_command, 1) != 0) {
+			return -1;
+		} else {
+			//do nothing
+		}
+		uint8_t type;
+		uint8_t length;
+		uint8_t payload[256];
+		int result = ReadResponse(port, 200, &type, payload, &length);
+		if (result < 0) {
+			return -1;
+		} else if ((result == 1) && (type == UART_response_ack) && (length >= 12)) {
+			port->device_protocol_version = payload[0];
+			port->device_window = payload[2];
+			port->device_slot_size_in_words = payload[3];
+			port->device_app_start_addr = GetLE32(&payload[4]);
+			port->device_app_size_in_bytes = GetLE32(&payload[8]) - GetLE32(&payload[4]);
+			port->device_update_slot = (length >= 14) ? payload[13] : -1;
+			port->device_auth_enabled = (length >= 16) ? payload[15] : 0;
+			return 0;
+		} else {
+			//do nothing
+		}
+	}
+	return -1;
+}
+
+
+//5)Windowed transfer
+/*
+ * We send addressed pages and keep at most "window" of them in flight. The bootloader acknowledges each page once it is in the FLASH, in the order the pages were sent.
+ *
+ * 1)We fill up the window. Pages that have been NACKed go first.
+ * 2)We take the next response. It must be for the oldest page in flight.
+ * 3)A NACKed page goes back into the queue, until it runs out of retries.
+ * 4)When every page is acknowledged, we send the end-of-transfer page and wait for its ACK.
+ *
+ * Note: a timeout is fatal. The bootloader cuts the Rx ring into frames by counting bytes, a lost byte shifts every frame after it. The target must be reset.
+ * Note: the window must not be larger than the one the bootloader publishes (command 0xd2, half its Rx ring).
+ *
+ * */
+
+static void BuildFrame (uint8_t* frame_ptr, uint16_t page_index) {
+	frame_ptr[0] = page_index & 0xFF;
+	frame_ptr[1] = page_index >> 8;
+	frame_ptr[2] = 0;
+	frame_ptr[3] = 0;
+	if (page_index == Addressed_page_end_of_transfer) {
+		memset(&frame_ptr[4], 0, Page_size_in_bytes);
+	} else {
+		memcpy(&frame_ptr[4], &image[page_index * Page_size_in_bytes], Page_size_in_bytes);
+	}
+	PutLE32(&frame_ptr[4 + Page_size_in_bytes], CRC32(frame_ptr, 4 + Page_size_in_bytes));
+}
+
+static int WindowedTransfer (flasher_port_t* port, int window, uint32_t first_page) {
+	uint16_t* send_queue = malloc(sizeof(uint16_t) * (image_page_count + 1));
+	uint8_t* retries = calloc(image_page_count, 1);
+	uint16_t in_flight[Max_window];
+	int in_flight_head = 0;
+	int in_flight_count = 0;
+	uint32_t send_head = 0;
+	uint32_t send_tail = 0;
+	uint32_t acked_pages = 0;
+	uint8_t frame[136];
+	int result = -1;
+
+	for (uint32_t i = first_page; i < image_page_count; i++) {
+		send_queue[send_tail++] = i;
+	}
+	send_tail = send_tail % (image_page_count + 1);
+
+	while (acked_pages < (image_page_count - first_page)) {
+
+		//1)
+		while ((in_flight_count < window) && (send_head != send_tail)) {
+			uint16_t page_index = send_queue[send_head];
+			send_head = (send_head + 1) % (image_page_count + 1);
+			BuildFrame(frame, page_index);
+			if (SerialWrite(port, frame, Frame_size_in_bytes) != 0) {
+				port->error = "port write failed";
+				goto end;
+			} else {
+				//do nothing
+			}
+			in_flight[(in_flight_head + in_flight_count) % Max_window] = page_index;
+			in_flight_count++;
+			port->pages_sent++;
+		}
+
+		//2)
+		uint8_t type;
+		uint8_t length;
+		uint8_t payload[256];
+		int response = ReadResponse(port, response_timeout_in_ms, &type, payload, &length);
+		if (response < 0) {
+			port->error = "port read failed";
+			goto end;
+		} else if (response == 0) {
+			port->error = "no response from the bootloader";
+			goto end;
+		} else if (type == UART_response_report) {
+			ReportStore(port, payload, length);
+			continue;
+		} else if ((length < 2) || (in_flight_count == 0)) {
+			continue;																//not a page response, we ignore it
+		} else {
+			//do nothing
+		}
+		uint16_t page_index = payload[0] | (payload[1] << 8);
+		uint16_t expected_page_index = in_flight[in_flight_head];
+		in_flight_head = (in_flight_head + 1) % Max_window;
+		in_flight_count--;
+
+		//3)
+		if ((type == UART_response_ack) && (page_index == expected_page_index)) {
+			acked_pages++;
+		} else if (type == UART_response_ack) {
+			port->error = "pages acknowledged out of order";
+			goto end;
+		} else if (type == UART_response_nack) {
+			port->nacks++;
+			port->last_error_code = (length >= 3) ? payload[2] : 0;
+			if (++retries[expected_page_index] > max_retries) {
+				port->error = "page rejected too many times";
+				goto end;
+			} else {
+				//do nothing
+			}
+			send_queue[send_tail] = expected_page_index;							//the index in the NACK may be broken, we go by the order instead
+			send_tail = (send_tail + 1) % (image_page_count + 1);
+			port->pages_resent++;
+		} else {
+			port->error = "unknown response";
+			goto end;
+		}
+	}
+
+	//4)
+	BuildFrame(frame, Addressed_page_end_of_transfer);
+	if (SerialWrite(port, frame, Frame_size_in_bytes) != 0) {
+		port->error = "port write failed";
+		goto end;
+	} else {
+		//do nothing
+	}
+	while (1) {
+		uint8_t type;
+		uint8_t length;
+		uint8_t payload[256];
+		int response = ReadResponse(port, response_timeout_in_ms, &type, payload, &length);
+		if (response <= 0) {
+			port->error = "end of transfer not acknowledged";
+			goto end;
+		} else if (type == UART_response_report) {
+			ReportStore(port, payload, length);
+		} else if ((type == UART_response_ack) && (length >= 2) && ((payload[0] | (payload[1] << 8)) == Addressed_page_end_of_transfer)) {
+			result = 0;
+			goto end;
+		} else {
+			//do nothing
+		}
+	}
+
+end:
+	free(send_queue);
+	free(retries);
+	return result;
+}
+
+
+//6)Commit
+/*
+ * We commit the app (command 0xd1) with the padded length, the CRC32 and the version. The bootloader answers with its own CRC32.
+ * If the commit has gone to the bootloader in the batch of the transfer already, we only wait for its answer.
+ *
+ * */
+
+static void CommitBuild (uint8_t* command_ptr) {
+	command_ptr[0] = 0xd1;
+	PutLE32(&command_ptr[1], image_length_in_bytes);
+	PutLE32(&command_ptr[5], image_crc);
+	PutLE32(&command_ptr[9], image_version);
+}
+
+static int Commit (flasher_port_t* port, int commit_sent) {
+	uint8_t command[13];
+	CommitBuild(command);
+	if ((commit_sent == 0) && (SendCommand(port, command, 13) != 0)) {
+		port->error = "port write failed";
+		return -1;
+	} else {
+		//do nothing
+	}
+
+	uint8_t type;
+	uint8_t length;
+	uint8_t payload[256];
+	int response = ReadResponse(port, 2000, &type, payload, &length);				//the bootloader may have to read the app back
+	while ((response == 1) && (type == UART_response_report)) {					//the report of the transfer may come in first
+		ReportStore(port, payload, length);
+		response = ReadResponse(port, 2000, &type, payload, &length);
+	}
+	if (response <= 0) {
+		port->error = "commit not answered";
+		return -1;
+	} else {
+		//do nothing
+	}
+	if (length >= 4) {
+		port->device_crc = GetLE32(payload);
+	} else {
+		//do nothing
+	}
+	if (type != UART_response_ack) {
+		port->last_error_code = (length >= 5) ? payload[4] : 0;
+		port->error = "commit rejected";
+		return -1;
+	} else {
+		return 0;
+	}
+}
+
+
+//7)Image authentication
+/*
+ * A bootloader built with image authentication only commits an app that comes with its tag (command 0xd9), see BootImageAuth.c in the bootloader.
+ * The tag is the HMAC-SHA256 of the padded image, followed by its length and its version (4 bytes each, LSB first), with the 32 byte key of -K.
+ * We send the tag before the transfer. It is kept by the bootloader until a commit checks it, thrown away after the check.
+ *
+ * */
+
+static const uint32_t Sha_round_constants[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+typedef struct {
+	uint32_t state[8];
+	uint8_t block[64];
+	uint32_t block_length;
+	uint64_t length_in_bytes;
+} sha256_t;
+
+static uint32_t Rotr (uint32_t x, int n) {
+	return (x >> n) | (x << (32 - n));
+}
+
+static void Sha256Block (sha256_t* sha) {
+	uint32_t w[64];
+	uint32_t v[8];
+	for (int i = 0; i < 16; i++) {
+		w[i] = ((uint32_t)sha->block[4 * i] << 24) | ((uint32_t)sha->block[(4 * i) + 1] << 16) | ((uint32_t)sha->block[(4 * i) + 2] << 8) | sha->block[(4 * i) + 3];
+	}
+	for (int i = 16; i < 64; i++) {
+		w[i] = w[i - 16] + w[i - 7] + (Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3)) + (Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10));
+	}
+	memcpy(v, sha->state, sizeof(v));
+	for (int i = 0; i < 64; i++) {
+		uint32_t t1 = v[7] + (Rotr(v[4], 6) ^ Rotr(v[4], 11) ^ Rotr(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) + Sha_round_constants[i] + w[i];
+		uint32_t t2 = (Rotr(v[0], 2) ^ Rotr(v[0], 13) ^ Rotr(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+		memmove(&v[1], &v[0], 7 * sizeof(uint32_t));
+		v[4] += t1;
+		v[0] = t1 + t2;
+	}
+	for (int i = 0; i < 8; i++) {
+		sha->state[i] += v[i];
+	}
+}
+
+static void Sha256Start (sha256_t* sha) {
+	static const uint32_t start_state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+	memcpy(sha->state, start_state, sizeof(start_state));
+	sha->block_length = 0;
+	sha->length_in_bytes = 0;
+}
+
+static void Sha256Add (sha256_t* sha, const uint8_t* data_ptr, uint32_t length_in_bytes) {
+	for (uint32_t i = 0; i < length_in_bytes; i++) {
+		sha->block[sha->block_length++] = data_ptr[i];
+		if (sha->block_length == 64) {
+			Sha256Block(sha);
+			sha->block_length = 0;
+		} else {
+			//do nothing
+		}
+	}
+	sha->length_in_bytes += length_in_bytes;
+}
+
+static void Sha256Final (sha256_t* sha, uint8_t* digest_ptr) {
+	uint64_t length_in_bits = sha->length_in_bytes * 8;
+	uint8_t padding = 0x80;
+	Sha256Add(sha, &padding, 1);
+	padding = 0x00;
+	while (sha->block_length != 56) {
+		Sha256Add(sha, &padding, 1);
+	}
+	for (int i = 7; i >= 0; i--) {
+		padding = (uint8_t)(length_in_bits >> (8 * i));
+		Sha256Add(sha, &padding, 1);
+	}
+	for (int i = 0; i < 32; i++) {
+		digest_ptr[i] = (uint8_t)(sha->state[i / 4] >> (24 - (8 * (i % 4))));
+	}
+}
+
+static void ImageTagCalculate (void) {
+	uint8_t key_block[64];
+	uint8_t inner_digest[32];
+	uint8_t trailer[8];
+	sha256_t sha;
+
+	PutLE32(&trailer[0], image_length_in_bytes);
+	PutLE32(&trailer[4], image_version);
+
+	memset(key_block, 0x36, sizeof(key_block));
+	for (int i = 0; i < 32; i++) {
+		key_block[i] ^= auth_key[i];
+	}
+	Sha256Start(&sha);
+	Sha256Add(&sha, key_block, 64);
+	Sha256Add(&sha, image, image_length_in_bytes);
+	Sha256Add(&sha, trailer, 8);
+	Sha256Final(&sha, inner_digest);
+
+	memset(key_block, 0x5c, sizeof(key_block));
+	for (int i = 0; i < 32; i++) {
+		key_block[i] ^= auth_key[i];
+	}
+	Sha256Start(&sha);
+	Sha256Add(&sha, key_block, 64);
+	Sha256Add(&sha, inner_digest, 32);
+	Sha256Final(&sha, image_tag);
+}
+
+static int KeyLoad (const char* file_name) {
+	/*
+	 * The key file holds the 32 bytes of the key, either raw or as 64 hex digits.
+	 *
+	 * */
+	uint8_t key_file_buf[130];
+	FILE* key_file = fopen(file_name, "rb");
+	if (key_file == NULL) {
+		fprintf(stderr, "Can't open %s\n", file_name);
+		return -1;
+	} else {
+		//do nothing
+	}
+	size_t key_file_length = fread(key_file_buf, 1, sizeof(key_file_buf), key_file);
+	fclose(key_file);
+	while ((key_file_length > 32) && ((key_file_buf[key_file_length - 1] == '\n') || (key_file_buf[key_file_length - 1] == '\r'))) {
+		key_file_length--;
+	}
+	if (key_file_length == 32) {
+		memcpy(auth_key, key_file_buf, 32);
+	} else if (key_file_length == 64) {
+		for (int i = 0; i < 32; i++) {
+			char hex_digits[3] = {(char)key_file_buf[2 * i], (char)key_file_buf[(2 * i) + 1], 0};
+			char* end_ptr;
+			auth_key[i] = (uint8_t)strtoul(hex_digits, &end_ptr, 16);
+			if (*end_ptr != 0) {
+				fprintf(stderr, "Invalid key in %s\n", file_name);
+				return -1;
+			} else {
+				//do nothing
+			}
+		}
+	} else {
+		fprintf(stderr, "The key in %s must be 32 bytes or 64 hex digits\n", file_name);
+		return -1;
+	}
+	auth_enabled = 1;
+	return 0;
+}
+
+static int TagSend (flasher_port_t* port) {
+	uint8_t command[33];
+	command[0] = 0xd9;
+	memcpy(&command[1], image_tag, 32);
+	uint8_t type;
+	uint8_t length;
+	uint8_t payload[256];
+	if ((SendCommand(port, command, 33) != 0) || (ReadResponse(port, 200, &type, payload, &length) != 1) || (type != UART_response_ack)) {
+		port->error = "authentication tag not taken";
+		return -1;
+	} else {
+		return 0;
+	}
+}
+
+
+//8)Baud rate negotiation
+/*
+ * We propose a faster baud rate to the bootloader (command 0xd7). The bootloader ACKs it at the old baud rate and switches.
+ * We follow and send the probe (0xd7, 0xFF and the probe pattern). The bootloader sends the pattern back at the new baud rate if the probe made it.
+ * Otherwise both sides stay at the old baud rate - the bootloader NACKs there once it has given up on the probe - and we try the next slower one.
+ * The function gives back 0 if we run faster than the baud rate of -b.
+ *
+ * Note: BaudSwitch tries a single baud rate, faster or slower than the one we run at. It gives back 0 if both sides have switched.
+ *
+ * */
+
+static int BaudSwitch (flasher_port_t* port, int baud_index) {
+	uint8_t command[10] = {0xd7, (uint8_t)baud_index};
+	uint8_t type;
+	uint8_t length;
+	uint8_t payload[256];
+	if ((SendCommand(port, command, 2) != 0) || (ReadResponse(port, 200, &type, payload, &length) != 1) || (type != UART_response_ack)) {
+		return -1;																	//the bootloader does not take the command (or the baud rate)
+	} else {
+		//do nothing
+	}
+	long previous_baud = Baud_rates[port->baud_index];
+	SerialBaudSet(port, Baud_rates[baud_index]);
+	tcflush(port->fd, TCIFLUSH);
+	port->rx_length = 0;
+	usleep(Command_gap_in_ms * 1000);												//the bootloader needs a moment to switch over
+	command[1] = 0xFF;
+	memcpy(&command[2], Baud_probe_pattern, sizeof(Baud_probe_pattern));
+	if ((SendCommand(port, command, 10) == 0) && (ReadResponse(port, 200, &type, payload, &length) == 1) && (type == UART_response_ack) &&
+		(length == sizeof(Baud_probe_pattern)) && (memcmp(payload, Baud_probe_pattern, sizeof(Baud_probe_pattern)) == 0)) {
+		port->baud_index = baud_index;
+		return 0;
+	} else {
+		//do nothing
+	}
+	SerialBaudSet(port, previous_baud);
+	tcflush(port->fd, TCIFLUSH);
+	port->rx_length = 0;
+	ReadResponse(port, Baud_probe_timeout_in_ms, &type, payload, &length);			//the NACK of the probe, if we did not miss it during the switch
+	return -1;
+}
+
+static int BaudNegotiate (flasher_port_t* port, int target_index) {
+	for (int baud_index = target_index; baud_index > port->baud_index; baud_index--) {
+		if (BaudSwitch(port, baud_index) == 0) {
+			return 0;
+		} else {
+			//do nothing
+		}
+	}
+	return -1;
+}
+
+
+//9)Batch
+/*
+ * We send the switch to addressed pages (command 0xbe), the commit and - with -j - the start of the app in one batch (command 0xb0).
+ * The bootloader runs the commit and the start of the app on its own once the transfer is over, so the whole update is a single command frame.
+ * The bootloader ACKs the batch with the number of commands in it.
+ *
+ * Note: the start of the app is dropped by the bootloader if the commit fails.
+ *
+ * */
+
+static int BatchStart (flasher_port_t* port) {
+	uint8_t command[16];
+	uint8_t command_count = jump_enabled ? 3 : 2;
+	command[0] = 0xb0;
+	command[1] = 0xbe;
+	CommitBuild(&command[2]);
+	command[15] = 0xaa;
+	uint8_t type;
+	uint8_t length;
+	uint8_t payload[256];
+	if (SendCommand(port, command, jump_enabled ? 16 : 15) != 0) {
+		port->error = "port write failed";
+		return -1;
+	} else if ((ReadResponse(port, 200, &type, payload, &length) != 1) || (type != UART_response_ack) || (length < 1) || (payload[0] != command_count)) {
+		port->last_error_code = ((type == UART_response_nack) && (length >= 1)) ? payload[0] : 0;
+		port->error = "batch rejected";
+		return -1;
+	} else {
+		return 0;
+	}
+}
+
+
+//10)Resume
+/*
+ * We ask the bootloader for its resume checkpoint (command 0xd6). The checkpoint gives the length of the update slot written in order and the CRC32 over it.
+ * If the CRC matches the same part of our app, the bootloader has the start of this very app and we resume the update from there (command 0xd6 again, with 0x01).
+ * The function gives back the page to start the transfer from, 0 if the update can't be resumed.
+ *
+ * */
+
+static uint32_t Resume (flasher_port_t* port) {
+	uint8_t command[2] = {0xd6, 0x00};
+	uint8_t type;
+	uint8_t length;
+	uint8_t payload[256];
+	if ((SendCommand(port, command, 2) != 0) || (ReadResponse(port, 200, &type, payload, &length) != 1) || (type != UART_response_ack) || (length < 9)) {
+		return 0;
+	} else {
+		//do nothing
+	}
+	uint32_t resume_length_in_bytes = GetLE32(&payload[1]);
+	if ((resume_length_in_bytes >= image_length_in_bytes) || (CRC32(image, resume_length_in_bytes) != GetLE32(&payload[5]))) {
+		return 0;																	//the bootloader has the start of another app
+	} else {
+		//do nothing
+	}
+	usleep(Command_gap_in_ms * 1000);
+	command[1] = 0x01;
+	if ((SendCommand(port, command, 2) != 0) || (ReadResponse(port, 200, &type, payload, &length) != 1) || (type != UART_response_ack)) {
+		return 0;
+	} else {
+		return resume_length_in_bytes / Page_size_in_bytes;
+	}
+}
+
+
+//11)Pipeline timing
+/*
+ * We ask for the timing results of the bootloader pipeline (command 0xd3) and wipe them on the bootloader.
+ * Before the transfer, this only throws away the results of earlier transfers.
+ *
+ * */
+
+static int TimingQuery (flasher_port_t* port) {
+	uint8_t command[2] = {0xd3, 0x01};
+	if (SendCommand(port, command, 2) != 0) {
+		return -1;
+	} else {
+		//do nothing
+	}
+
+	uint8_t type;
+	uint8_t length;
+	uint8_t payload[256];
+	int response = ReadResponse(port, response_timeout_in_ms, &type, payload, &length);
+	while ((response == 1) && (type == UART_response_report)) {					//the report of the transfer may come in first
+		ReportStore(port, payload, length);
+		response = ReadResponse(port, response_timeout_in_ms, &type, payload, &length);
+	}
+	if ((response <= 0) || (type != UART_response_ack) || (length < Timing_report_min_size_in_bytes)) {
+		port->timing_length = 0;												//older bootloaders don't know the command
+		return -1;
+	} else {
+		memcpy(port->timing, payload, length);
+		port->timing_length = length;
+		return 0;
+	}
+}
+
+static void TimingPrint (flasher_port_t* port) {
+	for (int i = 0; i < Timing_stat_count; i++) {
+		const uint8_t* stat_ptr = &port->timing[14 * i];
+		printf("%s: %-9s %5u times, min %7u us, mean %7u us, max %7u us\n", port->port_name, Timing_stat_names[i],
+				stat_ptr[0] | (stat_ptr[1] << 8), GetLE32(&stat_ptr[2]), GetLE32(&stat_ptr[10]), GetLE32(&stat_ptr[6]));
+	}
+	printf("%s: slack   %u..%u slots [", port->port_name, port->timing[56], port->timing[57]);
+	for (int i = Timing_report_min_size_in_bytes; (i + 1) < port->timing_length; i = i + 2) {
+		printf((i == Timing_report_min_size_in_bytes) ? "%u" : " %u", port->timing[i] | (port->timing[i + 1] << 8));
+	}
+	printf("] (releases with 0, 1, 2... slots left before the DMA overwrites the slot)\n");
+}
+
+
+//12)Benchmark
+/*
+ * 1)We run the NVM benchmark of the bootloader (command 0xd4, 0x00) and print the page times together with the throughput they give.
+ * 2)We switch to every baud rate from the one of -b up to the one of -s (or the fastest one) in turn (command 0xd7), and run the Rx benchmark there (see BenchRxRun).
+ * 3)We print the fastest sustainable baud rate and go back to the baud rate of -b.
+ *
+ * Rx benchmark:
+ * 1)We start the Rx benchmark (command 0xd4, 0x01) and send the pattern pages back-to-back. Word "w" of page "n" is (n << 16) | (w << 8) | 0x5A, LSB first.
+ * 2)Once the bus is idle, the bootloader sends the transfer report and the result of the Rx benchmark.
+ * The function gives back 0 if the baud rate is sustainable (no page corrupted or overwritten in the Rx ring), 1 if it is not, -1 if the bootloader did not answer.
+ *
+ * Note: a baud rate the bootloader does not switch to is skipped. If the bootloader steps down after a noisy benchmark, the next baud rate is negotiated from there.
+ *
+ * */
+
+static int BenchRxRun (flasher_port_t* port) {
+	uint8_t type;
+	uint8_t length;
+	uint8_t payload[256];
+
+	//1)
+	uint8_t rx_command[2] = {0xd4, 0x01};
+	long bench_baud = Baud_rates[port->baud_index];
+	SendCommand(port, rx_command, 2);
+	usleep(Programmer_mode_setup_in_ms * 1000);
+
+	uint8_t* pattern = malloc(bench_pages * Page_size_in_bytes);
+	for (int page = 0; page < bench_pages; page++) {
+		for (uint32_t word = 0; word < (Page_size_in_bytes / 4); word++) {
+			PutLE32(&pattern[(page * Page_size_in_bytes) + (4 * word)], ((uint32_t)page << 16) | (word << 8) | 0x5A);
+		}
+	}
+	double send_start_time = Now();
+	if (SerialWrite(port, pattern, bench_pages * Page_size_in_bytes) != 0) {
+		port->error = "port write failed";
+	} else {
+		tcdrain(port->fd);
+	}
+	double send_time_in_s = Now() - send_start_time;
+	free(pattern);
+
+	//2)
+	int response = ReadResponse(port, response_timeout_in_ms, &type, payload, &length);
+	while ((response == 1) && (type == UART_response_report)) {
+		ReportStore(port, payload, length);											//may step us down along with the bootloader
+		response = ReadResponse(port, response_timeout_in_ms, &type, payload, &length);
+	}
+
+	int bench_result = -1;
+	pthread_mutex_lock(&print_lock);
+	if ((response == 1) && (length >= 10)) {
+		uint32_t pages = payload[0] | (payload[1] << 8);
+		uint32_t bad_pages = payload[2] | (payload[3] << 8);
+		uint32_t overwritten_pages = payload[4] | (payload[5] << 8);
+		uint32_t elapsed_us = GetLE32(&payload[6]);
+		double rate = (elapsed_us != 0) ? ((pages - 1) * Page_size_in_bytes * 1e6 / elapsed_us) : 0.0;
+		bench_result = ((type == UART_response_ack) && (pages == (uint32_t)bench_pages)) ? 0 : 1;
+		printf("%s: Rx benchmark at %ld baud, %u of %d pages received, %u corrupted, %u overwritten, %.0f bytes/s received (line rate %ld bytes/s, sent at %.0f bytes/s) - %s\n",
+				port->port_name, bench_baud, pages, bench_pages, bad_pages, overwritten_pages, rate, bench_baud / 10,
+				bench_pages * Page_size_in_bytes / send_time_in_s, (bench_result == 0) ? "sustainable" : "NOT sustainable");
+	} else {
+		printf("%s: Rx benchmark at %ld baud not answered\n", port->port_name, bench_baud);
+	}
+	pthread_mutex_unlock(&print_lock);
+	return bench_result;
+}
+
+static void* BenchPort (void* arg) {
+	flasher_port_t* port = (flasher_port_t*)arg;
+	uint8_t type;
+	uint8_t length;
+	uint8_t payload[256];
+
+	if (SerialOpen(port) != 0) {
+		port->error = "can't open the port";
+		return NULL;
+	} else if (Handshake(port) != 0) {
+		port->error = "no bootloader found";
+		close(port->fd);
+		return NULL;
+	} else {
+		//do nothing
+	}
+
+	//1)
+	uint8_t nvm_command[2] = {0xd4, 0x00};
+	SendCommand(port, nvm_command, 2);
+	int response = ReadResponse(port, 5000, &type, payload, &length);				//a round takes roughly 100 ms
+	pthread_mutex_lock(&print_lock);
+	if ((response == 1) && (type == UART_response_ack) && (length >= 25)) {
+		printf("%s: NVM benchmark, %u rounds\n", port->port_name, payload[0]);
+		for (int i = 0; i < Bench_NVM_stat_count; i++) {
+			uint32_t min_us = GetLE32(&payload[1 + (8 * i)]);
+			uint32_t max_us = GetLE32(&payload[5 + (8 * i)]);
+			printf("%s: %-18s min %7u us, max %7u us, %8.0f bytes/s at worst\n", port->port_name, Bench_NVM_names[i],
+					min_us, max_us, (max_us != 0) ? (Page_size_in_bytes * 1e6 / max_us) : 0.0);
+		}
+	} else if ((response == 1) && (type == UART_response_nack) && (length >= 1)) {
+		printf("%s: NVM benchmark rejected (%s)\n", port->port_name, ErrorName(payload[0]));
+	} else {
+		printf("%s: NVM benchmark not answered\n", port->port_name);
+	}
+	pthread_mutex_unlock(&print_lock);
+
+	//2)
+	int start_index = port->baud_index;
+	int last_index = Baud_count - 1;
+	while ((switch_baud_in_bits != 0) && (Baud_rates[last_index] != switch_baud_in_bits)) {
+		last_index--;																//the baud rate has been checked in main
+	}
+	long fastest_baud = 0;
+	for (int baud_index = start_index; baud_index <= last_index; baud_index++) {
+		if ((baud_index != port->baud_index) && (BaudSwitch(port, baud_index) != 0)) {
+			pthread_mutex_lock(&print_lock);
+			printf("%s: Rx benchmark at %ld baud skipped, the bootloader did not switch to it\n", port->port_name, Baud_rates[baud_index]);
+			pthread_mutex_unlock(&print_lock);
+			continue;
+		} else {
+			//do nothing
+		}
+		int bench_result = BenchRxRun(port);
+		if (bench_result < 0) {
+			port->error = "Rx benchmark not answered";								//the bootloader is lost, most likely still in programmer mode
+			break;
+		} else if (bench_result == 0) {
+			fastest_baud = Baud_rates[baud_index];
+		} else {
+			//do nothing
+		}
+		usleep(Command_gap_in_ms * 1000);
+	}
+
+	//3)
+	if ((port->error == NULL) && (port->baud_index != start_index) && (BaudSwitch(port, start_index) != 0)) {
+		pthread_mutex_lock(&print_lock);
+		printf("%s: the bootloader stays at %ld baud\n", port->port_name, Baud_rates[port->baud_index]);
+		pthread_mutex_unlock(&print_lock);
+	} else {
+		//do nothing
+	}
+	close(port->fd);
+
+	pthread_mutex_lock(&print_lock);
+	if (fastest_baud != 0) {
+		printf("%s: fastest sustainable Rx at %ld baud\n", port->port_name, fastest_baud);
+	} else {
+		printf("%s: no sustainable Rx rate found\n", port->port_name);
+	}
+	pthread_mutex_unlock(&print_lock);
+	if ((port->error == NULL) && (fastest_baud == 0)) {
+		port->error = "Rx benchmark failed";
+	} else {
+		//do nothing
+	}
+	return NULL;
+}
+
+
+//13)Flashing one port
+/*
+ * We check the parameters published by the bootloader (command 0xd2) against the app. The function gives back 0 if the app can be sent over.
+ *
+ * */
+
+static int DeviceCheck (flasher_port_t* port) {
+	if ((port->device_slot_size_in_words * 4) != Frame_size_in_bytes) {
+		port->error = "bootloader does not take addressed pages of 128 bytes";			//the bootloader is built for another page size (see BootConfig.h)
+	} else if (image_length_in_bytes > port->device_app_size_in_bytes) {
+		port->error = "app does not fit the app section";
+	} else if ((GetLE32(&image[4]) < port->device_app_start_addr) ||
+			   (GetLE32(&image[4]) >= (port->device_app_start_addr + port->device_app_size_in_bytes))) {
+		port->error = "app is not linked to the app section of the bootloader";		//the reset vector must point into the update slot
+	} else if (port->device_auth_enabled && (auth_enabled == 0)) {
+		port->error = "bootloader only takes authenticated apps, a key is needed (-K)";
+	} else {
+		//do nothing
+	}
+	return (port->error == NULL) ? 0 : -1;
+}
+
+static int WindowSelect (flasher_port_t* port) {
+	int window = port->device_window;
+	if ((requested_window != 0) && (requested_window < window)) {
+		window = requested_window;
+	} else {
+		//do nothing
+	}
+	if (window > Max_window) {
+		window = Max_window;
+	} else if (window < 1) {
+		window = 1;
+	} else {
+		//do nothing
+	}
+	return window;
+}
+
+static void* FlashPort (void* arg) {
+	flasher_port_t* port = (flasher_port_t*)arg;
+	double start_time = Now();
+
+	if (SerialOpen(port) != 0) {
+		port->error = "can't open the port";
+		return NULL;
+	} else {
+		//do nothing
+	}
+
+	if (Handshake(port) != 0) {
+		port->error = "no bootloader found";
+		close(port->fd);
+		return NULL;
+	} else {
+		//do nothing
+	}
+
+	if (DeviceCheck(port) != 0) {
+		close(port->fd);
+		return NULL;
+	} else {
+		//do nothing
+	}
+
+	if (switch_baud_in_bits != 0) {
+		int target_index = 0;
+		while (Baud_rates[target_index] != switch_baud_in_bits) {
+			target_index++;															//the baud rate has been checked in main
+		}
+		if (BaudNegotiate(port, target_index) != 0) {
+			pthread_mutex_lock(&print_lock);
+			printf("%s: staying at %ld baud\n", port->port_name, Baud_rates[port->baud_index]);
+			pthread_mutex_unlock(&print_lock);
+		} else {
+			//do nothing
+		}
+	} else {
+		//do nothing
+	}
+
+	if (timing_enabled) {
+		TimingQuery(port);														//we start from zero
+	} else {
+		//do nothing
+	}
+
+	int window = WindowSelect(port);
+
+	uint32_t first_page = 0;
+	if (resume_enabled) {
+		first_page = Resume(port);
+	} else {
+		//do nothing
+	}
+	if (auth_enabled && commit_enabled && (port->device_protocol_version >= 4) && (TagSend(port) != 0)) {
+		close(port->fd);
+		return NULL;
+	} else {
+		//do nothing
+	}
+	int commit_sent = 0;
+	if ((first_page == 0) && commit_enabled && (port->device_protocol_version >= 2)) {
+		if (BatchStart(port) != 0) {
+			close(port->fd);
+			return NULL;
+		} else {
+			commit_sent = 1;
+		}
+	} else if (first_page == 0) {
+		uint8_t addressed_mode_command = 0xbe;
+		SendCommand(port, &addressed_mode_command, 1);
+	} else {
+		port->pages_resumed = first_page;
+	}
+	usleep(Programmer_mode_setup_in_ms * 1000);
+
+	double transfer_start_time = Now();
+	if (WindowedTransfer(port, window, first_page) == 0) {
+		port->transfer_time_in_s = Now() - transfer_start_time;
+		if (commit_sent == 0) {
+			usleep(Command_gap_in_ms * 1000);										//the bootloader goes back to command capture after the transfer
+		} else {
+			//do nothing
+		}
+		if (commit_enabled && (Commit(port, commit_sent) == 0) && jump_enabled && (commit_sent == 0)) {
+			uint8_t jump_command = 0xaa;
+			SendCommand(port, &jump_command, 1);
+		} else {
+			//do nothing
+		}
+	} else {
+		port->transfer_time_in_s = Now() - transfer_start_time;
+	}
+	if (timing_enabled && (jump_enabled == 0)) {
+		TimingQuery(port);														//the bootloader is gone once the app has been started
+	} else {
+		//do nothing
+	}
+
+	port->total_time_in_s = Now() - start_time;
+	close(port->fd);
+	ResultPrint(port, window);
+	return NULL;
+}
+
+static void ResultPrint (flasher_port_t* port, int window) {
+	pthread_mutex_lock(&print_lock);
+	if ((port->error == NULL) && (port->device_update_slot >= 0)) {
+		printf("%s: app written to slot %c at 0x%08x\n", port->port_name, 'A' + port->device_update_slot, port->device_app_start_addr);
+	} else {
+		//do nothing
+	}
+	if (port->pages_resumed != 0) {
+		printf("%s: resumed at page %u\n", port->port_name, port->pages_resumed);
+	} else {
+		//do nothing
+	}
+	if (port->baud_stepped_down) {
+		printf("%s: the bootloader stepped down to %ld baud after the transfer\n", port->port_name, Baud_rates[port->baud_index]);
+	} else {
+		//do nothing
+	}
+	if ((port->error == NULL) && (window == 0)) {									//a node of a bus that took the broadcast
+		printf("%s: done at %ld baud, broadcast, %u pages sent (%u resent), %.2f s transfer, %.0f bytes/s, %.2f s total\n",
+				port->port_name, Baud_rates[port->baud_index], port->pages_sent, port->pages_resent, port->transfer_time_in_s,
+				image_length_in_bytes / port->transfer_time_in_s, port->total_time_in_s);
+	} else if (port->error == NULL) {
+		printf("%s: done at %ld baud, window %d, %u pages sent (%u resent), %.2f s transfer, %.0f bytes/s, %.2f s total\n",
+				port->port_name, Baud_rates[port->baud_index], window, port->pages_sent, port->pages_resent, port->transfer_time_in_s,
+				image_length_in_bytes / port->transfer_time_in_s, port->total_time_in_s);
+	} else {
+		printf("%s: FAILED (%s, last error: %s) after %u pages sent, %u NACKs, %.2f s\n",
+				port->port_name, port->error, ErrorName(port->last_error_code), port->pages_sent, port->nacks, port->total_time_in_s);
+	}
+	if (port->report_received) {
+		printf("%s: bootloader report: %u pages updated, %u written, %u skipped, %u rejected, %u overwritten in the Rx ring, %u NVM errors (flags 0x%08x), %u responses dropped",
+				port->port_name, port->report[0] | (port->report[1] << 8), port->report[2] | (port->report[3] << 8),
+				port->report[4] | (port->report[5] << 8), port->report[6] | (port->report[7] << 8),
+				port->report[8] | (port->report[9] << 8), port->report[10] | (port->report[11] << 8),
+				GetLE32(&port->report[12]), port->report[16] | (port->report[17] << 8));
+		if (port->log_dropped_bytes >= 0) {
+			printf(", %d log bytes dropped", port->log_dropped_bytes);
+		} else {
+			//do nothing
+		}
+		if (port->missed_events >= 0) {
+			printf(", %d HT/TC events served late, %d command frames dropped", port->missed_events, port->cmd_frames_dropped);
+		} else {
+			//do nothing
+		}
+		if (port->rx_errors >= 0) {
+			printf(", %d Rx errors", port->rx_errors);
+		} else {
+			//do nothing
+		}
+		printf("\n");
+	} else {
+		//do nothing
+	}
+	if (port->timing_length != 0) {
+		TimingPrint(port);
+	} else if (timing_enabled) {
+		printf("%s: no timing results from the bootloader\n", port->port_name);
+	} else {
+		//do nothing
+	}
+	pthread_mutex_unlock(&print_lock);
+}
+
+
+//14)Gang programming
+/*
+ * Several bootloaders share one bus (-N). Each of them takes the command frames sent to its node address and the ones sent to the broadcast address.
+ *
+ * 1)We keep every bootloader in the external controller mode (broadcast 0xc3), then ask each node for its transfer parameters and its unique ID (0xd2 and 0xd8 0x00).
+ * 2)We switch the nodes that can take the app to addressed pages in one broadcast frame (0xbe) and send every page once, followed by the end-of-transfer page.
+ *   None of the nodes respond to a broadcast frame, so there is no window: the pages are paced to the NVM of the nodes (Broadcast_page_period_in_us), or with -g as a pause between them.
+ * 3)We ask each node for its transfer report (0xd8 0x02) and commit the app on it - with -K, after sending it the tag. A node that has lost or rejected a page, or has a wrong CRC, gets the app on its own (windowed transfer).
+ * 4)With -j, we start the app on every node that has it.
+ *
+ * Note: the pages have no node address. A node that is not in programmer mode drops them: it has seen our frames with a node address, and from then on it drops every frame without one.
+ * 		This also covers the pages sent to a single node in 3). Any 0xF0 0xF0 in them would otherwise look like a start sequence to the other nodes.
+ * Note: the baud rate is not negotiated on a bus, every node stays at the baud rate of -b.
+ * Note: a node that has lost the end-of-transfer page stays in programmer mode and does not answer 0xd8. It must be reset, like after a timeout of a windowed transfer.
+ *
+ * */
+
+static int NodeQuery (flasher_port_t* node) {
+	uint8_t command[2] = {0xd8, 0x00};
+	uint8_t type;
+	uint8_t length;
+	uint8_t payload[256];
+	if ((SendCommand(node, command, 2) != 0) || (ReadResponse(node, 200, &type, payload, &length) != 1) || (type != UART_response_ack) || (length < 20)) {
+		return -1;
+	} else {
+		memcpy(node->device_unique_id, &payload[2], 12);
+		return 0;
+	}
+}
+
+static int NodeReport (flasher_port_t* node) {
+	uint8_t command[2] = {0xd8, 0x02};
+	uint8_t type;
+	uint8_t length;
+	uint8_t payload[256];
+	if ((SendCommand(node, command, 2) != 0) || (ReadResponse(node, 200, &type, payload, &length) != 1) || (type != UART_response_report)) {
+		return -1;
+	} else {
+		ReportStore(node, payload, length);
+		return 0;
+	}
+}
+
+static int NodeReportBroken (flasher_port_t* node) {
+	if ((node->report_received == 0) ||
+		((uint32_t)(node->report[0] | (node->report[1] << 8)) != image_page_count) ||			//pages updated
+		((node->report[6] | (node->report[7] << 8)) != 0) ||								//rejected
+		((node->report[8] | (node->report[9] << 8)) != 0) ||								//overwritten in the Rx ring
+		((node->report[10] | (node->report[11] << 8)) != 0)) {							//NVM errors
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+static int NodeCommit (flasher_port_t* node) {
+	if (auth_enabled && (node->device_protocol_version >= 4) && (TagSend(node) != 0)) {
+		return -1;																	//a checked tag is used up, even if the check failed
+	} else {
+		return Commit(node, 0);
+	}
+}
+
+static int GangFlash (flasher_port_t* bus, flasher_port_t* nodes) {
+	double start_time = Now();
+	int nodes_ready = 0;
+	int failed_nodes = 0;
+
+	if (SerialOpen(bus) != 0) {
+		fprintf(stderr, "Can't open %s\n", bus->port_name);
+		return gang_node_count;
+	} else {
+		//do nothing
+	}
+	bus->node = UART_node_broadcast;
+
+	//1)
+	for (int attempt = 0; attempt < Handshake_attempts; attempt++) {
+		uint8_t stay_command = 0xc3;
+		SendCommand(bus, &stay_command, 1);
+	}
+	for (int i = 0; i < gang_node_count; i++) {
+		nodes[i].port_name = nodes[i].node_name;
+		snprintf(nodes[i].node_name, sizeof(nodes[i].node_name), "%s@0x%02x", bus->port_name, gang_nodes[i]);
+		nodes[i].fd = bus->fd;
+		nodes[i].node = gang_nodes[i];
+		nodes[i].baud_index = bus->baud_index;
+		if (Handshake(&nodes[i]) != 0) {
+			nodes[i].error = "no bootloader found";
+		} else if (DeviceCheck(&nodes[i]) != 0) {
+			//do nothing
+		} else if (NodeQuery(&nodes[i]) != 0) {
+			nodes[i].error = "node does not report its unique ID";
+		} else {
+			nodes_ready++;
+		}
+	}
+
+	//2)
+	double transfer_start_time = Now();
+	if (gang_page_gap_in_us < 0) {
+		int frame_time_in_us = (int)((Frame_size_in_bytes * 10 * 1000000LL) / Baud_rates[bus->baud_index]);
+		gang_page_gap_in_us = (frame_time_in_us < Broadcast_page_period_in_us) ? (Broadcast_page_period_in_us - frame_time_in_us) : 0;
+	} else {
+		//do nothing
+	}
+	if (nodes_ready != 0) {
+		uint8_t addressed_mode_command = 0xbe;
+		uint8_t frame[136];
+		SendCommand(bus, &addressed_mode_command, 1);
+		usleep(Programmer_mode_setup_in_ms * 1000);
+		for (uint32_t page_index = 0; page_index <= image_page_count; page_index++) {
+			BuildFrame(frame, (page_index == image_page_count) ? Addressed_page_end_of_transfer : page_index);
+			SerialWrite(bus, frame, Frame_size_in_bytes);
+			if (gang_page_gap_in_us != 0) {
+				tcdrain(bus->fd);
+				usleep(gang_page_gap_in_us);
+			} else {
+				//do nothing
+			}
+		}
+		tcdrain(bus->fd);
+		usleep(Programmer_mode_setup_in_ms * 1000);											//the nodes finish the last pages and go back to command capture
+	} else {
+		//do nothing
+	}
+	double broadcast_time_in_s = Now() - transfer_start_time;
+
+	//3)
+	for (int i = 0; i < gang_node_count; i++) {
+		flasher_port_t* node = &nodes[i];
+		int window = 0;
+		if (node->error != NULL) {
+			ResultPrint(node, window);
+			failed_nodes++;
+			continue;
+		} else {
+			//do nothing
+		}
+		tcflush(node->fd, TCIFLUSH);
+		node->rx_length = 0;
+		node->pages_sent = image_page_count;
+		node->transfer_time_in_s = broadcast_time_in_s;
+		if (NodeReport(node) != 0) {
+			node->error = "node did not come back from the broadcast transfer, reset it";
+			ResultPrint(node, window);
+			failed_nodes++;
+			continue;
+		} else if ((NodeReportBroken(node) == 0) && ((commit_enabled == 0) || (NodeCommit(node) == 0))) {
+			pthread_mutex_lock(&print_lock);
+			printf("%s: app received in broadcast\n", node->port_name);
+			pthread_mutex_unlock(&print_lock);
+		} else {
+			pthread_mutex_lock(&print_lock);
+			printf("%s: broadcast not received, sending the app to the node on its own\n", node->port_name);
+			pthread_mutex_unlock(&print_lock);
+			node->error = NULL;
+			node->report_received = 0;
+			window = WindowSelect(node);
+			uint8_t addressed_mode_command = 0xbe;
+			SendCommand(node, &addressed_mode_command, 1);
+			usleep(Programmer_mode_setup_in_ms * 1000);
+			double unicast_start_time = Now();
+			if ((WindowedTransfer(node, window, 0) == 0) && commit_enabled) {
+				usleep(Command_gap_in_ms * 1000);
+				NodeCommit(node);
+			} else {
+				//do nothing
+			}
+			node->transfer_time_in_s = broadcast_time_in_s + (Now() - unicast_start_time);
+		}
+
+		//4)
+		if ((node->error == NULL) && commit_enabled && jump_enabled) {
+			uint8_t jump_command = 0xaa;
+			SendCommand(node, &jump_command, 1);
+		} else {
+			//do nothing
+		}
+		node->total_time_in_s = Now() - start_time;
+		ResultPrint(node, window);
+		if (node->error != NULL) {
+			failed_nodes++;
+		} else {
+			//do nothing
+		}
+	}
+
+	close(bus->fd);
+	return failed_nodes;
+}
+
+
+//15)Main
+static speed_t BaudSelect (long baud) {
+	switch (baud) {
+	case 57600:
+		return B57600;
+	case 115200:
+		return B115200;
+	case 230400:
+		return B230400;
+	case 460800:
+		return B460800;
+	case 921600:
+		return B921600;
+	case 1000000:
+		return B1000000;
+	default:
+		return 0;
+	}
+}
+
+static void Usage (const char* name) {
+	fprintf(stderr, "Use: %s [-b baud] [-s baud] [-w window] [-V version] [-t timeout_ms] [-r retries] [-K keyfile] [-n] [-j] [-p] [-R] app.bin port [port ...]\n", name);
+	fprintf(stderr, "     %s [-b baud] [-w window] [-V version] [-t timeout_ms] [-r retries] [-g gap_ms] [-K keyfile] [-n] [-j] -N node[,node ...] app.bin port\n", name);
+	fprintf(stderr, "     %s [-b baud] [-s baud] -B pages port [port ...]\n", name);
+	fprintf(stderr, "  -b  baud rate of UART1 of the bootloader (57600, 115200, 230400, 460800, 921600, 1000000), 57600 by default\n");
+	fprintf(stderr, "  -s  baud rate negotiated with the bootloader for the transfer, the next slower one is tried if it does not work (with -B, the fastest one benchmarked)\n");
+	fprintf(stderr, "  -w  pages in flight, limited by the bootloader (command 0xd2)\n");
+	fprintf(stderr, "  -V  app version written into the app descriptor\n");
+	fprintf(stderr, "  -t  how long we wait for a response, 1000 ms by default\n");
+	fprintf(stderr, "  -r  how many times a rejected page is sent again, 5 by default\n");
+	fprintf(stderr, "  -K  file with the 32 byte key of the bootloader (raw or 64 hex digits), the app is sent with its authentication tag\n");
+	fprintf(stderr, "  -n  don't commit the app after the transfer\n");
+	fprintf(stderr, "  -j  start the app after the commit\n");
+	fprintf(stderr, "  -p  show the timing results of the bootloader pipeline after the transfer\n");
+	fprintf(stderr, "  -R  resume an interrupted update of the same app from the checkpoint of the bootloader\n");
+	fprintf(stderr, "  -B  benchmark the NVM and the Rx of the bootloader with this many pattern pages instead of flashing, at every baud rate from -b up\n");
+	fprintf(stderr, "  -N  node addresses of the bootloaders sharing the bus of the port (0x01 to 0xfe), the app is sent to all of them at once\n");
+	fprintf(stderr, "  -g  pause between two pages sent to all nodes, by default the pages are %d ms apart\n", Broadcast_page_period_in_us / 1000);
+}
+
+static int ImageLoad (const char* file_name) {
+	/*
+	 * We load the app and pad it with 0x00 (the erased value of the FLASH) to a full page.
+	 *
+	 * */
+	FILE* image_file = fopen(file_name, "rb");
+	if (image_file == NULL) {
+		fprintf(stderr, "Can't open %s\n", file_name);
+		return -1;
+	} else {
+		//do nothing
+	}
+	fseek(image_file, 0, SEEK_END);
+	long file_length = ftell(image_file);
+	fseek(image_file, 0, SEEK_SET);
+	if ((file_length <= 0) || (file_length > (long)(Page_size_in_bytes * 0xFFFF))) {
+		fprintf(stderr, "Invalid app length\n");
+		fclose(image_file);
+		return -1;
+	} else {
+		//do nothing
+	}
+	image_page_count = (file_length + Page_size_in_bytes - 1) / Page_size_in_bytes;
+	image_length_in_bytes = image_page_count * Page_size_in_bytes;
+	image = calloc(image_length_in_bytes, 1);
+	if (fread(image, 1, file_length, image_file) != (size_t)file_length) {
+		fprintf(stderr, "Can't read %s\n", file_name);
+		fclose(image_file);
+		return -1;
+	} else {
+		//do nothing
+	}
+	fclose(image_file);
+
+	CRCTableInit();
+	image_crc = CRC32(image, image_length_in_bytes);
+	printf("%s: %u bytes, %u pages, CRC32 0x%08x\n", file_name, image_length_in_bytes, image_page_count, image_crc);
+	return 0;
+}
+
+int main (int argc, char** argv) {
+	int opt;
+	while ((opt = getopt(argc, argv, "b:s:w:V:t:r:njpRB:N:g:K:")) != -1) {
+		switch (opt) {
+		case 'b':
+			baud_in_bits = strtol(optarg, NULL, 0);
+			baud_rate = BaudSelect(baud_in_bits);
+			if (baud_rate == 0) {
+				fprintf(stderr, "Unsupported baud rate %s\n", optarg);
+				return 1;
+			} else {
+				//do nothing
+			}
+			break;
+		case 's':
+			switch_baud_in_bits = strtol(optarg, NULL, 0);
+			if (BaudSelect(switch_baud_in_bits) == 0) {
+				fprintf(stderr, "Unsupported baud rate %s\n", optarg);
+				return 1;
+			} else {
+				//do nothing
+			}
+			break;
+		case 'w':
+			requested_window = atoi(optarg);
+			break;
+		case 'V':
+			image_version = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			response_timeout_in_ms = atoi(optarg);
+			break;
+		case 'r':
+			max_retries = atoi(optarg);
+			break;
+		case 'n':
+			commit_enabled = 0;
+			break;
+		case 'j':
+			jump_enabled = 1;
+			break;
+		case 'p':
+			timing_enabled = 1;
+			break;
+		case 'R':
+			resume_enabled = 1;
+			break;
+		case 'B':
+			bench_pages = atoi(optarg);
+			if ((bench_pages < 2) || (bench_pages > 0xFFFF)) {
+				fprintf(stderr, "The benchmark needs 2 to 65535 pages\n");
+				return 1;
+			} else {
+				//do nothing
+			}
+			break;
+		case 'N':
+			for (char* node_ptr = strtok(optarg, ","); node_ptr != NULL; node_ptr = strtok(NULL, ",")) {
+				long node = strtol(node_ptr, NULL, 0);
+				if ((node < 0x01) || (node > 0xFE) || (gang_node_count == Max_nodes)) {
+					fprintf(stderr, "Invalid node address %s (0x01 to 0xfe, at most %d nodes)\n", node_ptr, Max_nodes);
+					return 1;
+				} else {
+					gang_nodes[gang_node_count++] = (uint8_t)node;
+				}
+			}
+			break;
+		case 'g':
+			gang_page_gap_in_us = atoi(optarg) * 1000;
+			break;
+		case 'K':
+			if (KeyLoad(optarg) != 0) {
+				return 1;
+			} else {
+				//do nothing
+			}
+			break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	if ((gang_node_count != 0) && ((bench_pages != 0) || (switch_baud_in_bits != 0) || resume_enabled || timing_enabled || ((argc - optind) != 2))) {
+		fprintf(stderr, "-N takes a single port and can't be used with -B, -s, -R or -p\n");
+		return 1;
+	} else {
+		//do nothing
+	}
+	int first_port = (bench_pages == 0) ? (optind + 1) : optind;				//there is no app in benchmark mode
+	int port_count = argc - first_port;
+	if ((port_count < 1) || (port_count > Max_ports)) {
+		Usage(argv[0]);
+		return 1;
+	} else {
+		//do nothing
+	}
+
+	if (bench_pages == 0) {
+		if (ImageLoad(argv[optind]) != 0) {
+			return 1;
+		} else if (auth_enabled) {
+			ImageTagCalculate();													//the tag covers the version of -V
+		} else {
+			//do nothing
+		}
+	} else {
+		//do nothing
+	}
+
+	if (gang_node_count != 0) {
+		flasher_port_t bus;
+		static flasher_port_t nodes[Max_nodes];
+		memset(&bus, 0, sizeof(bus));
+		bus.port_name = argv[first_port];
+		for (int baud_index = 0; baud_index < Baud_count; baud_index++) {
+			if (Baud_rates[baud_index] == baud_in_bits) {
+				bus.baud_index = baud_index;
+			} else {
+				//do nothing
+			}
+		}
+		double start_time = Now();
+		int failed_nodes = GangFlash(&bus, nodes);
+		printf("%d of %d nodes flashed in %.2f s\n", gang_node_count - failed_nodes, gang_node_count, Now() - start_time);
+		free(image);
+		return (failed_nodes == 0) ? 0 : 2;
+	} else {
+		//do nothing
+	}
+
+	//we flash every port in its own thread
+	flasher_port_t ports[Max_ports];
+	pthread_t threads[Max_ports];
+	memset(ports, 0, sizeof(ports));
+	double start_time = Now();
+	for (int i = 0; i < port_count; i++) {
+		ports[i].port_name = argv[first_port + i];
+		for (int baud_index = 0; baud_index < Baud_count; baud_index++) {
+			if (Baud_rates[baud_index] == baud_in_bits) {
+				ports[i].baud_index = baud_index;
+			} else {
+				//do nothing
+			}
+		}
+		pthread_create(&threads[i], NULL, (bench_pages == 0) ? FlashPort : BenchPort, &ports[i]);
+	}
+	int failed_ports = 0;
+	for (int i = 0; i < port_count; i++) {
+		pthread_join(threads[i], NULL);
+		if (ports[i].error != NULL) {
+			failed_ports++;
+		} else {
+			//do nothing
+		}
+	}
+
+	printf("%d of %d ports %s in %.2f s\n", port_count - failed_ports, port_count, (bench_pages == 0) ? "flashed" : "benchmarked", Now() - start_time);
+	free(image);
+	return (failed_ports == 0) ? 0 : 2;
+}
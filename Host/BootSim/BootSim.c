@@ -0,0 +1,2248 @@
+/*
+ *  Created on: 14 Oct 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_Bootloader
+ *  Processor: host PC (Linux, x86-64)
+ *  Program version: 1.0
+ *  File: BootSim.c
+ *  Modified from: N/A
+ *  Change history:
+ *
+ * v.1.0
+ * Host simulator of the bootloader. The bootloader sources are built for the PC as they are and run against a model of the STM32L053R8 peripherals they use.
+ * A simulated master flashes an app over UART1 like BootFlasher does. The UART byte timing, the DMA, the IRQs and the NVM busy times are modeled, the rest is approximated.
+ * Benchmark sweep over the baud rates, the transfer modes and the NVM timings. The Rx ring depth is set at build time (see BootSimSweep.sh).
+ *
+ * v.1.1
+ * The unique ID of the part is modeled. Added the broadcast mode: the pages go out in broadcast frames without a window, the report is collected with command 0xd8 afterwards.
+ *
+ * v.1.2
+ * The compare of channel 1 of the timers (CC1IF) is modeled, it wakes up the sniff window of the fast boot path.
+ *
+ * Build (from the root of the repository):
+ *        gcc -O2 -w -fno-inline -no-pie -fno-pie -finstrument-functions -finstrument-functions-exclude-file-list=Host/BootSim/ -DBOOT_LOG_ENABLE=0 -Dmain=BootMain
+ *            -include Host/BootSim/BootSimHooks.h -IHost/BootSim -I. -o BootSim *.c Host/BootSim/BootSim.c
+ * Use:   BootSim [-m raw|erased|addressed|broadcast] [-b baud] [-n pages] [-w window] [-g gap_us] [-l latency_us] [-e erase_us] [-p program_us] [-E eeprom_us] [-c cycles] [-i cycles] [-v]
+ *        BootSim -S [-F scale,scale,...] [-n pages] [-w window] [-g gap_us] [-l latency_us] [-e erase_us] [-p program_us] [-E eeprom_us] [-c cycles] [-i cycles]
+ *
+ */
+
+#define _GNU_SOURCE
+
+#undef main																	//the bootloader's main is built as BootMain
+#undef while																//the loop hooks are only for the bootloader code (see BootSimHooks.h)
+#undef for
+
+#include <errno.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "main.h"
+
+/*
+ * How the simulator works
+ *
+ * 1)Memory: the FLASH, the data EEPROM and the peripheral register blocks are mapped at their addresses on the part, read-only.
+ *   Every block is mapped a second time elsewhere with write access. The simulator updates the registers through this second mapping.
+ * 2)Register writes: a write of the bootloader to a read-only block faults. We let the write through with a single step of the CPU, then apply what the write means to the peripheral:
+ *   write-1-to-clear flags, the NVM keys, a DMA channel being enabled, a word written into the FLASH starting an erase or a half-page write, a word fed to the CRC and so on.
+ *   Register reads don't fault. Registers that change on their own (counters, flags) are kept up to date by the simulator before the bootloader looks at them.
+ * 3)Time: the simulated time moves along at every function entry and every loop iteration of the bootloader (see BootSimHooks.h), by a fixed number of CPU cycles each.
+ *   A WFI jumps ahead to the next event. The events are the UART bytes coming and going, the idle line, the timer updates, the end of an NVM operation and the master waking up.
+ * 4)IRQs: the IRQ lines are worked out from the flags and the enable bits of the peripherals. A pending and enabled IRQ is taken at the next hook if PRIMASK allows it and its
+ *   priority beats what is running. The handler is taken from the vector table the VTOR points to, so the RAM vector table of the bootloader is used once it is set up.
+ * 5)NVM stalls: while an erase or a write is going on, code running from the FLASH stops until the NVM is done. Code placed in RAM (BOOT_RAM_FUNC) and its IRQs carry on.
+ * 6)The master: runs as a coroutine on its own stack. It sends commands and pages over the simulated UART1 and reads the responses, with a turnaround latency (USB serial adapters).
+ * 7)Sweep: every run is done in a child process, so every run starts from an erased part and from the reset values of the bootloader's variables.
+ *
+ * Note: this is an approximate model. CPU time is counted in hooks, not in instructions. The simulator itself, the C library and inlined code cost nothing.
+ * Note: only what the bootloader uses is modeled: 8 bit UART frames with one stop bit, byte wide DMA transfers, the word/half-page writes of the L0 NVM.
+ * Note: a baud rate mismatch between the master and the bootloader (more than 3%) turns every byte into a framing error.
+ * Note: the part starts erased - no app, so the bootloader stays in the boot and waits for the master.
+ * Note: the bootloader casts pointers to 32 bits and back (DMA addresses, vector tables). This is fine on the host as long as it is built without PIE, the warnings are turned off (-w).
+ *
+ * */
+
+//LOCAL CONSTANT
+#define Ps_per_s 1000000000000ULL											//the simulated time is counted in ps
+#define Ps_per_us 1000000ULL
+#define Sim_never UINT64_MAX
+#define Sim_page_size 4096													//page size of the host MMU
+#define Sim_rx_queue_size 65536												//bytes sent by the master that have not yet arrived
+#define Sim_host_stack_size (256 * 1024)
+#define Host_rx_buf_size 4096
+#define Host_max_window 64
+#define Baud_count 6
+
+static const long Baud_rates[Baud_count] = {57600, 115200, 230400, 460800, 921600, 1000000};
+static const uint8_t UART_message_start_byte = 0xF0;
+static const uint8_t UART_response_ack = 0x06;
+static const uint8_t UART_response_nack = 0x15;
+static const uint8_t UART_response_report = 0x52;
+static const uint8_t UART_node_prefix = 0xA5;
+static const uint8_t UART_node_broadcast = 0xFF;
+static const uint32_t Sim_unique_id[3] = {0x00470031, 0x3036510A, 0x20343638};	//the unique ID words of the simulated part
+static const uint16_t Addressed_page_end_of_transfer = 0xFFFF;
+static const uint8_t Baud_probe_pattern[8] = {0x55, 0xAA, 0x00, 0xFF, 0x0F, 0xF0, 0xCC, 0x33};
+static const uint64_t Command_gap_in_us = 20000;							//same timing as BootFlasher
+static const uint64_t Programmer_mode_setup_in_us = 100000;
+static const uint64_t Response_timeout_in_us = 1000000;
+static const int Handshake_attempts = 5;
+static const int Max_retries = 5;
+static const uint32_t Sim_usart2_clock_in_Hz = Boot_SYSCLK_in_Hz / 4;		//APB1 runs at SYSCLK/4 (see SysClockConfig)
+static const uint32_t Sim_flash_sr_error_mask = (0x32F<<8);					//same as NVM_error_flags_mask
+static const double Sim_time_limit_in_s = 300;								//a run that takes longer than this is stuck
+
+typedef struct {
+	uint32_t base;
+	uint32_t size;
+	volatile uint8_t* alias;												//the writable mapping of the block
+} sim_region_t;
+
+typedef struct {
+	TIM_TypeDef* tim;
+	int running;
+	uint64_t base_time;														//time of the last update event (or of the start of the timer)
+	uint32_t psc_active;													//the prescaler is preloaded, it only takes effect at an update event
+	uint64_t last_time;														//the time the counter was last brought up to date, for the compare
+} sim_timer_t;
+
+typedef struct {
+	USART_TypeDef* usart;
+	int rx_channel;															//DMA channel of Rx and Tx, 0 if there is none
+	int tx_channel;
+	int enabled;															//UE was set at the last look
+	uint64_t idle_time;														//when the idle line will be detected, Sim_never if it is not armed
+	int tdr_full;
+	uint8_t tdr;
+	int shift_busy;
+	uint8_t shift;
+	uint64_t shift_done_time;
+} sim_usart_t;
+
+typedef struct {
+	uint64_t arrival_time;
+	uint8_t byte;
+	uint32_t baud;
+} sim_rx_byte_t;
+
+typedef enum {
+	Sim_NVM_Idle,
+	Sim_NVM_Erase,
+	Sim_NVM_Half_Page,
+	Sim_NVM_Word,
+	Sim_NVM_EEPROM
+} enum_Sim_NVM_Op;
+
+typedef enum {
+	Host_Raw,
+	Host_Erased,
+	Host_Addressed,
+	Host_Broadcast
+} enum_Host_Mode;
+
+static const char* Host_mode_names[] = {"raw", "erased", "addressed", "broadcast"};
+
+typedef enum {
+	Sim_End_None,
+	Sim_End_Host_Done,
+	Sim_End_Jump,
+	Sim_End_Reset,
+	Sim_End_Time_Limit,
+	Sim_End_Fault
+} enum_Sim_End;
+
+typedef struct {
+	enum_Host_Mode mode;
+	long baud;
+	uint32_t pages;															//0 means we fill the update slot but for the scratch pages
+	int window;																//0 means we take the window from the bootloader
+	uint64_t page_gap_in_us;												//pause between two raw or broadcast pages
+	uint64_t host_latency_in_us;											//how long the master takes to react to a response
+	uint64_t erase_in_us;
+	uint64_t program_in_us;													//half-page and word writes
+	uint64_t eeprom_in_us;
+	uint32_t call_cycles;													//CPU cycles counted for a function call
+	uint32_t loop_cycles;													//CPU cycles counted for a loop iteration
+	int verbose;
+} sim_params_t;
+
+typedef struct {
+	int completed;															//the master has got through the whole update
+	char error[64];
+	enum_Sim_End end;
+	long baud;																//the baud rate the transfer has run at
+	uint32_t image_length_in_bytes;
+	int window;
+	double transfer_time_in_s;
+	double total_time_in_s;
+	double throughput;														//app bytes per second of transfer
+	uint32_t pages_sent;
+	uint32_t nacks;
+	int report_received;
+	uint16_t report_written;
+	uint16_t report_rejected;
+	uint16_t report_overflow;
+	uint16_t report_nvm_errors;
+	uint16_t report_missed_events;
+	uint16_t report_rx_errors;
+	int commit_ok;
+	int flash_match;
+	double cpu_sleep_share;													//share of the time the CPU spent in WFI
+	double nvm_stall_share;													//share of the time code in FLASH was stalled by the NVM
+	double nvm_busy_share;
+	uint32_t nvm_ops[5];
+	uint32_t irqs[32];
+	uint64_t traps;
+	double wall_time_in_s;
+} sim_result_t;
+
+//LOCAL VARIABLE
+static sim_region_t Sim_regions[] = {
+		{Boot_FLASH_start_addr, Boot_FLASH_end_addr - Boot_FLASH_start_addr, NULL},
+		{Boot_EEPROM_start_addr, (Boot_EEPROM_size_in_bytes + Sim_page_size - 1) & ~(Sim_page_size - 1), NULL},
+		{0x40000000, 0x8000, NULL},											//APB1: TIM2, TIM6, RTC, USART2, PWR
+		{0x40010000, 0x6000, NULL},											//APB2: EXTI, USART1, DBGMCU
+		{0x40020000, 0x4000, NULL},											//AHB: DMA1, RCC, FLASH interface, CRC
+		{0x50000000, 0x2000, NULL},											//IOPORT: GPIOs
+		{Boot_unique_ID_addr & ~0xFFF, 0x1000, NULL},						//system memory: unique ID
+		{0xE000E000, 0x1000, NULL}											//SCS: SysTick, NVIC, SCB
+};
+#define Sim_region_count ((int)(sizeof(Sim_regions) / sizeof(Sim_regions[0])))
+
+static sim_params_t Sim_params;
+static sim_result_t Sim_result;
+static sigjmp_buf Sim_run_end;
+
+static uint64_t Sim_now = 0;
+static uint64_t Sim_next_event_time = 0;									//0 forces the next hook to look at the events
+static uint64_t Sim_call_cost;
+static uint64_t Sim_loop_cost;
+static uint64_t Sim_time_limit;
+static uint64_t Sim_sleep_time = 0;
+static uint64_t Sim_stall_time = 0;
+static uint64_t Sim_nvm_busy_time = 0;
+static int Sim_irq_dirty = 1;
+
+static uint32_t Sim_primask = 0;
+static uint32_t Sim_nvic_enabled = 0;
+static uint32_t Sim_nvic_pending = 0;
+static uint8_t Sim_nvic_priority[32];
+static int Sim_active_priority = 4;											//4 is thread mode, below every IRQ priority (0 to 3)
+
+static sim_timer_t Sim_timers[2] = {{TIM2, 0, 0, 0}, {TIM6, 0, 0, 0}};
+static sim_usart_t Sim_usarts[2] = {{USART1, 3, 2, 0, Sim_never, 0, 0, 0, 0, 0}, {USART2, 0, 4, 0, Sim_never, 0, 0, 0, 0, 0}};
+static uint32_t Sim_usart2_baud = 115200;
+static uint16_t Sim_dma_reload[8];											//what CNDTR is reloaded with, latched when the channel is enabled
+
+static volatile uintptr_t Sim_trap_addr = 0;
+static volatile uint32_t Sim_trap_old_value = 0;
+static volatile int Sim_trap_active = 0;
+
+static enum_Sim_NVM_Op Sim_nvm_op = Sim_NVM_Idle;
+static uint64_t Sim_nvm_done_time = Sim_never;
+static uint32_t Sim_nvm_addr;
+static uint32_t Sim_nvm_data[Boot_half_page_size_in_words];
+static uint8_t Sim_half_page_count = 0;
+static int Sim_pekey_state = 0;
+static int Sim_prgkey_state = 0;
+
+static sim_rx_byte_t Sim_rx_queue[Sim_rx_queue_size];
+static uint32_t Sim_rx_head = 0;
+static uint32_t Sim_rx_tail = 0;
+
+static ucontext_t Sim_context;
+static ucontext_t Host_context;
+static uint64_t Host_wake_time = Sim_never;
+static int Host_waits_for_rx = 0;
+static int Host_done = 0;
+static long Host_baud = 57600;
+static uint64_t Host_line_free_time = 0;									//when the master's Tx line is done with what it has sent
+static uint8_t Host_rx_buf[Host_rx_buf_size];
+static int Host_rx_length = 0;
+static uint8_t* Host_image = NULL;
+static uint32_t Host_image_crc;
+static uint32_t Host_page_count;
+static uint32_t Host_app_start_addr;
+static uint8_t Host_node = 0;												//node address published by the bootloader, 0 if it has none
+static uint8_t Host_frame_node = 0;											//node address the commands go to, 0 for frames without one
+static uint8_t Host_last_report[32];
+
+//EXTERNAL VARIABLE
+extern char __start_BootRamFunc[];											//the linker gives us the bounds of the RAM functions
+extern char __stop_BootRamFunc[];
+uint32_t SystemCoreClock = 2097152;											//MSI after reset
+
+//FUNCTION PROTOTYPES
+int BootMain (void);
+void FLASH_IRQHandler (void);
+void DMA1_Channel2_3_IRQHandler (void);
+void DMA1_Channel4_5_6_7_IRQHandler (void);
+void TIM2_IRQHandler (void);
+void TIM6_DAC_IRQHandler (void);
+void USART1_IRQHandler (void);
+void __cyg_profile_func_enter (void* this_fn, void* call_site);
+void __cyg_profile_func_exit (void* this_fn, void* call_site);
+static void SimEvents (void);
+static void SimIRQDeliver (void);
+static void SimUsartTx (sim_usart_t* sim_usart, uint64_t time);
+static void HostRxPush (uint8_t byte, uint32_t baud);
+
+
+//1)Simulated memory
+/*
+ * Every block is a memfd mapped twice: read-only at the address of the part, writable anywhere for the simulator.
+ * The bootloader must be built without PIE: it casts the addresses of its buffers to 32 bits (DMA CMAR, vector table entries).
+ *
+ * */
+
+static volatile uint32_t* SimAlias (volatile const void* addr_ptr) {
+	uintptr_t addr = (uintptr_t)addr_ptr;
+	for (int i = 0; i < Sim_region_count; i++) {
+		if ((addr - Sim_regions[i].base) < Sim_regions[i].size) {
+			return (volatile uint32_t*)(Sim_regions[i].alias + (addr - Sim_regions[i].base));
+		} else {
+			//do nothing
+		}
+	}
+	fprintf(stderr, "BootSim: no simulated memory at 0x%08lx\n", (unsigned long)addr);
+	abort();
+}
+
+#define SIM(reg) (*SimAlias(&(reg)))										//a register as the simulator writes it
+#define SIM_WORD(addr) (*SimAlias((const void*)(uintptr_t)(addr)))
+
+static int SimRegionOf (uintptr_t addr) {
+	for (int i = 0; i < Sim_region_count; i++) {
+		if ((addr - Sim_regions[i].base) < Sim_regions[i].size) {
+			return i;
+		} else {
+			//do nothing
+		}
+	}
+	return -1;
+}
+
+static int SimMemoryMap (void) {
+	for (int i = 0; i < Sim_region_count; i++) {
+		int fd = memfd_create("BootSim", 0);
+		if ((fd < 0) || (ftruncate(fd, Sim_regions[i].size) != 0)) {
+			return -1;
+		} else {
+			//do nothing
+		}
+		void* part_ptr = mmap((void*)(uintptr_t)Sim_regions[i].base, Sim_regions[i].size, PROT_READ, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+		void* alias_ptr = mmap(NULL, Sim_regions[i].size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if ((part_ptr != (void*)(uintptr_t)Sim_regions[i].base) || (alias_ptr == MAP_FAILED)) {
+			fprintf(stderr, "BootSim: can't map 0x%08x (%s)\n", Sim_regions[i].base, strerror(errno));
+			return -1;
+		} else {
+			Sim_regions[i].alias = alias_ptr;
+		}
+	}
+	return 0;
+}
+
+
+//2)Reset state of the part
+/*
+ * The blocks start zeroed: erased FLASH and EEPROM, and most registers reset to 0. We only set what differs from 0.
+ * The boot section gets a vector table with the IRQ handlers of the bootloader. Its reset vector points into the FLASH, so a jump to it (ReBoot) ends the run.
+ *
+ * */
+
+static void SimReset (void) {
+	volatile uint32_t* vector_table_ptr = SimAlias((const void*)(uintptr_t)Boot_FLASH_start_addr);
+	vector_table_ptr[0] = Boot_stack_top_addr;
+	vector_table_ptr[1] = Boot_FLASH_start_addr + 0xC1;
+	vector_table_ptr[16 + FLASH_IRQn] = (uint32_t)(uintptr_t)FLASH_IRQHandler;
+	vector_table_ptr[16 + DMA1_Channel2_3_IRQn] = (uint32_t)(uintptr_t)DMA1_Channel2_3_IRQHandler;
+	vector_table_ptr[16 + DMA1_Channel4_5_6_7_IRQn] = (uint32_t)(uintptr_t)DMA1_Channel4_5_6_7_IRQHandler;
+	vector_table_ptr[16 + TIM2_IRQn] = (uint32_t)(uintptr_t)TIM2_IRQHandler;
+	vector_table_ptr[16 + TIM6_DAC_IRQn] = (uint32_t)(uintptr_t)TIM6_DAC_IRQHandler;
+	vector_table_ptr[16 + USART1_IRQn] = (uint32_t)(uintptr_t)USART1_IRQHandler;
+
+	SIM(SCB->VTOR) = Boot_FLASH_start_addr;
+	SIM(RCC->CR) = (1<<8) | (1<<9);											//MSI on and ready
+	SIM(FLASH->PECR) = (1<<0) | (1<<1) | (1<<2);							//PELOCK, PRGLOCK, OPTLOCK
+	SIM(FLASH->SR) = (1<<3);												//READY
+	SIM(CRC->DR) = 0xFFFFFFFF;
+	SIM(CRC->INIT) = 0xFFFFFFFF;
+	SIM(CRC->POL) = 0x04C11DB7;
+	SIM(TIM2->ARR) = 0xFFFFFFFF;
+	SIM(TIM6->ARR) = 0xFFFF;
+	SIM(USART1->ISR) = (1<<6) | (1<<7);										//TC and TXE
+	SIM(USART2->ISR) = (1<<6) | (1<<7);
+	SIM(GPIOA->IDR) = (1<<10);												//the master keeps the Rx line (PA10) high
+	SIM(*(uint32_t*)(Boot_unique_ID_addr)) = Sim_unique_id[0];
+	SIM(*(uint32_t*)(Boot_unique_ID_addr + 0x04)) = Sim_unique_id[1];
+	SIM(*(uint32_t*)(Boot_unique_ID_addr + 0x14)) = Sim_unique_id[2];
+	for (int i = 0; i < 32; i++) {
+		Sim_nvic_priority[i] = 0;
+	}
+}
+
+
+//3)Time and events
+/*
+ * The next event is looked up every time the hooks pass it. Register writes reset the lookup, since they can start something new (a DMA transfer, an NVM operation).
+ *
+ * */
+
+static uint64_t SimTimerTick (sim_timer_t* sim_timer) {
+	return ((uint64_t)(sim_timer->psc_active + 1) * Ps_per_s) / Boot_TIM_clock_in_Hz;
+}
+
+static uint64_t SimTimerPeriod (sim_timer_t* sim_timer) {
+	uint32_t arr = sim_timer->tim->ARR;
+	if (sim_timer->tim == TIM6) {
+		arr &= 0xFFFF;														//TIM6 is a 16 bit timer
+	} else {
+		//do nothing
+	}
+	return ((uint64_t)arr + 1) * SimTimerTick(sim_timer);
+}
+
+static uint64_t SimTimerCompareTime (sim_timer_t* sim_timer) {
+	return sim_timer->base_time + ((uint64_t)sim_timer->tim->CCR1 * SimTimerTick(sim_timer));	//the counter reaches CCR1 in the current period
+}
+
+static void SimTimerCompare (sim_timer_t* sim_timer, uint64_t time) {
+	uint64_t compare_time = SimTimerCompareTime(sim_timer);
+	if ((sim_timer->last_time < compare_time) && (time >= compare_time)) {
+		SIM(sim_timer->tim->SR) |= (1<<1);									//CC1IF
+		Sim_irq_dirty = 1;
+	} else {
+		//do nothing
+	}
+	sim_timer->last_time = time;
+}
+
+static void SimTimerUpdate (sim_timer_t* sim_timer, uint64_t time) {
+	if (sim_timer->running == 0) {
+		return;
+	} else {
+		//do nothing
+	}
+	while (time >= (sim_timer->base_time + SimTimerPeriod(sim_timer))) {		//update event: the counter wraps, the prescaler is loaded
+		SimTimerCompare(sim_timer, sim_timer->base_time + SimTimerPeriod(sim_timer) - 1);
+		sim_timer->base_time += SimTimerPeriod(sim_timer);
+		sim_timer->psc_active = sim_timer->tim->PSC & 0xFFFF;
+		SIM(sim_timer->tim->SR) |= (1<<0);
+		Sim_irq_dirty = 1;
+	}
+	SimTimerCompare(sim_timer, time);
+	SIM(sim_timer->tim->CNT) = (time - sim_timer->base_time) / SimTimerTick(sim_timer);
+}
+
+static uint64_t SimUsartFrameTime (sim_usart_t* sim_usart) {
+	uint32_t brr = sim_usart->usart->BRR & 0xFFFF;
+	uint32_t clock_in_Hz = Sim_usart2_clock_in_Hz;
+	if (sim_usart->usart == USART1) {
+		clock_in_Hz = ((RCC->CCIPR & (3<<0)) == (1<<0)) ? Boot_SYSCLK_in_Hz : Boot_APB2_clock_in_Hz;
+	} else if (brr == 0) {
+		return (10 * Ps_per_s) / Sim_usart2_baud;
+	} else {
+		//do nothing
+	}
+	if (brr < 16) {
+		brr = 16;
+	} else {
+		//do nothing
+	}
+	return (10 * Ps_per_s * brr) / clock_in_Hz;									//start bit, 8 data bits, stop bit
+}
+
+static uint32_t SimUsartBaud (sim_usart_t* sim_usart) {
+	return (10 * Ps_per_s) / SimUsartFrameTime(sim_usart);
+}
+
+static uint64_t SimNextEventTime (void) {
+	uint64_t next_time = Host_wake_time;
+	if ((Sim_rx_head != Sim_rx_tail) && (Sim_rx_queue[Sim_rx_tail].arrival_time < next_time)) {
+		next_time = Sim_rx_queue[Sim_rx_tail].arrival_time;
+	} else {
+		//do nothing
+	}
+	for (int i = 0; i < 2; i++) {
+		if (Sim_usarts[i].idle_time < next_time) {
+			next_time = Sim_usarts[i].idle_time;
+		} else {
+			//do nothing
+		}
+		if (Sim_usarts[i].shift_busy && (Sim_usarts[i].shift_done_time < next_time)) {
+			next_time = Sim_usarts[i].shift_done_time;
+		} else {
+			//do nothing
+		}
+		if (Sim_timers[i].running && ((Sim_timers[i].base_time + SimTimerPeriod(&Sim_timers[i])) < next_time)) {
+			next_time = Sim_timers[i].base_time + SimTimerPeriod(&Sim_timers[i]);
+		} else {
+			//do nothing
+		}
+		if (Sim_timers[i].running && ((Sim_timers[i].tim->DIER & (1<<1)) != 0) && (SimTimerCompareTime(&Sim_timers[i]) > Sim_timers[i].last_time) &&
+			(SimTimerCompareTime(&Sim_timers[i]) < next_time)) {
+			next_time = SimTimerCompareTime(&Sim_timers[i]);					//the compare only wakes us up if its IRQ is on
+		} else {
+			//do nothing
+		}
+	}
+	if (Sim_nvm_done_time < next_time) {
+		next_time = Sim_nvm_done_time;
+	} else {
+		//do nothing
+	}
+	return next_time;
+}
+
+static void SimEnd (enum_Sim_End end) {
+	Sim_result.end = end;
+	siglongjmp(Sim_run_end, 1);
+}
+
+
+//4)DMA
+/*
+ * The channels move bytes one at a time. CNDTR counts down, HT and TC are set at half and at the end of the transfer. A circular channel reloads CNDTR at TC.
+ *
+ * */
+
+static DMA_Channel_TypeDef* SimDmaChannel (int channel) {
+	return (DMA_Channel_TypeDef*)(uintptr_t)(0x40020008 + 20 * (channel - 1));
+}
+
+static void SimDmaFlag (int channel, int flag) {
+	SIM(DMA1->ISR) |= (1 << (4 * (channel - 1))) | (1 << ((4 * (channel - 1)) + flag));	//GIF and the flag (1 TC, 2 HT, 3 TE)
+	Sim_irq_dirty = 1;
+}
+
+static int SimDmaReady (int channel) {
+	DMA_Channel_TypeDef* dma_channel = SimDmaChannel(channel);
+	return ((dma_channel->CCR & (1<<0)) != 0) && ((dma_channel->CNDTR & 0xFFFF) != 0);
+}
+
+static uint32_t SimDmaStep (int channel) {
+	/*
+	 * One transfer: gives back the memory address of the byte and counts it off.
+	 *
+	 * */
+	DMA_Channel_TypeDef* dma_channel = SimDmaChannel(channel);
+	uint16_t remaining = dma_channel->CNDTR & 0xFFFF;
+	uint32_t mem_addr = dma_channel->CMAR;
+	if ((dma_channel->CCR & (1<<7)) != 0) {									//MINC
+		mem_addr += Sim_dma_reload[channel] - remaining;
+	} else {
+		//do nothing
+	}
+	remaining--;
+	if (remaining == (Sim_dma_reload[channel] / 2)) {
+		SimDmaFlag(channel, 2);												//HT
+	} else {
+		//do nothing
+	}
+	if (remaining == 0) {
+		SimDmaFlag(channel, 1);												//TC
+		if ((dma_channel->CCR & (1<<5)) != 0) {								//circular mode
+			remaining = Sim_dma_reload[channel];
+		} else {
+			//do nothing
+		}
+	} else {
+		//do nothing
+	}
+	SIM(dma_channel->CNDTR) = remaining;
+	return mem_addr;
+}
+
+
+//5)UARTs
+/*
+ * Rx (UART1 only): the bytes of the master arrive one frame time after each other. The DMA takes them if it is set up, otherwise they land in the RDR.
+ * The idle line is detected one frame after the last byte, or one frame after the receiver has been enabled. The start bit of a byte coming right after cancels it.
+ * Tx: the DMA fills the TDR as soon as it is empty and the shift register takes the TDR as soon as the previous byte has gone out.
+ *
+ * */
+
+static void SimUsartCheckEnable (sim_usart_t* sim_usart, uint64_t time) {
+	uint32_t cr1 = sim_usart->usart->CR1;
+	int enabled = ((cr1 & (1<<0)) != 0);
+	if (enabled && (sim_usart->enabled == 0) && ((cr1 & (1<<2)) != 0)) {
+		sim_usart->idle_time = time + SimUsartFrameTime(sim_usart);			//the receiver sees the line idle right after being enabled
+	} else if (enabled == 0) {
+		sim_usart->idle_time = Sim_never;
+		sim_usart->tdr_full = 0;
+		sim_usart->shift_busy = 0;
+		SIM(sim_usart->usart->ISR) |= (1<<6) | (1<<7);
+	} else {
+		//do nothing
+	}
+	sim_usart->enabled = enabled;
+	uint32_t isr = sim_usart->usart->ISR & ~((1<<21) | (1<<22));
+	if (enabled && ((cr1 & (1<<3)) != 0)) isr |= (1<<21);					//TEACK
+	if (enabled && ((cr1 & (1<<2)) != 0)) isr |= (1<<22);					//REACK
+	SIM(sim_usart->usart->ISR) = isr;
+}
+
+static void SimUsartRx (sim_rx_byte_t* rx_byte) {
+	sim_usart_t* sim_usart = &Sim_usarts[0];
+	USART_TypeDef* usart = sim_usart->usart;
+	if (((usart->CR1 & (1<<0)) == 0) || ((usart->CR1 & (1<<2)) == 0)) {
+		return;																//the receiver is off, the byte is lost
+	} else {
+		//do nothing
+	}
+	uint32_t device_baud = SimUsartBaud(sim_usart);
+	uint8_t byte = rx_byte->byte;
+	int framing_error = 0;
+	if ((labs((long)device_baud - (long)rx_byte->baud) * 100) > (3 * (long)device_baud)) {
+		framing_error = 1;
+		byte = byte ^ 0x5A;													//what is sampled at the wrong baud rate is garbage
+		SIM(usart->ISR) |= (1<<1);											//FE
+		Sim_irq_dirty = 1;
+	} else {
+		//do nothing
+	}
+	if (((usart->CR3 & (1<<6)) != 0) && SimDmaReady(sim_usart->rx_channel) && !(framing_error && ((usart->CR3 & (1<<13)) != 0))) {
+		uint32_t mem_addr = SimDmaStep(sim_usart->rx_channel);				//DMAR: the DMA takes the byte
+		*(volatile uint8_t*)(uintptr_t)mem_addr = byte;
+	} else if (framing_error && ((usart->CR3 & (1<<13)) != 0)) {
+		//do nothing														//DDRE: an erroneous byte is not transferred
+	} else {
+		if (((usart->ISR & (1<<5)) != 0) && ((usart->CR3 & (1<<12)) == 0)) {
+			SIM(usart->ISR) |= (1<<3);										//ORE - the previous byte has not been read
+		} else {
+			//do nothing
+		}
+		SIM(usart->RDR) = byte;
+		SIM(usart->ISR) |= (1<<5);											//RXNE
+		Sim_irq_dirty = 1;
+	}
+	sim_usart->idle_time = rx_byte->arrival_time + SimUsartFrameTime(sim_usart);
+}
+
+static void SimUsartTx (sim_usart_t* sim_usart, uint64_t time) {
+	USART_TypeDef* usart = sim_usart->usart;
+	if (((usart->CR1 & (1<<0)) == 0) || ((usart->CR1 & (1<<3)) == 0)) {
+		return;
+	} else {
+		//do nothing
+	}
+	for (int step = 0; step < 2; step++) {
+		if ((sim_usart->tdr_full == 0) && ((usart->CR3 & (1<<7)) != 0) && SimDmaReady(sim_usart->tx_channel)) {
+			uint32_t mem_addr = SimDmaStep(sim_usart->tx_channel);			//DMAT: the DMA fills the TDR
+			sim_usart->tdr = *(volatile uint8_t*)(uintptr_t)mem_addr;
+			sim_usart->tdr_full = 1;
+		} else {
+			//do nothing
+		}
+		if ((sim_usart->shift_busy == 0) && sim_usart->tdr_full) {
+			sim_usart->shift = sim_usart->tdr;
+			sim_usart->tdr_full = 0;
+			sim_usart->shift_busy = 1;
+			sim_usart->shift_done_time = time + SimUsartFrameTime(sim_usart);
+		} else {
+			//do nothing
+		}
+	}
+	uint32_t isr = usart->ISR & ~((1<<6) | (1<<7));
+	if (sim_usart->tdr_full == 0) isr |= (1<<7);								//TXE
+	if ((sim_usart->tdr_full == 0) && (sim_usart->shift_busy == 0)) isr |= (1<<6);	//TC
+	if (isr != usart->ISR) {
+		SIM(usart->ISR) = isr;
+		Sim_irq_dirty = 1;
+	} else {
+		//do nothing
+	}
+}
+
+static void SimUsartTxDone (sim_usart_t* sim_usart) {
+	uint64_t time = sim_usart->shift_done_time;
+	sim_usart->shift_busy = 0;
+	if (sim_usart->usart == USART1) {
+		HostRxPush(sim_usart->shift, SimUsartBaud(sim_usart));
+	} else if (Sim_params.verbose) {
+		fputc(sim_usart->shift, stderr);									//the text log of UART2
+	} else {
+		//do nothing
+	}
+	SimUsartTx(sim_usart, time);
+}
+
+
+//6)NVM
+/*
+ * A word written into the FLASH or the EEPROM does not land there. It starts the operation selected in PECR, which takes the configured time.
+ * The FLASH (or EEPROM) only changes at the end of the operation, when BSY goes low and EOP is set.
+ * The half-page write collects the words of a half-page first. The L0 takes them all at the same address, they go to the half-page in the order they come.
+ *
+ * */
+
+static void SimNVMStart (enum_Sim_NVM_Op nvm_op, uint32_t nvm_addr, uint64_t duration_in_us) {
+	if (Sim_nvm_op != Sim_NVM_Idle) {
+		SIM(FLASH->SR) |= (1<<17);											//FWWERR - the model does not stall the bus, we flag it instead
+		Sim_irq_dirty = 1;
+		return;
+	} else {
+		//do nothing
+	}
+	Sim_nvm_op = nvm_op;
+	Sim_nvm_addr = nvm_addr;
+	Sim_nvm_done_time = Sim_now + duration_in_us * Ps_per_us;
+	Sim_nvm_busy_time += duration_in_us * Ps_per_us;
+	Sim_result.nvm_ops[nvm_op]++;
+	SIM(FLASH->SR) |= (1<<0);												//BSY
+}
+
+static void SimNVMDone (void) {
+	volatile uint32_t* nvm_ptr = SimAlias((const void*)(uintptr_t)Sim_nvm_addr);
+	uint32_t not_zero = 0;
+	if (Sim_nvm_op == Sim_NVM_Erase) {
+		memset((void*)nvm_ptr, 0, Boot_page_size_in_bytes);
+	} else if (Sim_nvm_op == Sim_NVM_Half_Page) {
+		for (int i = 0; i < Boot_half_page_size_in_words; i++) {
+			not_zero |= nvm_ptr[i];
+			nvm_ptr[i] |= Sim_nvm_data[i];
+		}
+	} else if (Sim_nvm_op == Sim_NVM_Word) {
+		not_zero = nvm_ptr[0];
+		nvm_ptr[0] |= Sim_nvm_data[0];
+	} else {
+		nvm_ptr[0] = Sim_nvm_data[0];										//the EEPROM erases the word itself
+	}
+	uint32_t sr = (FLASH->SR & ~(1<<0)) | (1<<1);							//BSY off, EOP
+	if (not_zero != 0) {
+		sr |= (1<<16);														//NOTZEROERR - the word was not erased
+	} else {
+		//do nothing
+	}
+	SIM(FLASH->SR) = sr;
+	Sim_nvm_op = Sim_NVM_Idle;
+	Sim_nvm_done_time = Sim_never;
+	Sim_irq_dirty = 1;
+}
+
+static void SimNVMWrite (uint32_t word_addr, uint32_t old_value, uint32_t new_value) {
+	SIM_WORD(word_addr) = old_value;											//the NVM only changes at the end of the operation
+	uint32_t pecr = FLASH->PECR;
+	if ((pecr & (1<<0)) != 0) {
+		SIM(FLASH->SR) |= (1<<8);											//WRPERR - PELOCK is on
+		Sim_irq_dirty = 1;
+		return;
+	} else {
+		//do nothing
+	}
+	if ((word_addr - Boot_EEPROM_start_addr) < Boot_EEPROM_size_in_bytes) {
+		Sim_nvm_data[0] = new_value;
+		SimNVMStart(Sim_NVM_EEPROM, word_addr, Sim_params.eeprom_in_us);
+	} else if ((pecr & (1<<1)) != 0) {
+		SIM(FLASH->SR) |= (1<<8);											//WRPERR - PRGLOCK is on
+		Sim_irq_dirty = 1;
+	} else if ((pecr & ((1<<9) | (1<<3))) == ((1<<9) | (1<<3))) {
+		SimNVMStart(Sim_NVM_Erase, word_addr & ~(Boot_page_size_in_bytes - 1), Sim_params.erase_in_us);
+	} else if ((pecr & ((1<<10) | (1<<3))) == ((1<<10) | (1<<3))) {
+		if (Sim_half_page_count == 0) {
+			Sim_nvm_addr = word_addr & ~((4 * Boot_half_page_size_in_words) - 1);
+		} else {
+			//do nothing
+		}
+		Sim_nvm_data[Sim_half_page_count] = new_value;
+		Sim_half_page_count++;
+		if (Sim_half_page_count == Boot_half_page_size_in_words) {
+			Sim_half_page_count = 0;
+			SimNVMStart(Sim_NVM_Half_Page, Sim_nvm_addr, Sim_params.program_in_us);
+		} else {
+			//do nothing
+		}
+	} else {
+		Sim_nvm_data[0] = new_value;
+		SimNVMStart(Sim_NVM_Word, word_addr, Sim_params.program_in_us);
+	}
+}
+
+
+//7)Register writes
+/*
+ * Called after a write of the bootloader has landed in a block of the part. "old_value" is what the word held before.
+ * Plain registers need nothing. The rest is fixed up here to behave like on the part.
+ *
+ * */
+
+static uint32_t SimCRCFeed (uint32_t crc_state, uint32_t data) {
+	uint32_t input = data;
+	if ((CRC->CR & (3<<5)) == (3<<5)) {										//REV_IN by word
+		input = 0;
+		for (int i = 0; i < 32; i++) {
+			input = (input << 1) | ((data >> i) & 1);
+		}
+	} else {
+		//do nothing															//only the word reversal is modeled
+	}
+	crc_state ^= input;
+	for (int i = 0; i < 32; i++) {
+		crc_state = (crc_state & 0x80000000) ? ((crc_state << 1) ^ CRC->POL) : (crc_state << 1);
+	}
+	return crc_state;
+}
+
+static void SimRegWrite (uint32_t addr, uint32_t old_value, uint32_t new_value) {
+	Sim_next_event_time = 0;
+	Sim_irq_dirty = 1;
+
+	//FLASH and EEPROM
+	if (((addr - Boot_FLASH_start_addr) < (Boot_FLASH_end_addr - Boot_FLASH_start_addr)) || ((addr - Boot_EEPROM_start_addr) < Boot_EEPROM_size_in_bytes)) {
+		SimNVMWrite(addr, old_value, new_value);
+
+	//NVM interface
+	} else if (addr == (uintptr_t)&FLASH->PEKEYR) {
+		if ((Sim_pekey_state == 0) && (new_value == 0x89ABCDEF)) {
+			Sim_pekey_state = 1;
+		} else if ((Sim_pekey_state == 1) && (new_value == 0x02030405)) {
+			SIM(FLASH->PECR) &= ~(1<<0);
+			Sim_pekey_state = 0;
+		} else {
+			Sim_pekey_state = 0;
+		}
+		SIM(FLASH->PEKEYR) = 0;
+	} else if (addr == (uintptr_t)&FLASH->PRGKEYR) {
+		if ((Sim_prgkey_state == 0) && (new_value == 0x8C9DAEBF)) {
+			Sim_prgkey_state = 1;
+		} else if ((Sim_prgkey_state == 1) && (new_value == 0x13141516) && ((FLASH->PECR & (1<<0)) == 0)) {
+			SIM(FLASH->PECR) &= ~(1<<1);
+			Sim_prgkey_state = 0;
+		} else {
+			Sim_prgkey_state = 0;
+		}
+		SIM(FLASH->PRGKEYR) = 0;
+	} else if (addr == (uintptr_t)&FLASH->PECR) {
+		if ((old_value & (1<<0)) != 0) {
+			SIM(FLASH->PECR) = old_value;									//PECR is write protected while PELOCK is on
+		} else if ((new_value & (1<<0)) != 0) {
+			SIM(FLASH->PECR) = new_value | (1<<1) | (1<<2);					//PELOCK locks everything again
+			Sim_half_page_count = 0;
+		} else {
+			SIM(FLASH->PECR) = new_value | (old_value & ((1<<1) | (1<<2)));	//the other locks can't be removed by a write
+		}
+	} else if (addr == (uintptr_t)&FLASH->SR) {
+		SIM(FLASH->SR) = old_value & ~(new_value & ((1<<1) | Sim_flash_sr_error_mask));
+
+	//CRC
+	} else if (addr == (uintptr_t)&CRC->DR) {
+		SIM(CRC->DR) = SimCRCFeed(old_value, new_value);
+	} else if (addr == (uintptr_t)&CRC->CR) {
+		if ((new_value & (1<<0)) != 0) {
+			SIM(CRC->DR) = CRC->INIT;										//RESET
+			SIM(CRC->CR) = new_value & ~(1<<0);
+		} else {
+			//do nothing
+		}
+
+	//RCC - the clocks are ready right away
+	} else if (addr == (uintptr_t)&RCC->CR) {
+		uint32_t rcc_cr = new_value & ~((1<<2) | (1<<9) | (1<<17) | (1<<25));
+		if (new_value & (1<<0)) rcc_cr |= (1<<2);							//HSI16
+		if (new_value & (1<<8)) rcc_cr |= (1<<9);							//MSI
+		if (new_value & (1<<16)) rcc_cr |= (1<<17);							//HSE
+		if (new_value & (1<<24)) rcc_cr |= (1<<25);							//PLL
+		SIM(RCC->CR) = rcc_cr;
+	} else if (addr == (uintptr_t)&RCC->CFGR) {
+		SIM(RCC->CFGR) = (new_value & ~(3<<2)) | ((new_value & 3) << 2);		//SWS follows SW
+
+	//DMA
+	} else if (addr == (uintptr_t)&DMA1->ISR) {
+		SIM(DMA1->ISR) = old_value;											//read-only
+	} else if (addr == (uintptr_t)&DMA1->IFCR) {
+		uint32_t isr = DMA1->ISR;
+		for (int channel = 0; channel < 7; channel++) {
+			if ((new_value & (1 << (4 * channel))) != 0) {					//CGIF clears every flag of the channel
+				isr &= ~(0xF << (4 * channel));
+			} else {
+				isr &= ~(new_value & (0xE << (4 * channel)));
+			}
+		}
+		SIM(DMA1->ISR) = isr;
+		SIM(DMA1->IFCR) = 0;
+	} else if ((addr >= 0x40020008) && (addr < (0x40020008 + 7 * 20))) {
+		int channel = 1 + ((addr - 0x40020008) / 20);
+		DMA_Channel_TypeDef* dma_channel = SimDmaChannel(channel);
+		if (addr == (uintptr_t)&dma_channel->CCR) {
+			if (((old_value & (1<<0)) == 0) && ((new_value & (1<<0)) != 0)) {
+				Sim_dma_reload[channel] = dma_channel->CNDTR & 0xFFFF;			//circular mode reloads what was there when the channel was enabled
+			} else {
+				//do nothing
+			}
+		} else if ((addr == (uintptr_t)&dma_channel->CNDTR) && ((dma_channel->CCR & (1<<0)) != 0)) {
+			SIM(dma_channel->CNDTR) = old_value;								//CNDTR can't be written while the channel is on
+		} else {
+			//do nothing
+		}
+		SimUsartTx(&Sim_usarts[0], Sim_now);
+		SimUsartTx(&Sim_usarts[1], Sim_now);
+
+	//UARTs
+	} else if ((addr >= (uintptr_t)USART1) && (addr < ((uintptr_t)USART1 + 0x400))) {
+		sim_usart_t* sim_usart = &Sim_usarts[0];
+		if (addr == (uintptr_t)&USART1->ISR) {
+			SIM(USART1->ISR) = old_value;
+		} else if (addr == (uintptr_t)&USART1->ICR) {
+			SIM(USART1->ISR) = USART1->ISR & ~(new_value & ((1<<0) | (1<<1) | (1<<2) | (1<<3) | (1<<4) | (1<<6)));
+			SIM(USART1->ICR) = 0;
+		} else if (addr == (uintptr_t)&USART1->TDR) {
+			sim_usart->tdr = new_value & 0xFF;
+			sim_usart->tdr_full = 1;
+		} else {
+			//do nothing
+		}
+		SimUsartCheckEnable(sim_usart, Sim_now);
+		SimUsartTx(sim_usart, Sim_now);
+	} else if ((addr >= (uintptr_t)USART2) && (addr < ((uintptr_t)USART2 + 0x400))) {
+		sim_usart_t* sim_usart = &Sim_usarts[1];
+		if (addr == (uintptr_t)&USART2->ISR) {
+			SIM(USART2->ISR) = old_value;
+		} else if (addr == (uintptr_t)&USART2->ICR) {
+			SIM(USART2->ISR) = USART2->ISR & ~(new_value & ((1<<0) | (1<<1) | (1<<2) | (1<<3) | (1<<4) | (1<<6)));
+			SIM(USART2->ICR) = 0;
+		} else if (addr == (uintptr_t)&USART2->TDR) {
+			sim_usart->tdr = new_value & 0xFF;
+			sim_usart->tdr_full = 1;
+		} else {
+			//do nothing
+		}
+		SimUsartCheckEnable(sim_usart, Sim_now);
+		SimUsartTx(sim_usart, Sim_now);
+
+	//Timers
+	} else if ((addr >= (uintptr_t)TIM2) && (addr < ((uintptr_t)TIM6 + 0x400))) {
+		sim_timer_t* sim_timer = (addr < (uintptr_t)TIM6) ? &Sim_timers[0] : &Sim_timers[1];
+		TIM_TypeDef* tim = sim_timer->tim;
+		if (addr == (uintptr_t)&tim->CR1) {
+			if (((old_value & (1<<0)) == 0) && ((new_value & (1<<0)) != 0)) {
+				sim_timer->base_time = Sim_now - (uint64_t)tim->CNT * SimTimerTick(sim_timer);
+				sim_timer->last_time = Sim_now;
+				sim_timer->running = 1;
+			} else if (((old_value & (1<<0)) != 0) && ((new_value & (1<<0)) == 0)) {
+				SimTimerUpdate(sim_timer, Sim_now);
+				sim_timer->running = 0;
+			} else {
+				//do nothing
+			}
+		} else if (addr == (uintptr_t)&tim->CNT) {
+			sim_timer->base_time = Sim_now - (uint64_t)new_value * SimTimerTick(sim_timer);
+			sim_timer->last_time = Sim_now;
+		} else if (addr == (uintptr_t)&tim->SR) {
+			SIM(tim->SR) = old_value & new_value;							//the flags are cleared by writing 0
+		} else if (addr == (uintptr_t)&tim->EGR) {
+			if ((new_value & (1<<0)) != 0) {								//UG
+				sim_timer->psc_active = tim->PSC & 0xFFFF;
+				sim_timer->base_time = Sim_now;
+				sim_timer->last_time = Sim_now;
+				if ((tim->CR1 & (1<<2)) == 0) {
+					SIM(tim->SR) |= (1<<0);
+				} else {
+					//do nothing
+				}
+			} else {
+				//do nothing
+			}
+			SIM(tim->EGR) = 0;
+		} else {
+			//do nothing
+		}
+		SimTimerUpdate(sim_timer, Sim_now);
+
+	//NVIC and SCB
+	} else if (addr == (uintptr_t)&NVIC->ISER[0]) {
+		Sim_nvic_enabled |= new_value;
+		SIM(NVIC->ISER[0]) = Sim_nvic_enabled;
+	} else if (addr == (uintptr_t)&NVIC->ICER[0]) {
+		Sim_nvic_enabled &= ~new_value;
+		SIM(NVIC->ICER[0]) = Sim_nvic_enabled;
+		SIM(NVIC->ISER[0]) = Sim_nvic_enabled;
+	} else if (addr == (uintptr_t)&NVIC->ISPR[0]) {
+		Sim_nvic_pending |= new_value;
+	} else if (addr == (uintptr_t)&NVIC->ICPR[0]) {
+		Sim_nvic_pending &= ~new_value;
+		SIM(NVIC->ICPR[0]) = 0;
+	} else if (addr == (uintptr_t)&SCB->ICSR) {
+		SIM(SCB->ICSR) = old_value;											//the pending bits of the core exceptions are not modeled
+	} else if (addr == (uintptr_t)&SCB->AIRCR) {
+		if ((new_value >> 16) == 0x05FA && ((new_value & (1<<2)) != 0)) {
+			SimEnd(Sim_End_Reset);											//SYSRESETREQ
+		} else {
+			//do nothing
+		}
+
+	//Read-only registers
+	} else if ((addr == (uintptr_t)&GPIOA->IDR) || (addr == (uintptr_t)&PWR->CSR)) {
+		SIM_WORD(addr) = old_value;
+	} else if (addr == (uintptr_t)&EXTI->PR) {
+		SIM(EXTI->PR) = old_value & ~new_value;
+
+	} else {
+		//do nothing														//plain register
+	}
+}
+
+
+//8)Write trapping
+/*
+ * A write of the bootloader faults on the read-only mapping. We open up the host page, set the trap flag and let the write happen.
+ * The trap comes right after the write. We close the page again and tell the register model what has been written.
+ * A fault on the instruction fetch is a jump into the FLASH of the part: the handoff to the app (or to the boot, in case of a reboot).
+ *
+ * */
+
+static void SimFaultHandler (int signal_number, siginfo_t* info, void* context) {
+	ucontext_t* uc = (ucontext_t*)context;
+	uintptr_t addr = (uintptr_t)info->si_addr;
+	if (addr == (uintptr_t)uc->uc_mcontext.gregs[REG_RIP]) {
+		if (SimRegionOf(addr) == 0) {
+			if (addr == (Boot_FLASH_start_addr + 0xC1)) {
+				SimEnd(Sim_End_Reset);
+			} else {
+				SimEnd(Sim_End_Jump);
+			}
+		} else {
+			//do nothing
+		}
+	} else if ((SimRegionOf(addr) >= 0) && (Sim_trap_active == 0)) {
+		Sim_trap_addr = addr & ~(uintptr_t)3;
+		Sim_trap_old_value = *(volatile uint32_t*)Sim_trap_addr;
+		Sim_trap_active = 1;
+		mprotect((void*)(addr & ~(uintptr_t)(Sim_page_size - 1)), Sim_page_size, PROT_READ | PROT_WRITE);
+		uc->uc_mcontext.gregs[REG_EFL] |= 0x100;							//TF: trap after the write
+		return;
+	} else {
+		//do nothing
+	}
+	static const char fault_message[] = "BootSim: the bootloader has crashed\n";
+	write(2, fault_message, sizeof(fault_message) - 1);
+	Sim_result.end = Sim_End_Fault;
+	siglongjmp(Sim_run_end, 1);
+}
+
+static void SimTrapHandler (int signal_number, siginfo_t* info, void* context) {
+	ucontext_t* uc = (ucontext_t*)context;
+	uc->uc_mcontext.gregs[REG_EFL] &= ~0x100;
+	if (Sim_trap_active == 0) {
+		return;
+	} else {
+		//do nothing
+	}
+	mprotect((void*)(Sim_trap_addr & ~(uintptr_t)(Sim_page_size - 1)), Sim_page_size, PROT_READ);
+	Sim_trap_active = 0;
+	Sim_result.traps++;
+	SimRegWrite(Sim_trap_addr, Sim_trap_old_value, *(volatile uint32_t*)Sim_trap_addr);
+}
+
+
+//9)IRQs
+/*
+ * The NVIC latches a line that is up. Taking the IRQ clears the latch, the line latches again if the handler has left the flags on.
+ * Priorities are the 2 bits of the M0+. Equal priorities don't preempt each other, the lower IRQ number goes first.
+ *
+ * */
+
+static uint32_t SimIRQLines (void) {
+	uint32_t lines = 0;
+	uint32_t flash_sr = FLASH->SR;
+	uint32_t flash_pecr = FLASH->PECR;
+	if ((((flash_sr & (1<<1)) != 0) && ((flash_pecr & (1<<16)) != 0)) || (((flash_sr & Sim_flash_sr_error_mask) != 0) && ((flash_pecr & (1<<17)) != 0))) {
+		lines |= (1 << FLASH_IRQn);
+	} else {
+		//do nothing
+	}
+	uint32_t dma_isr = DMA1->ISR;
+	for (int channel = 1; channel <= 7; channel++) {
+		if ((((dma_isr >> (4 * (channel - 1))) & SimDmaChannel(channel)->CCR) & 0xE) != 0) {
+			lines |= (1 << ((channel == 1) ? DMA1_Channel1_IRQn : ((channel <= 3) ? DMA1_Channel2_3_IRQn : DMA1_Channel4_5_6_7_IRQn)));
+		} else {
+			//do nothing
+		}
+	}
+	for (int i = 0; i < 2; i++) {
+		TIM_TypeDef* tim = Sim_timers[i].tim;
+		if (((tim->SR & tim->DIER) & ((1<<0) | (1<<1))) != 0) {					//update or CC1
+			lines |= (1 << ((i == 0) ? TIM2_IRQn : TIM6_DAC_IRQn));
+		} else {
+			//do nothing
+		}
+		USART_TypeDef* usart = Sim_usarts[i].usart;
+		uint32_t isr = usart->ISR;
+		uint32_t cr1 = usart->CR1;
+		if ((((isr & cr1) & ((1<<4) | (1<<5) | (1<<6) | (1<<7))) != 0) || (((isr & ((1<<1) | (1<<2) | (1<<3))) != 0) && ((usart->CR3 & (1<<0)) != 0)) ||
+			(((isr & (1<<3)) != 0) && ((cr1 & (1<<5)) != 0))) {
+			lines |= (1 << ((i == 0) ? USART1_IRQn : USART2_IRQn));
+		} else {
+			//do nothing
+		}
+	}
+	return lines;
+}
+
+static int SimIRQNext (void) {
+	/*
+	 * We give back the IRQ that would be taken now, -1 if there is none.
+	 *
+	 * */
+	uint32_t candidates = Sim_nvic_pending & Sim_nvic_enabled;
+	int next_irq = -1;
+	int next_priority = Sim_active_priority;
+	for (int irq = 0; irq < 32; irq++) {
+		if (((candidates & (1 << irq)) != 0) && (Sim_nvic_priority[irq] < next_priority)) {
+			next_irq = irq;
+			next_priority = Sim_nvic_priority[irq];
+		} else {
+			//do nothing
+		}
+	}
+	return next_irq;
+}
+
+static void SimIRQDeliver (void) {
+	while (1) {
+		Sim_irq_dirty = 0;
+		Sim_nvic_pending |= SimIRQLines();
+		if (Sim_primask != 0) {
+			return;
+		} else {
+			//do nothing
+		}
+		int irq = SimIRQNext();
+		if (irq < 0) {
+			return;
+		} else if ((Sim_nvm_op != Sim_NVM_Idle) && (SimRegionOf(SCB->VTOR) == 0)) {
+			return;															//the vector fetch from the FLASH waits for the NVM
+		} else {
+			//do nothing
+		}
+		uint32_t handler_addr = ((volatile uint32_t*)(uintptr_t)SCB->VTOR)[16 + irq];
+		if ((handler_addr == 0) || (SimRegionOf(handler_addr) >= 0)) {
+			fprintf(stderr, "BootSim: no handler for IRQ %d\n", irq);
+			SimEnd(Sim_End_Fault);
+		} else {
+			//do nothing
+		}
+		Sim_nvic_pending &= ~(1 << irq);
+		int previous_priority = Sim_active_priority;
+		Sim_active_priority = Sim_nvic_priority[irq];
+		Sim_result.irqs[irq]++;
+		Sim_now += 16 * Sim_call_cost / (Sim_params.call_cycles ? Sim_params.call_cycles : 1);	//exception entry: 16 cycles on the M0+
+		((void (*)(void))(uintptr_t)handler_addr)();
+		Sim_now += 16 * Sim_call_cost / (Sim_params.call_cycles ? Sim_params.call_cycles : 1);
+		Sim_active_priority = previous_priority;
+	}
+}
+
+
+//10)Hooks
+/*
+ * 1)Time moves along by the cost of the hook.
+ * 2)Code in FLASH is stalled while the NVM is busy. The IRQs keep on being served, if they can.
+ * 3)Whatever has come due is processed, the timer counters are brought up to date and pending IRQs are taken.
+ *
+ * */
+
+static int SimInRam (void* code_ptr) {
+	return ((char*)code_ptr >= __start_BootRamFunc) && ((char*)code_ptr < __stop_BootRamFunc);
+}
+
+static void SimStall (void) {
+	while (Sim_nvm_op != Sim_NVM_Idle) {
+		uint64_t next_time = SimNextEventTime();
+		if (next_time > Sim_now) {
+			Sim_stall_time += next_time - Sim_now;
+			Sim_now = next_time;
+		} else {
+			//do nothing
+		}
+		SimEvents();
+		SimIRQDeliver();
+	}
+}
+
+static void SimStep (uint64_t cost, void* code_ptr) {
+	//1)
+	Sim_now += cost;
+	//2)
+	if ((Sim_nvm_op != Sim_NVM_Idle) && (SimInRam(code_ptr) == 0)) {
+		SimStall();
+	} else {
+		//do nothing
+	}
+	//3)
+	if (Sim_now >= Sim_next_event_time) {
+		SimEvents();
+	} else {
+		//do nothing
+	}
+	SimTimerUpdate(&Sim_timers[0], Sim_now);
+	SimTimerUpdate(&Sim_timers[1], Sim_now);
+	if (Sim_irq_dirty) {
+		SimIRQDeliver();
+	} else {
+		//do nothing
+	}
+}
+
+void __cyg_profile_func_enter (void* this_fn, void* call_site) {
+	SimStep(Sim_call_cost, this_fn);
+}
+
+void __cyg_profile_func_exit (void* this_fn, void* call_site) {
+	//do nothing
+}
+
+void SimLoopHook (void) {
+	SimStep(Sim_loop_cost, __builtin_return_address(0));
+}
+
+static void SimEvents (void) {
+	/*
+	 * We process everything that has come due, in the order of time. The master is resumed when its time has come.
+	 *
+	 * */
+	if (Sim_now > Sim_time_limit) {
+		SimEnd(Sim_End_Time_Limit);
+	} else {
+		//do nothing
+	}
+	while (1) {
+		uint64_t event_time = SimNextEventTime();
+		if (event_time > Sim_now) {
+			Sim_next_event_time = event_time;
+			return;
+		} else {
+			//do nothing
+		}
+		SimTimerUpdate(&Sim_timers[0], event_time);
+		SimTimerUpdate(&Sim_timers[1], event_time);
+		if (Sim_nvm_done_time == event_time) {
+			SimNVMDone();
+		} else if ((Sim_rx_head != Sim_rx_tail) && (Sim_rx_queue[Sim_rx_tail].arrival_time == event_time)) {
+			SimUsartRx(&Sim_rx_queue[Sim_rx_tail]);
+			Sim_rx_tail = (Sim_rx_tail + 1) % Sim_rx_queue_size;
+		} else if (Sim_usarts[0].idle_time == event_time) {
+			Sim_usarts[0].idle_time = Sim_never;
+			if ((Sim_rx_head != Sim_rx_tail) && ((Sim_rx_queue[Sim_rx_tail].arrival_time - ((10 * Ps_per_s) / Sim_rx_queue[Sim_rx_tail].baud)) <= event_time)) {
+				//do nothing												//the start bit of the next byte is already on the line
+			} else {
+				SIM(USART1->ISR) |= (1<<4);									//IDLE
+				Sim_irq_dirty = 1;
+			}
+		} else if (Sim_usarts[1].idle_time == event_time) {
+			Sim_usarts[1].idle_time = Sim_never;
+		} else if (Sim_usarts[0].shift_busy && (Sim_usarts[0].shift_done_time == event_time)) {
+			SimUsartTxDone(&Sim_usarts[0]);
+		} else if (Sim_usarts[1].shift_busy && (Sim_usarts[1].shift_done_time == event_time)) {
+			SimUsartTxDone(&Sim_usarts[1]);
+		} else if (Host_wake_time == event_time) {
+			Host_wake_time = Sim_never;
+			Host_waits_for_rx = 0;
+			swapcontext(&Sim_context, &Host_context);						//the master runs until it waits again
+			if (Host_done) {
+				SimEnd(Sim_End_Host_Done);
+			} else {
+				//do nothing
+			}
+		} else {
+			//do nothing														//a timer update, already done above
+		}
+	}
+}
+
+
+//11)Core functions
+/*
+ * The intrinsics and the NVIC functions of CMSIS, on the model.
+ *
+ * */
+
+void __disable_irq (void) {
+	Sim_primask = 1;
+}
+
+void __enable_irq (void) {
+	Sim_primask = 0;
+	SimIRQDeliver();
+}
+
+uint32_t __get_PRIMASK (void) {
+	return Sim_primask;
+}
+
+void __set_PRIMASK (uint32_t primask) {
+	Sim_primask = primask & 1;
+	if (Sim_primask == 0) {
+		SimIRQDeliver();
+	} else {
+		//do nothing
+	}
+}
+
+void __set_MSP (uint32_t top_of_stack) {
+	//do nothing															//the bootloader keeps the host stack
+}
+
+void __WFI (void) {
+	/*
+	 * We sleep until an IRQ could be taken, PRIMASK aside. Time jumps from one event to the next.
+	 *
+	 * */
+	while (1) {
+		Sim_nvic_pending |= SimIRQLines();
+		if (SimIRQNext() >= 0) {
+			break;
+		} else {
+			//do nothing
+		}
+		uint64_t next_time = SimNextEventTime();
+		if (next_time == Sim_never) {
+			SimEnd(Sim_End_Time_Limit);										//nothing will ever wake us up
+		} else if (next_time > Sim_now) {
+			Sim_sleep_time += next_time - Sim_now;
+			Sim_now = next_time;
+		} else {
+			//do nothing
+		}
+		SimEvents();
+		SimTimerUpdate(&Sim_timers[0], Sim_now);
+		SimTimerUpdate(&Sim_timers[1], Sim_now);
+	}
+	SimIRQDeliver();
+}
+
+void __DSB (void) {
+	//do nothing
+}
+
+void __ISB (void) {
+	//do nothing
+}
+
+void __DMB (void) {
+	//do nothing
+}
+
+void __NOP (void) {
+	//do nothing
+}
+
+void NVIC_SetPriority (IRQn_Type IRQn, uint32_t priority) {
+	if (IRQn >= 0) {
+		Sim_nvic_priority[IRQn] = priority & 3;
+	} else {
+		//do nothing
+	}
+}
+
+void NVIC_EnableIRQ (IRQn_Type IRQn) {
+	Sim_nvic_enabled |= (1 << IRQn);
+	Sim_irq_dirty = 1;
+}
+
+void NVIC_DisableIRQ (IRQn_Type IRQn) {
+	Sim_nvic_enabled &= ~(1 << IRQn);
+}
+
+void NVIC_ClearPendingIRQ (IRQn_Type IRQn) {
+	Sim_nvic_pending &= ~(1 << IRQn);
+	Sim_irq_dirty = 1;
+}
+
+void NVIC_SystemReset (void) {
+	SimEnd(Sim_End_Reset);
+}
+
+void SystemCoreClockUpdate (void) {
+	SystemCoreClock = Boot_SYSCLK_in_Hz;
+}
+
+
+//12)HAL
+/*
+ * Only the CubeMX init of main.c uses the HAL. UART2 is set up for the text log, the rest does nothing.
+ *
+ * */
+
+HAL_StatusTypeDef HAL_Init (void) {
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Init (UART_HandleTypeDef* huart) {
+	Sim_usart2_baud = huart->Init.BaudRate;
+	SIM(huart->Instance->BRR) = (Sim_usart2_clock_in_Hz + (huart->Init.BaudRate / 2)) / huart->Init.BaudRate;
+	SIM(huart->Instance->CR1) = (1<<0) | (1<<2) | (1<<3);
+	SimUsartCheckEnable(&Sim_usarts[1], Sim_now);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RCC_OscConfig (RCC_OscInitTypeDef* RCC_OscInitStruct) {
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RCC_ClockConfig (RCC_ClkInitTypeDef* RCC_ClkInitStruct, uint32_t FLatency) {
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RCCEx_PeriphCLKConfig (RCC_PeriphCLKInitTypeDef* PeriphClkInit) {
+	return HAL_OK;
+}
+
+void HAL_GPIO_Init (GPIO_TypeDef* GPIOx, GPIO_InitTypeDef* GPIO_Init) {
+	//do nothing
+}
+
+void HAL_GPIO_WritePin (GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState) {
+	//do nothing
+}
+
+
+//13)Master - serial line
+/*
+ * The master sends whole buffers: the bytes go out back to back at the master's baud rate from when the line is free.
+ * What the bootloader sends is collected in the Rx buffer of the master. A master waiting for a response is woken up after its turnaround latency.
+ *
+ * */
+
+static double SimSeconds (uint64_t time) {
+	return (double)time / Ps_per_s;
+}
+
+static void HostLog (const char* text) {
+	if (Sim_params.verbose) {
+		fprintf(stderr, "[%10.6f s] %s\n", SimSeconds(Sim_now), text);
+	} else {
+		//do nothing
+	}
+}
+
+static void HostYield (void) {
+	swapcontext(&Host_context, &Sim_context);
+}
+
+static void HostSleep (uint64_t duration_in_us) {
+	uint64_t wake_time = Sim_now + duration_in_us * Ps_per_us;
+	while (Sim_now < wake_time) {
+		Host_wake_time = wake_time;
+		Host_waits_for_rx = 0;
+		HostYield();
+	}
+}
+
+static void HostSend (const uint8_t* data_ptr, uint32_t length_in_bytes) {
+	uint64_t frame_time = (10 * Ps_per_s) / Host_baud;
+	if (Host_line_free_time < Sim_now) {
+		Host_line_free_time = Sim_now;
+	} else {
+		//do nothing
+	}
+	for (uint32_t i = 0; i < length_in_bytes; i++) {
+		uint32_t next_head = (Sim_rx_head + 1) % Sim_rx_queue_size;
+		if (next_head == Sim_rx_tail) {
+			fprintf(stderr, "BootSim: the Rx queue of the simulator is full\n");
+			abort();
+		} else {
+			//do nothing
+		}
+		Host_line_free_time += frame_time;
+		Sim_rx_queue[Sim_rx_head].arrival_time = Host_line_free_time;
+		Sim_rx_queue[Sim_rx_head].byte = data_ptr[i];
+		Sim_rx_queue[Sim_rx_head].baud = Host_baud;
+		Sim_rx_head = next_head;
+	}
+	Sim_next_event_time = 0;
+}
+
+static void HostDrain (void) {
+	if (Host_line_free_time > Sim_now) {
+		HostSleep((Host_line_free_time - Sim_now + Ps_per_us - 1) / Ps_per_us);
+	} else {
+		//do nothing
+	}
+}
+
+static void HostRxPush (uint8_t byte, uint32_t baud) {
+	if ((labs((long)baud - Host_baud) * 100) > (3 * Host_baud)) {
+		byte = byte ^ 0x5A;
+	} else {
+		//do nothing
+	}
+	if (Host_rx_length < Host_rx_buf_size) {
+		Host_rx_buf[Host_rx_length++] = byte;
+	} else {
+		//do nothing
+	}
+	if (Host_waits_for_rx) {
+		uint64_t wake_time = Sim_now + Sim_params.host_latency_in_us * Ps_per_us;
+		if (wake_time < Host_wake_time) {
+			Host_wake_time = wake_time;
+		} else {
+			//do nothing
+		}
+	} else {
+		//do nothing
+	}
+}
+
+static void HostCommand (const uint8_t* command_ptr, uint8_t command_length) {
+	uint8_t frame[64];
+	uint8_t frame_length = 2;
+	frame[0] = UART_message_start_byte;
+	frame[1] = UART_message_start_byte;
+	if (Host_frame_node != 0) {												//same node framing as BootFlasher
+		frame[frame_length++] = UART_node_prefix;
+		frame[frame_length++] = Host_frame_node;
+	} else {
+		//do nothing
+	}
+	memcpy(&frame[frame_length], command_ptr, command_length);
+	HostSend(frame, frame_length + command_length);
+	HostDrain();
+	HostSleep(Command_gap_in_us);
+}
+
+static int HostResponse (uint64_t timeout_in_us, uint8_t* type_ptr, uint8_t* payload_ptr, uint8_t* length_ptr) {
+	/*
+	 * Same framing as BootFlasher: start sequence, type, length and payload. We give back 1 for a response, 0 on a timeout.
+	 *
+	 * */
+	uint64_t deadline = Sim_now + timeout_in_us * Ps_per_us;
+	while (1) {
+		int start = 0;
+		while (((start + 1) < Host_rx_length) && !((Host_rx_buf[start] == UART_message_start_byte) && (Host_rx_buf[start + 1] == UART_message_start_byte))) {
+			start++;
+		}
+		if (start != 0) {
+			memmove(Host_rx_buf, &Host_rx_buf[start], Host_rx_length - start);
+			Host_rx_length -= start;
+		} else {
+			//do nothing
+		}
+		if ((Host_rx_length >= 4) && (Host_rx_length >= (4 + Host_rx_buf[3]))) {
+			*type_ptr = Host_rx_buf[2];
+			*length_ptr = Host_rx_buf[3];
+			memcpy(payload_ptr, &Host_rx_buf[4], Host_rx_buf[3]);
+			int frame_length = 4 + Host_rx_buf[3];
+			memmove(Host_rx_buf, &Host_rx_buf[frame_length], Host_rx_length - frame_length);
+			Host_rx_length -= frame_length;
+			if (*type_ptr == UART_response_report) {
+				memcpy(Host_last_report, payload_ptr, (*length_ptr < sizeof(Host_last_report)) ? *length_ptr : sizeof(Host_last_report));
+				Sim_result.report_received = 1;
+			} else {
+				//do nothing
+			}
+			return 1;
+		} else if (Sim_now >= deadline) {
+			return 0;
+		} else {
+			Host_wake_time = deadline;
+			Host_waits_for_rx = 1;
+			HostYield();
+		}
+	}
+}
+
+static void HostFlush (void) {
+	Host_rx_length = 0;
+}
+
+
+//14)Master - update
+/*
+ * 1)Handshake: 0xc3 and 0xd2, repeated until the bootloader answers. We learn the window and the update slot.
+ * 2)Baud rate negotiation (command 0xd7), if we run faster than the boot baud rate.
+ * 3)The app: random machine code with a vector table pointing into the update slot, so the commit takes it.
+ * 4)The transfer: raw pages (0xbb), raw pages into a pre-erased slot (0xbd), or addressed pages with a window (0xbe).
+ *   In broadcast mode, the switch to addressed pages goes in a broadcast frame and the pages go out without a window. The report is asked for afterwards (0xd8), sent to the node.
+ * 5)The commit (0xd1). In broadcast mode, it goes to the node.
+ *
+ * */
+
+static uint32_t HostCRC32 (const uint8_t* data_ptr, uint32_t length_in_bytes) {
+	uint32_t crc = 0xFFFFFFFF;
+	for (uint32_t i = 0; i < length_in_bytes; i++) {
+		crc ^= data_ptr[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+		}
+	}
+	return crc ^ 0xFFFFFFFF;
+}
+
+static void HostPutLE32 (uint8_t* dst_ptr, uint32_t value) {
+	dst_ptr[0] = value & 0xFF;
+	dst_ptr[1] = (value >> 8) & 0xFF;
+	dst_ptr[2] = (value >> 16) & 0xFF;
+	dst_ptr[3] = value >> 24;
+}
+
+static uint32_t HostGetLE32 (const uint8_t* src_ptr) {
+	return src_ptr[0] | (src_ptr[1] << 8) | (src_ptr[2] << 16) | ((uint32_t)src_ptr[3] << 24);
+}
+
+static int HostFail (const char* error) {
+	snprintf(Sim_result.error, sizeof(Sim_result.error), "%s", error);
+	HostLog(error);
+	return -1;
+}
+
+static int HostHandshake (int* window_ptr) {
+	for (int attempt = 0; attempt < Handshake_attempts; attempt++) {
+		uint8_t command = 0xc3;
+		HostCommand(&command, 1);
+		command = 0xd2;
+		HostCommand(&command, 1);
+		uint8_t type;
+		uint8_t length;
+		uint8_t payload[256];
+		if ((HostResponse(200000, &type, payload, &length) == 1) && (type == UART_response_ack) && (length >= 12)) {
+			*window_ptr = payload[2];
+			Host_app_start_addr = HostGetLE32(&payload[4]);
+			Host_node = (length >= 15) ? payload[14] : 0;
+			if ((payload[3] * 4) != (Boot_page_size_in_bytes + 8)) {
+				return HostFail("unexpected slot size");
+			} else {
+				HostLog("handshake done");
+				return 0;
+			}
+		} else {
+			//do nothing
+		}
+	}
+	return HostFail("no bootloader found");
+}
+
+static int HostBaudNegotiate (int baud_index) {
+	uint8_t command[10] = {0xd7, (uint8_t)baud_index};
+	uint8_t type;
+	uint8_t length;
+	uint8_t payload[256];
+	HostCommand(command, 2);
+	if ((HostResponse(200000, &type, payload, &length) != 1) || (type != UART_response_ack)) {
+		return HostFail("baud rate not taken");
+	} else {
+		//do nothing
+	}
+	Host_baud = Baud_rates[baud_index];
+	HostFlush();
+	HostSleep(Command_gap_in_us);
+	command[1] = 0xFF;
+	memcpy(&command[2], Baud_probe_pattern, sizeof(Baud_probe_pattern));
+	HostCommand(command, 10);
+	if ((HostResponse(200000, &type, payload, &length) == 1) && (type == UART_response_ack) && (length == sizeof(Baud_probe_pattern))) {
+		HostLog("baud rate switched");
+		return 0;
+	} else {
+		return HostFail("baud rate probe failed");
+	}
+}
+
+static void HostImageBuild (void) {
+	uint32_t image_length_in_bytes = Host_page_count * Boot_page_size_in_bytes;
+	Host_image = malloc(image_length_in_bytes);
+	uint32_t seed = 0x12345678;
+	for (uint32_t i = 0; i < image_length_in_bytes; i++) {
+		seed = seed * 1664525 + 1013904223;
+		Host_image[i] = seed >> 24;
+	}
+	HostPutLE32(&Host_image[0], Boot_stack_top_addr);
+	HostPutLE32(&Host_image[4], Host_app_start_addr + 0xC1);				//reset vector in the update slot
+	Host_image_crc = HostCRC32(Host_image, image_length_in_bytes);
+	Sim_result.image_length_in_bytes = image_length_in_bytes;
+}
+
+static void HostFrameBuild (uint8_t* frame_ptr, uint16_t page_index) {
+	frame_ptr[0] = page_index & 0xFF;
+	frame_ptr[1] = page_index >> 8;
+	frame_ptr[2] = 0;
+	frame_ptr[3] = 0;
+	if (page_index == Addressed_page_end_of_transfer) {
+		memset(&frame_ptr[4], 0, Boot_page_size_in_bytes);
+	} else {
+		memcpy(&frame_ptr[4], &Host_image[page_index * Boot_page_size_in_bytes], Boot_page_size_in_bytes);
+	}
+	HostPutLE32(&frame_ptr[4 + Boot_page_size_in_bytes], HostCRC32(frame_ptr, 4 + Boot_page_size_in_bytes));
+}
+
+static int HostRawTransfer (void) {
+	/*
+	 * The pages go out back to back (or with the page gap). The bootloader ends the transfer on the idle line and sends its report.
+	 *
+	 * */
+	for (uint32_t page = 0; page < Host_page_count; page++) {
+		HostSend(&Host_image[page * Boot_page_size_in_bytes], Boot_page_size_in_bytes);
+		Sim_result.pages_sent++;
+		if (Sim_params.page_gap_in_us != 0) {
+			HostDrain();
+			HostSleep(Sim_params.page_gap_in_us);
+		} else {
+			//do nothing
+		}
+	}
+	HostDrain();
+	uint8_t type;
+	uint8_t length;
+	uint8_t payload[256];
+	while (HostResponse(3000000, &type, payload, &length) == 1) {
+		if (type == UART_response_report) {
+			return 0;
+		} else {
+			//do nothing
+		}
+	}
+	return HostFail("no transfer report");
+}
+
+static int HostBroadcastTransfer (void) {
+	/*
+	 * Every page goes out once (with the page gap), then the end-of-transfer page. The bootloader must not answer any of them.
+	 * We then ask the node for the report of the transfer.
+	 *
+	 * */
+	uint8_t frame[Boot_page_size_in_bytes + 8];
+	uint8_t type;
+	uint8_t length;
+	uint8_t payload[256];
+	for (uint32_t page = 0; page <= Host_page_count; page++) {
+		HostFrameBuild(frame, (page == Host_page_count) ? Addressed_page_end_of_transfer : page);
+		HostSend(frame, sizeof(frame));
+		Sim_result.pages_sent++;
+		if (Sim_params.page_gap_in_us != 0) {
+			HostDrain();
+			HostSleep(Sim_params.page_gap_in_us);
+		} else {
+			//do nothing
+		}
+	}
+	HostDrain();
+	if (HostResponse(Programmer_mode_setup_in_us, &type, payload, &length) == 1) {
+		return HostFail("response to a broadcast frame");
+	} else {
+		//do nothing
+	}
+	Sim_result.report_received = 0;
+	Host_frame_node = Host_node;
+	uint8_t command[2] = {0xd8, 0x02};
+	HostCommand(command, 2);
+	if ((HostResponse(200000, &type, payload, &length) == 1) && (type == UART_response_report)) {
+		return 0;
+	} else {
+		return HostFail("no transfer report from the node");
+	}
+}
+
+static int HostWindowedTransfer (int window) {
+	/*
+	 * Same as BootFlasher: at most "window" pages in flight, the ACKs come in order, a NACKed page goes to the back of the queue.
+	 *
+	 * */
+	uint16_t* send_queue = malloc(sizeof(uint16_t) * (Host_page_count + 1));
+	uint8_t* retries = calloc(Host_page_count, 1);
+	uint16_t in_flight[Host_max_window];
+	int in_flight_head = 0;
+	int in_flight_count = 0;
+	uint32_t send_head = 0;
+	uint32_t send_tail = 0;
+	uint32_t acked_pages = 0;
+	uint8_t frame[Boot_page_size_in_bytes + 8];
+	uint8_t type;
+	uint8_t length;
+	uint8_t payload[256];
+	int result = -1;
+
+	for (uint32_t i = 0; i < Host_page_count; i++) {
+		send_queue[send_tail++] = i;
+	}
+	send_tail = send_tail % (Host_page_count + 1);
+
+	while (acked_pages < Host_page_count) {
+		while ((in_flight_count < window) && (send_head != send_tail)) {
+			uint16_t page_index = send_queue[send_head];
+			send_head = (send_head + 1) % (Host_page_count + 1);
+			HostFrameBuild(frame, page_index);
+			HostSend(frame, sizeof(frame));
+			in_flight[(in_flight_head + in_flight_count) % Host_max_window] = page_index;
+			in_flight_count++;
+			Sim_result.pages_sent++;
+		}
+		if (HostResponse(Response_timeout_in_us, &type, payload, &length) == 0) {
+			HostFail("no response from the bootloader");
+			goto end;
+		} else if ((type == UART_response_report) || (length < 2) || (in_flight_count == 0)) {
+			continue;
+		} else {
+			//do nothing
+		}
+		uint16_t page_index = payload[0] | (payload[1] << 8);
+		uint16_t expected_page_index = in_flight[in_flight_head];
+		in_flight_head = (in_flight_head + 1) % Host_max_window;
+		in_flight_count--;
+		if ((type == UART_response_ack) && (page_index == expected_page_index)) {
+			acked_pages++;
+		} else if (type == UART_response_nack) {
+			Sim_result.nacks++;
+			if (++retries[expected_page_index] > Max_retries) {
+				HostFail("page rejected too many times");
+				goto end;
+			} else {
+				//do nothing
+			}
+			send_queue[send_tail] = expected_page_index;
+			send_tail = (send_tail + 1) % (Host_page_count + 1);
+		} else {
+			HostFail("unexpected response");
+			goto end;
+		}
+	}
+
+	HostFrameBuild(frame, Addressed_page_end_of_transfer);
+	HostSend(frame, sizeof(frame));
+	while (1) {
+		if (HostResponse(Response_timeout_in_us, &type, payload, &length) == 0) {
+			HostFail("end of transfer not acknowledged");
+			goto end;
+		} else if ((type == UART_response_ack) && (length >= 2) && ((payload[0] | (payload[1] << 8)) == Addressed_page_end_of_transfer)) {
+			result = 0;
+			goto end;
+		} else {
+			//do nothing
+		}
+	}
+
+end:
+	free(send_queue);
+	free(retries);
+	return result;
+}
+
+static int HostCommit (void) {
+	uint8_t command[13];
+	uint8_t type;
+	uint8_t length;
+	uint8_t payload[256];
+	command[0] = 0xd1;
+	HostPutLE32(&command[1], Sim_result.image_length_in_bytes);
+	HostPutLE32(&command[5], Host_image_crc);
+	HostPutLE32(&command[9], 1);
+	HostCommand(command, 13);
+	int response = HostResponse(2000000, &type, payload, &length);
+	while ((response == 1) && (type == UART_response_report)) {				//the report may still be on its way
+		response = HostResponse(2000000, &type, payload, &length);
+	}
+	if ((response == 1) && (type == UART_response_ack) && (length >= 4) && (HostGetLE32(payload) == Host_image_crc)) {
+		Sim_result.commit_ok = 1;
+		HostLog("app committed");
+		return 0;
+	} else {
+		return HostFail("commit rejected");
+	}
+}
+
+static void HostMain (void) {
+	int window = 0;
+	uint64_t transfer_start_time;
+
+	//1)
+	if (HostHandshake(&window) != 0) {
+		goto end;
+	} else {
+		//do nothing
+	}
+	if ((Sim_params.window != 0) && (Sim_params.window < window)) {
+		window = Sim_params.window;
+	} else if (window > Host_max_window) {
+		window = Host_max_window;
+	} else {
+		//do nothing
+	}
+	Sim_result.window = window;
+
+	//2)
+	for (int baud_index = 1; baud_index < Baud_count; baud_index++) {
+		if ((Baud_rates[baud_index] == Sim_params.baud) && (HostBaudNegotiate(baud_index) != 0)) {
+			goto end;
+		} else {
+			//do nothing
+		}
+	}
+	Sim_result.baud = Host_baud;
+
+	//3)
+	uint32_t slot_pages = ((Boot_FLASH_end_addr - App_section_start_addr) / App_slot_count) / Boot_page_size_in_bytes;
+	Host_page_count = Sim_params.pages;
+	if ((Host_page_count == 0) || (Host_page_count > (slot_pages - 2))) {
+		Host_page_count = slot_pages - 2;									//we keep off the scratch pages of the NVM benchmark
+	} else {
+		//do nothing
+	}
+	HostImageBuild();
+
+	//4)
+	uint8_t command[5];
+	if ((Sim_params.mode == Host_Broadcast) && (Host_node == 0)) {
+		HostFail("bootloader has no node address");
+		goto end;
+	} else if (Sim_params.mode == Host_Broadcast) {
+		Host_frame_node = UART_node_broadcast;
+		command[0] = 0xbe;
+		HostCommand(command, 1);
+	} else if (Sim_params.mode == Host_Addressed) {
+		command[0] = 0xbe;
+		HostCommand(command, 1);
+	} else if (Sim_params.mode == Host_Erased) {
+		command[0] = 0xbd;
+		HostPutLE32(&command[1], Sim_result.image_length_in_bytes);
+		HostCommand(command, 5);
+		HostSleep(Host_page_count * (Sim_params.erase_in_us + 100));			//the bootloader erases before it takes the pages
+	} else {
+		command[0] = 0xbb;
+		HostCommand(command, 1);
+	}
+	HostSleep(Programmer_mode_setup_in_us);
+	transfer_start_time = Sim_now;
+	int transfer_result = 0;
+	if (Sim_params.mode == Host_Broadcast) {
+		transfer_result = HostBroadcastTransfer();
+	} else if (Sim_params.mode == Host_Addressed) {
+		transfer_result = HostWindowedTransfer(window);
+	} else {
+		transfer_result = HostRawTransfer();
+	}
+	Sim_result.transfer_time_in_s = SimSeconds(Sim_now - transfer_start_time);
+	if (transfer_result != 0) {
+		goto end;
+	} else {
+		//do nothing
+	}
+
+	//5)
+	HostSleep(Command_gap_in_us);
+	if (HostCommit() == 0) {
+		Sim_result.completed = 1;
+	} else {
+		//do nothing
+	}
+
+end:
+	Host_done = 1;
+}
+
+
+//15)One run
+/*
+ * A run is done in a child process: the part is mapped, the bootloader is started from its main and the master from its first command.
+ * The run ends when the master is done (or the bootloader jumps away, or time runs out). The result goes back to the parent on a pipe.
+ *
+ * */
+
+static void SimResultFinish (void) {
+	const uint8_t* report_ptr = Host_last_report;
+	Sim_result.total_time_in_s = SimSeconds(Sim_now);
+	Sim_result.throughput = (Sim_result.transfer_time_in_s > 0) ? (Sim_result.image_length_in_bytes / Sim_result.transfer_time_in_s) : 0;
+	if (Sim_result.report_received) {
+		Sim_result.report_written = report_ptr[2] | (report_ptr[3] << 8);
+		Sim_result.report_rejected = report_ptr[6] | (report_ptr[7] << 8);
+		Sim_result.report_overflow = report_ptr[8] | (report_ptr[9] << 8);
+		Sim_result.report_nvm_errors = report_ptr[10] | (report_ptr[11] << 8);
+		Sim_result.report_missed_events = report_ptr[20] | (report_ptr[21] << 8);
+		Sim_result.report_rx_errors = report_ptr[24] | (report_ptr[25] << 8);
+	} else {
+		//do nothing
+	}
+	if ((Host_image != NULL) && (Host_app_start_addr != 0)) {
+		Sim_result.flash_match = (memcmp((const void*)(uintptr_t)Host_app_start_addr, Host_image, Sim_result.image_length_in_bytes) == 0);
+	} else {
+		//do nothing
+	}
+	if (Sim_now != 0) {
+		Sim_result.cpu_sleep_share = (double)Sim_sleep_time / Sim_now;
+		Sim_result.nvm_stall_share = (double)Sim_stall_time / Sim_now;
+		Sim_result.nvm_busy_share = (double)Sim_nvm_busy_time / Sim_now;
+	} else {
+		//do nothing
+	}
+}
+
+static void SimRunChild (int result_fd) {
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_flags = SA_SIGINFO | SA_NODEFER;
+	action.sa_sigaction = SimFaultHandler;
+	sigaction(SIGSEGV, &action, NULL);
+	action.sa_sigaction = SimTrapHandler;
+	sigaction(SIGTRAP, &action, NULL);
+
+	memset(&Sim_result, 0, sizeof(Sim_result));
+	Sim_result.baud = 57600;
+	Sim_call_cost = (Sim_params.call_cycles * Ps_per_s) / Boot_SYSCLK_in_Hz;
+	Sim_loop_cost = (Sim_params.loop_cycles * Ps_per_s) / Boot_SYSCLK_in_Hz;
+	Sim_time_limit = (uint64_t)(Sim_time_limit_in_s * Ps_per_s);
+	struct timespec wall_start;
+	clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+	if (SimMemoryMap() != 0) {
+		snprintf(Sim_result.error, sizeof(Sim_result.error), "can't map the part");
+	} else {
+		SimReset();
+		getcontext(&Host_context);
+		Host_context.uc_stack.ss_sp = malloc(Sim_host_stack_size);
+		Host_context.uc_stack.ss_size = Sim_host_stack_size;
+		Host_context.uc_link = &Sim_context;
+		makecontext(&Host_context, HostMain, 0);
+		Host_wake_time = 0;													//the master starts right after reset
+		if (sigsetjmp(Sim_run_end, 1) == 0) {
+			BootMain();
+		} else {
+			//do nothing
+		}
+		if ((Sim_result.end != Sim_End_Host_Done) && (Sim_result.error[0] == 0)) {
+			static const char* end_names[] = {"", "", "bootloader jumped away", "bootloader reset", "time limit", "bootloader crashed"};
+			snprintf(Sim_result.error, sizeof(Sim_result.error), "%s", end_names[Sim_result.end]);
+		} else {
+			//do nothing
+		}
+		SimResultFinish();
+	}
+
+	struct timespec wall_end;
+	clock_gettime(CLOCK_MONOTONIC, &wall_end);
+	Sim_result.wall_time_in_s = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) * 1e-9;
+	write(result_fd, &Sim_result, sizeof(Sim_result));
+	_exit(0);
+}
+
+static int SimRun (const sim_params_t* params, sim_result_t* result_ptr) {
+	int pipe_fd[2];
+	if (pipe(pipe_fd) != 0) {
+		return -1;
+	} else {
+		//do nothing
+	}
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(pipe_fd[0]);
+		Sim_params = *params;
+		SimRunChild(pipe_fd[1]);
+	} else {
+		//do nothing
+	}
+	close(pipe_fd[1]);
+	memset(result_ptr, 0, sizeof(*result_ptr));
+	ssize_t received = read(pipe_fd[0], result_ptr, sizeof(*result_ptr));
+	close(pipe_fd[0]);
+	waitpid(pid, NULL, 0);
+	if (received != sizeof(*result_ptr)) {
+		snprintf(result_ptr->error, sizeof(result_ptr->error), "simulator crashed");
+		return -1;
+	} else {
+		return 0;
+	}
+}
+
+
+//16)Results
+static int SimDropFree (const sim_result_t* result_ptr) {
+	return result_ptr->completed && result_ptr->flash_match && (result_ptr->report_overflow == 0) && (result_ptr->report_rejected == 0);
+}
+
+static void SimPrintHeader (void) {
+	printf("ring  mode       baud     erase/prog ms  result    transfer s  bytes/s  overflow  missed  rejected  NACKs  CPU busy  NVM stall  wall s\n");
+}
+
+static void SimPrintResult (const sim_params_t* params, const sim_result_t* result_ptr) {
+	printf("%4d  %-9s  %7ld  %5.2f/%5.2f    %-8s  %10.3f  %7.0f  %8u  %6u  %8u  %5u  %7.1f%%  %8.1f%%  %6.2f",
+			Rx_ring_depth_in_pages, Host_mode_names[params->mode], params->baud, params->erase_in_us / 1000.0, params->program_in_us / 1000.0,
+			SimDropFree(result_ptr) ? "ok" : (result_ptr->completed ? "corrupt" : "failed"),
+			result_ptr->transfer_time_in_s, result_ptr->throughput, result_ptr->report_overflow, result_ptr->report_missed_events,
+			result_ptr->report_rejected, result_ptr->nacks, 100.0 * (1.0 - result_ptr->cpu_sleep_share), 100.0 * result_ptr->nvm_stall_share,
+			result_ptr->wall_time_in_s);
+	if (result_ptr->error[0] != 0) {
+		printf("  (%s)", result_ptr->error);
+	} else {
+		//do nothing
+	}
+	printf("\n");
+}
+
+static void SimPrintDetails (const sim_result_t* result_ptr) {
+	printf("image: %u bytes, window %d, %u pages sent, transfer %.3f s, %.0f bytes/s, total %.3f s\n",
+			result_ptr->image_length_in_bytes, result_ptr->window, result_ptr->pages_sent, result_ptr->transfer_time_in_s, result_ptr->throughput, result_ptr->total_time_in_s);
+	printf("report: %s, %u written, %u rejected, %u overwritten in the Rx ring, %u HT/TC events served late, %u NVM errors, %u Rx errors\n",
+			result_ptr->report_received ? "received" : "missing", result_ptr->report_written, result_ptr->report_rejected,
+			result_ptr->report_overflow, result_ptr->report_missed_events, result_ptr->report_nvm_errors, result_ptr->report_rx_errors);
+	printf("commit: %s, FLASH %s the app\n", result_ptr->commit_ok ? "ACK" : "failed", result_ptr->flash_match ? "matches" : "does NOT match");
+	printf("NVM: %u erases, %u half-page writes, %u word writes, %u EEPROM writes, busy %.1f%% of the time\n",
+			result_ptr->nvm_ops[Sim_NVM_Erase], result_ptr->nvm_ops[Sim_NVM_Half_Page], result_ptr->nvm_ops[Sim_NVM_Word], result_ptr->nvm_ops[Sim_NVM_EEPROM],
+			100.0 * result_ptr->nvm_busy_share);
+	printf("IRQs: %u DMA1_Channel2_3, %u USART1, %u FLASH, %u TIM6, %u TIM2\n",
+			result_ptr->irqs[DMA1_Channel2_3_IRQn], result_ptr->irqs[USART1_IRQn], result_ptr->irqs[FLASH_IRQn], result_ptr->irqs[TIM6_DAC_IRQn], result_ptr->irqs[TIM2_IRQn]);
+	printf("simulator: %llu register writes trapped, %.2f s wall time\n", (unsigned long long)result_ptr->traps, result_ptr->wall_time_in_s);
+}
+
+
+//17)Main
+static void Usage (const char* name) {
+	fprintf(stderr, "Use: %s [-m raw|erased|addressed|broadcast] [-b baud] [-n pages] [-w window] [-g gap_us] [-l latency_us] [-e erase_us] [-p program_us] [-E eeprom_us] [-c cycles] [-i cycles] [-v]\n", name);
+	fprintf(stderr, "     %s -S [-F scale,scale,...] [options as above, except -m and -b]\n", name);
+	fprintf(stderr, "  -m  transfer mode: raw pages (0xbb), raw pages into a pre-erased slot (0xbd), addressed pages with a window (0xbe)\n");
+	fprintf(stderr, "      or addressed pages in broadcast frames without a window (0xbe, then 0xd8 to the node), addressed by default\n");
+	fprintf(stderr, "  -b  baud rate of the transfer (57600, 115200, 230400, 460800, 921600, 1000000), negotiated with command 0xd7, 57600 by default\n");
+	fprintf(stderr, "  -n  pages in the app, the update slot but for the benchmark scratch pages by default\n");
+	fprintf(stderr, "  -w  pages in flight in addressed mode, limited by the bootloader (command 0xd2)\n");
+	fprintf(stderr, "  -g  pause of the master between two raw or broadcast pages, 0 by default\n");
+	fprintf(stderr, "  -l  turnaround latency of the master, 1000 us by default\n");
+	fprintf(stderr, "  -e  page erase time, 3200 us by default\n");
+	fprintf(stderr, "  -p  half-page (and word) write time, 3200 us by default\n");
+	fprintf(stderr, "  -E  EEPROM word write time, 3200 us by default\n");
+	fprintf(stderr, "  -c  CPU cycles counted for a function call, 24 by default\n");
+	fprintf(stderr, "  -i  CPU cycles counted for a loop iteration, 8 by default\n");
+	fprintf(stderr, "  -v  log of the master (and the UART2 text log of the bootloader) on stderr\n");
+	fprintf(stderr, "  -S  sweep: every mode at every baud rate, for every NVM time scale of -F (1 by default)\n");
+}
+
+int main (int argc, char** argv) {
+	sim_params_t params = {Host_Addressed, 57600, 0, 0, 0, 1000, 3200, 3200, 3200, 24, 8, 0};
+	int sweep_enabled = 0;
+	double nvm_scales[8] = {1.0};
+	int nvm_scale_count = 1;
+	int opt;
+	while ((opt = getopt(argc, argv, "m:b:n:w:g:l:e:p:E:c:i:vSF:")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (strcmp(optarg, "raw") == 0) {
+				params.mode = Host_Raw;
+			} else if (strcmp(optarg, "erased") == 0) {
+				params.mode = Host_Erased;
+			} else if (strcmp(optarg, "addressed") == 0) {
+				params.mode = Host_Addressed;
+			} else if (strcmp(optarg, "broadcast") == 0) {
+				params.mode = Host_Broadcast;
+			} else {
+				Usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'b':
+			params.baud = strtol(optarg, NULL, 0);
+			break;
+		case 'n':
+			params.pages = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			params.window = atoi(optarg);
+			break;
+		case 'g':
+			params.page_gap_in_us = strtoull(optarg, NULL, 0);
+			break;
+		case 'l':
+			params.host_latency_in_us = strtoull(optarg, NULL, 0);
+			break;
+		case 'e':
+			params.erase_in_us = strtoull(optarg, NULL, 0);
+			break;
+		case 'p':
+			params.program_in_us = strtoull(optarg, NULL, 0);
+			break;
+		case 'E':
+			params.eeprom_in_us = strtoull(optarg, NULL, 0);
+			break;
+		case 'c':
+			params.call_cycles = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			params.loop_cycles = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			params.verbose = 1;
+			break;
+		case 'S':
+			sweep_enabled = 1;
+			break;
+		case 'F':
+		{
+			nvm_scale_count = 0;
+			char* scale_ptr = strtok(optarg, ",");
+			while ((scale_ptr != NULL) && (nvm_scale_count < 8)) {
+				nvm_scales[nvm_scale_count++] = strtod(scale_ptr, NULL);
+				scale_ptr = strtok(NULL, ",");
+			}
+			break;
+		}
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	int baud_supported = 0;
+	for (int i = 0; i < Baud_count; i++) {
+		if (Baud_rates[i] == params.baud) {
+			baud_supported = 1;
+		} else {
+			//do nothing
+		}
+	}
+	if ((baud_supported == 0) || (nvm_scale_count == 0)) {
+		Usage(argv[0]);
+		return 1;
+	} else {
+		//do nothing
+	}
+
+	sim_result_t result;
+	if (sweep_enabled == 0) {
+		SimRun(&params, &result);
+		SimPrintHeader();
+		SimPrintResult(&params, &result);
+		SimPrintDetails(&result);
+		return SimDropFree(&result) ? 0 : 2;
+	} else {
+		//do nothing
+	}
+
+	/*
+	 * The sweep: for every NVM time scale and every mode, we go through the baud rates and keep the fastest drop-free transfer.
+	 *
+	 * */
+	SimPrintHeader();
+	for (int scale_index = 0; scale_index < nvm_scale_count; scale_index++) {
+		sim_params_t point_params = params;
+		point_params.erase_in_us = params.erase_in_us * nvm_scales[scale_index];
+		point_params.program_in_us = params.program_in_us * nvm_scales[scale_index];
+		point_params.eeprom_in_us = params.eeprom_in_us * nvm_scales[scale_index];
+		for (int mode = Host_Raw; mode <= Host_Addressed; mode++) {
+			point_params.mode = mode;
+			double best_throughput = 0;
+			long best_baud = 0;
+			for (int baud_index = 0; baud_index < Baud_count; baud_index++) {
+				point_params.baud = Baud_rates[baud_index];
+				SimRun(&point_params, &result);
+				SimPrintResult(&point_params, &result);
+				if (SimDropFree(&result) && (result.throughput > best_throughput)) {
+					best_throughput = result.throughput;
+					best_baud = point_params.baud;
+				} else {
+					//do nothing
+				}
+			}
+			if (best_baud != 0) {
+				printf("=> ring %d, %s, NVM x%.2f: drop-free up to %.0f bytes/s at %ld baud\n",
+						Rx_ring_depth_in_pages, Host_mode_names[mode], nvm_scales[scale_index], best_throughput, best_baud);
+			} else {
+				printf("=> ring %d, %s, NVM x%.2f: no drop-free transfer\n", Rx_ring_depth_in_pages, Host_mode_names[mode], nvm_scales[scale_index]);
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,36 @@
+/*
+ *  Created on: 14 Oct 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_Bootloader
+ *  Processor: host PC (Linux, x86-64)
+ *  Header version: 1.0
+ *  File: BootSimHooks.h
+ *  Modified from: N/A
+ *  Change history: N/A
+ */
+
+#ifndef BOOTSIM_HOOKS_H_
+#define BOOTSIM_HOOKS_H_
+
+/*
+ * This header is forced into every source file of the bootloader when it is built for the host simulator (gcc -include BootSimHooks.h, see BootSim.c).
+ * The bootloader code is not modified, it only passes through the hooks below:
+ *
+ * 1)Every loop iteration calls the simulator. This is where the simulated time moves along, the peripherals are updated and the IRQs are served.
+ *   Busy waits on a register (while (!(RCC->CR & (1<<25)));) thus see the register change just like on the part.
+ * 2)Every function entry calls the simulator too (gcc -finstrument-functions).
+ * 3)Functions placed in RAM get a section of their own instead of .RamFunc. The simulator knows from it, which code keeps running while the NVM is busy.
+ *
+ * Note: the "for" hook goes into the loop body so it works with any loop header. The dangling else is taken by the "if" of the hook.
+ * Note: the definitions in BootSim.c remove the hooks again for the simulator itself.
+ *
+ * */
+
+void SimLoopHook (void);
+
+#define while(condition) while (SimLoopHook(), (condition))
+#define for(...) for (__VA_ARGS__) if (SimLoopHook(), 0) {} else
+
+#define BOOT_RAM_FUNC __attribute__((section("BootRamFunc"), noinline))
+
+#endif /* BOOTSIM_HOOKS_H_ */
@@ -0,0 +1,18 @@
+#!/bin/sh
+#
+# Benchmark sweep of the bootloader on the host simulator (see BootSim.c).
+# The Rx ring depth is a build parameter of the bootloader, so the simulator is built once for every depth. The other arguments go to "BootSim -S".
+#
+# Use (from the root of the repository): Host/BootSim/BootSimSweep.sh [-F scale,scale,...] [BootSim options]
+#
+
+set -e
+
+BUILD_DIR=${TMPDIR:-/tmp}
+
+for DEPTH in 2 4 8 16; do
+	gcc -O2 -w -fno-inline -no-pie -fno-pie -finstrument-functions -finstrument-functions-exclude-file-list=Host/BootSim/ \
+		-DBOOT_LOG_ENABLE=0 -DRx_ring_depth_in_pages=$DEPTH -Dmain=BootMain -include Host/BootSim/BootSimHooks.h -IHost/BootSim -I. \
+		-o "$BUILD_DIR/BootSim_$DEPTH" *.c Host/BootSim/BootSim.c
+	"$BUILD_DIR/BootSim_$DEPTH" -S "$@"
+done
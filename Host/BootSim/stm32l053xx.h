@@ -0,0 +1,220 @@
+/*
+ *  Created on: 14 Oct 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_Bootloader
+ *  Processor: host PC (Linux, x86-64)
+ *  Header version: 1.0
+ *  File: stm32l053xx.h
+ *  Modified from: the CMSIS device header of the STM32L053xx
+ *  Change history: N/A
+ */
+
+#ifndef BOOTSIM_STM32L053XX_H_
+#define BOOTSIM_STM32L053XX_H_
+
+/*
+ * Stand-in for the CMSIS device header, used by the host simulator only (see BootSim.c).
+ * Only the peripherals and the registers the bootloader touches are here. The register layouts and the base addresses are the ones of the STM32L053R8.
+ * The simulator maps memory at these addresses, so the bootloader code accesses the registers exactly the way it does on the part.
+ *
+ * The core intrinsics and the NVIC functions are implemented by the simulator.
+ *
+ * */
+
+#include <stdint.h>
+
+#define __IO volatile
+#define __I volatile const
+
+typedef enum {
+	NonMaskableInt_IRQn = -14,
+	HardFault_IRQn = -13,
+	SVC_IRQn = -5,
+	PendSV_IRQn = -2,
+	SysTick_IRQn = -1,
+	WWDG_IRQn = 0,
+	PVD_IRQn = 1,
+	RTC_IRQn = 2,
+	FLASH_IRQn = 3,
+	RCC_CRS_IRQn = 4,
+	EXTI0_1_IRQn = 5,
+	EXTI2_3_IRQn = 6,
+	EXTI4_15_IRQn = 7,
+	TSC_IRQn = 8,
+	DMA1_Channel1_IRQn = 9,
+	DMA1_Channel2_3_IRQn = 10,
+	DMA1_Channel4_5_6_7_IRQn = 11,
+	ADC1_COMP_IRQn = 12,
+	LPTIM1_IRQn = 13,
+	TIM2_IRQn = 15,
+	TIM6_DAC_IRQn = 17,
+	TIM21_IRQn = 20,
+	TIM22_IRQn = 22,
+	I2C1_IRQn = 23,
+	I2C2_IRQn = 24,
+	SPI1_IRQn = 25,
+	SPI2_IRQn = 26,
+	USART1_IRQn = 27,
+	USART2_IRQn = 28,
+	RNG_LPUART1_IRQn = 29,
+	LCD_IRQn = 30,
+	USB_IRQn = 31
+} IRQn_Type;
+
+//1)Register layouts
+typedef struct {
+	__IO uint32_t CR1, CR2, CR3, BRR, GTPR, RTOR, RQR, ISR, ICR, RDR, TDR;
+} USART_TypeDef;
+
+typedef struct {
+	__IO uint32_t ISR, IFCR;
+} DMA_TypeDef;
+
+typedef struct {
+	__IO uint32_t CCR, CNDTR, CPAR, CMAR;
+} DMA_Channel_TypeDef;
+
+typedef struct {
+	__IO uint32_t CSELR;
+} DMA_Request_TypeDef;
+
+typedef struct {
+	__IO uint32_t ACR, PECR, PDKEYR, PEKEYR, PRGKEYR, OPTKEYR, SR, OPTR, WRPR;
+} FLASH_TypeDef;
+
+typedef struct {
+	__IO uint32_t CR, ICSCR, CRRCR, CFGR, CIER, CIFR, CICR, IOPRSTR, AHBRSTR, APB2RSTR, APB1RSTR, IOPENR, AHBENR, APB2ENR, APB1ENR,
+				  IOPSMENR, AHBSMENR, APB2SMENR, APB1SMENR, CCIPR, CSR;
+} RCC_TypeDef;
+
+typedef struct {
+	__IO uint32_t MODER, OTYPER, OSPEEDR, PUPDR, IDR, ODR, BSRR, LCKR;
+	__IO uint32_t AFR[2];
+	__IO uint32_t BRR;
+} GPIO_TypeDef;
+
+typedef struct {
+	__IO uint32_t CR1, CR2, SMCR, DIER, SR, EGR, CCMR1, CCMR2, CCER, CNT, PSC, ARR, RESERVED0, CCR1, CCR2, CCR3, CCR4, RESERVED1, DCR, DMAR, OR;
+} TIM_TypeDef;
+
+typedef struct {
+	__IO uint32_t CR, CSR;
+} PWR_TypeDef;
+
+typedef struct {
+	__IO uint32_t DR;
+	__IO uint8_t IDR;
+	uint8_t RESERVED0;
+	uint16_t RESERVED1;
+	__IO uint32_t CR;
+	uint32_t RESERVED2;
+	__IO uint32_t INIT, POL;
+} CRC_TypeDef;
+
+typedef struct {
+	__IO uint32_t TR, DR, CR, ISR, PRER, WUTR, RESERVED0, ALRMAR, ALRMBR, WPR, SSR, SHIFTR, TSTR, TSDR, TSSSR, CALR, TAMPCR, ALRMASSR, ALRMBSSR, OR,
+				  BKP0R, BKP1R, BKP2R, BKP3R, BKP4R;
+} RTC_TypeDef;
+
+typedef struct {
+	__IO uint32_t IMR, EMR, RTSR, FTSR, SWIER, PR;
+} EXTI_TypeDef;
+
+typedef struct {
+	__IO uint32_t IDCODE, CR, APB1FZ, APB2FZ;
+} DBGMCU_TypeDef;
+
+typedef struct {
+	__IO uint32_t CPUID, ICSR, VTOR, AIRCR, SCR, CCR, RESERVED0;
+	__IO uint32_t SHP[2];
+	__IO uint32_t SHCSR;
+} SCB_Type;
+
+typedef struct {
+	__IO uint32_t CTRL, LOAD, VAL, CALIB;
+} SysTick_Type;
+
+typedef struct {
+	__IO uint32_t ISER[1];
+	uint32_t RESERVED0[31];
+	__IO uint32_t ICER[1];
+	uint32_t RESERVED1[31];
+	__IO uint32_t ISPR[1];
+	uint32_t RESERVED2[31];
+	__IO uint32_t ICPR[1];
+} NVIC_Type;
+
+//2)Base addresses
+#define TIM2_BASE			0x40000000UL
+#define TIM6_BASE			0x40001000UL
+#define RTC_BASE			0x40002800UL
+#define USART2_BASE			0x40004400UL
+#define PWR_BASE			0x40007000UL
+#define EXTI_BASE			0x40010400UL
+#define USART1_BASE			0x40013800UL
+#define DBGMCU_BASE			0x40015800UL
+#define DMA1_BASE			0x40020000UL
+#define DMA1_Channel2_BASE	0x4002001CUL
+#define DMA1_Channel3_BASE	0x40020030UL
+#define DMA1_Channel4_BASE	0x40020044UL
+#define DMA1_CSELR_BASE		0x400200A8UL
+#define RCC_BASE			0x40021000UL
+#define FLASH_R_BASE		0x40022000UL
+#define CRC_BASE			0x40023000UL
+#define GPIOA_BASE			0x50000000UL
+#define GPIOC_BASE			0x50000800UL
+#define GPIOH_BASE			0x50001C00UL
+#define SysTick_BASE		0xE000E010UL
+#define NVIC_BASE			0xE000E100UL
+#define SCB_BASE			0xE000ED00UL
+
+#define TIM2				((TIM_TypeDef *) TIM2_BASE)
+#define TIM6				((TIM_TypeDef *) TIM6_BASE)
+#define RTC					((RTC_TypeDef *) RTC_BASE)
+#define USART2				((USART_TypeDef *) USART2_BASE)
+#define PWR					((PWR_TypeDef *) PWR_BASE)
+#define EXTI				((EXTI_TypeDef *) EXTI_BASE)
+#define USART1				((USART_TypeDef *) USART1_BASE)
+#define DBGMCU				((DBGMCU_TypeDef *) DBGMCU_BASE)
+#define DMA1				((DMA_TypeDef *) DMA1_BASE)
+#define DMA1_Channel2		((DMA_Channel_TypeDef *) DMA1_Channel2_BASE)
+#define DMA1_Channel3		((DMA_Channel_TypeDef *) DMA1_Channel3_BASE)
+#define DMA1_Channel4		((DMA_Channel_TypeDef *) DMA1_Channel4_BASE)
+#define DMA1_CSELR			((DMA_Request_TypeDef *) DMA1_CSELR_BASE)
+#define RCC					((RCC_TypeDef *) RCC_BASE)
+#define FLASH				((FLASH_TypeDef *) FLASH_R_BASE)
+#define CRC					((CRC_TypeDef *) CRC_BASE)
+#define GPIOA				((GPIO_TypeDef *) GPIOA_BASE)
+#define GPIOC				((GPIO_TypeDef *) GPIOC_BASE)
+#define GPIOH				((GPIO_TypeDef *) GPIOH_BASE)
+#define SysTick				((SysTick_Type *) SysTick_BASE)
+#define NVIC				((NVIC_Type *) NVIC_BASE)
+#define SCB					((SCB_Type *) SCB_BASE)
+
+//3)Bit definitions
+#define RCC_CFGR_HPRE_DIV1		0x00000000U
+#define RCC_CFGR_SWS			(3U<<2)
+#define RCC_CFGR_SWS_PLL		(3U<<2)
+#define SCB_SCR_SLEEPDEEP_Msk	(1U<<2)
+#define SCB_SCR_SLEEPONEXIT_Msk	(1U<<1)
+
+//4)Core functions - implemented by the simulator
+void NVIC_SetPriority (IRQn_Type IRQn, uint32_t priority);
+void NVIC_EnableIRQ (IRQn_Type IRQn);
+void NVIC_DisableIRQ (IRQn_Type IRQn);
+void NVIC_ClearPendingIRQ (IRQn_Type IRQn);
+void NVIC_SystemReset (void);
+void __disable_irq (void);
+void __enable_irq (void);
+uint32_t __get_PRIMASK (void);
+void __set_PRIMASK (uint32_t primask);
+void __set_MSP (uint32_t top_of_stack);
+void __WFI (void);
+void __DSB (void);
+void __ISB (void);
+void __DMB (void);
+void __NOP (void);
+void SystemCoreClockUpdate (void);
+extern uint32_t SystemCoreClock;
+
+#endif /* BOOTSIM_STM32L053XX_H_ */
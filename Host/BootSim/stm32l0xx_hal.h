@@ -0,0 +1,117 @@
+/*
+ *  Created on: 14 Oct 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_Bootloader
+ *  Processor: host PC (Linux, x86-64)
+ *  Header version: 1.0
+ *  File: stm32l0xx_hal.h
+ *  Modified from: the STM32L0xx HAL
+ *  Change history: N/A
+ */
+
+#ifndef BOOTSIM_STM32L0XX_HAL_H_
+#define BOOTSIM_STM32L0XX_HAL_H_
+
+/*
+ * Stand-in for the HAL, used by the host simulator only (see BootSim.c).
+ * The bootloader only uses the HAL for the CubeMX init of the GPIOs and of UART2 in main.c. The functions are implemented by the simulator.
+ *
+ * */
+
+#include "stm32l053xx.h"
+#include <stddef.h>
+#include <string.h>
+
+typedef enum {
+	HAL_OK = 0,
+	HAL_ERROR,
+	HAL_BUSY,
+	HAL_TIMEOUT
+} HAL_StatusTypeDef;
+
+typedef struct {
+	uint32_t BaudRate, WordLength, StopBits, Parity, Mode, HwFlowCtl, OverSampling, OneBitSampling;
+} UART_InitTypeDef;
+
+typedef struct {
+	uint32_t AdvFeatureInit;
+} UART_AdvFeatureInitTypeDef;
+
+typedef struct {
+	USART_TypeDef* Instance;
+	UART_InitTypeDef Init;
+	UART_AdvFeatureInitTypeDef AdvancedInit;
+} UART_HandleTypeDef;
+
+typedef struct {
+	uint32_t PLLState;
+} RCC_PLLInitTypeDef;
+
+typedef struct {
+	uint32_t OscillatorType, MSIState, MSICalibrationValue, MSIClockRange;
+	RCC_PLLInitTypeDef PLL;
+} RCC_OscInitTypeDef;
+
+typedef struct {
+	uint32_t ClockType, SYSCLKSource, AHBCLKDivider, APB1CLKDivider, APB2CLKDivider;
+} RCC_ClkInitTypeDef;
+
+typedef struct {
+	uint32_t PeriphClockSelection, Usart2ClockSelection;
+} RCC_PeriphCLKInitTypeDef;
+
+typedef struct {
+	uint32_t Pin, Mode, Pull, Speed;
+} GPIO_InitTypeDef;
+
+typedef enum {
+	GPIO_PIN_RESET = 0,
+	GPIO_PIN_SET
+} GPIO_PinState;
+
+HAL_StatusTypeDef HAL_Init (void);
+HAL_StatusTypeDef HAL_UART_Init (UART_HandleTypeDef* huart);
+HAL_StatusTypeDef HAL_RCC_OscConfig (RCC_OscInitTypeDef* RCC_OscInitStruct);
+HAL_StatusTypeDef HAL_RCC_ClockConfig (RCC_ClkInitTypeDef* RCC_ClkInitStruct, uint32_t FLatency);
+HAL_StatusTypeDef HAL_RCCEx_PeriphCLKConfig (RCC_PeriphCLKInitTypeDef* PeriphClkInit);
+void HAL_GPIO_Init (GPIO_TypeDef* GPIOx, GPIO_InitTypeDef* GPIO_Init);
+void HAL_GPIO_WritePin (GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+
+#define __HAL_PWR_VOLTAGESCALING_CONFIG(__REGULATOR__)	do {} while (0)
+#define __HAL_RCC_GPIOA_CLK_ENABLE()					(RCC->IOPENR |= (1<<0))
+#define __HAL_RCC_GPIOC_CLK_ENABLE()					(RCC->IOPENR |= (1<<2))
+#define __HAL_RCC_GPIOH_CLK_ENABLE()					(RCC->IOPENR |= (1<<7))
+
+#define PWR_REGULATOR_VOLTAGE_SCALE1	(1U<<11)
+#define RCC_OSCILLATORTYPE_MSI			0x00000010U
+#define RCC_MSI_ON						0x00000100U
+#define RCC_MSIRANGE_5					(5U<<13)
+#define RCC_PLL_NONE					0x00000000U
+#define RCC_CLOCKTYPE_SYSCLK			0x00000001U
+#define RCC_CLOCKTYPE_HCLK				0x00000002U
+#define RCC_CLOCKTYPE_PCLK1				0x00000004U
+#define RCC_CLOCKTYPE_PCLK2				0x00000008U
+#define RCC_SYSCLKSOURCE_MSI			0x00000000U
+#define RCC_SYSCLK_DIV1					0x00000000U
+#define RCC_HCLK_DIV1					0x00000000U
+#define FLASH_LATENCY_0					0x00000000U
+#define RCC_PERIPHCLK_USART2			0x00000002U
+#define RCC_USART2CLKSOURCE_PCLK1		0x00000000U
+#define UART_WORDLENGTH_8B				0x00000000U
+#define UART_STOPBITS_1					0x00000000U
+#define UART_PARITY_NONE				0x00000000U
+#define UART_MODE_TX_RX					0x0000000CU
+#define UART_HWCONTROL_NONE				0x00000000U
+#define UART_OVERSAMPLING_16			0x00000000U
+#define UART_ONE_BIT_SAMPLE_DISABLE		0x00000000U
+#define UART_ADVFEATURE_NO_INIT			0x00000000U
+#define GPIO_PIN_2						((uint16_t)0x0004)
+#define GPIO_PIN_5						((uint16_t)0x0020)
+#define GPIO_PIN_13						((uint16_t)0x2000)
+#define GPIO_PIN_14						((uint16_t)0x4000)
+#define GPIO_MODE_OUTPUT_PP				0x00000001U
+#define GPIO_MODE_IT_FALLING			0x10210000U
+#define GPIO_NOPULL						0x00000000U
+#define GPIO_SPEED_FREQ_LOW				0x00000000U
+
+#endif /* BOOTSIM_STM32L0XX_HAL_H_ */
@@ -30,7 +30,8 @@
   * Uses DMA for machine code reception.
   * Uses half-page FLASH burst to update app.
   * If for 5 seconds, not external controller request arrives, bootloader transitions to app.
-  * App is to be stored at address 0x8008000 - look for "App_Section_Start_Addr" int eh code to modify it.
+  * App is to be stored at address 0x8008000 - look for "App_section_start_addr" in BootConfig.h to modify it.
+  * The app section is split into two slots (0x8008000 and 0x800C000). An update goes into the slot that is not active - look for "App_slot_count" in BootConfig.h.
   * App and master controller are not provided.
   *
   ******************************************************************************
@@ -47,6 +48,8 @@
 #include "BootAppManager.h"
 #include "BootExternalController.h"
 #include "BootClockDriver_STM32L0x3.h"
+#include "BootStreamDecoder.h"
+#include "BootProfiler.h"
 
 /* USER CODE END Includes */
 
@@ -85,37 +88,83 @@ static void MX_USART2_UART_Init(void);
 
 
 //printf transition
+#if BOOT_LOG_ENABLE
 int _write(int file, char *ptr, int len)
 {
-	int DataIdx;
-	for (DataIdx = 0; DataIdx < len; DataIdx++) {
-		HAL_UART_Transmit(&huart2, (uint8_t *)ptr++, 1, 100);
-	}
+	UART2LogWrite(ptr, len);															//we only copy into the log ring, the DMA sends it out
 	return len;
 }
+#endif
+
+uint32_t Rx_Message_buf [Rx_Message_buf_size_in_words];								//buffer is one ring slot (a FLASH page plus a header word) times the ring depth
 
-uint32_t Rx_Message_buf [64];															//buffer is 64 times 4 bytes / 1 word
+uint8_t Rx_Command_buf [Rx_Command_buf_size_in_bytes];									//the last command that has been received, without the start sequence
 
-uint8_t* Rx_Message_buf_ptr;
+uint32_t Stream_page_buf [Boot_page_size_in_words];										//page assembled by the stream decoder (decompressed machine code)
+uint32_t Stream_page_addr;																//where the page assembled from HEX/SREC records goes in the FLASH
 
 uint16_t DMA_transfer_width_UART1;
 
-uint8_t page_counter;
+uint16_t page_counter;
+
+uint16_t page_written_counter;															//pages that have been written to the FLASH
+
+uint16_t page_skipped_counter;															//pages that were identical to the FLASH and thus were not written
+
+uint16_t page_rejected_counter;															//addressed pages that would have been outside the app section
 
 uint8_t seconds_counter;
 
+volatile enum_Yes_No_Selector Boot_window_expired;										//TIM2 has counted down the boot window - written only by the TIM2 IRQ
+
 enum_Yes_No_Selector UART1_Message_Received;
 
-enum_Yes_No_Selector UART1_Message_Started;
+enum_Yes_No_Selector UART1_Command_Capture_active;										//indicates that the UART1 IRQ logs command frames instead of counting idle frames
+
+volatile uint16_t Cmd_frame_end_position [Cmd_frame_queue_depth];						//where the DMA was in the Rx buffer when the bus went idle - written only by the UART1 IRQ
+volatile uint8_t Cmd_frames_produced;													//number of command frames logged by the UART1 IRQ
+volatile uint16_t Cmd_frames_dropped_counter;											//number of command frames overwritten in the frame queue before they were picked up
+
+volatile uint16_t UART1_Tx_dropped_counter;												//number of responses that did not fit into the UART1 Tx ring
+volatile uint16_t UART1_Rx_error_counter;												//number of framing and noise errors on UART1 Rx since the last baud rate switch
+enum_UART_Baud_Selector UART1_baud_rate;												//the baud rate UART1 is running at
+volatile uint16_t UART2_Log_dropped_bytes;												//number of log bytes that did not fit into the UART2 log ring
+uint8_t UART1_node_address;																//our address on a shared bus (see NodeAddressLoad)
+enum_Yes_No_Selector UART1_Responses_muted;												//the command being run came in a broadcast frame, nothing is sent back
+enum_Yes_No_Selector UART1_Bus_shared;													//our address is configured or a frame with a node address has come in - frames without one are dropped
 
-enum_First_Second_Selector Machine_Code_Page_Received;									//indicator that we have a full page in the Rx buffer ready to be copied into the FLASH
-																						//Note: a 2 page long ping-pong buffer captures one page while the other page is being processed
+volatile uint16_t Rx_ring_produced_pages;												//number of pages the DMA has put into the Rx ring - written only by the DMA IRQ
+volatile uint16_t Rx_ring_consumed_pages;												//number of pages the FLASH update has taken out of the Rx ring - written only by the main loop
+volatile uint16_t Rx_ring_submitted_pages;												//number of pages that have been handed over to the NVM job queue - written only by the main loop
+volatile uint16_t Rx_ring_overflow_counter;												//number of pages the DMA has overwritten before they were copied into the FLASH - written only by the main loop
+volatile uint16_t Rx_ring_missed_events_counter;										//number of HT/TC events the DMA IRQ has served only together with the next one
+volatile uint8_t Rx_ring_DMA_next_half;													//the half of the Rx ring the DMA is loading (0 or 1) - written only by the DMA IRQ
+uint8_t Rx_ring_slot_size_in_words;														//32 words for a raw page, 33 words for a page with its header
+																						//Note: the Rx ring captures pages while earlier pages are being processed
+
+enum_Programmer_Mode_Selector Programmer_Mode;											//raw machine code or addressed pages
 
 enum_Yes_No_Selector UART1_DMA_active;													//indicator for DMA activity
 																						//Note: UART messaging must not occur while DMA is active!!!
 
 uint32_t flash_page_addr;
 
+volatile uint16_t NVM_jobs_submitted;													//number of jobs put into the NVM job queue - written only by the main loop
+volatile uint16_t NVM_jobs_completed;													//number of jobs the NVM has finished - written only by the FLASH IRQ
+volatile uint16_t NVM_error_counter;													//number of NVM jobs that ended with an error
+volatile uint32_t NVM_last_error_flags;													//error flags of the last failed NVM job (FLASH->SR)
+
+uint32_t Image_crc_state;																//running CRC of the pages that have been written in this update (see CRCCalculate)
+uint32_t Image_crc_length_in_bytes;														//how many bytes the running CRC covers
+enum_Yes_No_Selector Image_crc_valid;													//the running CRC matches what has been written to the FLASH from the start of the update slot
+
+uint32_t flash_erased_end_addr;															//pages below this address have been erased before the machine code started coming in
+
+uint8_t App_active_slot;																//the slot we start the app from (see AppSlotSelect)
+uint8_t App_update_slot;																//the slot an update goes into - always the one that is not active
+uint32_t App_update_start_addr;
+uint32_t App_update_end_addr;
+
 /* USER CODE END 0 */
 
 /**
@@ -141,14 +190,22 @@ int main(void)
 //  SystemClock_Config();
 
   /* USER CODE BEGIN SysInit */
+  BootVectorTableToRAM();																//vector table copied to RAM (the NVM functions and the Rx IRQs run from RAM)
   SysClockConfig();
   TIM6Config();
+  TIM6IRQPriorEnable();																	//TIM6 IRQ - extends TIM6 to a 32 bit timestamp
   BootTIM2_INT();																		//TIM2 init
   BootTIM2IRQPriorEnable();																//TIM2 IRQ
-  UART1Config();																		//UART1 init
+  UART1Config(UART1_boot_baud_rate);													//UART1 init
+  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the master can switch to a faster baud rate using command 0xd7
   UART1IRQPriorEnable();																//UART1 IRQ - enable is done at a different place
   BootDMAInit();																		//DMA init
   BootDMAIRQPriorEnable();																//DMA IRQ - enable is done at a different place
+  DMAChannelUART1TxConfig();															//DMA channel for the responses on UART1 Tx
+  BootDMALogIRQPriorEnable();															//DMA IRQ of the log channel - enable is done in UART2LogConfig
+  NVM_Init();																			//NVM error IRQ enabled, EOP IRQ is only enabled while NVM jobs are running
+  FLASHIRQPriorEnable();																//FLASH IRQ - drives the NVM job queue
+  CRCInit();																			//hardware CRC for the app verification
 
   /* USER CODE END SysInit */
 
@@ -156,24 +213,73 @@ int main(void)
   MX_GPIO_Init();
   MX_USART2_UART_Init();
   /* USER CODE BEGIN 2 */
+  UART2LogConfig();																		//the text log is sent by the DMA on UART2
+  BootSleepConfig();																	//only what we need stays clocked while we sleep, SysTick is stopped
 
-  flash_page_addr = App_Section_Start_Addr;												//we define the base address where the app is supposed to be
+  AppSlotSelect();																		//we pick the active slot and the update slot
+  flash_page_addr = App_update_start_addr;												//we define the base address where the app is supposed to be
+  flash_erased_end_addr = App_update_start_addr;										//nothing is pre-erased
   	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  							//mind, the app's machine code has all the placing information. We need to respect it, otherwise we won't find and run the app.
+  UART1_node_address = NodeAddressLoad();												//configured in the EEPROM or derived from the unique ID
+  UART1_Bus_shared = NodeAddressConfigured();											//a node with a configured address only takes the frames sent to it
 
   UART1_Message_Received = No;															//we reset the message received flag
-  UART1_Message_Started = No;															//we reset the message started flag
-  Machine_Code_Page_Received = None;
+  UART1_Command_Capture_active = No;
+  UART1_Responses_muted = No;
+  Cmd_frames_produced = 0;
+  Cmd_frames_dropped_counter = 0;
+  UART1_Tx_dropped_counter = 0;
+  UART1_Rx_error_counter = 0;
+  UART2_Log_dropped_bytes = 0;
+  ProfilerReset();																		//no timing results yet
+  Rx_ring_produced_pages = 0;
+  Rx_ring_consumed_pages = 0;
+  Rx_ring_submitted_pages = 0;
+  Rx_ring_overflow_counter = 0;
+  Rx_ring_missed_events_counter = 0;
+  Rx_ring_DMA_next_half = 0;
+  NVM_jobs_submitted = 0;
+  NVM_jobs_completed = 0;
+  NVM_error_counter = 0;
+  NVM_last_error_flags = 0;
+  Image_crc_state = CRC_start_state;
+  Image_crc_length_in_bytes = 0;
+  Image_crc_valid = No;
   UART1_DMA_active = No;
   page_counter = 0;
-  Rx_Message_buf_ptr = Rx_Message_buf;													//we place the buffer loading pointer to the buffer
-  DMA_transfer_width_UART1 = 256;														//DMA transfer width is the entirety of the Rx buffer
-  memset(Rx_Message_buf, 0, 64);														//we erase the buffer
+  page_written_counter = 0;
+  page_skipped_counter = 0;
+  page_rejected_counter = 0;
+  Rx_ring_slot_size_in_words = Boot_page_size_in_words;
+  Programmer_Mode = Raw_Stream;
+  DMA_transfer_width_UART1 = 4 * Rx_ring_slot_size_in_words * Rx_ring_depth_in_pages;	//DMA transfer width is the entirety of the Rx ring
+  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the Rx buffer is not wiped, the ring indices tell what is valid in it
 
   enum_Yes_No_Selector External_Controller_Mode = No;									//this is a local variable that should be wiped upon reset
 
   seconds_counter = 0;
+  Boot_window_expired = No;
+
+  BOOT_LOG("Bootloader running...\r\n");
+
+  UART1CommandCaptureEnable();															//we start capturing command messages using the DMA
 
-  printf("Bootloader running...\r\n");
+  switch (BootStartSelect()) {															//we check, if we need to wait for the host at all
+  case Start_App_Now:
+	  BootTIM2_DEINT();
+	  GoToApp();																		//the handoff resets UART1 and TIM2 for the app
+	  break;
+
+  case Stay_In_Boot:
+	  BOOT_LOG("No APP found. Staying in bootloader...\r\n");
+	  BootTIM2_DEINT();																	//there is nothing to time out to
+	  break;
+
+  case Wait_For_Host:
+  default:
+	  //do nothing																		//TIM2 starts the app after the full boot window
+	  break;
+  }
 
   /* USER CODE END 2 */
 
@@ -184,18 +290,26 @@ int main(void)
 
 
 	//The following segment ensures that we only switch to external control if a certain byte (0xc3) is received on the UART1 bus.
-	//If there is no byte received, a TIM2 IRQ will deinitialize the bootloader and start the app after a certain number of cycles (set in the IRQ header)
+	//If there is no byte received, the TIM2 IRQ flags the end of the boot window after a certain number of cycles (set in the IRQ header) and we start the app
 
 	if (External_Controller_Mode == No) {												//if we are not in external controller mode
 
-		UART1RxMessage();																//we listen to the UART bus for the external control byte
+		enum_Yes_No_Selector command_received = UART1RxMessageWait(0);					//we listen to the UART bus for the external control byte
+																						//Note: the wait is over at the end of the boot window too
+
+		if (Boot_window_expired == Yes) {
+
+		  BootTIM2_DEINT();
+		  GoToApp();																	//we leave the bootloader from here, not from the TIM2 IRQ
+		  Boot_window_expired = No;														//we only come back if there is no app - we stay in the bootloader
 
-		if (Rx_Message_buf[0] == 0xc3) {
+		} else if ((command_received == Yes) && (Rx_Command_buf[0] == 0xc3)) {
 
-		  printf("External controller activated...\r\n");
+		  BOOT_LOG("External controller activated...\r\n");
 		  External_Controller_Mode = Yes;												//this flag will be reset upon reboot only
 		  BootTIM2_DEINT();																//we completely shut off the TIM2 timer and its IRQ
 		  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  		//Note: TIM2 IRQ governs the automatic transition to the app if there is no command byte received
+		  Boot_window_expired = No;														//a flag raised right before the TIM2 shut-off must not end the waits of the external controller
 
 		} else {
 
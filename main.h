@@ -40,6 +40,7 @@ extern "C" {
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "BootConfig.h"													//memory map, buffer sizes and clocking of the bootloader
 
 /* USER CODE END Includes */
 
@@ -63,10 +64,81 @@ typedef enum {
 
 
 typedef enum {
-	None,
-	First,
-	Second
-} enum_First_Second_Selector;
+	Raw_Stream,
+	Addressed_Pages,
+	Compressed_Stream,
+	Benchmark_Stream,
+	Record_Stream
+} enum_Programmer_Mode_Selector;
+
+
+typedef enum {
+	NVM_Erase_Page,
+	NVM_Program_Half_Page,
+	NVM_EEPROM_Word
+} enum_NVM_Job_Type;
+
+typedef enum {
+	LZ_Flags,
+	LZ_Item,
+	LZ_Match_High
+} enum_LZ_Decoder_State;
+
+typedef enum {
+	Record_Idle,
+	Record_SREC_Type,
+	Record_Hex_Digits
+} enum_Record_Decoder_State;
+
+
+typedef enum {
+	Boot_Full_Window,
+	Boot_Fast_Path
+} enum_Boot_Policy_Selector;
+
+
+typedef enum {
+	Start_App_Now,
+	Wait_For_Host,
+	Stay_In_Boot
+} enum_Boot_Start_Selector;
+
+
+typedef enum {
+	Baud_57600,
+	Baud_115200,
+	Baud_230400,
+	Baud_460800,
+	Baud_921600,
+	Baud_1000000
+} enum_UART_Baud_Selector;
+
+
+typedef enum {
+	Boot_Error_None,
+	Boot_Error_Page_CRC,
+	Boot_Error_Page_Header,
+	Boot_Error_Page_Range,
+	Boot_Error_NVM,
+	Boot_Error_App_Length,
+	Boot_Error_App_CRC,
+	Boot_Error_Scratch_In_Use,
+	Boot_Error_Slot_Invalid,
+	Boot_Error_No_Checkpoint,
+	Boot_Error_Batch_Invalid,
+	Boot_Error_Baud_Invalid,
+	Boot_Error_Baud_Probe,
+	Boot_Error_No_Commit,
+	Boot_Error_Node_Address,
+	Boot_Error_App_Auth
+} enum_Boot_Error_Code;
+
+
+typedef struct {
+	uint32_t header;																//page index on 16 bits, LSB first, followed by 2 bytes that must be zero
+	uint32_t page [Boot_page_size_in_words];
+	uint32_t crc;																	//CRC32 of the header and the page
+} struct_Addressed_Page_Slot;														//layout of an addressed page in the Rx ring, as loaded by the DMA
 
 /* USER CODE END EM */
 
@@ -90,6 +162,26 @@ void Error_Handler(void);
 #define TCK_GPIO_Port GPIOA
 
 /* USER CODE BEGIN Private defines */
+#ifndef BOOT_RAM_FUNC
+#define BOOT_RAM_FUNC __attribute__((section(".RamFunc"), long_call, noinline))	//places a function in RAM (copied over together with .data at startup)
+																			//Note: long_call is necessary, RAM is too far away from FLASH for a simple branch
+																			//Note: the host simulator puts its own definition in its place (see Host/BootSim)
+#endif
+
+#define BOOT_SLEEP_WHILE(condition) do { __disable_irq(); if (condition) { __WFI(); } __enable_irq(); } while (condition)
+																			//sleeps until an IRQ has changed the condition
+																			//Note: WFI wakes up on a pending IRQ even with the IRQs disabled. An IRQ that comes in between the check and the WFI is not missed.
+
+#ifndef BOOT_LOG_ENABLE
+#define BOOT_LOG_ENABLE 1													//set to 0 (e.g. -DBOOT_LOG_ENABLE=0) to remove the text log on UART2 from the build
+#endif
+
+#if BOOT_LOG_ENABLE
+#include <stdio.h>
+#define BOOT_LOG(...) printf(__VA_ARGS__)									//text log to the PC on UART2 - only formats and copies into the log ring (see UART2LogWrite)
+#else
+#define BOOT_LOG(...) do {} while (0)										//the log and its arguments are compiled out
+#endif
 
 /* USER CODE END Private defines */
 